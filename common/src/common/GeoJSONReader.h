@@ -0,0 +1,475 @@
+/*
+ * Copyright (c) 2016 CartoDB. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://cartodb.com/terms/
+ */
+
+#ifndef _CARTO_COMMON_GEOJSONREADER_H_
+#define _CARTO_COMMON_GEOJSONREADER_H_
+
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <variant>
+#include <optional>
+#include <functional>
+#include <istream>
+#include <sstream>
+#include <stdexcept>
+
+#include <cglib/vec.h>
+
+#include <picojson/picojson.h>
+
+namespace carto::common {
+    template <std::size_t N>
+    class GeoJSONReader final {
+    public:
+        using Point = cglib::vec<double, N>; // the first N coordinates are read
+        using MultiPoint = std::vector<Point>;
+        using MultiLineString = std::vector<std::vector<Point>>;
+        using MultiPolygon = std::vector<std::vector<std::vector<Point>>>;
+
+        using Geometry = std::variant<std::monostate, MultiPoint, MultiLineString, MultiPolygon>; // std::monostate for null geometry, single geometries are stored as multigeometries with one element
+        using FeatureHandler = std::function<void(Geometry geometry, picojson::value properties)>;
+
+        GeoJSONReader() = delete;
+        explicit GeoJSONReader(std::istream& stream) : _streamBuf(stream.rdbuf()) { }
+
+        // Reads a FeatureCollection or a single Feature from the stream and calls the handler for each feature in order.
+        // Only the current feature is kept in memory.
+        void read(const FeatureHandler& handler);
+
+    private:
+        void readFeature(const FeatureHandler& handler, bool topLevel);
+        Geometry readGeometry();
+        Geometry readCoordinates(const std::string& type);
+
+        Point readPoint();
+        std::vector<Point> readPointList();
+        std::vector<std::vector<Point>> readPointLists();
+
+        void skipValue(std::string* text);
+        std::string readString();
+        double readNumber();
+        bool readNull();
+
+        int peekChar();
+        void expectChar(char c);
+        bool nextElement(char endChar); // consumes either ',' or the end character, returns false at the end
+
+        std::streambuf* _streamBuf;
+    };
+
+    template <std::size_t N>
+    void GeoJSONReader<N>::read(const FeatureHandler& handler) {
+        readFeature(handler, true);
+        if (peekChar() != std::char_traits<char>::eof()) {
+            throw std::runtime_error("Unexpected data after GeoJSON element");
+        }
+    }
+
+    template <std::size_t N>
+    void GeoJSONReader<N>::readFeature(const FeatureHandler& handler, bool topLevel) {
+        std::string type;
+        Geometry geometry;
+        picojson::value properties;
+
+        expectChar('{');
+        if (peekChar() == '}') {
+            _streamBuf->sbumpc();
+        } else {
+            do {
+                std::string key = readString();
+                expectChar(':');
+                if (key == "type") {
+                    type = readString();
+                } else if (key == "features" && topLevel) {
+                    // Features are processed as soon as they are read, not after the whole collection
+                    expectChar('[');
+                    if (peekChar() == ']') {
+                        _streamBuf->sbumpc();
+                    } else {
+                        do {
+                            readFeature(handler, false);
+                        } while (nextElement(']'));
+                    }
+                } else if (key == "geometry") {
+                    if (!readNull()) {
+                        geometry = readGeometry();
+                    }
+                } else if (key == "properties") {
+                    std::string text;
+                    skipValue(&text);
+                    std::string err = picojson::parse(properties, text);
+                    if (!err.empty()) {
+                        throw std::runtime_error("Failed to parse feature properties: " + err);
+                    }
+                } else {
+                    skipValue(nullptr);
+                }
+            } while (nextElement('}'));
+        }
+
+        if (type == "FeatureCollection" && topLevel) {
+            return;
+        }
+        if (type != "Feature") {
+            throw std::runtime_error("Unexpected element type");
+        }
+        handler(std::move(geometry), std::move(properties));
+    }
+
+    template <std::size_t N>
+    typename GeoJSONReader<N>::Geometry GeoJSONReader<N>::readGeometry() {
+        std::string type;
+        std::optional<Geometry> geometry;
+        std::optional<std::string> coordsText;
+
+        expectChar('{');
+        if (peekChar() == '}') {
+            _streamBuf->sbumpc();
+        } else {
+            do {
+                std::string key = readString();
+                expectChar(':');
+                if (key == "type") {
+                    type = readString();
+                } else if (key == "coordinates") {
+                    if (!type.empty()) {
+                        geometry = readCoordinates(type);
+                    } else {
+                        // Geometry type is not yet known, keep the text and parse it once the type is read
+                        coordsText.emplace();
+                        skipValue(&*coordsText);
+                    }
+                } else {
+                    skipValue(nullptr);
+                }
+            } while (nextElement('}'));
+        }
+
+        if (coordsText) {
+            std::istringstream coordsStream(*coordsText);
+            geometry = GeoJSONReader<N>(coordsStream).readCoordinates(type);
+        }
+        if (!geometry) {
+            throw std::runtime_error("Missing geometry coordinates");
+        }
+        return std::move(*geometry);
+    }
+
+    template <std::size_t N>
+    typename GeoJSONReader<N>::Geometry GeoJSONReader<N>::readCoordinates(const std::string& type) {
+        if (type == "Point") {
+            return MultiPoint { readPoint() };
+        } else if (type == "LineString") {
+            return MultiLineString { readPointList() };
+        } else if (type == "Polygon") {
+            return MultiPolygon { readPointLists() };
+        } else if (type == "MultiPoint") {
+            return readPointList();
+        } else if (type == "MultiLineString") {
+            return readPointLists();
+        } else if (type == "MultiPolygon") {
+            MultiPolygon ringsList;
+            expectChar('[');
+            if (peekChar() == ']') {
+                _streamBuf->sbumpc();
+            } else {
+                do {
+                    ringsList.push_back(readPointLists());
+                } while (nextElement(']'));
+            }
+            return ringsList;
+        }
+        throw std::runtime_error("Invalid geometry type");
+    }
+
+    template <std::size_t N>
+    typename GeoJSONReader<N>::Point GeoJSONReader<N>::readPoint() {
+        // Missing coordinates are zero, extra coordinates are ignored
+        Point point = Point::zero();
+        expectChar('[');
+        point(0) = readNumber();
+        expectChar(',');
+        point(1) = readNumber();
+        for (std::size_t i = 2; nextElement(']'); i++) {
+            double value = readNumber();
+            if (i < N) {
+                point(i) = value;
+            }
+        }
+        return point;
+    }
+
+    template <std::size_t N>
+    std::vector<typename GeoJSONReader<N>::Point> GeoJSONReader<N>::readPointList() {
+        std::vector<Point> coordsList;
+        expectChar('[');
+        if (peekChar() == ']') {
+            _streamBuf->sbumpc();
+        } else {
+            do {
+                coordsList.push_back(readPoint());
+            } while (nextElement(']'));
+        }
+        return coordsList;
+    }
+
+    template <std::size_t N>
+    std::vector<std::vector<typename GeoJSONReader<N>::Point>> GeoJSONReader<N>::readPointLists() {
+        std::vector<std::vector<Point>> rings;
+        expectChar('[');
+        if (peekChar() == ']') {
+            _streamBuf->sbumpc();
+        } else {
+            do {
+                rings.push_back(readPointList());
+            } while (nextElement(']'));
+        }
+        return rings;
+    }
+
+    template <std::size_t N>
+    void GeoJSONReader<N>::skipValue(std::string* text) {
+        int c = peekChar();
+        if (c == '{' || c == '[') {
+            char endChar = (c == '{' ? '}' : ']');
+            _streamBuf->sbumpc();
+            if (text) {
+                text->push_back(static_cast<char>(c));
+            }
+            if (peekChar() == endChar) {
+                _streamBuf->sbumpc();
+                if (text) {
+                    text->push_back(endChar);
+                }
+                return;
+            }
+            while (true) {
+                if (c == '{') {
+                    if (peekChar() != '"') {
+                        throw std::runtime_error("Invalid JSON object key");
+                    }
+                    skipValue(text);
+                    expectChar(':');
+                    if (text) {
+                        text->push_back(':');
+                    }
+                }
+                skipValue(text);
+                int nextChar = peekChar();
+                if (nextChar != ',' && nextChar != endChar) {
+                    throw std::runtime_error("Invalid JSON element separator");
+                }
+                _streamBuf->sbumpc();
+                if (text) {
+                    text->push_back(static_cast<char>(nextChar));
+                }
+                if (nextChar == endChar) {
+                    return;
+                }
+            }
+        } else if (c == '"') {
+            // Keep the string as is, including escape sequences
+            _streamBuf->sbumpc();
+            if (text) {
+                text->push_back('"');
+            }
+            while (true) {
+                int strChar = _streamBuf->sbumpc();
+                if (strChar == std::char_traits<char>::eof()) {
+                    throw std::runtime_error("Unexpected end of JSON string");
+                }
+                if (text) {
+                    text->push_back(static_cast<char>(strChar));
+                }
+                if (strChar == '\\') {
+                    int escapedChar = _streamBuf->sbumpc();
+                    if (escapedChar == std::char_traits<char>::eof()) {
+                        throw std::runtime_error("Unexpected end of JSON string");
+                    }
+                    if (text) {
+                        text->push_back(static_cast<char>(escapedChar));
+                    }
+                } else if (strChar == '"') {
+                    return;
+                }
+            }
+        } else {
+            // Number or literal
+            std::size_t count = 0;
+            for (; (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '+' || c == '-' || c == '.' || c == 'E'; c = _streamBuf->snextc(), count++) {
+                if (text) {
+                    text->push_back(static_cast<char>(c));
+                }
+            }
+            if (count == 0) {
+                throw std::runtime_error("Invalid JSON value");
+            }
+        }
+    }
+
+    template <std::size_t N>
+    std::string GeoJSONReader<N>::readString() {
+        if (peekChar() != '"') {
+            throw std::runtime_error("Expected JSON string");
+        }
+        _streamBuf->sbumpc();
+
+        auto readHex4 = [this]() {
+            unsigned int code = 0;
+            for (int i = 0; i < 4; i++) {
+                int c = _streamBuf->sbumpc();
+                code <<= 4;
+                if (c >= '0' && c <= '9') {
+                    code |= c - '0';
+                } else if (c >= 'a' && c <= 'f') {
+                    code |= c - 'a' + 10;
+                } else if (c >= 'A' && c <= 'F') {
+                    code |= c - 'A' + 10;
+                } else {
+                    throw std::runtime_error("Invalid JSON string escape");
+                }
+            }
+            return code;
+        };
+
+        std::string str;
+        while (true) {
+            int c = _streamBuf->sbumpc();
+            if (c == std::char_traits<char>::eof()) {
+                throw std::runtime_error("Unexpected end of JSON string");
+            }
+            if (c == '"') {
+                return str;
+            }
+            if (c != '\\') {
+                str.push_back(static_cast<char>(c));
+                continue;
+            }
+
+            c = _streamBuf->sbumpc();
+            switch (c) {
+            case '"': case '\\': case '/':
+                str.push_back(static_cast<char>(c));
+                break;
+            case 'b':
+                str.push_back('\b');
+                break;
+            case 'f':
+                str.push_back('\f');
+                break;
+            case 'n':
+                str.push_back('\n');
+                break;
+            case 'r':
+                str.push_back('\r');
+                break;
+            case 't':
+                str.push_back('\t');
+                break;
+            case 'u': {
+                    unsigned int code = readHex4();
+                    if (code >= 0xd800 && code < 0xdc00) {
+                        if (_streamBuf->sbumpc() != '\\' || _streamBuf->sbumpc() != 'u') {
+                            throw std::runtime_error("Invalid JSON string escape");
+                        }
+                        unsigned int lowCode = readHex4();
+                        if (lowCode < 0xdc00 || lowCode >= 0xe000) {
+                            throw std::runtime_error("Invalid JSON string escape");
+                        }
+                        code = 0x10000 + ((code - 0xd800) << 10) + (lowCode - 0xdc00);
+                    }
+                    // Encode as UTF-8
+                    if (code < 0x80) {
+                        str.push_back(static_cast<char>(code));
+                    } else if (code < 0x800) {
+                        str.push_back(static_cast<char>(0xc0 | (code >> 6)));
+                        str.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+                    } else if (code < 0x10000) {
+                        str.push_back(static_cast<char>(0xe0 | (code >> 12)));
+                        str.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+                        str.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+                    } else {
+                        str.push_back(static_cast<char>(0xf0 | (code >> 18)));
+                        str.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3f)));
+                        str.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+                        str.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+                    }
+                    break;
+                }
+            default:
+                throw std::runtime_error("Invalid JSON string escape");
+            }
+        }
+    }
+
+    template <std::size_t N>
+    double GeoJSONReader<N>::readNumber() {
+        char buf[64];
+        std::size_t count = 0;
+        for (int c = peekChar(); (c >= '0' && c <= '9') || c == '+' || c == '-' || c == '.' || c == 'e' || c == 'E'; c = _streamBuf->snextc()) {
+            if (count + 1 >= sizeof(buf)) {
+                throw std::runtime_error("Invalid JSON number");
+            }
+            buf[count++] = static_cast<char>(c);
+        }
+        buf[count] = 0;
+
+        char* end = nullptr;
+        double value = std::strtod(buf, &end);
+        if (count == 0 || end != buf + count) {
+            throw std::runtime_error("Invalid JSON number");
+        }
+        return value;
+    }
+
+    template <std::size_t N>
+    bool GeoJSONReader<N>::readNull() {
+        if (peekChar() != 'n') {
+            return false;
+        }
+        for (const char* c = "null"; *c; c++) {
+            if (_streamBuf->sbumpc() != *c) {
+                throw std::runtime_error("Invalid JSON value");
+            }
+        }
+        return true;
+    }
+
+    template <std::size_t N>
+    int GeoJSONReader<N>::peekChar() {
+        int c = _streamBuf->sgetc();
+        while (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            c = _streamBuf->snextc();
+        }
+        return c;
+    }
+
+    template <std::size_t N>
+    void GeoJSONReader<N>::expectChar(char c) {
+        if (peekChar() != c) {
+            throw std::runtime_error(std::string("Invalid JSON, expected '") + c + "'");
+        }
+        _streamBuf->sbumpc();
+    }
+
+    template <std::size_t N>
+    bool GeoJSONReader<N>::nextElement(char endChar) {
+        int c = peekChar();
+        if (c == ',') {
+            _streamBuf->sbumpc();
+            return true;
+        }
+        if (c == endChar) {
+            _streamBuf->sbumpc();
+            return false;
+        }
+        throw std::runtime_error("Invalid JSON element separator");
+    }
+}
+
+#endif
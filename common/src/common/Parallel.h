@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2016 CartoDB. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://cartodb.com/terms/
+ */
+
+#ifndef _CARTO_COMMON_PARALLEL_H_
+#define _CARTO_COMMON_PARALLEL_H_
+
+#include <cstddef>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace carto::common {
+    inline void runParallel(std::size_t count, std::size_t threadCount, const std::function<void(std::size_t)>& func) {
+        // Process the items using the calling thread and up to threadCount - 1 extra threads. The first exception is rethrown once all threads are finished.
+        std::atomic<std::size_t> nextIndex(0);
+        std::exception_ptr exception;
+        std::mutex exceptionMutex;
+        auto processNextItems = [&]() {
+            try {
+                for (std::size_t i = nextIndex++; i < count; i = nextIndex++) {
+                    func(i);
+                }
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(exceptionMutex);
+                if (!exception) {
+                    exception = std::current_exception();
+                }
+                nextIndex = count;
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (std::size_t i = 1; i < std::min(threadCount, count); i++) {
+            threads.emplace_back(processNextItems);
+        }
+        processNextItems();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+}
+
+#endif
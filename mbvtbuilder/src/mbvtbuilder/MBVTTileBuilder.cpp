@@ -8,6 +8,8 @@
 #include <stdexcept>
 #include <cmath>
 
+#include <common/GeoJSONReader.h>
+
 #include "mapnikvt/mbvtpackage/MBVTPackage.pb.h"
 
 namespace carto::mbvtbuilder {
@@ -218,6 +220,21 @@ namespace carto::mbvtbuilder {
         }
     }
 
+    void MBVTTileBuilder::importGeoJSON(LayerIndex layerIndex, std::istream& stream) {
+        // Features with null geometry are skipped, like in the picojson-based import
+        using GeoJSONReader = common::GeoJSONReader<2>;
+        GeoJSONReader reader(stream);
+        reader.read([this, layerIndex](GeoJSONReader::Geometry geometry, picojson::value properties) {
+            if (auto coords = std::get_if<GeoJSONReader::MultiPoint>(&geometry)) {
+                addMultiPoint(layerIndex, std::move(*coords), std::move(properties));
+            } else if (auto coordsList = std::get_if<GeoJSONReader::MultiLineString>(&geometry)) {
+                addMultiLineString(layerIndex, std::move(*coordsList), std::move(properties));
+            } else if (auto ringsList = std::get_if<GeoJSONReader::MultiPolygon>(&geometry)) {
+                addMultiPolygon(layerIndex, std::move(*ringsList), std::move(properties));
+            }
+        });
+    }
+
     void MBVTTileBuilder::buildTile(int zoom, int tileX, int tileY, protobuf::encoded_message& encodedTile) const {
         static const Bounds mapBounds(Point(-PI * EARTH_RADIUS, -PI * EARTH_RADIUS), Point(PI * EARTH_RADIUS, PI * EARTH_RADIUS));
 
@@ -11,6 +11,7 @@
 #include <variant>
 #include <vector>
 #include <mutex>
+#include <istream>
 
 #include <boost/math/constants/constants.hpp>
 
@@ -58,6 +59,7 @@ namespace carto::mbvtbuilder {
         void importGeoJSON(LayerIndex layerIndex, const picojson::value& geoJSON);
         void importGeoJSONFeatureCollection(LayerIndex layerIndex, const picojson::value& featureCollectionDef);
         void importGeoJSONFeature(LayerIndex layerIndex, const picojson::value& featureDef);
+        void importGeoJSON(LayerIndex layerIndex, std::istream& stream); // streams the features, without building the whole JSON document in memory
 
         void buildTile(int zoom, int tileX, int tileY, protobuf::encoded_message& encodedTile) const;
         void buildTiles(std::function<void(int, int, int, const protobuf::encoded_message&)> handler) const;
@@ -7,6 +7,8 @@
 
 #include "mapnikvt/mbvtpackage/MBVTPackage.pb.h"
 
+#include <sstream>
+
 #include <picojson/picojson.h>
 
 #include <boost/math/constants/constants.hpp>
@@ -288,6 +290,41 @@ BOOST_AUTO_TEST_CASE(tileBuilder) {
     }
 }
 
+// Test streaming GeoJSON import, must match the result of importing the parsed document
+BOOST_AUTO_TEST_CASE(tileBuilderStreamingImport) {
+    std::string geoJSON = R"R({
+        "type": "FeatureCollection",
+        "features": [
+            { "type": "Feature", "properties": { "id": 1, "name": "A \"quoted\" name" }, "geometry": { "type": "Point", "coordinates": [0.001, 0.001] } },
+            { "type": "Feature", "properties": { "id": 2 }, "geometry": { "coordinates": [[0.001, 0.001, 10.0], [0.002, 0.003, 10.0]], "type": "LineString" } },
+            { "type": "Feature", "properties": null, "geometry": { "type": "MultiPolygon", "coordinates": [[[[0, 0], [0.002, 0], [0.002, 0.002], [0, 0]]]] } },
+            { "type": "Feature", "properties": { "id": 4 }, "geometry": null }
+        ]
+    })R";
+
+    auto buildTiles = [](const MBVTTileBuilder& tileBuilder) {
+        std::vector<std::string> tiles;
+        tileBuilder.buildTiles([&tiles](int zoom, int tileX, int tileY, const protobuf::encoded_message& encodedTile) { tiles.emplace_back(encodedTile.data().begin(), encodedTile.data().end()); });
+        return tiles;
+    };
+
+    picojson::value geoJSONDef;
+    BOOST_REQUIRE(picojson::parse(geoJSONDef, geoJSON).empty());
+    MBVTTileBuilder treeTileBuilder(14, 16);
+    treeTileBuilder.importGeoJSON(treeTileBuilder.createLayer("layer"), geoJSONDef);
+
+    MBVTTileBuilder streamTileBuilder(14, 16);
+    std::istringstream stream(geoJSON);
+    streamTileBuilder.importGeoJSON(streamTileBuilder.createLayer("layer"), stream);
+
+    std::vector<std::string> tiles = buildTiles(streamTileBuilder);
+    BOOST_CHECK(!tiles.empty());
+    BOOST_CHECK(tiles == buildTiles(treeTileBuilder));
+
+    std::istringstream badStream(geoJSON.substr(0, geoJSON.size() / 2));
+    BOOST_CHECK_THROW(streamTileBuilder.importGeoJSON(0, badStream), std::runtime_error);
+}
+
 // Test high-level tile builder functionality, simplifier part
 BOOST_AUTO_TEST_CASE(tileBuilderSimplifier) {
     typedef cglib::vec2<double> Point;
@@ -0,0 +1,279 @@
+// Routing benchmark for osrm graph packages.
+// Usage: osrm_benchmark [--queries N] [--seed N] [--threads 1,2,4] [--output results.csv] package.nmgraph...
+// Query sets are generated from the package contents using the given seed, so runs with the same packages and seed are comparable.
+// The optional output file lists the per-query results, these can be diffed between library versions to detect regressions.
+
+#include "osrm/Graph.h"
+#include "osrm/Query.h"
+#include "osrm/Result.h"
+#include "osrm/RouteFinder.h"
+
+#include <cstdlib>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+using namespace carto::osrm;
+
+struct QuerySet {
+    std::string name;
+    std::vector<Query> queries;
+};
+
+struct RunResult {
+    std::vector<double> latencies;
+    double wallTime = 0;
+};
+
+static const std::vector<std::pair<std::string, std::pair<double, double>>> DISTANCE_CLASSES = {
+    { "short (<1km)", { 0.0, 1000.0 } },
+    { "medium (1-10km)", { 1000.0, 10000.0 } },
+    { "long (10-100km)", { 10000.0, 100000.0 } },
+    { "very long (>100km)", { 100000.0, 1.0e9 } }
+};
+
+static std::shared_ptr<Graph> loadGraph(const std::vector<std::string>& fileNames) {
+    auto graph = std::make_shared<Graph>(Graph::Settings());
+    for (const std::string& fileName : fileNames) {
+        if (!graph->import(fileName)) {
+            throw std::runtime_error("Failed to import " + fileName);
+        }
+    }
+    return graph;
+}
+
+static std::vector<WGSPos> samplePositions(const Graph& graph, std::size_t count, std::mt19937& rng) {
+    std::vector<Graph::BlockId> blockIds = graph.findNodeBlockIds(WGSBounds(WGSPos(-90, -180), WGSPos(90, 180)));
+    std::vector<WGSPos> positions;
+    if (blockIds.empty()) {
+        return positions;
+    }
+    std::sort(blockIds.begin(), blockIds.end(), [](const Graph::BlockId& blockId1, const Graph::BlockId& blockId2) {
+        return std::make_pair(blockId1.packageId, blockId1.blockIndex) < std::make_pair(blockId2.packageId, blockId2.blockIndex);
+    });
+
+    // Use the first vertex of randomly chosen nodes, so that the positions are on the road network
+    std::uniform_int_distribution<std::size_t> blockDist(0, blockIds.size() - 1);
+    for (std::size_t attempt = 0; attempt < count * 100 && positions.size() < count; attempt++) {
+        Graph::BlockId blockId = blockIds[blockDist(rng)];
+        int nodeCount = graph.getNodeBlockSize(blockId);
+        if (nodeCount == 0) {
+            continue;
+        }
+        Graph::NodePtr node = graph.getNode(Graph::NodeId(blockId, std::uniform_int_distribution<int>(0, nodeCount - 1)(rng)));
+        std::vector<WGSPos> geometry = graph.getNodeGeometry(*node);
+        if (!geometry.empty()) {
+            positions.push_back(geometry.front());
+        }
+    }
+    return positions;
+}
+
+static std::vector<QuerySet> buildQuerySets(const std::vector<WGSPos>& positions, std::size_t queryCount, std::mt19937& rng) {
+    std::vector<QuerySet> querySets(1 + DISTANCE_CLASSES.size());
+    querySets[0].name = "random";
+    for (std::size_t i = 0; i < DISTANCE_CLASSES.size(); i++) {
+        querySets[i + 1].name = DISTANCE_CLASSES[i].first;
+    }
+    if (positions.empty()) {
+        return querySets;
+    }
+
+    // Random pairs are sorted into distance classes. Classes that cannot be filled (small packages) are left partially filled.
+    std::uniform_int_distribution<std::size_t> posDist(0, positions.size() - 1);
+    for (std::size_t attempt = 0; attempt < queryCount * 100; attempt++) {
+        Query query(positions[posDist(rng)], positions[posDist(rng)]);
+        if (querySets[0].queries.size() < queryCount) {
+            querySets[0].queries.push_back(query);
+        }
+        double dist = RouteFinder::calculateGreatCircleDistance(query.getPos(0), query.getPos(1));
+        bool filled = querySets[0].queries.size() >= queryCount;
+        for (std::size_t i = 0; i < DISTANCE_CLASSES.size(); i++) {
+            std::vector<Query>& queries = querySets[i + 1].queries;
+            if (dist >= DISTANCE_CLASSES[i].second.first && dist < DISTANCE_CLASSES[i].second.second && queries.size() < queryCount) {
+                queries.push_back(query);
+            }
+            filled = filled && queries.size() >= queryCount;
+        }
+        if (filled) {
+            break;
+        }
+    }
+    return querySets;
+}
+
+static RunResult runQueries(std::size_t queryCount, std::size_t threadCount, const std::function<void(std::size_t)>& queryFunc) {
+    RunResult runResult;
+    runResult.latencies.resize(queryCount);
+
+    std::atomic<std::size_t> nextIndex(0);
+    auto worker = [&]() {
+        for (std::size_t index = nextIndex++; index < queryCount; index = nextIndex++) {
+            auto startTime = std::chrono::steady_clock::now();
+            queryFunc(index);
+            runResult.latencies[index] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        }
+    };
+
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < threadCount; i++) {
+        threads.emplace_back(worker);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    runResult.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    return runResult;
+}
+
+static double getPercentile(std::vector<double> values, double percentile) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::size_t index = std::min(values.size() - 1, static_cast<std::size_t>(percentile * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static std::string formatHitRate(const Graph::CacheCounters& counters) {
+    std::size_t total = counters.hits + counters.misses;
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "%.1f%% (%zu)", total > 0 ? 100.0 * counters.hits / total : 100.0, total);
+    return buf;
+}
+
+static void printReport(const std::string& name, std::size_t threadCount, const RunResult& runResult, const Graph::CacheStatistics& cacheStats, const std::string& extra) {
+    std::printf("%-28s threads=%-2zu queries=%-6zu p50=%.3fms p90=%.3fms p99=%.3fms max=%.3fms throughput=%.1f/s%s\n",
+        name.c_str(), threadCount, runResult.latencies.size(),
+        getPercentile(runResult.latencies, 0.50), getPercentile(runResult.latencies, 0.90), getPercentile(runResult.latencies, 0.99), getPercentile(runResult.latencies, 1.0),
+        runResult.wallTime > 0 ? runResult.latencies.size() / runResult.wallTime : 0.0, extra.c_str());
+    std::printf("%-28s cache hit rates: node=%s geometry=%s name=%s globalnode=%s rtree=%s\n", "",
+        formatHitRate(cacheStats.nodeBlocks).c_str(), formatHitRate(cacheStats.geometryBlocks).c_str(), formatHitRate(cacheStats.nameBlocks).c_str(),
+        formatHitRate(cacheStats.globalNodeBlocks).c_str(), formatHitRate(cacheStats.rtreeNodeBlocks).c_str());
+}
+
+static void printStatistics(const std::vector<RouteFinder::Statistics>& statisticsList) {
+    if (statisticsList.empty()) {
+        return;
+    }
+    double settledNodes = 0, stalledNodes = 0, heapPops = 0, blocksTouched = 0, nodeBlockMisses = 0;
+    double snapTime = 0, searchTime = 0, unpackTime = 0;
+    for (const RouteFinder::Statistics& statistics : statisticsList) {
+        settledNodes += statistics.settledNodes[0] + statistics.settledNodes[1];
+        stalledNodes += statistics.stalledNodes[0] + statistics.stalledNodes[1];
+        heapPops += statistics.heapPops[0] + statistics.heapPops[1];
+        blocksTouched += statistics.blocksTouched;
+        nodeBlockMisses += statistics.cacheStatistics.nodeBlocks.misses;
+        snapTime += statistics.snapTime;
+        searchTime += statistics.searchTime;
+        unpackTime += statistics.unpackTime;
+    }
+    double count = static_cast<double>(statisticsList.size());
+    std::printf("%-28s mean per query: settled=%.1f stalled=%.1f pops=%.1f blocks=%.1f nodeblockmisses=%.1f snap=%.3fms search=%.3fms unpack=%.3fms\n", "",
+        settledNodes / count, stalledNodes / count, heapPops / count, blocksTouched / count, nodeBlockMisses / count,
+        snapTime * 1000 / count, searchTime * 1000 / count, unpackTime * 1000 / count);
+}
+
+int main(int argc, char* argv[]) {
+    std::size_t queryCount = 1000;
+    unsigned int seed = 1;
+    std::vector<std::size_t> threadCounts = { 1, 2, 4 };
+    std::string outputFileName;
+    std::vector<std::string> fileNames;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--queries" && i + 1 < argc) {
+            queryCount = std::stoul(argv[++i]);
+        }
+        else if (arg == "--seed" && i + 1 < argc) {
+            seed = static_cast<unsigned int>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--threads" && i + 1 < argc) {
+            threadCounts.clear();
+            std::istringstream ss(argv[++i]);
+            for (std::string token; std::getline(ss, token, ','); ) {
+                threadCounts.push_back(std::max<std::size_t>(1, std::stoul(token)));
+            }
+        }
+        else if (arg == "--output" && i + 1 < argc) {
+            outputFileName = argv[++i];
+        }
+        else {
+            fileNames.push_back(arg);
+        }
+    }
+    if (fileNames.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--queries N] [--seed N] [--threads 1,2,4] [--output results.csv] package.nmgraph..." << std::endl;
+        return 1;
+    }
+
+    try {
+        std::mt19937 rng(seed);
+        std::vector<WGSPos> positions = samplePositions(*loadGraph(fileNames), 1000, rng);
+        std::vector<QuerySet> querySets = buildQuerySets(positions, queryCount, rng);
+
+        // Nearest node queries use road positions displaced by up to ~200m
+        std::vector<WGSPos> nearestQueryPositions;
+        std::uniform_real_distribution<double> offsetDist(-0.002, 0.002);
+        for (std::size_t i = 0; i < queryCount && !positions.empty(); i++) {
+            nearestQueryPositions.push_back(positions[i % positions.size()] + WGSPos(offsetDist(rng), offsetDist(rng)));
+        }
+
+        std::ofstream outputFile;
+        if (!outputFileName.empty()) {
+            outputFile.open(outputFileName);
+            outputFile << "set,index,lat0,lon0,lat1,lon1,status,distance,time\n";
+        }
+
+        // Each run uses a freshly loaded graph, so that block cache statistics are comparable
+        for (std::size_t threadCount : threadCounts) {
+            std::shared_ptr<Graph> graph = loadGraph(fileNames);
+            std::vector<std::size_t> nodeCounts(nearestQueryPositions.size());
+            RunResult runResult = runQueries(nearestQueryPositions.size(), threadCount, [&](std::size_t index) {
+                nodeCounts[index] = graph->findNearestNode(nearestQueryPositions[index]).size();
+            });
+            std::size_t failures = std::count(nodeCounts.begin(), nodeCounts.end(), 0);
+            printReport("findNearestNode", threadCount, runResult, graph->getCacheStatistics(), " failures=" + std::to_string(failures));
+        }
+
+        for (const QuerySet& querySet : querySets) {
+            for (std::size_t threadCount : threadCounts) {
+                std::shared_ptr<Graph> graph = loadGraph(fileNames);
+                RouteFinder routeFinder(graph);
+                std::vector<Result> results(querySet.queries.size());
+                std::vector<RouteFinder::Statistics> statisticsList(querySet.queries.size());
+                RunResult runResult = runQueries(querySet.queries.size(), threadCount, [&](std::size_t index) {
+                    results[index] = routeFinder.find(querySet.queries[index], statisticsList[index]);
+                });
+
+                std::size_t failures = std::count_if(results.begin(), results.end(), [](const Result& result) { return result.getStatus() != Result::Status::SUCCESS; });
+                printReport("find " + querySet.name, threadCount, runResult, graph->getCacheStatistics(), " failures=" + std::to_string(failures));
+                printStatistics(statisticsList);
+
+                if (outputFile.is_open() && threadCount == threadCounts.front()) {
+                    for (std::size_t i = 0; i < results.size(); i++) {
+                        const Query& query = querySet.queries[i];
+                        outputFile << querySet.name << "," << i << "," << query.getPos(0)(0) << "," << query.getPos(0)(1) << "," << query.getPos(1)(0) << "," << query.getPos(1)(1) << ",";
+                        outputFile << (results[i].getStatus() == Result::Status::SUCCESS ? "success" : "failed") << "," << results[i].getTotalDistance() << "," << results[i].getTotalTime() << "\n";
+                    }
+                }
+            }
+        }
+    }
+    catch (const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -13,6 +13,8 @@
 namespace carto::osrm {
     using WGSPos = cglib::vec2<double>;
     using WGSBounds = cglib::bbox2<double>;
+
+    inline constexpr double EARTH_RADIUS = 6372797.560856; // in meters
 }
 
 #endif
@@ -4,14 +4,22 @@
 #include <cstddef>
 #include <list>
 #include <queue>
+#include <algorithm>
+#include <limits>
+#include <exception>
+#include <unordered_map>
 #include <unordered_set>
+#include <filesystem>
 
 #include <boost/math/constants/constants.hpp>
 
+#include <common/Parallel.h>
+
 #include <utf8.h>
 
 namespace carto::osrm {
     Graph::Graph(const Settings& settings) :
+        _settings(settings),
         _packages(),
         _nodeBlockCache(settings.nodeBlockCacheSize),
         _geometryBlockCache(settings.geometryBlockCacheSize),
@@ -20,27 +28,70 @@ namespace carto::osrm {
         _rtreeNodeBlockCache(settings.rtreeNodeBlockCacheSize),
         _mutex()
     {
+        for (std::size_t i = 0; i < settings.prefetchThreadCount; i++) {
+            _prefetchThreads.emplace_back(&Graph::prefetchWorker, this);
+        }
+    }
+
+    Graph::~Graph() {
+        {
+            std::lock_guard<std::mutex> lock(_prefetchMutex);
+            _prefetchStopped = true;
+        }
+        _prefetchCondition.notify_all();
+        for (std::thread& thread : _prefetchThreads) {
+            thread.join();
+        }
     }
     
     bool Graph::import(const std::string& fileName) {
-        auto file = std::make_shared<std::ifstream>();
-        file->exceptions(std::ifstream::failbit | std::ifstream::badbit);
-#ifdef _WIN32
-        std::wstring wfileName;
-        utf8::utf8to16(fileName.begin(), fileName.end(), std::back_inserter(wfileName));
-        file->open(wfileName, std::ios::binary);
-#else
-        file->open(fileName, std::ios::binary);
-#endif
-        return import(file);
+        return import(openFile(fileName));
     }
 
     bool Graph::import(const std::shared_ptr<std::ifstream>& file) {
+        Package package = readPackage(file);
+
         std::lock_guard<std::recursive_mutex> lock(_mutex);
+        package.packageId = static_cast<int>(_packages.size());
+        _packages.push_back(std::move(package));
+
+        // Invalidate caches whose contents may depend on other packages
+        _nodeBlockCache.clear();
+        _globalNodeBlockCache.clear();
+        _cacheGeneration++;
+        return true;
+    }
+
+    bool Graph::import(const std::vector<std::string>& fileNames, std::size_t threadCount) {
+        // Read the package headers in parallel. Packages are registered in the given order, so package ids do not depend on thread scheduling.
+        std::vector<Package> packages(fileNames.size());
+        common::runParallel(fileNames.size(), threadCount, [&](std::size_t i) {
+            packages[i] = readPackage(openFile(fileNames[i]));
+        });
+
+        int firstPackageId = 0;
+        {
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            firstPackageId = static_cast<int>(_packages.size());
+            for (Package& package : packages) {
+                package.packageId = static_cast<int>(_packages.size());
+                _packages.push_back(std::move(package));
+            }
+
+            // Invalidate caches whose contents may depend on other packages
+            _nodeBlockCache.clear();
+            _globalNodeBlockCache.clear();
+            _cacheGeneration++;
+        }
 
+        if (_settings.persistBoundsIndex) {
+            buildBoundsIndex(fileNames, firstPackageId, threadCount);
+        }
+        return true;
+    }
+
+    Graph::Package Graph::readPackage(const std::shared_ptr<std::ifstream>& file) {
         Package package;
-        package.packageId = static_cast<int>(_packages.size());
-        
         auto graphChunk = std::dynamic_pointer_cast<eiff::form_chunk>(eiff::read_chunk(file, true));
         if (!graphChunk) {
             throw std::runtime_error("Illegal graph file");
@@ -78,23 +129,44 @@ namespace carto::osrm {
         if (!package.nodeChunk || !package.geometryChunk || !package.nameChunk || !package.globalNodeChunk || !package.rtreeNodeChunk) {
             throw std::runtime_error("Graph sections missing");
         }
-        _packages.push_back(std::move(package));
+        return package;
+    }
 
-        // Invalidate caches whose contents may depend on other packages
-        _nodeBlockCache.clear();
-        _globalNodeBlockCache.clear();
-        return true;
+    std::shared_ptr<std::ifstream> Graph::openFile(const std::string& fileName) {
+        auto file = std::make_shared<std::ifstream>();
+        file->exceptions(std::ifstream::failbit | std::ifstream::badbit);
+#ifdef _WIN32
+        std::wstring wfileName;
+        utf8::utf8to16(fileName.begin(), fileName.end(), std::back_inserter(wfileName));
+        file->open(wfileName, std::ios::binary);
+#else
+        file->open(fileName, std::ios::binary);
+#endif
+        return file;
+    }
+
+    int Graph::getCacheGeneration() const {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        return _cacheGeneration;
+    }
+
+    Graph::CacheStatistics Graph::getCacheStatistics() const {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        return _cacheStatistics;
+    }
+
+    void Graph::resetCacheStatistics() {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        _cacheStatistics = CacheStatistics();
     }
 
     Graph::NodePtr Graph::getNode(NodeId nodeId) const {
         std::lock_guard<std::recursive_mutex> lock(_mutex);
 
-        std::shared_ptr<NodeBlock> nodeBlock;
-        if (!_nodeBlockCache.read(nodeId.blockId, nodeBlock)) {
-            nodeBlock = loadNodeBlock(nodeId.blockId);
-            _nodeBlockCache.put(nodeId.blockId, nodeBlock);
-        }
-        return NodePtr(nodeBlock, nodeId.elementIndex);
+        return NodePtr(getNodeBlock(nodeId.blockId), nodeId.elementIndex);
     }
 
     std::string Graph::getNodeName(const Node& node) const {
@@ -102,7 +174,11 @@ namespace carto::osrm {
 
         NameId nameId = node.nodeData.nameId;
         std::shared_ptr<NameBlock> nameBlock;
-        if (!_nameBlockCache.read(nameId.blockId, nameBlock)) {
+        if (_nameBlockCache.read(nameId.blockId, nameBlock)) {
+            _cacheStatistics.nameBlocks.hits++;
+        }
+        else {
+            _cacheStatistics.nameBlocks.misses++;
             nameBlock = loadNameBlock(nameId.blockId);
             _nameBlockCache.put(nameId.blockId, nameBlock);
         }
@@ -114,7 +190,11 @@ namespace carto::osrm {
 
         GeometryId geometryId = node.nodeData.geometryId;
         std::shared_ptr<GeometryBlock> geometryBlock;
-        if (!_geometryBlockCache.read(geometryId.blockId, geometryBlock)) {
+        if (_geometryBlockCache.read(geometryId.blockId, geometryBlock)) {
+            _cacheStatistics.geometryBlocks.hits++;
+        }
+        else {
+            _cacheStatistics.geometryBlocks.misses++;
             geometryBlock = loadGeometryBlock(geometryId.blockId);
             _geometryBlockCache.put(geometryId.blockId, geometryBlock);
         }
@@ -131,23 +211,220 @@ namespace carto::osrm {
     }
 
     std::vector<Graph::NearestNode> Graph::findNearestNode(const WGSPos& pos) const {
-        static const double DIST_THRESHOLD = 1.01;
-        
+        std::vector<std::vector<NearestNode>> bestNodesList;
+        findNearestNodeBatch(std::vector<WGSPos> { pos }, 0, bestNodesList);
+        return bestNodesList.front();
+    }
+
+    std::vector<std::vector<Graph::NearestNode>> Graph::findNearestNodes(const std::vector<WGSPos>& posList, double radius) const {
+        if (posList.empty()) {
+            return std::vector<std::vector<NearestNode>>();
+        }
+
+        // Sort the points along Hilbert curve, so that consecutive points are close to each other
+        WGSBounds bounds = WGSBounds::make_union(posList.begin(), posList.end());
+        std::vector<std::pair<std::uint64_t, std::size_t>> hilbertIndices;
+        hilbertIndices.reserve(posList.size());
+        for (std::size_t i = 0; i < posList.size(); i++) {
+            hilbertIndices.emplace_back(calculateHilbertIndex(posList[i], bounds), i);
+        }
+        std::sort(hilbertIndices.begin(), hilbertIndices.end());
+
+        // Process the points in batches, sharing the R-tree traversal within each batch
+        std::vector<std::vector<NearestNode>> result(posList.size());
+        for (std::size_t i0 = 0; i0 < hilbertIndices.size(); i0 += MAX_NEAREST_NODE_BATCH_SIZE) {
+            std::size_t i1 = std::min(hilbertIndices.size(), i0 + MAX_NEAREST_NODE_BATCH_SIZE);
+
+            std::vector<WGSPos> batchPosList;
+            batchPosList.reserve(i1 - i0);
+            for (std::size_t i = i0; i < i1; i++) {
+                batchPosList.push_back(posList[hilbertIndices[i].second]);
+            }
+
+            std::vector<std::vector<NearestNode>> bestNodesList;
+            findNearestNodeBatch(batchPosList, radius / EARTH_RADIUS * 180.0 / boost::math::constants::pi<double>(), bestNodesList);
+            for (std::size_t i = i0; i < i1; i++) {
+                result[hilbertIndices[i].second] = std::move(bestNodesList[i - i0]);
+            }
+        }
+        return result;
+    }
+
+    std::vector<Graph::BlockId> Graph::findNodeBlockIds(const WGSBounds& bounds) const {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        std::vector<BlockId> blockIds;
+        std::vector<RTreeNodeId> rtreeNodeIds;
+        for (const Package& package : _packages) {
+            if (package.bbox.intersects(bounds)) {
+                rtreeNodeIds.emplace_back(BlockId(package.packageId, 0), 0);
+            }
+        }
+        while (!rtreeNodeIds.empty()) {
+            RTreeNode rtreeNode = loadRTreeNode(rtreeNodeIds.back());
+            rtreeNodeIds.pop_back();
+            for (const std::pair<WGSBounds, RTreeNodeId>& child : rtreeNode.children) {
+                if (child.first.intersects(bounds)) {
+                    rtreeNodeIds.push_back(child.second);
+                }
+            }
+            for (const std::pair<WGSBounds, BlockId>& nodeBlockId : rtreeNode.nodeBlockIds) {
+                if (nodeBlockId.first.intersects(bounds)) {
+                    blockIds.push_back(nodeBlockId.second);
+                }
+            }
+        }
+        return blockIds;
+    }
+
+    int Graph::getNodeBlockSize(BlockId blockId) const {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        return getNodeBlock(blockId)->getNodeCount();
+    }
+
+    int Graph::getNodeBlockCount(int packageId) const {
         std::lock_guard<std::recursive_mutex> lock(_mutex);
 
+        // The node chunk starts with the block count
+        std::vector<unsigned char> blockCountData(sizeof(std::uint32_t));
+        _packages.at(packageId).nodeChunk->read(blockCountData, 0, blockCountData.size());
+        return static_cast<int>(*reinterpret_cast<const std::uint32_t*>(blockCountData.data()));
+    }
+
+    void Graph::prefetchNodeBlock(BlockId blockId) const {
+        if (_prefetchThreads.empty() || blockId.packageId == -1) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(_prefetchMutex);
+        if (!_prefetchQueueBlockIds.insert(blockId).second) {
+            return;
+        }
+
+        // Drop the oldest requests if the queue is full, the search frontier has probably moved on
+        _prefetchQueue.push_back(blockId);
+        while (_prefetchQueue.size() > MAX_PREFETCH_QUEUE_SIZE) {
+            _prefetchQueueBlockIds.erase(_prefetchQueue.front());
+            _prefetchQueue.pop_front();
+        }
+        _prefetchCondition.notify_one();
+    }
+
+    void Graph::preloadBlocks(const WGSBounds& bounds, std::size_t threadCount) const {
+        std::vector<BlockId> blockIds = findNodeBlockIds(bounds);
+
+        // Do not load more blocks than the cache can hold, otherwise the preloaded blocks would evict each other
+        if (blockIds.size() > _settings.nodeBlockCacheSize) {
+            blockIds.resize(_settings.nodeBlockCacheSize);
+        }
+
+        common::runParallel(blockIds.size(), threadCount, [&](std::size_t i) {
+            fetchNodeBlock(blockIds[i], true);
+        });
+    }
+
+    void Graph::fetchNodeBlock(BlockId blockId, bool withGeometry) const {
+        // Read the raw block data while holding the lock, as the underlying file is shared. Decoding is done without the lock.
+        std::shared_ptr<NodeBlock> nodeBlock;
+        std::vector<unsigned char> nodeBlockData;
+        int cacheGeneration = 0;
+        {
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            if (!_nodeBlockCache.peek(blockId, nodeBlock)) {
+                nodeBlockData = readBlock(&Package::nodeChunk, blockId);
+            }
+            cacheGeneration = _cacheGeneration;
+        }
+        if (!nodeBlock) {
+            nodeBlock = decodeNodeBlock(blockId, std::move(nodeBlockData));
+
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            if (cacheGeneration == _cacheGeneration && !_nodeBlockCache.exists(blockId)) {
+                _nodeBlockCache.put(blockId, nodeBlock);
+            }
+        }
+        if (!withGeometry) {
+            return;
+        }
+
+        std::unordered_set<BlockId, BlockId::Hash> geometryBlockIds;
+        for (const NodeBlock::PackedNodeData& nodeData : nodeBlock->nodeData) {
+            geometryBlockIds.insert(BlockId(blockId.packageId, nodeData.geometryBlockIndex));
+        }
+        for (BlockId geometryBlockId : geometryBlockIds) {
+            std::vector<unsigned char> geometryBlockData;
+            {
+                std::lock_guard<std::recursive_mutex> lock(_mutex);
+                if (_geometryBlockCache.exists(geometryBlockId)) {
+                    continue;
+                }
+                geometryBlockData = readBlock(&Package::geometryChunk, geometryBlockId);
+            }
+            std::shared_ptr<GeometryBlock> geometryBlock = decodeGeometryBlock(std::move(geometryBlockData));
+
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            if (!_geometryBlockCache.exists(geometryBlockId)) {
+                _geometryBlockCache.put(geometryBlockId, geometryBlock);
+            }
+        }
+    }
+
+    void Graph::prefetchWorker() const {
+        while (true) {
+            BlockId blockId;
+            {
+                std::unique_lock<std::mutex> lock(_prefetchMutex);
+                _prefetchCondition.wait(lock, [this] { return _prefetchStopped || !_prefetchQueue.empty(); });
+                if (_prefetchStopped) {
+                    return;
+                }
+                blockId = _prefetchQueue.front();
+                _prefetchQueue.pop_front();
+                _prefetchQueueBlockIds.erase(blockId);
+            }
+
+            try {
+                fetchNodeBlock(blockId, false);
+            }
+            catch (const std::exception&) {
+                // Ignore, the block will be loaded synchronously when actually needed and the error is reported then
+            }
+        }
+    }
+
+    void Graph::findNearestNodeBatch(const std::vector<WGSPos>& posList, double radius, std::vector<std::vector<NearestNode>>& bestNodesList) const {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+        std::vector<double> bestDists(posList.size(), std::numeric_limits<double>::infinity());
+        bestNodesList.assign(posList.size(), std::vector<NearestNode>());
+
+        // Calculate the minimum distance from the points to the bounding box, considering only the points that may still improve their results
+        auto calculateMinBBoxDistance = [&](const WGSBounds& bbox) {
+            double minDist = std::numeric_limits<double>::infinity();
+            for (std::size_t i = 0; i < posList.size(); i++) {
+                double dist = getBBoxDistance(posList[i], bbox);
+                if (dist <= bestDists[i] * NEAREST_NODE_DIST_THRESHOLD + radius) {
+                    minDist = std::min(minDist, dist);
+                }
+            }
+            return minDist;
+        };
+
         // First build a priority queue of the packages, based on distance from package bounding box
         std::priority_queue<SearchRTreeNode> searchRTreeNodeQueue;
         for (const Package& package : _packages) {
-            double dist = getBBoxDistance(pos, package.bbox);
-            searchRTreeNodeQueue.emplace(RTreeNodeId(BlockId(package.packageId, 0), 0), dist);
+            double dist = calculateMinBBoxDistance(package.bbox);
+            if (dist < std::numeric_limits<double>::infinity()) {
+                searchRTreeNodeQueue.emplace(RTreeNodeId(BlockId(package.packageId, 0), 0), dist);
+            }
         }
 
         // Process the queue in order, with early out
-        double bestDist = std::numeric_limits<double>::infinity();
-        std::vector<NearestNode> bestNodes;
         while (!searchRTreeNodeQueue.empty()) {
             SearchRTreeNode searchRTreeNode = searchRTreeNodeQueue.top();
-            if (searchRTreeNode.distance > bestDist * DIST_THRESHOLD) {
+            double maxBestDist = *std::max_element(bestDists.begin(), bestDists.end());
+            if (searchRTreeNode.distance > maxBestDist * NEAREST_NODE_DIST_THRESHOLD + radius) {
                 break;
             }
             searchRTreeNodeQueue.pop();
@@ -155,94 +432,154 @@ namespace carto::osrm {
             // Add all children of the node to the queue
             RTreeNode rtreeNode = loadRTreeNode(searchRTreeNode.rtreeNodeId);
             for (const std::pair<WGSBounds, RTreeNodeId>& child : rtreeNode.children) {
-                double dist = getBBoxDistance(pos, child.first);
-                searchRTreeNodeQueue.emplace(child.second, dist);
+                double dist = calculateMinBBoxDistance(child.first);
+                if (dist < std::numeric_limits<double>::infinity()) {
+                    searchRTreeNodeQueue.emplace(child.second, dist);
+                }
             }
             for (const std::pair<WGSBounds, BlockId>& nodeBlockId : rtreeNode.nodeBlockIds) {
-                double dist = getBBoxDistance(pos, nodeBlockId.first);
-                if (dist > bestDist * DIST_THRESHOLD) {
-                    continue;
-                }
-
-                BlockId blockId = nodeBlockId.second;
                 std::shared_ptr<NodeBlock> nodeBlock;
-                if (!_nodeBlockCache.read(blockId, nodeBlock)) {
-                    nodeBlock = loadNodeBlock(blockId);
-                    _nodeBlockCache.put(blockId, nodeBlock);
-                }
+                for (std::size_t i = 0; i < posList.size(); i++) {
+                    double dist = getBBoxDistance(posList[i], nodeBlockId.first);
+                    if (dist > bestDists[i] * NEAREST_NODE_DIST_THRESHOLD + radius) {
+                        continue;
+                    }
 
-                // Fill bounds cache for the node block, if not yet created
-                if (nodeBlock->nodeGeometryBoundsCache.empty()) {
-                    nodeBlock->nodeGeometryBoundsCache.reserve(nodeBlock->nodes.size());
-                    for (unsigned int i = 0; i < nodeBlock->nodes.size(); i++) {
-                        const Node& node = nodeBlock->nodes[i];
-                        std::vector<WGSPos> geometry = getNodeGeometry(node);
-                        nodeBlock->nodeGeometryBoundsCache.push_back(WGSBounds::make_union(geometry.begin(), geometry.end()));
+                    // Load the block only once for all the points in the batch
+                    if (!nodeBlock) {
+                        nodeBlock = getNodeBlock(nodeBlockId.second);
+                        buildNodeGeometryBoundsCache(*nodeBlock);
                     }
+                    findNearestNodeInBlock(posList[i], radius, nodeBlockId.second, *nodeBlock, bestDists[i], bestNodesList[i]);
                 }
+            }
+        }
+    }
+
+    void Graph::findNearestNodeInBlock(const WGSPos& pos, double radius, BlockId blockId, const NodeBlock& nodeBlock, double& bestDist, std::vector<NearestNode>& bestNodes) const {
+        // Build priority queue of the nodes within the block, using distance to geometry bounding box
+        std::priority_queue<SearchGeometry> searchGeometryQueue;
+        for (unsigned int i = 0; i < nodeBlock.nodeGeometryBoundsCache.size(); i++) {
+            double dist = getBBoxDistance(pos, nodeBlock.nodeGeometryBoundsCache[i]);
+            if (dist <= bestDist * NEAREST_NODE_DIST_THRESHOLD + radius) {
+                searchGeometryQueue.emplace(NodeId(blockId, i), dist);
+            }
+        }
 
-                // Build priority queue of the nodes within the block, using distance to geometry bounding box
-                std::priority_queue<SearchGeometry> searchGeometryQueue;
-                for (unsigned int i = 0; i < nodeBlock->nodeGeometryBoundsCache.size(); i++) {
-                    double dist = getBBoxDistance(pos, nodeBlock->nodeGeometryBoundsCache[i]);
-                    if (dist <= bestDist * DIST_THRESHOLD) {
-                        searchGeometryQueue.emplace(NodeId(blockId, i), dist);
+        // Process the node priority queue, with early out
+        while (!searchGeometryQueue.empty()) {
+            SearchGeometry searchGeometry = searchGeometryQueue.top();
+            if (searchGeometry.distance > bestDist * NEAREST_NODE_DIST_THRESHOLD + radius) {
+                break;
+            }
+            searchGeometryQueue.pop();
+
+            std::vector<WGSPos> geometry = getNodeGeometry(nodeBlock.getNode(searchGeometry.nodeId.elementIndex));
+            double t = 0;
+            for (unsigned int j = 1; j < geometry.size(); j++) {
+                WGSPos posProj = getClosestSegmentPoint(pos, geometry[j - 1], geometry[j]);
+                double dist = getPointDistance(pos, posProj);
+                if (dist <= bestDist * NEAREST_NODE_DIST_THRESHOLD + radius) {
+                    if (dist * NEAREST_NODE_DIST_THRESHOLD + radius < bestDist) {
+                        bestNodes.erase(std::remove_if(bestNodes.begin(), bestNodes.end(), [&](const NearestNode& bestNode) {
+                            return getPointDistance(pos, bestNode.nodePos) > dist * NEAREST_NODE_DIST_THRESHOLD + radius;
+                        }), bestNodes.end());
+                    }
+                    bestDist = std::min(dist, bestDist);
+                    
+                    double len = 0;
+                    for (unsigned int j = 1; j < geometry.size(); j++) {
+                        len += cglib::length(geometry[j] - geometry[j - 1]);
                     }
+                    
+                    NearestNode newBestNode;
+                    newBestNode.nodePos = posProj;
+                    newBestNode.nodeId = searchGeometry.nodeId;
+                    newBestNode.geometrySegmentIndex = j;
+                    newBestNode.geometryRelPos = static_cast<float>((t + cglib::length(posProj - geometry[j - 1])) / len);
+                    bestNodes.push_back(newBestNode);
                 }
+                t += cglib::length(geometry[j] - geometry[j - 1]);
+            }
+        }
+    }
 
-                // Process the node priority queue, with early out
-                while (!searchGeometryQueue.empty()) {
-                    SearchGeometry searchGeometry = searchGeometryQueue.top();
-                    if (searchGeometry.distance > bestDist * DIST_THRESHOLD) {
-                        break;
-                    }
-                    searchGeometryQueue.pop();
+    std::shared_ptr<Graph::NodeBlock> Graph::getNodeBlock(BlockId blockId) const {
+        std::shared_ptr<NodeBlock> nodeBlock;
+        if (_nodeBlockCache.read(blockId, nodeBlock)) {
+            _cacheStatistics.nodeBlocks.hits++;
+        }
+        else {
+            _cacheStatistics.nodeBlocks.misses++;
+            nodeBlock = loadNodeBlock(blockId);
+            _nodeBlockCache.put(blockId, nodeBlock);
+        }
+        return nodeBlock;
+    }
 
-                    std::vector<WGSPos> geometry = getNodeGeometry(nodeBlock->nodes[searchGeometry.nodeId.elementIndex]);
-                    double t = 0;
-                    for (unsigned int j = 1; j < geometry.size(); j++) {
-                        WGSPos posProj = getClosestSegmentPoint(pos, geometry[j - 1], geometry[j]);
-                        double dist = getPointDistance(pos, posProj);
-                        if (dist <= bestDist * DIST_THRESHOLD) {
-                            if (dist * DIST_THRESHOLD < bestDist) {
-                                bestNodes.clear();
-                            }
-                            bestDist = std::min(dist, bestDist);
-                            
-                            double len = 0;
-                            for (unsigned int j = 1; j < geometry.size(); j++) {
-                                len += cglib::length(geometry[j] - geometry[j - 1]);
-                            }
-                            
-                            NearestNode newBestNode;
-                            newBestNode.nodePos = posProj;
-                            newBestNode.nodeId = searchGeometry.nodeId;
-                            newBestNode.geometrySegmentIndex = j;
-                            newBestNode.geometryRelPos = static_cast<float>((t + cglib::length(posProj - geometry[j - 1])) / len);
-                            bestNodes.push_back(newBestNode);
-                        }
-                        t += cglib::length(geometry[j] - geometry[j - 1]);
+    void Graph::buildNodeGeometryBoundsCache(NodeBlock& nodeBlock) const {
+        // Fill bounds cache for the node block, if not yet created. Use the package bounds index if available, this avoids decoding the geometry.
+        if (nodeBlock.nodeGeometryBoundsCache.empty()) {
+            const BoundsIndex& boundsIndex = _packages.at(nodeBlock.blockId.packageId).boundsIndex;
+            std::size_t blockIndex = static_cast<std::size_t>(nodeBlock.blockId.blockIndex);
+            std::vector<std::array<std::uint16_t, 4>> nodeBoundsList;
+            if (blockIndex + 1 < boundsIndex.blockOffsets.size() && boundsIndex.blockOffsets[blockIndex + 1] - boundsIndex.blockOffsets[blockIndex] == static_cast<std::uint32_t>(nodeBlock.getNodeCount())) {
+                nodeBoundsList.resize(nodeBlock.getNodeCount());
+                try {
+                    std::lock_guard<std::recursive_mutex> lock(_mutex);
+                    boundsIndex.file->seekg(boundsIndex.nodeBoundsOffset + boundsIndex.blockOffsets[blockIndex] * sizeof(std::array<std::uint16_t, 4>));
+                    boundsIndex.file->read(reinterpret_cast<char*>(nodeBoundsList.data()), nodeBoundsList.size() * sizeof(std::array<std::uint16_t, 4>));
+                }
+                catch (const std::exception&) {
+                    nodeBoundsList.clear(); // index file is not readable anymore, decode the geometry instead
+                }
+            }
+            if (!nodeBoundsList.empty()) {
+                WGSPos blockMin = fromPoint(boundsIndex.blockBounds[blockIndex].first);
+                WGSPos blockScale = (fromPoint(boundsIndex.blockBounds[blockIndex].second) - blockMin) * (1.0 / 65535.0);
+                nodeBlock.nodeGeometryBoundsCache.reserve(nodeBlock.getNodeCount());
+                for (const std::array<std::uint16_t, 4>& nodeBounds : nodeBoundsList) {
+                    if (nodeBounds[0] > nodeBounds[2] || nodeBounds[1] > nodeBounds[3]) {
+                        nodeBlock.nodeGeometryBoundsCache.push_back(WGSBounds::smallest());
+                    }
+                    else {
+                        WGSPos minPos(blockMin(0) + nodeBounds[0] * blockScale(0), blockMin(1) + nodeBounds[1] * blockScale(1));
+                        WGSPos maxPos(blockMin(0) + nodeBounds[2] * blockScale(0), blockMin(1) + nodeBounds[3] * blockScale(1));
+                        nodeBlock.nodeGeometryBoundsCache.emplace_back(minPos, maxPos);
                     }
                 }
+                return;
+            }
+
+            nodeBlock.nodeGeometryBoundsCache.reserve(nodeBlock.getNodeCount());
+            for (int i = 0; i < nodeBlock.getNodeCount(); i++) {
+                std::vector<WGSPos> geometry = getNodeGeometry(nodeBlock.getNode(i));
+                nodeBlock.nodeGeometryBoundsCache.push_back(WGSBounds::make_union(geometry.begin(), geometry.end()));
             }
         }
-        return bestNodes;
     }
-    
-    std::shared_ptr<Graph::NodeBlock> Graph::loadNodeBlock(BlockId blockId) const {
+
+    std::vector<unsigned char> Graph::readBlock(std::shared_ptr<eiff::data_chunk> Package::* chunkPtr, BlockId blockId) const {
         if (blockId.packageId == -1) {
             throw std::runtime_error("Bad package id");
         }
 
-        const Package& package = _packages.at(blockId.packageId);
+        const std::shared_ptr<eiff::data_chunk>& chunk = _packages.at(blockId.packageId).*chunkPtr;
 
         std::vector<unsigned char> blockOffsetData(2 * sizeof(std::uint64_t));
-        package.nodeChunk->read(blockOffsetData, sizeof(std::uint32_t) + blockId.blockIndex * sizeof(std::uint64_t), blockOffsetData.size());
+        chunk->read(blockOffsetData, sizeof(std::uint32_t) + blockId.blockIndex * sizeof(std::uint64_t), blockOffsetData.size());
         const std::uint64_t* blockOffsets = reinterpret_cast<std::uint64_t*>(blockOffsetData.data());
 
         std::vector<unsigned char> block;
-        package.nodeChunk->read(block, blockOffsets[0], blockOffsets[1] - blockOffsets[0]);
+        chunk->read(block, blockOffsets[0], blockOffsets[1] - blockOffsets[0]);
+        return block;
+    }
 
+    std::shared_ptr<Graph::NodeBlock> Graph::loadNodeBlock(BlockId blockId) const {
+        return decodeNodeBlock(blockId, readBlock(&Package::nodeChunk, blockId));
+    }
+
+    std::shared_ptr<Graph::NodeBlock> Graph::decodeNodeBlock(BlockId blockId, std::vector<unsigned char> block) const {
         bitstreams::input_bitstream bs(std::move(block));
 
         auto nodeBlock = std::make_shared<NodeBlock>();
@@ -269,117 +606,126 @@ namespace carto::osrm {
         auto minGeometryBlockId = bs.read_bits<unsigned int>(maxGeometryBlockBits);
         auto minNameBlockId = bs.read_bits<unsigned int>(maxNameBlockBits);
 
-        // Store nodes and outgoing edges
+        // Store nodes and outgoing edges. References to nodes in other blocks are stored in the external node table.
+        std::unordered_map<NodeId, std::uint32_t, NodeId::Hash> externalNodeRefMap;
+        auto getNodeRef = [&](NodeId nodeId) -> std::uint32_t {
+            if (nodeId.blockId == blockId) {
+                return static_cast<std::uint32_t>(nodeId.elementIndex);
+            }
+            auto it = externalNodeRefMap.find(nodeId);
+            if (it == externalNodeRefMap.end()) {
+                it = externalNodeRefMap.emplace(nodeId, static_cast<std::uint32_t>(nodeBlock->externalNodeIds.size()) | NodeBlock::EXTERNAL_NODE_FLAG).first;
+                nodeBlock->externalNodeIds.push_back(nodeId);
+            }
+            return it->second;
+        };
+        auto getWeightBits = [&](unsigned int weight) -> std::uint32_t {
+            if (weight <= NodeBlock::EDGE_WEIGHT_MASK) {
+                return weight;
+            }
+            nodeBlock->largeWeights.push_back(weight);
+            return static_cast<std::uint32_t>(nodeBlock->largeWeights.size() - 1) | NodeBlock::EDGE_LARGE_WEIGHT_FLAG;
+        };
+
+        nodeBlock->blockId = blockId;
         auto nodeCount = bs.read_bits<int>(32);
-        nodeBlock->nodes.reserve(nodeCount);
-        std::vector<unsigned> nodeEdgeCount;
-        nodeEdgeCount.reserve(nodeCount);
+        nodeBlock->nodeData.reserve(nodeCount);
+        nodeBlock->nodeEdgeOffsets.reserve(nodeCount + 1);
+        nodeBlock->nodeEdgeOffsets.push_back(0);
         for (int nodeIndex = 0; nodeIndex < nodeCount; nodeIndex++) {
-            nodeBlock->nodes.emplace_back();
-            Node& node = nodeBlock->nodes.back();
+            nodeBlock->nodeData.emplace_back();
+            NodeBlock::PackedNodeData& nodeData = nodeBlock->nodeData.back();
             auto edgeCount = bs.read_bits<int>(maxNodeOutDegreeBits);
-            auto geometryBlockId = minGeometryBlockId + bs.read_bits<unsigned int>(maxGeometryBlockDiffBits);
-            auto geometryIndexId = bs.read_bits<unsigned int>(maxGeometryIndexBits);
-            node.nodeData.geometryId = GeometryId(BlockId(package.packageId, geometryBlockId), geometryIndexId);
-            node.nodeData.geometryReversed = bs.read_bit();
-            auto nameBlockId = minNameBlockId + bs.read_bits<unsigned int>(maxNameBlockDiffBits);
-            auto nameIndexId = bs.read_bits<unsigned int>(maxNameIndexBits);
-            node.nodeData.nameId = NameId(BlockId(package.packageId, nameBlockId), nameIndexId);
-            node.nodeData.travelMode = bs.read_bits<unsigned char>(maxTravelModeBits);
+            nodeData.geometryBlockIndex = minGeometryBlockId + bs.read_bits<unsigned int>(maxGeometryBlockDiffBits);
+            nodeData.geometryIndex = bs.read_bits<unsigned int>(maxGeometryIndexBits);
+            if (bs.read_bit()) {
+                nodeData.geometryIndex |= NodeBlock::GEOMETRY_REVERSED_FLAG;
+            }
+            nodeData.nameBlockIndex = minNameBlockId + bs.read_bits<unsigned int>(maxNameBlockDiffBits);
+            nodeData.nameIndex = bs.read_bits<unsigned int>(maxNameIndexBits);
+            nodeData.travelMode = bs.read_bits<unsigned char>(maxTravelModeBits);
             if (bs.read_bit()) {
-                node.nodeData.weight = bs.read_bits<unsigned int>(largeWeightBits);
+                nodeData.weight = bs.read_bits<unsigned int>(largeWeightBits);
             }
             else {
-                node.nodeData.weight = bs.read_bits<unsigned int>(smallWeightBits);
+                nodeData.weight = bs.read_bits<unsigned int>(smallWeightBits);
             }
 
-            nodeEdgeCount.push_back(edgeCount);
             while (edgeCount-- > 0) {
-                nodeBlock->edges.emplace_back();
-                Edge& edge = nodeBlock->edges.back();
+                NodeId targetNodeId;
                 if (bs.read_bit()) {
                     auto delta = bs.read_bits<unsigned int>(maxExternalNodeBlockBits);
                     auto targetBlockIndex = blockId.blockIndex - delta;
                     auto targetNodeIndex = bs.read_bits<unsigned int>(maxExternalNodeIndexBits);
-                    edge.targetNodeId = NodeId(BlockId(package.packageId, targetBlockIndex), targetNodeIndex);
+                    targetNodeId = NodeId(BlockId(blockId.packageId, targetBlockIndex), targetNodeIndex);
                 }
                 else {
                     auto delta = bs.read_bits<unsigned int>(maxInternalNodeIndexBits);
                     if (delta == 0) {
                         auto globalTargetBlockIndex = bs.read_bits<unsigned int>(maxGlobalNodeBlockBits);
                         auto globalTargetNodeIndex = bs.read_bits<unsigned int>(maxGlobalNodeIndexBits);
-                        edge.targetNodeId = resolveGlobalNodeId(NodeId(BlockId(package.packageId, globalTargetBlockIndex), globalTargetNodeIndex));
+                        targetNodeId = resolveGlobalNodeId(NodeId(BlockId(blockId.packageId, globalTargetBlockIndex), globalTargetNodeIndex));
                     }
                     else {
                         auto targetNodeIndex = nodeIndex - delta;
-                        edge.targetNodeId = NodeId(blockId, targetNodeIndex);
+                        targetNodeId = NodeId(blockId, targetNodeIndex);
                     }
                 }
-                edge.forward = bs.read_bit();
-                edge.backward = bs.read_bit();
+                std::uint32_t weightFlags = 0;
+                if (bs.read_bit()) {
+                    weightFlags |= NodeBlock::EDGE_FORWARD_FLAG;
+                }
                 if (bs.read_bit()) {
-                    edge.edgeData.weight = bs.read_bits<unsigned int>(largeWeightBits);
+                    weightFlags |= NodeBlock::EDGE_BACKWARD_FLAG;
+                }
+                if (bs.read_bit()) {
+                    weightFlags |= getWeightBits(bs.read_bits<unsigned int>(largeWeightBits));
                 }
                 else {
-                    edge.edgeData.weight = bs.read_bits<unsigned int>(smallWeightBits);
+                    weightFlags |= getWeightBits(bs.read_bits<unsigned int>(smallWeightBits));
                 }
+                std::uint32_t contractedNodeRef = 0;
                 if (bs.read_bit()) {
-                    edge.contracted = true;
+                    weightFlags |= NodeBlock::EDGE_CONTRACTED_FLAG;
+                    NodeId contractedNodeId;
                     if (bs.read_bit()) {
                         auto delta = decodeZigZagValue(bs.read_bits<unsigned int>(maxContractedNodeBlockBits));
                         auto contractedBlockIndex = blockId.blockIndex + delta;
                         auto contractedNodeIndex = bs.read_bits<unsigned int>(maxContractedNodeIndexBits);
-                        edge.contractedNodeId = NodeId(BlockId(package.packageId, contractedBlockIndex), contractedNodeIndex);
+                        contractedNodeId = NodeId(BlockId(blockId.packageId, contractedBlockIndex), contractedNodeIndex);
                     }
                     else {
                         auto delta = bs.read_bits<unsigned int>(maxInternalNodeIndexBits);
                         if (delta == 0) {
                             auto globalContractedBlockIndex = bs.read_bits<unsigned int>(maxGlobalNodeBlockBits);
                             auto globalContractedNodeIndex = bs.read_bits<unsigned int>(maxGlobalNodeIndexBits);
-                            edge.contractedNodeId = resolveGlobalNodeId(NodeId(BlockId(package.packageId, globalContractedBlockIndex), globalContractedNodeIndex));
+                            contractedNodeId = resolveGlobalNodeId(NodeId(BlockId(blockId.packageId, globalContractedBlockIndex), globalContractedNodeIndex));
                         }
                         else {
                             auto contractedNodeIndex = nodeIndex - delta;
-                            edge.contractedNodeId = NodeId(blockId, contractedNodeIndex);
+                            contractedNodeId = NodeId(blockId, contractedNodeIndex);
                         }
                     }
+                    contractedNodeRef = getNodeRef(contractedNodeId);
                 }
                 else {
-                    edge.contracted = false;
-                    edge.edgeData.turnInstruction = bs.read_bits<unsigned char>(maxInstructionBits);
+                    contractedNodeRef = bs.read_bits<unsigned char>(maxInstructionBits);
                 }
+                nodeBlock->edgeTargetNodes.push_back(getNodeRef(targetNodeId));
+                nodeBlock->edgeContractedNodes.push_back(contractedNodeRef);
+                nodeBlock->edgeWeightFlags.push_back(weightFlags);
             }
-        }
-        
-        // Link node edge iterators to edge table
-        unsigned edgeIndex = 0;
-        for (int nodeIndex = 0; nodeIndex < nodeCount; nodeIndex++) {
-            Node& node = nodeBlock->nodes[nodeIndex];
-            node.firstEdge = nodeBlock->edges.data() + edgeIndex;
-            edgeIndex += nodeEdgeCount[nodeIndex];
-            node.lastEdge = nodeBlock->edges.data() + edgeIndex;
-        }
-        if (edgeIndex != nodeBlock->edges.size()) {
-            throw std::runtime_error("Block node/edge table is corrupted");
+            nodeBlock->nodeEdgeOffsets.push_back(static_cast<std::uint32_t>(nodeBlock->edgeTargetNodes.size()));
         }
         
         return nodeBlock;
     }
 
     std::shared_ptr<Graph::GeometryBlock> Graph::loadGeometryBlock(BlockId blockId) const {
-        if (blockId.packageId == -1) {
-            throw std::runtime_error("Bad package id");
-        }
-
-        const Package& package = _packages.at(blockId.packageId);
-
-        std::vector<unsigned char> blockOffsetData(2 * sizeof(std::uint64_t));
-        package.geometryChunk->read(blockOffsetData, sizeof(std::uint32_t) + blockId.blockIndex * sizeof(std::uint64_t), blockOffsetData.size());
-        const std::uint64_t* blockOffsets = reinterpret_cast<std::uint64_t*>(blockOffsetData.data());
-
-        std::vector<unsigned char> block;
-        package.geometryChunk->read(block, blockOffsets[0], blockOffsets[1] - blockOffsets[0]);
+        return decodeGeometryBlock(readBlock(&Package::geometryChunk, blockId));
+    }
 
+    std::shared_ptr<Graph::GeometryBlock> Graph::decodeGeometryBlock(std::vector<unsigned char> block) const {
         bitstreams::input_bitstream bs(std::move(block));
 
         auto geometryBlock = std::make_shared<GeometryBlock>();
@@ -417,19 +763,7 @@ namespace carto::osrm {
     }
 
     std::shared_ptr<Graph::NameBlock> Graph::loadNameBlock(BlockId blockId) const {
-        if (blockId.packageId == -1) {
-            throw std::runtime_error("Bad package id");
-        }
-
-        const Package& package = _packages.at(blockId.packageId);
-
-        std::vector<unsigned char> blockOffsetData(2 * sizeof(std::uint64_t));
-        package.nameChunk->read(blockOffsetData, sizeof(std::uint32_t) + blockId.blockIndex * sizeof(std::uint64_t), blockOffsetData.size());
-        const std::uint64_t* blockOffsets = reinterpret_cast<std::uint64_t*>(blockOffsetData.data());
-
-        std::vector<unsigned char> block;
-        package.nameChunk->read(block, blockOffsets[0], blockOffsets[1] - blockOffsets[0]);
-
+        std::vector<unsigned char> block = readBlock(&Package::nameChunk, blockId);
         bitstreams::input_bitstream bs(std::move(block));
 
         auto nameBlock = std::make_shared<NameBlock>();
@@ -454,19 +788,7 @@ namespace carto::osrm {
     }
     
     std::shared_ptr<Graph::GlobalNodeBlock> Graph::loadGlobalNodeBlock(BlockId blockId) const {
-        if (blockId.packageId == -1) {
-            throw std::runtime_error("Bad package id");
-        }
-        
-        const Package& package = _packages.at(blockId.packageId);
-        
-        std::vector<unsigned char> blockOffsetData(2 * sizeof(std::uint64_t));
-        package.globalNodeChunk->read(blockOffsetData, sizeof(std::uint32_t) + blockId.blockIndex * sizeof(std::uint64_t), blockOffsetData.size());
-        const std::uint64_t* blockOffsets = reinterpret_cast<std::uint64_t*>(blockOffsetData.data());
-        
-        std::vector<unsigned char> block;
-        package.globalNodeChunk->read(block, blockOffsets[0], blockOffsets[1] - blockOffsets[0]);
-        
+        std::vector<unsigned char> block = readBlock(&Package::globalNodeChunk, blockId);
         bitstreams::input_bitstream bs(std::move(block));
         
         auto globalNodeBlock = std::make_shared<GlobalNodeBlock>();
@@ -516,19 +838,7 @@ namespace carto::osrm {
     }
     
     std::shared_ptr<Graph::RTreeNodeBlock> Graph::loadRTreeNodeBlock(BlockId blockId) const {
-        if (blockId.packageId == -1) {
-            throw std::runtime_error("Bad package id");
-        }
-        
-        const Package& package = _packages.at(blockId.packageId);
-
-        std::vector<unsigned char> blockOffsetData(2 * sizeof(std::uint64_t));
-        package.rtreeNodeChunk->read(blockOffsetData, sizeof(std::uint32_t) + blockId.blockIndex * sizeof(std::uint64_t), blockOffsetData.size());
-        const std::uint64_t* blockOffsets = reinterpret_cast<std::uint64_t*>(blockOffsetData.data());
-        
-        std::vector<unsigned char> block;
-        package.rtreeNodeChunk->read(block, blockOffsets[0], blockOffsets[1] - blockOffsets[0]);
-        
+        std::vector<unsigned char> block = readBlock(&Package::rtreeNodeChunk, blockId);
         bitstreams::input_bitstream bs(std::move(block));
         
         auto rtreeNodeBlock = std::make_shared<RTreeNodeBlock>();
@@ -565,12 +875,12 @@ namespace carto::osrm {
                 WGSBounds bbox(fromPoint(Point(lat0, lon0)), fromPoint(Point(lat1, lon1)));
                 if (leaf) {
                     auto nodeBlockId = bs.read_bits<unsigned int>(maxNodeBlockBits);
-                    rtreeNode.nodeBlockIds.emplace_back(bbox, BlockId(package.packageId, nodeBlockId));
+                    rtreeNode.nodeBlockIds.emplace_back(bbox, BlockId(blockId.packageId, nodeBlockId));
                 }
                 else {
                     auto rtreeNodeBlockId = bs.read_bits<unsigned int>(maxRTreeBlockBits);
                     auto rtreeNodeIndexId = bs.read_bits<unsigned int>(maxRTreeIndexBits);
-                    rtreeNode.children.emplace_back(bbox, RTreeNodeId(BlockId(package.packageId, rtreeNodeBlockId), rtreeNodeIndexId));
+                    rtreeNode.children.emplace_back(bbox, RTreeNodeId(BlockId(blockId.packageId, rtreeNodeBlockId), rtreeNodeIndexId));
                 }
             }
             rtreeNodeBlock->rtreeNodes.push_back(std::move(rtreeNode));
@@ -580,23 +890,263 @@ namespace carto::osrm {
     }
     
     Graph::NodeId Graph::resolveGlobalNodeId(GlobalNodeId globalNodeId) const {
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+
         std::shared_ptr<GlobalNodeBlock> globalNodeBlock;
-        if (!_globalNodeBlockCache.read(globalNodeId.blockId, globalNodeBlock)) {
+        if (_globalNodeBlockCache.read(globalNodeId.blockId, globalNodeBlock)) {
+            _cacheStatistics.globalNodeBlocks.hits++;
+        }
+        else {
+            _cacheStatistics.globalNodeBlocks.misses++;
             globalNodeBlock = loadGlobalNodeBlock(globalNodeId.blockId);
             _globalNodeBlockCache.put(globalNodeId.blockId, globalNodeBlock);
         }
         return globalNodeBlock->globalNodeIds.at(globalNodeId.elementIndex);
     }
 
+    void Graph::buildBoundsIndex(const std::vector<std::string>& fileNames, int firstPackageId, std::size_t threadCount) {
+        // Open the persisted indices that match the package files and collect the node blocks of the other packages
+        std::vector<std::pair<std::uint64_t, std::int64_t>> fileStamps(fileNames.size());
+        std::vector<BoundsIndex> boundsIndices(fileNames.size());
+        std::vector<std::vector<std::pair<Point, Point>>> blockBoundsLists(fileNames.size());
+        std::vector<std::vector<std::vector<std::array<std::uint16_t, 4>>>> nodeBoundsLists(fileNames.size());
+        std::vector<BlockId> blockIds;
+        for (std::size_t i = 0; i < fileNames.size(); i++) {
+            std::size_t blockCount = static_cast<std::size_t>(getNodeBlockCount(firstPackageId + static_cast<int>(i)));
+            fileStamps[i] = getFileStamp(fileNames[i]);
+            if (loadBoundsIndex(fileNames[i] + ".bounds", fileStamps[i], blockCount, boundsIndices[i])) {
+                continue;
+            }
+            blockBoundsLists[i].resize(blockCount);
+            nodeBoundsLists[i].resize(blockCount);
+            for (std::size_t j = 0; j < blockCount; j++) {
+                blockIds.emplace_back(firstPackageId + static_cast<int>(i), static_cast<int>(j));
+            }
+        }
+
+        // Calculate the node bounds of the blocks in parallel
+        common::runParallel(blockIds.size(), threadCount, [&](std::size_t i) {
+            std::size_t packageIndex = static_cast<std::size_t>(blockIds[i].packageId - firstPackageId);
+            calculateNodeBlockBounds(blockIds[i], blockBoundsLists[packageIndex][blockIds[i].blockIndex], nodeBoundsLists[packageIndex][blockIds[i].blockIndex]);
+        });
+
+        // Store the new indices and reopen them, so that only the block tables stay in memory. If the index can not be stored, the package is used without it.
+        for (std::size_t i = 0; i < fileNames.size(); i++) {
+            if (!boundsIndices[i].file) {
+                saveBoundsIndex(fileNames[i] + ".bounds", fileStamps[i], blockBoundsLists[i], nodeBoundsLists[i]);
+                loadBoundsIndex(fileNames[i] + ".bounds", fileStamps[i], blockBoundsLists[i].size(), boundsIndices[i]);
+            }
+        }
+
+        std::lock_guard<std::recursive_mutex> lock(_mutex);
+        for (std::size_t i = 0; i < fileNames.size(); i++) {
+            _packages.at(firstPackageId + i).boundsIndex = std::move(boundsIndices[i]);
+        }
+    }
+
+    void Graph::calculateNodeBlockBounds(BlockId blockId, std::pair<Point, Point>& blockBounds, std::vector<std::array<std::uint16_t, 4>>& nodeBounds) const {
+        // Decode the node block and its geometry blocks without holding the lock, only reading is serialized
+        std::vector<unsigned char> nodeBlockData;
+        {
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            nodeBlockData = readBlock(&Package::nodeChunk, blockId);
+        }
+        std::shared_ptr<NodeBlock> nodeBlock = decodeNodeBlock(blockId, std::move(nodeBlockData));
+
+        // Calculate exact node bounds, empty geometries get inverted bounds
+        std::unordered_map<int, std::shared_ptr<GeometryBlock>> geometryBlocks;
+        std::vector<std::pair<Point, Point>> exactNodeBounds;
+        exactNodeBounds.reserve(nodeBlock->getNodeCount());
+        blockBounds = std::make_pair(Point(std::numeric_limits<int>::max(), std::numeric_limits<int>::max()), Point(std::numeric_limits<int>::min(), std::numeric_limits<int>::min()));
+        for (const NodeBlock::PackedNodeData& nodeData : nodeBlock->nodeData) {
+            std::shared_ptr<GeometryBlock>& geometryBlock = geometryBlocks[nodeData.geometryBlockIndex];
+            if (!geometryBlock) {
+                std::vector<unsigned char> geometryBlockData;
+                {
+                    std::lock_guard<std::recursive_mutex> lock(_mutex);
+                    geometryBlockData = readBlock(&Package::geometryChunk, BlockId(blockId.packageId, nodeData.geometryBlockIndex));
+                }
+                geometryBlock = decodeGeometryBlock(std::move(geometryBlockData));
+            }
+
+            std::pair<Point, Point> bounds(Point(std::numeric_limits<int>::max(), std::numeric_limits<int>::max()), Point(std::numeric_limits<int>::min(), std::numeric_limits<int>::min()));
+            for (const Point& point : geometryBlock->geometries.at(nodeData.geometryIndex & ~NodeBlock::GEOMETRY_REVERSED_FLAG)) {
+                bounds.first = Point(std::min(bounds.first.lat, point.lat), std::min(bounds.first.lon, point.lon));
+                bounds.second = Point(std::max(bounds.second.lat, point.lat), std::max(bounds.second.lon, point.lon));
+            }
+            blockBounds.first = Point(std::min(blockBounds.first.lat, bounds.first.lat), std::min(blockBounds.first.lon, bounds.first.lon));
+            blockBounds.second = Point(std::max(blockBounds.second.lat, bounds.second.lat), std::max(blockBounds.second.lon, bounds.second.lon));
+            exactNodeBounds.push_back(bounds);
+        }
+
+        // Quantize the node bounds relative to the block bounds. Minimum is rounded down and maximum up, so the quantized bounds always contain the geometry.
+        std::int64_t rangeLat = std::max<std::int64_t>(1, static_cast<std::int64_t>(blockBounds.second.lat) - blockBounds.first.lat);
+        std::int64_t rangeLon = std::max<std::int64_t>(1, static_cast<std::int64_t>(blockBounds.second.lon) - blockBounds.first.lon);
+        auto quantize = [](int value, int minValue, std::int64_t range, bool roundUp) {
+            std::int64_t scaled = (static_cast<std::int64_t>(value) - minValue) * 65535;
+            return static_cast<std::uint16_t>(std::min<std::int64_t>(65535, roundUp ? (scaled + range - 1) / range : scaled / range));
+        };
+        nodeBounds.clear();
+        nodeBounds.reserve(exactNodeBounds.size());
+        for (const std::pair<Point, Point>& bounds : exactNodeBounds) {
+            if (bounds.first.lat > bounds.second.lat || bounds.first.lon > bounds.second.lon) {
+                nodeBounds.push_back({{ 65535, 65535, 0, 0 }});
+                continue;
+            }
+            nodeBounds.push_back({{
+                quantize(bounds.first.lat, blockBounds.first.lat, rangeLat, false),
+                quantize(bounds.first.lon, blockBounds.first.lon, rangeLon, false),
+                quantize(bounds.second.lat, blockBounds.first.lat, rangeLat, true),
+                quantize(bounds.second.lon, blockBounds.first.lon, rangeLon, true)
+            }});
+        }
+    }
+
+    std::pair<std::uint64_t, std::int64_t> Graph::getFileStamp(const std::string& fileName) {
+        // Returns the size and the modification time of the file, or zeros if these are not available
+        std::error_code ec;
+        std::filesystem::path path = std::filesystem::u8path(fileName);
+        std::uintmax_t fileSize = std::filesystem::file_size(path, ec);
+        if (ec) {
+            return std::make_pair(0, 0);
+        }
+        std::filesystem::file_time_type fileTime = std::filesystem::last_write_time(path, ec);
+        if (ec) {
+            return std::make_pair(0, 0);
+        }
+        return std::make_pair(static_cast<std::uint64_t>(fileSize), static_cast<std::int64_t>(fileTime.time_since_epoch().count()));
+    }
+
+    bool Graph::loadBoundsIndex(const std::string& fileName, const std::pair<std::uint64_t, std::int64_t>& packageFileStamp, std::size_t blockCount, BoundsIndex& boundsIndex) {
+        // The index is valid only for the package file it was built from, this is checked using the package file size and modification time
+        if (packageFileStamp.first == 0) {
+            return false;
+        }
+        try {
+            std::shared_ptr<std::ifstream> file = openFile(fileName);
+            std::uint32_t version = 0;
+            std::uint64_t fileSize = 0;
+            std::int64_t fileTime = 0;
+            std::uint32_t fileBlockCount = 0;
+            file->read(reinterpret_cast<char*>(&version), sizeof(version));
+            file->read(reinterpret_cast<char*>(&fileSize), sizeof(fileSize));
+            file->read(reinterpret_cast<char*>(&fileTime), sizeof(fileTime));
+            file->read(reinterpret_cast<char*>(&fileBlockCount), sizeof(fileBlockCount));
+            if (version != BOUNDS_INDEX_VERSION || fileSize != packageFileStamp.first || fileTime != packageFileStamp.second || fileBlockCount != blockCount) {
+                return false;
+            }
+
+            BoundsIndex index;
+            index.blockOffsets.resize(blockCount + 1);
+            file->read(reinterpret_cast<char*>(index.blockOffsets.data()), index.blockOffsets.size() * sizeof(std::uint32_t));
+            if (index.blockOffsets.front() != 0 || !std::is_sorted(index.blockOffsets.begin(), index.blockOffsets.end())) {
+                return false;
+            }
+            index.blockBounds.resize(blockCount);
+            for (std::pair<Point, Point>& blockBounds : index.blockBounds) {
+                std::int32_t coords[4] = { 0, 0, 0, 0 };
+                file->read(reinterpret_cast<char*>(coords), sizeof(coords));
+                blockBounds = std::make_pair(Point(coords[0], coords[1]), Point(coords[2], coords[3]));
+            }
+
+            // Node bounds are not loaded, only check that the table is complete
+            index.nodeBoundsOffset = static_cast<std::uint64_t>(file->tellg());
+            file->seekg(0, std::ios::end);
+            if (static_cast<std::uint64_t>(file->tellg()) < index.nodeBoundsOffset + index.blockOffsets.back() * sizeof(std::array<std::uint16_t, 4>)) {
+                return false;
+            }
+            index.file = std::move(file);
+            boundsIndex = std::move(index);
+            return true;
+        }
+        catch (const std::exception&) {
+            return false;
+        }
+    }
+
+    void Graph::saveBoundsIndex(const std::string& fileName, const std::pair<std::uint64_t, std::int64_t>& packageFileStamp, const std::vector<std::pair<Point, Point>>& blockBounds, const std::vector<std::vector<std::array<std::uint16_t, 4>>>& nodeBounds) {
+        // Failures are ignored, the package directory may be read-only
+        std::ofstream file(std::filesystem::u8path(fileName), std::ios::binary);
+        std::uint32_t version = BOUNDS_INDEX_VERSION;
+        std::uint32_t blockCount = static_cast<std::uint32_t>(blockBounds.size());
+        file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        file.write(reinterpret_cast<const char*>(&packageFileStamp.first), sizeof(packageFileStamp.first));
+        file.write(reinterpret_cast<const char*>(&packageFileStamp.second), sizeof(packageFileStamp.second));
+        file.write(reinterpret_cast<const char*>(&blockCount), sizeof(blockCount));
+        std::uint32_t blockOffset = 0;
+        file.write(reinterpret_cast<const char*>(&blockOffset), sizeof(blockOffset));
+        for (const std::vector<std::array<std::uint16_t, 4>>& blockNodeBounds : nodeBounds) {
+            blockOffset += static_cast<std::uint32_t>(blockNodeBounds.size());
+            file.write(reinterpret_cast<const char*>(&blockOffset), sizeof(blockOffset));
+        }
+        for (const std::pair<Point, Point>& bounds : blockBounds) {
+            std::int32_t coords[4] = { bounds.first.lat, bounds.first.lon, bounds.second.lat, bounds.second.lon };
+            file.write(reinterpret_cast<const char*>(coords), sizeof(coords));
+        }
+        for (const std::vector<std::array<std::uint16_t, 4>>& blockNodeBounds : nodeBounds) {
+            file.write(reinterpret_cast<const char*>(blockNodeBounds.data()), blockNodeBounds.size() * sizeof(std::array<std::uint16_t, 4>));
+        }
+    }
+
     Graph::RTreeNode Graph::loadRTreeNode(RTreeNodeId rtreeNodeId) const {
         std::shared_ptr<RTreeNodeBlock> rtreeNodeBlock;
-        if (!_rtreeNodeBlockCache.read(rtreeNodeId.blockId, rtreeNodeBlock)) {
+        if (_rtreeNodeBlockCache.read(rtreeNodeId.blockId, rtreeNodeBlock)) {
+            _cacheStatistics.rtreeNodeBlocks.hits++;
+        }
+        else {
+            _cacheStatistics.rtreeNodeBlocks.misses++;
             rtreeNodeBlock = loadRTreeNodeBlock(rtreeNodeId.blockId);
             _rtreeNodeBlockCache.put(rtreeNodeId.blockId, rtreeNodeBlock);
         }
         return rtreeNodeBlock->rtreeNodes.at(rtreeNodeId.elementIndex);
     }
     
+    Graph::Node Graph::NodeBlock::getNode(int nodeIndex) const {
+        const PackedNodeData& packedNodeData = nodeData.at(nodeIndex);
+
+        Node node;
+        node.firstEdge = EdgeIterator(this, nodeEdgeOffsets[nodeIndex]);
+        node.lastEdge = EdgeIterator(this, nodeEdgeOffsets[nodeIndex + 1]);
+        node.nodeData.geometryId = GeometryId(BlockId(blockId.packageId, packedNodeData.geometryBlockIndex), static_cast<int>(packedNodeData.geometryIndex & ~GEOMETRY_REVERSED_FLAG));
+        node.nodeData.geometryReversed = (packedNodeData.geometryIndex & GEOMETRY_REVERSED_FLAG) != 0;
+        node.nodeData.nameId = NameId(BlockId(blockId.packageId, packedNodeData.nameBlockIndex), static_cast<int>(packedNodeData.nameIndex));
+        node.nodeData.weight = packedNodeData.weight;
+        node.nodeData.travelMode = packedNodeData.travelMode;
+        return node;
+    }
+
+    Graph::Edge Graph::EdgeIterator::operator * () const {
+        return _nodeBlock->getEdge(_edgeIndex);
+    }
+
+    std::uint64_t Graph::calculateHilbertIndex(const WGSPos& pos, const WGSBounds& bounds) {
+        static constexpr int ORDER = 16;
+        static constexpr std::uint32_t SIZE = 1 << ORDER;
+
+        std::uint32_t coords[2];
+        for (int i = 0; i < 2; i++) {
+            double extent = bounds.max(i) - bounds.min(i);
+            double t = (extent > 0 ? (pos(i) - bounds.min(i)) / extent : 0.0);
+            coords[i] = static_cast<std::uint32_t>(std::max(0.0, std::min(1.0, t)) * (SIZE - 1));
+        }
+
+        std::uint32_t x = coords[1], y = coords[0];
+        std::uint64_t index = 0;
+        for (std::uint32_t s = SIZE / 2; s > 0; s /= 2) {
+            std::uint32_t rx = (x & s) > 0 ? 1 : 0;
+            std::uint32_t ry = (y & s) > 0 ? 1 : 0;
+            index += static_cast<std::uint64_t>(s) * s * ((3 * rx) ^ ry);
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = SIZE - 1 - x;
+                    y = SIZE - 1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return index;
+    }
+
     WGSPos Graph::getClosestSegmentPoint(const WGSPos& pos, const WGSPos& p0, const WGSPos& p1) {
         // TODO: questionable approximation, we should project all positions to EPSG3857 and the result back
         double lonFactor = std::cos((p0(0) + p1(0)) * 0.5 * boost::math::constants::pi<double>() / 180.0);
@@ -9,13 +9,18 @@
 
 #include "Base.h"
 
+#include <cstdint>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
 #include <array>
 #include <vector>
 #include <fstream>
 #include <utility>
 #include <functional>
+#include <unordered_set>
 
 #include <stdext/lru_cache.h>
 #include <stdext/eiff_file.h>
@@ -94,9 +99,30 @@ namespace carto::osrm {
             NodeData() = default;
         };
 
+        struct NodeBlock;
+
+        // Edges are decoded from the packed node block on each dereference, so the edge should be read once per iteration
+        class EdgeIterator {
+        public:
+            EdgeIterator() = default;
+            explicit EdgeIterator(const NodeBlock* nodeBlock, unsigned int edgeIndex) : _nodeBlock(nodeBlock), _edgeIndex(edgeIndex) { }
+
+            Edge operator * () const;
+
+            EdgeIterator& operator ++ () { _edgeIndex++; return *this; }
+            EdgeIterator operator ++ (int) { EdgeIterator it = *this; _edgeIndex++; return it; }
+
+            bool operator == (const EdgeIterator& it) const { return _nodeBlock == it._nodeBlock && _edgeIndex == it._edgeIndex; }
+            bool operator != (const EdgeIterator& it) const { return !(*this == it); }
+
+        private:
+            const NodeBlock* _nodeBlock = nullptr;
+            unsigned int _edgeIndex = 0;
+        };
+
         struct Node {
-            const Edge* firstEdge = nullptr;
-            const Edge* lastEdge = nullptr;
+            EdgeIterator firstEdge;
+            EdgeIterator lastEdge;
             NodeData nodeData;
 
             Node() = default;
@@ -122,11 +148,65 @@ namespace carto::osrm {
         };
 
         struct NodeBlock {
-            std::vector<Node> nodes;
-            std::vector<Edge> edges;
+            // Packed node data. Geometry and name ids refer to the package of the block, highest bit of geometry index is the reversed flag
+            struct PackedNodeData {
+                int geometryBlockIndex = -1;
+                std::uint32_t geometryIndex = 0;
+                int nameBlockIndex = -1;
+                std::uint32_t nameIndex = 0;
+                std::uint32_t weight = 0;
+                std::uint8_t travelMode = 0;
+
+                PackedNodeData() = default;
+            };
+
+            // Node references are block-local node indices, or indices to the external node table if the highest bit is set.
+            // Edge weights use the low 24 bits, if the weight does not fit, the bits contain index to the large weight table.
+            // Uncontracted edges store the turn instruction in place of the contracted node reference.
+            static constexpr std::uint32_t EXTERNAL_NODE_FLAG = 1U << 31;
+            static constexpr std::uint32_t GEOMETRY_REVERSED_FLAG = 1U << 31;
+            static constexpr std::uint32_t EDGE_WEIGHT_MASK = (1U << 24) - 1;
+            static constexpr std::uint32_t EDGE_FORWARD_FLAG = 1U << 24;
+            static constexpr std::uint32_t EDGE_BACKWARD_FLAG = 1U << 25;
+            static constexpr std::uint32_t EDGE_CONTRACTED_FLAG = 1U << 26;
+            static constexpr std::uint32_t EDGE_LARGE_WEIGHT_FLAG = 1U << 27;
+
+            BlockId blockId;
+            std::vector<PackedNodeData> nodeData;
+            std::vector<std::uint32_t> nodeEdgeOffsets;
+            std::vector<std::uint32_t> edgeTargetNodes;
+            std::vector<std::uint32_t> edgeContractedNodes;
+            std::vector<std::uint32_t> edgeWeightFlags;
+            std::vector<NodeId> externalNodeIds;
+            std::vector<unsigned int> largeWeights;
             std::vector<WGSBounds> nodeGeometryBoundsCache;
 
             NodeBlock() = default;
+
+            int getNodeCount() const { return static_cast<int>(nodeData.size()); }
+
+            Node getNode(int nodeIndex) const;
+
+            Edge getEdge(unsigned int edgeIndex) const {
+                Edge edge;
+                std::uint32_t weightFlags = edgeWeightFlags[edgeIndex];
+                edge.targetNodeId = getNodeId(edgeTargetNodes[edgeIndex]);
+                edge.forward = (weightFlags & EDGE_FORWARD_FLAG) != 0;
+                edge.backward = (weightFlags & EDGE_BACKWARD_FLAG) != 0;
+                edge.contracted = (weightFlags & EDGE_CONTRACTED_FLAG) != 0;
+                edge.edgeData.weight = ((weightFlags & EDGE_LARGE_WEIGHT_FLAG) != 0 ? largeWeights[weightFlags & EDGE_WEIGHT_MASK] : weightFlags & EDGE_WEIGHT_MASK);
+                if (edge.contracted) {
+                    edge.contractedNodeId = getNodeId(edgeContractedNodes[edgeIndex]);
+                }
+                else {
+                    edge.edgeData.turnInstruction = static_cast<unsigned char>(edgeContractedNodes[edgeIndex]);
+                }
+                return edge;
+            }
+
+            NodeId getNodeId(std::uint32_t nodeRef) const {
+                return ((nodeRef & EXTERNAL_NODE_FLAG) != 0 ? externalNodeIds[nodeRef & ~EXTERNAL_NODE_FLAG] : NodeId(blockId, static_cast<int>(nodeRef)));
+            }
         };
         
         struct GlobalNodeBlock {
@@ -143,14 +223,14 @@ namespace carto::osrm {
         
         struct NodePtr {
             NodePtr() = default;
-            explicit NodePtr(const std::shared_ptr<NodeBlock>& nodeBlock, int elementIndex) : _node(&nodeBlock->nodes.at(elementIndex)), _nodeBlock(nodeBlock) { }
+            explicit NodePtr(const std::shared_ptr<NodeBlock>& nodeBlock, int elementIndex) : _node(nodeBlock->getNode(elementIndex)), _nodeBlock(nodeBlock) { }
 
-            const Node* operator -> () const { return _node; }
-            const Node& operator * () const { return *_node; }
+            const Node* operator -> () const { return &_node; }
+            const Node& operator * () const { return _node; }
 
         private:
-            const Node* _node = nullptr;
-            std::shared_ptr<NodeBlock> _nodeBlock; // keep the node pointer valid by holding reference to the node block
+            Node _node;
+            std::shared_ptr<NodeBlock> _nodeBlock; // keep the node edge iterators valid by holding reference to the node block
         };
 
         struct NearestNode {
@@ -162,32 +242,83 @@ namespace carto::osrm {
             NearestNode() = default;
         };
 
+        struct CacheCounters {
+            std::size_t hits = 0;
+            std::size_t misses = 0;
+
+            CacheCounters() = default;
+        };
+
+        struct CacheStatistics {
+            CacheCounters nodeBlocks;
+            CacheCounters geometryBlocks;
+            CacheCounters nameBlocks;
+            CacheCounters globalNodeBlocks;
+            CacheCounters rtreeNodeBlocks;
+
+            CacheStatistics() = default;
+        };
+
         struct Settings {
             std::size_t nodeBlockCacheSize = 512;
             std::size_t geometryBlockCacheSize = 512;
             std::size_t nameBlockCacheSize = 64;
             std::size_t globalNodeBlockCacheSize = 64;
             std::size_t rtreeNodeBlockCacheSize = 16;
+            std::size_t prefetchThreadCount = 0;
+            bool persistBoundsIndex = false; // build a node bounds index on multi-package import, store it next to the package files and reuse it later
 
             Settings() = default;
         };
 
         Graph() = delete;
         explicit Graph(const Settings& settings);
+        ~Graph();
         
         bool import(const std::string& fileName);
         bool import(const std::shared_ptr<std::ifstream>& file);
+        bool import(const std::vector<std::string>& fileNames, std::size_t threadCount);
+
+        int getCacheGeneration() const;
+
+        CacheStatistics getCacheStatistics() const;
+        void resetCacheStatistics();
 
         NodePtr getNode(NodeId nodeId) const;
         std::string getNodeName(const Node& node) const;
         std::vector<WGSPos> getNodeGeometry(const Node& node) const;
         std::vector<NearestNode> findNearestNode(const WGSPos& pos) const;
+        std::vector<std::vector<NearestNode>> findNearestNodes(const std::vector<WGSPos>& posList, double radius = 0) const;
+
+        std::vector<BlockId> findNodeBlockIds(const WGSBounds& bounds) const;
+        int getNodeBlockSize(BlockId blockId) const;
+        int getNodeBlockCount(int packageId) const;
+
+        void prefetchNodeBlock(BlockId blockId) const;
+        void preloadBlocks(const WGSBounds& bounds, std::size_t threadCount) const;
 
     private:
         static constexpr int VERSION = 0;
 
+        static constexpr std::uint32_t BOUNDS_INDEX_VERSION = 2;
+
+        static constexpr std::size_t MAX_PREFETCH_QUEUE_SIZE = 64;
+
+        static constexpr std::size_t MAX_NEAREST_NODE_BATCH_SIZE = 32;
+
+        static constexpr double NEAREST_NODE_DIST_THRESHOLD = 1.01;
+
         static constexpr double COORDINATE_SCALE = 1.0e-6;
 
+        struct BoundsIndex {
+            std::vector<std::uint32_t> blockOffsets;                // offsets of the block nodes in the node bounds table, block count + 1 entries. Empty if the index is not available.
+            std::vector<std::pair<Point, Point>> blockBounds;       // bounds of the node geometries of each block
+            std::shared_ptr<std::ifstream> file;                    // index file, node bounds are read from it per block when needed
+            std::uint64_t nodeBoundsOffset = 0;                     // file offset of the node bounds table
+
+            BoundsIndex() = default;
+        };
+
         struct Package {
             int packageId = -1;
             std::string packageName;
@@ -197,6 +328,7 @@ namespace carto::osrm {
             std::shared_ptr<eiff::data_chunk> nameChunk;
             std::shared_ptr<eiff::data_chunk> globalNodeChunk;
             std::shared_ptr<eiff::data_chunk> rtreeNodeChunk;
+            BoundsIndex boundsIndex;
             
             Package() = default;
         };
@@ -225,10 +357,42 @@ namespace carto::osrm {
             }
         };
         
+        void findNearestNodeBatch(const std::vector<WGSPos>& posList, double radius, std::vector<std::vector<NearestNode>>& bestNodesList) const;
+
+        void findNearestNodeInBlock(const WGSPos& pos, double radius, BlockId blockId, const NodeBlock& nodeBlock, double& bestDist, std::vector<NearestNode>& bestNodes) const;
+
+        std::shared_ptr<NodeBlock> getNodeBlock(BlockId blockId) const;
+
+        void buildNodeGeometryBoundsCache(NodeBlock& nodeBlock) const;
+
+        void buildBoundsIndex(const std::vector<std::string>& fileNames, int firstPackageId, std::size_t threadCount);
+
+        void calculateNodeBlockBounds(BlockId blockId, std::pair<Point, Point>& blockBounds, std::vector<std::array<std::uint16_t, 4>>& nodeBounds) const;
+
+        static Package readPackage(const std::shared_ptr<std::ifstream>& file);
+
+        static std::shared_ptr<std::ifstream> openFile(const std::string& fileName);
+
+        static std::pair<std::uint64_t, std::int64_t> getFileStamp(const std::string& fileName);
+
+        static bool loadBoundsIndex(const std::string& fileName, const std::pair<std::uint64_t, std::int64_t>& packageFileStamp, std::size_t blockCount, BoundsIndex& boundsIndex);
+
+        static void saveBoundsIndex(const std::string& fileName, const std::pair<std::uint64_t, std::int64_t>& packageFileStamp, const std::vector<std::pair<Point, Point>>& blockBounds, const std::vector<std::vector<std::array<std::uint16_t, 4>>>& nodeBounds);
+
+        void fetchNodeBlock(BlockId blockId, bool withGeometry) const;
+
+        void prefetchWorker() const;
+
+        std::vector<unsigned char> readBlock(std::shared_ptr<eiff::data_chunk> Package::* chunkPtr, BlockId blockId) const;
+
         std::shared_ptr<NodeBlock> loadNodeBlock(BlockId blockId) const;
 
+        std::shared_ptr<NodeBlock> decodeNodeBlock(BlockId blockId, std::vector<unsigned char> block) const;
+
         std::shared_ptr<GeometryBlock> loadGeometryBlock(BlockId blockId) const;
 
+        std::shared_ptr<GeometryBlock> decodeGeometryBlock(std::vector<unsigned char> block) const;
+
         std::shared_ptr<NameBlock> loadNameBlock(BlockId blockId) const;
         
         std::shared_ptr<GlobalNodeBlock> loadGlobalNodeBlock(BlockId blockId) const;
@@ -239,6 +403,8 @@ namespace carto::osrm {
         
         RTreeNode loadRTreeNode(RTreeNodeId rtreeNodeId) const;
 
+        static std::uint64_t calculateHilbertIndex(const WGSPos& pos, const WGSBounds& bounds);
+
         static WGSPos getClosestSegmentPoint(const WGSPos& pos, const WGSPos& p0, const WGSPos& p1);
         
         static double getPointDistance(const WGSPos& pos0, const WGSPos& pos1);
@@ -250,7 +416,10 @@ namespace carto::osrm {
         static WGSPos fromPoint(const Point& point);
         static Point toPoint(const WGSPos& pos);
 
+        const Settings _settings;
         std::vector<Package> _packages;
+        int _cacheGeneration = 0;
+        mutable CacheStatistics _cacheStatistics;
 
         mutable cache::lru_cache<BlockId, std::shared_ptr<NodeBlock>, BlockId::Hash> _nodeBlockCache;
         mutable cache::lru_cache<BlockId, std::shared_ptr<GeometryBlock>, BlockId::Hash> _geometryBlockCache;
@@ -258,6 +427,13 @@ namespace carto::osrm {
         mutable cache::lru_cache<BlockId, std::shared_ptr<GlobalNodeBlock>, BlockId::Hash> _globalNodeBlockCache;
         mutable cache::lru_cache<BlockId, std::shared_ptr<RTreeNodeBlock>, BlockId::Hash> _rtreeNodeBlockCache;
         mutable std::recursive_mutex _mutex;
+
+        std::vector<std::thread> _prefetchThreads;
+        mutable std::deque<BlockId> _prefetchQueue;
+        mutable std::unordered_set<BlockId, BlockId::Hash> _prefetchQueueBlockIds;
+        mutable bool _prefetchStopped = false;
+        mutable std::condition_variable _prefetchCondition;
+        mutable std::mutex _prefetchMutex;
     };
 }
 
@@ -0,0 +1,353 @@
+#include "IsochroneFinder.h"
+
+#include <cmath>
+#include <queue>
+#include <limits>
+#include <algorithm>
+#include <unordered_set>
+#include <stdexcept>
+
+#include <boost/math/constants/constants.hpp>
+
+namespace carto::osrm {
+    std::vector<IsochroneFinder::ReachableNode> IsochroneFinder::findReachableNodes(const WGSPos& pos, double maxTime) const {
+        std::vector<Graph::NearestNode> nearestNodes = _graph->findNearestNode(pos);
+        if (nearestNodes.empty()) {
+            return std::vector<ReachableNode>();
+        }
+        float maxWeight = static_cast<float>(maxTime * 10.0);
+
+        // The contracted graph stores each edge only at one of its end nodes, so the edges stored at the other end point are indexed per node block.
+        // Shortcuts are not needed for a plain Dijkstra search, so only the original edges are used. These connect nodes with a common geometry vertex,
+        // thus all edges leading from a node are known once the blocks overlapping its geometry are indexed. The indexed area is grown geometrically around the settled nodes,
+        // so that the indexed area follows the actual reach of the search and the block index is queried only a logarithmic number of times.
+        // Backward edges of a newly indexed block leading from already settled nodes are relaxed immediately.
+        ReverseEdgeMap reverseEdgeMap;
+        std::unordered_set<Graph::BlockId, Graph::BlockId::Hash> indexedBlockIds;
+        std::unordered_map<Graph::NodeId, float, Graph::NodeId::Hash> settledNodes;
+        std::priority_queue<SearchNode> heap;
+        auto indexBlock = [&](Graph::BlockId blockId) {
+            if (!indexedBlockIds.insert(blockId).second) {
+                return;
+            }
+            int nodeCount = _graph->getNodeBlockSize(blockId);
+            for (int i = 0; i < nodeCount; i++) {
+                Graph::NodeId nodeId(blockId, i);
+                Graph::NodePtr node = _graph->getNode(nodeId);
+                for (auto edgeIt = node->firstEdge; edgeIt != node->lastEdge; edgeIt++) {
+                    const Graph::Edge edge = *edgeIt;
+                    if (edge.backward && !edge.contracted && edge.targetNodeId.blockId.packageId != -1) {
+                        reverseEdgeMap[edge.targetNodeId].emplace_back(nodeId, edge.edgeData.weight);
+                        auto it = settledNodes.find(edge.targetNodeId);
+                        if (it != settledNodes.end()) {
+                            heap.emplace(nodeId, it->second + edge.edgeData.weight);
+                        }
+                    }
+                }
+            }
+        };
+        WGSBounds indexedBounds = WGSBounds::smallest();
+        auto indexBlocks = [&](const WGSBounds& bounds) {
+            if (!indexedBounds.empty() && bounds.min(0) >= indexedBounds.min(0) && bounds.min(1) >= indexedBounds.min(1) && bounds.max(0) <= indexedBounds.max(0) && bounds.max(1) <= indexedBounds.max(1)) {
+                return;
+            }
+            indexedBounds.add(bounds);
+            WGSPos margin = indexedBounds.size() * 0.5;
+            indexedBounds = WGSBounds(indexedBounds.min - margin, indexedBounds.max + margin);
+            for (Graph::BlockId blockId : _graph->findNodeBlockIds(indexedBounds)) {
+                indexBlock(blockId);
+            }
+        };
+
+        // Apply bounded Dijkstra over the original edges. Start node weights are negative, as in RouteFinder.
+        for (const Graph::NearestNode& nearestNode : nearestNodes) {
+            Graph::NodePtr node = _graph->getNode(nearestNode.nodeId);
+            heap.emplace(nearestNode.nodeId, -nearestNode.geometryRelPos * node->nodeData.weight);
+        }
+        while (!heap.empty()) {
+            SearchNode searchNode = heap.top();
+            if (searchNode.weight > maxWeight) {
+                break;
+            }
+            heap.pop();
+            if (!settledNodes.emplace(searchNode.nodeId, searchNode.weight).second) {
+                continue;
+            }
+
+            // Index the blocks around the node geometry, this adds the backward edges leading from the node. The bounds are padded by the coordinate precision.
+            Graph::NodePtr node = _graph->getNode(searchNode.nodeId);
+            std::vector<WGSPos> geometry = _graph->getNodeGeometry(*node);
+            WGSBounds bounds = WGSBounds::make_union(geometry.begin(), geometry.end());
+            if (!bounds.empty()) {
+                indexBlocks(WGSBounds(bounds.min - WGSPos(COORDINATE_PADDING, COORDINATE_PADDING), bounds.max + WGSPos(COORDINATE_PADDING, COORDINATE_PADDING)));
+            }
+            indexBlock(searchNode.nodeId.blockId);
+
+            for (auto edgeIt = node->firstEdge; edgeIt != node->lastEdge; edgeIt++) {
+                const Graph::Edge edge = *edgeIt;
+                if (edge.forward && !edge.contracted && edge.targetNodeId.blockId.packageId != -1) {
+                    heap.emplace(edge.targetNodeId, searchNode.weight + edge.edgeData.weight);
+                }
+            }
+            auto it = reverseEdgeMap.find(searchNode.nodeId);
+            if (it != reverseEdgeMap.end()) {
+                for (const std::pair<Graph::NodeId, unsigned int>& reverseEdge : it->second) {
+                    heap.emplace(reverseEdge.first, searchNode.weight + reverseEdge.second);
+                }
+            }
+        }
+
+        // Calculate the reachable part of each settled node
+        std::vector<ReachableNode> reachableNodes;
+        reachableNodes.reserve(settledNodes.size());
+        for (auto it = settledNodes.begin(); it != settledNodes.end(); it++) {
+            Graph::NodePtr node = _graph->getNode(it->first);
+            float nodeWeight = static_cast<float>(node->nodeData.weight);
+
+            ReachableNode reachableNode;
+            reachableNode.nodeId = it->first;
+            reachableNode.time = it->second / 10.0;
+            if (nodeWeight > 0) {
+                reachableNode.geometryRelPos0 = std::max(0.0f, -it->second / nodeWeight);
+                reachableNode.geometryRelPos1 = std::min(1.0f, (maxWeight - it->second) / nodeWeight);
+            }
+            if (reachableNode.geometryRelPos0 <= reachableNode.geometryRelPos1) {
+                reachableNodes.push_back(reachableNode);
+            }
+        }
+        return reachableNodes;
+    }
+
+    std::vector<IsochroneFinder::Polygon> IsochroneFinder::buildIsochrone(const std::vector<ReachableNode>& reachableNodes) const {
+        static const double degToRad = boost::math::constants::pi<double>() / 180.0;
+
+        // Collect the reachable parts of the node geometries
+        std::vector<std::vector<WGSPos>> geometries;
+        WGSBounds bounds = WGSBounds::smallest();
+        for (const ReachableNode& reachableNode : reachableNodes) {
+            Graph::NodePtr node = _graph->getNode(reachableNode.nodeId);
+            std::vector<WGSPos> geometry = extractGeometry(_graph->getNodeGeometry(*node), reachableNode.geometryRelPos0, reachableNode.geometryRelPos1);
+            bounds.add(geometry.begin(), geometry.end());
+            geometries.push_back(std::move(geometry));
+        }
+        if (bounds.empty()) {
+            return std::vector<Polygon>();
+        }
+
+        // Calculate grid cell size, enlarge the cells if the grid would become too large
+        double cellLat = _settings.cellSize / EARTH_RADIUS / degToRad;
+        double cellLon = cellLat / std::max(0.01, std::cos(bounds.center()(0) * degToRad));
+        double cellScale = std::max(1.0, std::max(bounds.size()(0) / cellLat, bounds.size()(1) / cellLon) / (MAX_GRID_SIZE - 4));
+        cellLat *= cellScale;
+        cellLon *= cellScale;
+
+        // Rasterize the geometries. Keep empty border of 2 cells, so that dilated cells stay within the grid.
+        WGSPos origin = bounds.min - WGSPos(cellLat, cellLon) * 2.0;
+        int gridWidth = static_cast<int>(std::ceil(bounds.size()(1) / cellLon)) + 5;
+        int gridHeight = static_cast<int>(std::ceil(bounds.size()(0) / cellLat)) + 5;
+        std::vector<unsigned char> grid(static_cast<std::size_t>(gridWidth) * gridHeight, 0);
+        for (const std::vector<WGSPos>& geometry : geometries) {
+            for (std::size_t i = 0; i < geometry.size(); i++) {
+                const WGSPos& p0 = geometry[i > 0 ? i - 1 : i];
+                const WGSPos& p1 = geometry[i];
+                int steps = static_cast<int>(std::ceil(2.0 * std::max(std::abs(p1(0) - p0(0)) / cellLat, std::abs(p1(1) - p0(1)) / cellLon))) + 1;
+                for (int j = 0; j <= steps; j++) {
+                    WGSPos p = p0 + (p1 - p0) * (static_cast<double>(j) / steps);
+                    int x = static_cast<int>((p(1) - origin(1)) / cellLon);
+                    int y = static_cast<int>((p(0) - origin(0)) / cellLat);
+                    grid[y * gridWidth + x] = 1;
+                }
+            }
+        }
+
+        // Dilate the rasterized geometry, this closes gaps between nearby roads
+        std::vector<unsigned char> dilatedGrid(grid.size(), 0);
+        for (int y = 1; y < gridHeight - 1; y++) {
+            for (int x = 1; x < gridWidth - 1; x++) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        dilatedGrid[y * gridWidth + x] |= grid[(y + dy) * gridWidth + x + dx];
+                    }
+                }
+            }
+        }
+
+        // Build directed boundary edges, having the filled cells on the left side. Outer rings are counter-clockwise, holes clockwise.
+        int vertexWidth = gridWidth + 1;
+        std::vector<std::pair<int, int>> boundaryEdges;
+        std::unordered_map<int, std::vector<std::size_t>> vertexEdgeIndices; // outgoing boundary edges of each vertex
+        auto addBoundaryEdge = [&](int vertex0, int vertex1) {
+            vertexEdgeIndices[vertex0].push_back(boundaryEdges.size());
+            boundaryEdges.emplace_back(vertex0, vertex1);
+        };
+        auto isFilled = [&](int x, int y) {
+            return dilatedGrid[y * gridWidth + x] != 0;
+        };
+        for (int y = 1; y < gridHeight - 1; y++) {
+            for (int x = 1; x < gridWidth - 1; x++) {
+                if (!isFilled(x, y)) {
+                    continue;
+                }
+                if (!isFilled(x, y - 1)) {
+                    addBoundaryEdge(y * vertexWidth + x, y * vertexWidth + x + 1);
+                }
+                if (!isFilled(x + 1, y)) {
+                    addBoundaryEdge(y * vertexWidth + x + 1, (y + 1) * vertexWidth + x + 1);
+                }
+                if (!isFilled(x, y + 1)) {
+                    addBoundaryEdge((y + 1) * vertexWidth + x + 1, (y + 1) * vertexWidth + x);
+                }
+                if (!isFilled(x - 1, y)) {
+                    addBoundaryEdge((y + 1) * vertexWidth + x, y * vertexWidth + x);
+                }
+            }
+        }
+
+        // Saddle vertices (two diagonally touching filled cells) have two outgoing edges. The ring always turns towards the other filled cell,
+        // so diagonally touching cells are connected, consistent with the dilation. This pairs the incoming and outgoing edges uniquely.
+        auto getNextEdgeIndex = [&](std::size_t edgeIndex) {
+            const std::pair<int, int>& edge = boundaryEdges[edgeIndex];
+            const std::vector<std::size_t>& nextEdgeIndices = vertexEdgeIndices.at(edge.second);
+            if (nextEdgeIndices.size() == 1) {
+                return nextEdgeIndices.front();
+            }
+            int dx0 = edge.second % vertexWidth - edge.first % vertexWidth;
+            int dy0 = edge.second / vertexWidth - edge.first / vertexWidth;
+            for (std::size_t nextEdgeIndex : nextEdgeIndices) {
+                const std::pair<int, int>& nextEdge = boundaryEdges[nextEdgeIndex];
+                int dx1 = nextEdge.second % vertexWidth - nextEdge.first % vertexWidth;
+                int dy1 = nextEdge.second / vertexWidth - nextEdge.first / vertexWidth;
+                if (dx0 * dy1 - dy0 * dx1 < 0) {
+                    return nextEdgeIndex;
+                }
+            }
+            throw std::runtime_error("Inconsistent isochrone boundary");
+        };
+
+        // Link the boundary edges into rings
+        std::vector<std::vector<int>> rings;
+        std::vector<bool> linkedEdges(boundaryEdges.size(), false);
+        for (std::size_t i = 0; i < boundaryEdges.size(); i++) {
+            if (linkedEdges[i]) {
+                continue;
+            }
+
+            std::vector<int> vertices;
+            std::size_t edgeIndex = i;
+            do {
+                linkedEdges[edgeIndex] = true;
+                vertices.push_back(boundaryEdges[edgeIndex].first);
+                edgeIndex = getNextEdgeIndex(edgeIndex);
+            } while (edgeIndex != i);
+            rings.push_back(std::move(vertices));
+        }
+
+        // Classify the rings by orientation. Ring areas and points are in doubled grid coordinates, so that the cell centers are integers.
+        auto calculateArea = [&](const std::vector<int>& ring) {
+            long long area = 0;
+            for (std::size_t j = 0; j < ring.size(); j++) {
+                int v0 = ring[j];
+                int v1 = ring[(j + 1) % ring.size()];
+                area += static_cast<long long>(v0 % vertexWidth) * (v1 / vertexWidth) - static_cast<long long>(v1 % vertexWidth) * (v0 / vertexWidth);
+            }
+            return area;
+        };
+        auto isInside = [&](const std::vector<int>& ring, int x, int y) {
+            bool inside = false;
+            for (std::size_t j = 0; j < ring.size(); j++) {
+                int x0 = ring[j] % vertexWidth * 2, y0 = ring[j] / vertexWidth * 2;
+                int x1 = ring[(j + 1) % ring.size()] % vertexWidth * 2, y1 = ring[(j + 1) % ring.size()] / vertexWidth * 2;
+                if ((y0 > y) != (y1 > y) && x < x0 + static_cast<double>(x1 - x0) * (y - y0) / (y1 - y0)) {
+                    inside = !inside;
+                }
+            }
+            return inside;
+        };
+        std::vector<std::size_t> outerRingIndices;
+        std::vector<long long> ringAreas;
+        for (std::size_t i = 0; i < rings.size(); i++) {
+            ringAreas.push_back(calculateArea(rings[i]));
+            if (ringAreas.back() > 0) {
+                outerRingIndices.push_back(i);
+            }
+        }
+
+        // Assign each hole to the smallest outer ring containing it. The tested point is the center of the empty cell on the right side of the first hole edge.
+        std::vector<std::vector<std::size_t>> polygonRingIndices;
+        std::unordered_map<std::size_t, std::size_t> outerRingPolygonIndices;
+        for (std::size_t outerRingIndex : outerRingIndices) {
+            outerRingPolygonIndices[outerRingIndex] = polygonRingIndices.size();
+            polygonRingIndices.push_back(std::vector<std::size_t> { outerRingIndex });
+        }
+        for (std::size_t i = 0; i < rings.size(); i++) {
+            if (ringAreas[i] > 0) {
+                continue;
+            }
+            int v0 = rings[i][0];
+            int v1 = rings[i][1 % rings[i].size()];
+            int dx = v1 % vertexWidth - v0 % vertexWidth;
+            int dy = v1 / vertexWidth - v0 / vertexWidth;
+            int x = v0 % vertexWidth * 2 + dx + dy;
+            int y = v0 / vertexWidth * 2 + dy - dx;
+            std::size_t bestRingIndex = rings.size();
+            for (std::size_t outerRingIndex : outerRingIndices) {
+                if ((bestRingIndex == rings.size() || ringAreas[outerRingIndex] < ringAreas[bestRingIndex]) && isInside(rings[outerRingIndex], x, y)) {
+                    bestRingIndex = outerRingIndex;
+                }
+            }
+            if (bestRingIndex == rings.size()) {
+                throw std::runtime_error("Inconsistent isochrone boundary");
+            }
+            polygonRingIndices[outerRingPolygonIndices[bestRingIndex]].push_back(i);
+        }
+
+        // Build the polygons, dropping the vertices between collinear edges
+        std::vector<Polygon> polygons;
+        polygons.reserve(polygonRingIndices.size());
+        for (const std::vector<std::size_t>& ringIndices : polygonRingIndices) {
+            Polygon polygon;
+            for (std::size_t ringIndex : ringIndices) {
+                const std::vector<int>& vertices = rings[ringIndex];
+                std::vector<WGSPos> ring;
+                for (std::size_t j = 0; j < vertices.size(); j++) {
+                    int v0 = vertices[(j + vertices.size() - 1) % vertices.size()];
+                    int v1 = vertices[j];
+                    int v2 = vertices[(j + 1) % vertices.size()];
+                    if (v1 - v0 == v2 - v1) {
+                        continue;
+                    }
+                    ring.push_back(origin + WGSPos((v1 / vertexWidth) * cellLat, (v1 % vertexWidth) * cellLon));
+                }
+                polygon.push_back(std::move(ring));
+            }
+            polygons.push_back(std::move(polygon));
+        }
+        return polygons;
+    }
+
+    std::vector<WGSPos> IsochroneFinder::extractGeometry(const std::vector<WGSPos>& geometry, double t0, double t1) {
+        double totalLen = 0;
+        for (std::size_t i = 1; i < geometry.size(); i++) {
+            totalLen += cglib::length(geometry[i] - geometry[i - 1]);
+        }
+        if ((t0 <= 0 && t1 >= 1) || totalLen == 0) {
+            return geometry;
+        }
+
+        std::vector<WGSPos> result;
+        double pos = 0;
+        for (std::size_t i = 1; i < geometry.size(); i++) {
+            double segmentLen = cglib::length(geometry[i] - geometry[i - 1]);
+            double segmentT0 = (t0 * totalLen - pos) / segmentLen;
+            double segmentT1 = (t1 * totalLen - pos) / segmentLen;
+            if (segmentLen > 0 && segmentT0 <= 1 && segmentT1 >= 0) {
+                if (result.empty()) {
+                    result.push_back(geometry[i - 1] + (geometry[i] - geometry[i - 1]) * std::max(0.0, segmentT0));
+                }
+                result.push_back(geometry[i - 1] + (geometry[i] - geometry[i - 1]) * std::min(1.0, segmentT1));
+            }
+            pos += segmentLen;
+        }
+        return result;
+    }
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2016 CartoDB. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://cartodb.com/terms/
+ */
+
+#ifndef _CARTO_OSRM_ISOCHRONEFINDER_H_
+#define _CARTO_OSRM_ISOCHRONEFINDER_H_
+
+#include "Base.h"
+#include "Graph.h"
+
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+namespace carto::osrm {
+    class IsochroneFinder final {
+    public:
+        struct Settings {
+            double cellSize = 50.0;  // grid cell size used for building the isochrone polygons, in meters
+
+            Settings() = default;
+        };
+
+        struct ReachableNode {
+            Graph::NodeId nodeId;
+            double time = 0.0;                // travel time to the start of the node, negative for the start node
+            float geometryRelPos0 = 0.0f;     // start of the reachable part of the node geometry
+            float geometryRelPos1 = 1.0f;     // end of the reachable part of the node geometry
+
+            ReachableNode() = default;
+        };
+
+        using Polygon = std::vector<std::vector<WGSPos>>; // outer ring (counter-clockwise) followed by its holes (clockwise)
+
+        explicit IsochroneFinder(std::shared_ptr<Graph> graph, const Settings& settings) : _graph(std::move(graph)), _settings(settings) { }
+
+        std::vector<ReachableNode> findReachableNodes(const WGSPos& pos, double maxTime) const;
+
+        std::vector<Polygon> buildIsochrone(const std::vector<ReachableNode>& reachableNodes) const;
+
+    private:
+        static constexpr int MAX_GRID_SIZE = 2048;
+
+        static constexpr double COORDINATE_PADDING = 1.0e-5; // padding of node geometry bounds when indexing the blocks around the node, larger than the package coordinate precision
+
+        struct SearchNode {
+            Graph::NodeId nodeId;
+            float weight = 0.0f;
+
+            SearchNode() = default;
+            explicit SearchNode(Graph::NodeId nodeId, float weight) : nodeId(nodeId), weight(weight) { }
+
+            bool operator < (const SearchNode& searchNode) const {
+                return weight > searchNode.weight;
+            }
+        };
+
+        using ReverseEdgeMap = std::unordered_map<Graph::NodeId, std::vector<std::pair<Graph::NodeId, unsigned int>>, Graph::NodeId::Hash>;
+
+        static std::vector<WGSPos> extractGeometry(const std::vector<WGSPos>& geometry, double t0, double t1);
+
+        const std::shared_ptr<Graph> _graph;
+        const Settings _settings;
+    };
+}
+
+#endif
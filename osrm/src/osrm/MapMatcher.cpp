@@ -0,0 +1,189 @@
+#include "MapMatcher.h"
+
+#include <cmath>
+#include <limits>
+#include <iterator>
+#include <algorithm>
+
+namespace carto::osrm {
+    std::vector<Result> MapMatcher::match(const std::vector<WGSPos>& points, std::vector<MatchedPoint>& matchedPoints) const {
+        matchedPoints.assign(points.size(), MatchedPoint());
+        std::vector<std::vector<Graph::NearestNode>> nearestNodesList = _graph->findNearestNodes(points, _settings.searchRadius);
+
+        // Build Viterbi layers for the points having candidates. Transition costs are based on the extra travel time compared to the straight line distance.
+        std::vector<std::vector<Candidate>> layers;
+        std::vector<std::size_t> layerPointIndices;
+        std::vector<bool> layerBreaks;
+        for (std::size_t i = 0; i < points.size(); i++) {
+            std::vector<Candidate> candidates = findCandidates(points[i], nearestNodesList[i]);
+            if (candidates.empty()) {
+                continue;
+            }
+
+            bool connected = false;
+            if (!layers.empty()) {
+                const std::vector<Candidate>& prevCandidates = layers.back();
+                double directTime = RouteFinder::calculateGreatCircleDistance(points[layerPointIndices.back()], points[i]) / _settings.referenceSpeed;
+
+                std::vector<Graph::NearestNode> prevNearestNodes, nearestNodes;
+                std::transform(prevCandidates.begin(), prevCandidates.end(), std::back_inserter(prevNearestNodes), [](const Candidate& candidate) { return candidate.nearestNode; });
+                std::transform(candidates.begin(), candidates.end(), std::back_inserter(nearestNodes), [](const Candidate& candidate) { return candidate.nearestNode; });
+                std::vector<std::vector<double>> times = _routeFinder.calculateTimeMatrix(prevNearestNodes, nearestNodes, directTime + _settings.maxExtraTime);
+
+                for (std::size_t j = 0; j < candidates.size(); j++) {
+                    Candidate& candidate = candidates[j];
+                    candidate.cost = std::numeric_limits<double>::infinity();
+                    for (std::size_t k = 0; k < prevCandidates.size(); k++) {
+                        if (times[k][j] == std::numeric_limits<double>::infinity()) {
+                            continue;
+                        }
+                        double transitionCost = std::max(0.0, times[k][j] - directTime) / _settings.transitionScale;
+                        double cost = prevCandidates[k].cost + transitionCost + candidate.emissionCost;
+                        if (cost < candidate.cost) {
+                            candidate.cost = cost;
+                            candidate.prevIndex = k;
+                            connected = true;
+                        }
+                    }
+                }
+            }
+
+            // If no candidate is reachable from the previous layer, start a new matched segment
+            if (!connected) {
+                for (Candidate& candidate : candidates) {
+                    candidate.cost = candidate.emissionCost;
+                }
+            }
+            layers.push_back(std::move(candidates));
+            layerPointIndices.push_back(i);
+            layerBreaks.push_back(!connected);
+        }
+
+        // Backtrack the best candidate sequence of each segment, starting from the last layer
+        std::vector<std::size_t> candidateIndices(layers.size(), 0);
+        std::size_t candidateIndex = 0;
+        for (std::size_t l = layers.size(); l-- > 0; ) {
+            const std::vector<Candidate>& candidates = layers[l];
+            if (l + 1 == layers.size() || layerBreaks[l + 1]) {
+                candidateIndex = std::min_element(candidates.begin(), candidates.end(), [](const Candidate& candidate1, const Candidate& candidate2) {
+                    return candidate1.cost < candidate2.cost;
+                }) - candidates.begin();
+            }
+
+            // Confidence is the relative likelihood of the chosen candidate among all candidates of the point
+            double minCost = std::numeric_limits<double>::infinity();
+            for (const Candidate& candidate : candidates) {
+                minCost = std::min(minCost, candidate.cost);
+            }
+            double likelihoodSum = 0;
+            for (const Candidate& candidate : candidates) {
+                likelihoodSum += std::exp(minCost - candidate.cost);
+            }
+
+            const Candidate& candidate = candidates[candidateIndex];
+            MatchedPoint& matchedPoint = matchedPoints[layerPointIndices[l]];
+            matchedPoint.nearestNode = candidate.nearestNode;
+            matchedPoint.confidence = static_cast<float>(std::exp(minCost - candidate.cost) / likelihoodSum);
+            matchedPoint.matched = true;
+
+            candidateIndices[l] = candidateIndex;
+            candidateIndex = candidate.prevIndex;
+        }
+
+        // Build the routes of the segments in order
+        std::vector<Result> results;
+        for (std::size_t l0 = 0; l0 < layers.size(); ) {
+            std::size_t l1 = l0 + 1;
+            while (l1 < layers.size() && !layerBreaks[l1]) {
+                l1++;
+            }
+
+            std::vector<Graph::NearestNode> segmentNearestNodes;
+            std::vector<std::size_t> segmentPointIndices;
+            for (std::size_t l = l0; l < l1; l++) {
+                segmentNearestNodes.push_back(layers[l][candidateIndices[l]].nearestNode);
+                segmentPointIndices.push_back(layerPointIndices[l]);
+            }
+            buildRoutes(segmentNearestNodes, segmentPointIndices, matchedPoints, results);
+            l0 = l1;
+        }
+        return results;
+    }
+
+    std::vector<MapMatcher::Candidate> MapMatcher::findCandidates(const WGSPos& pos, const std::vector<Graph::NearestNode>& nearestNodes) const {
+        // Keep only the closest snap for each node
+        std::vector<Candidate> candidates;
+        for (const Graph::NearestNode& nearestNode : nearestNodes) {
+            double dist = RouteFinder::calculateGreatCircleDistance(pos, nearestNode.nodePos);
+            double emissionCost = 0.5 * (dist / _settings.gpsAccuracy) * (dist / _settings.gpsAccuracy);
+            auto it = std::find_if(candidates.begin(), candidates.end(), [&](const Candidate& candidate) {
+                return candidate.nearestNode.nodeId == nearestNode.nodeId;
+            });
+            if (it == candidates.end()) {
+                candidates.emplace_back();
+                it = candidates.end() - 1;
+            }
+            else if (it->emissionCost <= emissionCost) {
+                continue;
+            }
+            it->nearestNode = nearestNode;
+            it->emissionCost = emissionCost;
+        }
+
+        std::sort(candidates.begin(), candidates.end(), [](const Candidate& candidate1, const Candidate& candidate2) {
+            return candidate1.emissionCost < candidate2.emissionCost;
+        });
+        if (candidates.size() > _settings.maxCandidates) {
+            candidates.resize(_settings.maxCandidates);
+        }
+        return candidates;
+    }
+
+    void MapMatcher::buildRoutes(const std::vector<Graph::NearestNode>& nearestNodes, const std::vector<std::size_t>& pointIndices, std::vector<MatchedPoint>& matchedPoints, std::vector<Result>& results) const {
+        // Join the routes between consecutive matched nodes. The consecutive routes share the end/start vertex and node.
+        // If a leg can not be routed, the current route is finished at the previous node and a new route is started.
+        std::vector<Instruction> instructions;
+        std::vector<WGSPos> geometry;
+        auto finishRoute = [&](std::size_t lastIndex) {
+            if (geometry.empty()) {
+                results.push_back(_routeFinder.find(std::vector<Graph::NearestNode> { nearestNodes[lastIndex] }, std::vector<Graph::NearestNode> { nearestNodes[lastIndex] }));
+            }
+            else {
+                results.push_back(Result(std::move(instructions), std::move(geometry)));
+            }
+            instructions.clear();
+            geometry.clear();
+        };
+
+        matchedPoints[pointIndices.front()].routeIndex = results.size();
+        for (std::size_t i = 1; i < nearestNodes.size(); i++) {
+            Result result = _routeFinder.find(std::vector<Graph::NearestNode> { nearestNodes[i - 1] }, std::vector<Graph::NearestNode> { nearestNodes[i] });
+            if (result.getStatus() != Result::Status::SUCCESS || result.getGeometry().empty() || result.getInstructions().empty()) {
+                finishRoute(i - 1);
+                matchedPoints[pointIndices[i]].routeIndex = results.size();
+                continue;
+            }
+
+            std::size_t geometryOffset = 0;
+            auto instructionIt = result.getInstructions().begin();
+            if (!geometry.empty()) {
+                geometryOffset = geometry.size() - 1;
+                geometry.insert(geometry.end(), result.getGeometry().begin() + 1, result.getGeometry().end());
+
+                // Replace the final instruction of the previous route with the initial instruction of the current route
+                instructions.pop_back();
+                const Instruction& prevInstruction = instructions.back();
+                instructions.back() = Instruction(prevInstruction.getType(), prevInstruction.getTravelMode(), prevInstruction.getAddress(), prevInstruction.getDistance() + instructionIt->getDistance(), prevInstruction.getTime() + instructionIt->getTime(), prevInstruction.getGeometryIndex());
+                instructionIt++;
+            }
+            else {
+                geometry = result.getGeometry();
+            }
+            for (; instructionIt != result.getInstructions().end(); instructionIt++) {
+                instructions.emplace_back(instructionIt->getType(), instructionIt->getTravelMode(), instructionIt->getAddress(), instructionIt->getDistance(), instructionIt->getTime(), instructionIt->getGeometryIndex() + geometryOffset);
+            }
+            matchedPoints[pointIndices[i]].routeIndex = results.size();
+        }
+        finishRoute(nearestNodes.size() - 1);
+    }
+}
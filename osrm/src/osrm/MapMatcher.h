@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2016 CartoDB. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://cartodb.com/terms/
+ */
+
+#ifndef _CARTO_OSRM_MAPMATCHER_H_
+#define _CARTO_OSRM_MAPMATCHER_H_
+
+#include "Result.h"
+#include "Graph.h"
+#include "RouteFinder.h"
+
+#include <memory>
+#include <vector>
+
+namespace carto::osrm {
+    class MapMatcher final {
+    public:
+        struct Settings {
+            double gpsAccuracy = 10.0;        // standard deviation of the GPS position error, in meters
+            double searchRadius = 50.0;       // radius around the GPS position for candidate road nodes, in meters
+            std::size_t maxCandidates = 8;    // maximum number of candidate road nodes per GPS position
+            double referenceSpeed = 15.0;     // speed used for converting straight line distances to travel times, in m/s
+            double transitionScale = 10.0;    // scale of the extra travel time in transition costs, in seconds
+            double maxExtraTime = 120.0;      // maximum extra travel time between consecutive GPS positions, in seconds
+
+            Settings() = default;
+        };
+
+        struct MatchedPoint {
+            Graph::NearestNode nearestNode;
+            float confidence = 0.0f;
+            bool matched = false;
+            std::size_t routeIndex = 0;       // index of the result containing the point. Routes are split at unmatched gaps and at unroutable legs.
+
+            MatchedPoint() = default;
+        };
+
+        explicit MapMatcher(std::shared_ptr<Graph> graph, const Settings& settings) : _graph(graph), _routeFinder(std::move(graph)), _settings(settings) { }
+
+        std::vector<Result> match(const std::vector<WGSPos>& points, std::vector<MatchedPoint>& matchedPoints) const;
+
+    private:
+        struct Candidate {
+            Graph::NearestNode nearestNode;
+            double emissionCost = 0;
+            double cost = 0;
+            std::size_t prevIndex = 0;
+
+            Candidate() = default;
+        };
+
+        std::vector<Candidate> findCandidates(const WGSPos& pos, const std::vector<Graph::NearestNode>& nearestNodes) const;
+
+        void buildRoutes(const std::vector<Graph::NearestNode>& nearestNodes, const std::vector<std::size_t>& pointIndices, std::vector<MatchedPoint>& matchedPoints, std::vector<Result>& results) const;
+
+        const std::shared_ptr<Graph> _graph;
+        const RouteFinder _routeFinder;
+        const Settings _settings;
+    };
+}
+
+#endif
@@ -22,28 +22,25 @@ namespace carto::osrm {
         };
 
         Result() = default;
-        explicit Result(std::vector<Instruction> instructions, std::vector<WGSPos> geometry) : _status(Status::SUCCESS), _instructions(std::move(instructions)), _geometry(std::move(geometry)) { }
+        explicit Result(std::vector<Instruction> instructions, std::vector<WGSPos> geometry) : _status(Status::SUCCESS), _instructions(std::move(instructions)), _geometry(std::move(geometry)) {
+            _totalDistance = std::accumulate(_instructions.begin(), _instructions.end(), 0.0, [](double dist, const Instruction& instruction) { return dist + instruction.getDistance(); });
+            _totalTime = std::accumulate(_instructions.begin(), _instructions.end(), 0.0, [](double time, const Instruction& instruction) { return time + instruction.getTime(); });
+        }
+        explicit Result(std::vector<Instruction> instructions, std::vector<WGSPos> geometry, double totalDistance, double totalTime) : _status(Status::SUCCESS), _instructions(std::move(instructions)), _geometry(std::move(geometry)), _totalDistance(totalDistance), _totalTime(totalTime) { }
 
         Status getStatus() const { return _status; }
         const std::vector<Instruction>& getInstructions() const { return _instructions; }
         const std::vector<WGSPos>& getGeometry() const { return _geometry; }
 
-        double getTotalDistance() const {
-            return std::accumulate(_instructions.begin(), _instructions.end(), 0.0, [](double dist, const Instruction& instruction) {
-                return dist + instruction.getDistance();
-            });
-        }
-
-        double getTotalTime() const {
-            return std::accumulate(_instructions.begin(), _instructions.end(), 0.0, [](double time, const Instruction& instruction) {
-                return time + instruction.getTime();
-            });
-        }
+        double getTotalDistance() const { return _totalDistance; }
+        double getTotalTime() const { return _totalTime; }
 
     private:
         Status _status = Status::FAILED;
         std::vector<Instruction> _instructions;
         std::vector<WGSPos> _geometry;
+        double _totalDistance = 0;
+        double _totalTime = 0;
     };
 }
 
@@ -1,35 +1,300 @@
 #include "RouteFinder.h"
 
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <tuple>
+#include <chrono>
+#include <algorithm>
+#include <unordered_set>
+#include <stdexcept>
+
 #include <boost/math/constants/constants.hpp>
 
 namespace carto::osrm {
+    std::shared_ptr<const WeightOverlay> RouteFinder::getWeightOverlay() const {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        return _weightOverlay;
+    }
+
+    void RouteFinder::setWeightOverlay(std::shared_ptr<const WeightOverlay> weightOverlay) {
+        // Customize the shortcut weights once for the overlay, before it becomes visible to the queries
+        std::lock_guard<std::mutex> customizationLock(_customizationMutex);
+        std::shared_ptr<const Customization> customization;
+        if (weightOverlay && !weightOverlay->empty()) {
+            customization = customize(*weightOverlay, getCustomization().get());
+        }
+
+        // Unpacked shortcuts contain customized weights, so these must be dropped together with the old customization
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        _weightOverlay = std::move(weightOverlay);
+        _customization = std::move(customization);
+        _shortcutCache.clear();
+    }
+
+    void RouteFinder::updateWeightOverlay() {
+        // Imported packages may contain overlay segments, so the customization is rebuilt. Only the packages with changed speed factors are customized again.
+        std::lock_guard<std::mutex> customizationLock(_customizationMutex);
+        std::shared_ptr<const WeightOverlay> weightOverlay = getWeightOverlay();
+        std::shared_ptr<const Customization> customization = getCustomization();
+        if (!customization || customization->cacheGeneration == _graph->getCacheGeneration()) {
+            return;
+        }
+        customization = customize(*weightOverlay, customization.get());
+
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        _customization = std::move(customization);
+        _shortcutCache.clear();
+    }
+
     Result RouteFinder::find(const Query& query) const {
-        std::array<std::vector<Graph::NearestNode>, 2> nearestNodes;
-        std::array<std::priority_queue<SearchNode>, 2> heaps;
-        std::unordered_map<Graph::NodeId, PathNode, Graph::NodeId::Hash> pathSuffixMap;
-        float minWeight = 0.0f;
+        return find(_graph->findNearestNode(query.getPos(0)), _graph->findNearestNode(query.getPos(1)));
+    }
+
+    Result RouteFinder::find(const Query& query, Statistics& statistics) const {
+        return find(query, RouteOptions(), statistics);
+    }
+
+    Result RouteFinder::find(const Query& query, const RouteOptions& options) const {
+        return findRoute(_graph->findNearestNode(query.getPos(0)), _graph->findNearestNode(query.getPos(1)), options, nullptr);
+    }
+
+    Result RouteFinder::find(const Query& query, const RouteOptions& options, Statistics& statistics) const {
+        // Graph cache counters are global, so only the difference over the query is stored
+        statistics = Statistics();
+        Graph::CacheStatistics cacheStatistics = _graph->getCacheStatistics();
+
+        auto startTime = std::chrono::steady_clock::now();
+        std::vector<Graph::NearestNode> sourceNodes = _graph->findNearestNode(query.getPos(0));
+        std::vector<Graph::NearestNode> targetNodes = _graph->findNearestNode(query.getPos(1));
+        statistics.snapTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        Result result = findRoute(sourceNodes, targetNodes, options, &statistics);
+        auto subtractCounters = [](Graph::CacheCounters& counters, const Graph::CacheCounters& initialCounters) {
+            counters.hits -= initialCounters.hits;
+            counters.misses -= initialCounters.misses;
+        };
+        statistics.cacheStatistics = _graph->getCacheStatistics();
+        subtractCounters(statistics.cacheStatistics.nodeBlocks, cacheStatistics.nodeBlocks);
+        subtractCounters(statistics.cacheStatistics.geometryBlocks, cacheStatistics.geometryBlocks);
+        subtractCounters(statistics.cacheStatistics.nameBlocks, cacheStatistics.nameBlocks);
+        subtractCounters(statistics.cacheStatistics.globalNodeBlocks, cacheStatistics.globalNodeBlocks);
+        subtractCounters(statistics.cacheStatistics.rtreeNodeBlocks, cacheStatistics.rtreeNodeBlocks);
+        return result;
+    }
+
+    Result RouteFinder::find(const std::vector<Graph::NearestNode>& sourceNodes, const std::vector<Graph::NearestNode>& targetNodes) const {
+        return findRoute(sourceNodes, targetNodes, RouteOptions(), nullptr);
+    }
+
+    std::vector<Result> RouteFinder::findAlternatives(const Query& query, const AlternativeOptions& options) const {
+        EndPoints endPoints;
+        if (!findEndPoints({{ _graph->findNearestNode(query.getPos(0)), _graph->findNearestNode(query.getPos(1)) }}, endPoints) || options.maxRoutes == 0) {
+            return std::vector<Result>();
+        }
+
+        // Apply bidirectional Dijkstra, but do not stop at the best path. Continue until the stretch limit is reached.
+        std::array<SettledNodeMap, 2> settledNodes;
+        Graph::NodeId bestNodeId;
+        float bestWeight = std::numeric_limits<float>::infinity();
+        search(endPoints, 1.0f + options.maxStretch, settledNodes, bestNodeId, bestWeight);
+        if (bestNodeId.blockId.packageId == -1) {
+            return std::vector<Result>();
+        }
+
+        std::vector<std::vector<PathNode>> paths(1);
+        if (!unpackPath(settledNodes, endPoints, bestNodeId, paths.front())) {
+            return std::vector<Result>();
+        }
+
+        // Via node candidates are the nodes settled by both searches, stalled nodes are not included. Sort these by the total weight of the resulting path.
+        std::vector<std::pair<float, Graph::NodeId>> candidates;
+        for (auto it0 = settledNodes[0].begin(); it0 != settledNodes[0].end(); it0++) {
+            auto it1 = settledNodes[1].find(it0->first);
+            if (it1 == settledNodes[1].end() || it0->first == bestNodeId) {
+                continue;
+            }
+            float totalWeight = it0->second.weight + it1->second.weight;
+            if (totalWeight >= 0 && totalWeight <= bestWeight * (1.0f + options.maxStretch)) {
+                candidates.emplace_back(totalWeight, it0->first);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const std::pair<float, Graph::NodeId>& candidate1, const std::pair<float, Graph::NodeId>& candidate2) {
+            const Graph::NodeId& nodeId1 = candidate1.second;
+            const Graph::NodeId& nodeId2 = candidate2.second;
+            return std::make_tuple(candidate1.first, nodeId1.blockId.packageId, nodeId1.blockId.blockIndex, nodeId1.elementIndex) < std::make_tuple(candidate2.first, nodeId2.blockId.packageId, nodeId2.blockId.blockIndex, nodeId2.elementIndex);
+        });
+
+        // Accept candidates in the order of increasing weight, as long as they do not share too much with the already accepted paths and are locally optimal around the via node
+        std::unordered_set<Graph::NodeId, Graph::NodeId::Hash> acceptedNodeIds;
+        for (const PathNode& pathNode : paths.front()) {
+            acceptedNodeIds.insert(pathNode.nextNodeId);
+        }
+        for (std::size_t i = 0; i < candidates.size() && i < options.maxCandidates && paths.size() < options.maxRoutes; i++) {
+            std::vector<PathNode> path;
+            if (!unpackPath(settledNodes, endPoints, candidates[i].second, path)) {
+                continue;
+            }
+
+            // Calculate shared weight. Edge weights include the weight of the source node, so the weight is attributed to the previous node.
+            float totalWeight = 0;
+            float sharedWeight = 0;
+            bool loop = false;
+            std::unordered_set<Graph::NodeId, Graph::NodeId::Hash> pathNodeIds;
+            for (const PathNode& pathNode : path) {
+                if (!pathNodeIds.insert(pathNode.nextNodeId).second) {
+                    loop = true;
+                    break;
+                }
+                totalWeight += pathNode.edge.edgeData.weight;
+                if (acceptedNodeIds.count(pathNode.prevNodeId) > 0) {
+                    sharedWeight += pathNode.edge.edgeData.weight;
+                }
+            }
+            if (loop || sharedWeight > totalWeight * options.maxSharing) {
+                continue;
+            }
+            if (!isLocallyOptimal(endPoints, path, candidates[i].second, bestWeight * options.localOptimality)) {
+                continue;
+            }
+
+            acceptedNodeIds.insert(pathNodeIds.begin(), pathNodeIds.end());
+            paths.push_back(std::move(path));
+        }
+
+        std::vector<Result> results;
+        results.reserve(paths.size());
+        for (const std::vector<PathNode>& path : paths) {
+            Result result = buildResult(endPoints, path, RouteOptions());
+            if (result.getStatus() == Result::Status::SUCCESS) {
+                results.push_back(std::move(result));
+            }
+        }
+        return results;
+    }
+
+    std::vector<std::vector<double>> RouteFinder::calculateTimeMatrix(const std::vector<Graph::NearestNode>& sourceNodes, const std::vector<Graph::NearestNode>& targetNodes, double maxTime) const {
+        std::vector<std::vector<double>> times(sourceNodes.size(), std::vector<double>(targetNodes.size(), std::numeric_limits<double>::infinity()));
+        float maxWeight = static_cast<float>(maxTime * 10.0);
+
+        validateCaches();
+        std::shared_ptr<const Customization> customization = getCustomization();
+
+        // Calculate source end-point weights. These are negative, so the backward searches must be extended by the largest offset.
+        std::vector<SearchNode> sourceSearchNodes;
+        float maxSourceOffset = 0.0f;
+        for (const Graph::NearestNode& sourceNode : sourceNodes) {
+            Graph::NodePtr node = _graph->getNode(sourceNode.nodeId);
+            sourceSearchNodes.emplace_back(sourceNode.nodeId, Graph::NodeId(), -sourceNode.geometryRelPos * getNodeWeight(customization.get(), sourceNode.nodeId, *node));
+            maxSourceOffset = std::max(maxSourceOffset, -sourceSearchNodes.back().weight);
+        }
+
+        // Run bounded backward searches from the targets and store the settled weights in node buckets
+        std::unordered_map<Graph::NodeId, std::vector<std::pair<std::size_t, float>>, Graph::NodeId::Hash> buckets;
+        for (std::size_t j = 0; j < targetNodes.size(); j++) {
+            Graph::NodePtr node = _graph->getNode(targetNodes[j].nodeId);
+            SettledNodeMap settledNodes;
+            searchBounded(SearchNode(targetNodes[j].nodeId, Graph::NodeId(), targetNodes[j].geometryRelPos * getNodeWeight(customization.get(), targetNodes[j].nodeId, *node)), 1, maxWeight + maxSourceOffset, customization.get(), settledNodes);
+            for (auto it = settledNodes.begin(); it != settledNodes.end(); it++) {
+                buckets[it->first].emplace_back(j, it->second.weight);
+            }
+        }
+
+        // Run bounded forward searches from the sources and combine the results with the bucket entries
+        for (std::size_t i = 0; i < sourceNodes.size(); i++) {
+            SettledNodeMap settledNodes;
+            searchBounded(sourceSearchNodes[i], 0, maxWeight, customization.get(), settledNodes);
+            for (auto it = settledNodes.begin(); it != settledNodes.end(); it++) {
+                auto bucketIt = buckets.find(it->first);
+                if (bucketIt == buckets.end()) {
+                    continue;
+                }
+                for (const std::pair<std::size_t, float>& entry : bucketIt->second) {
+                    float totalWeight = it->second.weight + entry.second;
+                    if (totalWeight >= 0 && totalWeight <= maxWeight) {
+                        times[i][entry.first] = std::min(times[i][entry.first], totalWeight / 10.0);
+                    }
+                }
+            }
+        }
+        return times;
+    }
+
+    Result RouteFinder::findRoute(const std::vector<Graph::NearestNode>& sourceNodes, const std::vector<Graph::NearestNode>& targetNodes, const RouteOptions& options, Statistics* statistics) const {
+        // Returns the time since the previous call, in seconds
+        auto lapTime = [lastTime = std::chrono::steady_clock::now()]() mutable {
+            auto currentTime = std::chrono::steady_clock::now();
+            double time = std::chrono::duration<double>(currentTime - lastTime).count();
+            lastTime = currentTime;
+            return time;
+        };
+
+        EndPoints endPoints;
+        bool endPointsFound = findEndPoints({{ sourceNodes, targetNodes }}, endPoints);
+        if (statistics) {
+            statistics->snapTime += lapTime();
+            statistics->initialNodes = {{ endPoints.initialNodes[0].size(), endPoints.initialNodes[1].size() }};
+        }
+        if (!endPointsFound) {
+            return Result();
+        }
+
+        // Apply bidirectional Dijkstra
+        std::array<SettledNodeMap, 2> settledNodes;
+        Graph::NodeId bestNodeId;
+        float bestWeight = std::numeric_limits<float>::infinity();
+        search(endPoints, 1.0f, settledNodes, bestNodeId, bestWeight, statistics);
+        if (statistics) {
+            statistics->searchTime += lapTime();
+        }
+
+        // Check that path was found
+        if (bestNodeId.blockId.packageId == -1) {
+            return Result();
+        }
+
+        // Unpack path and construct the result
+        std::vector<PathNode> path;
+        if (!unpackPath(settledNodes, endPoints, bestNodeId, path)) {
+            return Result();
+        }
+        Result result = buildResult(endPoints, path, options);
+        if (statistics) {
+            statistics->unpackTime += lapTime();
+        }
+        return result;
+    }
+
+    bool RouteFinder::findEndPoints(const std::array<std::vector<Graph::NearestNode>, 2>& nearestNodes, EndPoints& endPoints) const {
+        validateCaches();
+        endPoints.nearestNodes = nearestNodes;
+        endPoints.customization = getCustomization();
+        const Customization* customization = endPoints.customization.get();
         for (int i = 0; i < 2; i++) {
-            nearestNodes[i] = _graph->findNearestNode(query.getPos(i));
             if (nearestNodes[i].empty()) {
-                return Result();
+                return false;
             }
+            endPoints.minWeights[i] = std::numeric_limits<float>::infinity();
 
             for (const Graph::NearestNode& nearestNode : nearestNodes[i]) {
                 Graph::NodePtr node = _graph->getNode(nearestNode.nodeId);
 
                 // Calculate end-point weights
-                float weight = (i == 0 ? -nearestNode.geometryRelPos : nearestNode.geometryRelPos) * node->nodeData.weight;
-                minWeight = std::min(minWeight, weight);
+                float weight = (i == 0 ? -nearestNode.geometryRelPos : nearestNode.geometryRelPos) * getNodeWeight(customization, nearestNode.nodeId, *node);
+                endPoints.minWeights[i] = std::min(endPoints.minWeights[i], weight);
 
                 // Special case: we have already added same node but the node is inaccessible along the current direction
                 if (i == 1 && nearestNodes[0].size() == 1 && nearestNodes[1].size() == 1) {
                     const Graph::NearestNode& otherNearestNode = nearestNodes[1 - i][0];
                     if (nearestNode.nodeId == otherNearestNode.nodeId && nearestNode.geometryRelPos < otherNearestNode.geometryRelPos) {
                         // Add all backward edges "leading" to current node
-                        for (auto edge = node->firstEdge; edge != node->lastEdge; edge++) {
-                            if (edge->backward) {
-                                heaps[i].emplace(edge->targetNodeId, Graph::NodeId(), weight + edge->edgeData.weight);
-                                pathSuffixMap[edge->targetNodeId] = PathNode(edge->targetNodeId, *edge, nearestNode.nodeId);
+                        for (auto edgeIt = node->firstEdge; edgeIt != node->lastEdge; edgeIt++) {
+                            const Graph::Edge edge = *edgeIt;
+                            if (edge.backward) {
+                                Graph::Edge pathEdge = edge;
+                                pathEdge.edgeData.weight = static_cast<unsigned int>(std::lround(getEdgeWeight(customization, edge.targetNodeId, nearestNode.nodeId, edge)));
+                                endPoints.initialNodes[i].emplace_back(edge.targetNodeId, Graph::NodeId(), weight + pathEdge.edgeData.weight);
+                                endPoints.pathSuffixMap[edge.targetNodeId] = PathNode(edge.targetNodeId, pathEdge, nearestNode.nodeId);
                             }
                         }
 
@@ -38,10 +303,13 @@ namespace carto::osrm {
                         std::vector<Graph::NearestNode> nearestNodes2 = _graph->findNearestNode(geometry.front());
                         for (const Graph::NearestNode& nearestNode2 : nearestNodes2) {
                             Graph::NodePtr node2 = _graph->getNode(nearestNode2.nodeId);
-                            for (auto edge2 = node2->firstEdge; edge2 != node2->lastEdge; edge2++) {
-                                if (edge2->forward && edge2->targetNodeId == nearestNode.nodeId) {
-                                    heaps[i].emplace(nearestNode2.nodeId, Graph::NodeId(), weight + edge2->edgeData.weight);
-                                    pathSuffixMap[nearestNode2.nodeId] = PathNode(nearestNode2.nodeId, *edge2, nearestNode.nodeId);
+                            for (auto edgeIt2 = node2->firstEdge; edgeIt2 != node2->lastEdge; edgeIt2++) {
+                                const Graph::Edge edge2 = *edgeIt2;
+                                if (edge2.forward && edge2.targetNodeId == nearestNode.nodeId) {
+                                    Graph::Edge pathEdge = edge2;
+                                    pathEdge.edgeData.weight = static_cast<unsigned int>(std::lround(getEdgeWeight(customization, nearestNode2.nodeId, nearestNode.nodeId, edge2)));
+                                    endPoints.initialNodes[i].emplace_back(nearestNode2.nodeId, Graph::NodeId(), weight + pathEdge.edgeData.weight);
+                                    endPoints.pathSuffixMap[nearestNode2.nodeId] = PathNode(nearestNode2.nodeId, pathEdge, nearestNode.nodeId);
                                 }
                             }
                         }
@@ -51,53 +319,98 @@ namespace carto::osrm {
                 }
 
                 // Add the node to heap, if other nodes were not already added
-                heaps[i].emplace(nearestNode.nodeId, Graph::NodeId(), weight);
+                endPoints.initialNodes[i].emplace_back(nearestNode.nodeId, Graph::NodeId(), weight);
+            }
+        }
+        return true;
+    }
+
+    void RouteFinder::searchBounded(const SearchNode& initialNode, int direction, float maxWeight, const Customization* customization, SettledNodeMap& settledNodes) const {
+        SearchHeap heap;
+        heap.update(initialNode);
+        while (!heap.empty()) {
+            SearchNode searchNode = heap.top();
+            heap.pop();
+
+            // Skip all invalid nodes and stop once the bound is reached
+            if (searchNode.nodeId.blockId.packageId == -1) {
+                continue;
+            }
+            if (searchNode.weight > maxWeight) {
+                break;
+            }
+            settledNodes[searchNode.nodeId] = searchNode;
+
+            Graph::NodePtr node = _graph->getNode(searchNode.nodeId);
+            for (auto edgeIt = node->firstEdge; edgeIt != node->lastEdge; edgeIt++) {
+                const Graph::Edge edge = *edgeIt;
+                if (settledNodes.count(edge.targetNodeId) > 0) {
+                    continue;
+                }
+                if (direction == 0 && edge.forward) {
+                    heap.update(SearchNode(edge.targetNodeId, searchNode.nodeId, searchNode.weight + getEdgeWeight(customization, searchNode.nodeId, edge.targetNodeId, edge)));
+                }
+                else if (direction != 0 && edge.backward) {
+                    heap.update(SearchNode(edge.targetNodeId, searchNode.nodeId, searchNode.weight + getEdgeWeight(customization, edge.targetNodeId, searchNode.nodeId, edge)));
+                }
+            }
+        }
+    }
+
+    void RouteFinder::search(const EndPoints& endPoints, float maxWeightFactor, std::array<SettledNodeMap, 2>& settledNodes, Graph::NodeId& bestNodeId, float& bestWeight, Statistics* statistics) const {
+        const Customization* customization = endPoints.customization.get();
+        std::unordered_set<Graph::BlockId, Graph::BlockId::Hash> touchedBlockIds;
+        std::array<std::unordered_set<Graph::NodeId, Graph::NodeId::Hash>, 2> stalledNodeIds; // popped but not settled, their weights are not shortest path weights
+        std::array<SearchHeap, 2> heaps;
+        for (int i = 0; i < 2; i++) {
+            for (const SearchNode& searchNode : endPoints.initialNodes[i]) {
+                heaps[i].update(searchNode);
+            }
+            if (statistics) {
+                statistics->heapPushes[i] += endPoints.initialNodes[i].size();
             }
         }
 
-        // Apply bidirectional Dijkstra
-        Graph::NodeId bestNodeId;
-        float bestWeight = std::numeric_limits<float>::infinity();
-        std::array<std::unordered_map<Graph::NodeId, SearchNode, Graph::NodeId::Hash>, 2> settledNodes;
         for (int i = 0; !(heaps[0].empty() && heaps[1].empty()); i = 1 - i) {
             if (heaps[i].empty()) {
                 continue;
             }
             SearchNode searchNode = heaps[i].top();
             heaps[i].pop();
+            if (statistics) {
+                statistics->heapPops[i]++;
+            }
             
             // Skip all invalid nodes
             if (searchNode.nodeId.blockId.packageId == -1) {
                 continue;
             }
 
-            // Already shorter path found? In that case we can stop searching in the given direction
-            if (searchNode.weight + minWeight > bestWeight) {
-                while (!heaps[i].empty()) {
-                    heaps[i].pop();
-                }
+            // Already shorter path found? In that case we can stop searching in the given direction. The weights of the other direction are bounded by its minimum initial weight.
+            if (searchNode.weight + endPoints.minWeights[1 - i] > bestWeight * maxWeightFactor) {
+                heaps[i].clear();
                 continue;
             }
-            
-            // Best path to give node?
-            auto it0 = settledNodes[i].find(searchNode.nodeId);
-            if (it0 != settledNodes[i].end()) {
-                if (searchNode.weight >= it0->second.weight) { // not sure if the check is required
-                    continue;
-                }
-            }
 
-            // Settle the node
-            settledNodes[i][searchNode.nodeId] = searchNode;
-            
-            // Stalling optimization. This implementation is not optimal, we should also look at non-settled heap nodes
+            // Stall-on-demand. If a higher node reaches this node with a smaller weight (using either its settled or tentative heap weight), this node
+            // can not be part of the shortest path and is not expanded. Edges are traversed towards the popped node here, so the source and target are swapped compared to the relaxation below.
+            // Stalled nodes are kept out of the settled node maps, so they are never used as meeting nodes, via nodes or path nodes.
             Graph::NodePtr node = _graph->getNode(searchNode.nodeId);
             bool stall = false;
-            for (auto edge = node->firstEdge; edge != node->lastEdge; edge++) {
-                if ((i == 0 && edge->backward) || (i != 0 && edge->forward)) {
-                    auto it = settledNodes[i].find(edge->targetNodeId);
+            for (auto edgeIt = node->firstEdge; edgeIt != node->lastEdge; edgeIt++) {
+                const Graph::Edge edge = *edgeIt;
+                if ((i == 0 && edge.backward) || (i != 0 && edge.forward)) {
+                    const SearchNode* sourceNode = nullptr;
+                    auto it = settledNodes[i].find(edge.targetNodeId);
                     if (it != settledNodes[i].end()) {
-                        if (it->second.weight + edge->edgeData.weight < searchNode.weight) {
+                        sourceNode = &it->second;
+                    }
+                    else {
+                        sourceNode = heaps[i].find(edge.targetNodeId);
+                    }
+                    if (sourceNode && sourceNode->weight < searchNode.weight) {
+                        float edgeWeight = (i == 0 ? getEdgeWeight(customization, edge.targetNodeId, searchNode.nodeId, edge) : getEdgeWeight(customization, searchNode.nodeId, edge.targetNodeId, edge));
+                        if (sourceNode->weight + edgeWeight < searchNode.weight) {
                             stall = true;
                             break;
                         }
@@ -105,9 +418,21 @@ namespace carto::osrm {
                 }
             }
             if (stall) {
+                stalledNodeIds[i].insert(searchNode.nodeId);
+                if (statistics) {
+                    statistics->stalledNodes[i]++;
+                    touchedBlockIds.insert(searchNode.nodeId.blockId);
+                }
                 continue;
             }
 
+            // Settle the node. Each node is popped only once, as the heap keeps a single entry per node.
+            settledNodes[i][searchNode.nodeId] = searchNode;
+            if (statistics) {
+                statistics->settledNodes[i]++;
+                touchedBlockIds.insert(searchNode.nodeId.blockId);
+            }
+
             // Recalculate shortest path and middle node
             auto it1 = settledNodes[1 - i].find(searchNode.nodeId);
             if (it1 != settledNodes[1 - i].end()) {
@@ -118,24 +443,114 @@ namespace carto::osrm {
                 }
             }
 
-            // Add target nodes to heap
-            for (auto edge = node->firstEdge; edge != node->lastEdge; edge++) {
-                if ((i == 0 && edge->forward) || (i != 0 && edge->backward)) {
-                    heaps[i].emplace(edge->targetNodeId, searchNode.nodeId, searchNode.weight + edge->edgeData.weight);
+            // Add or update target nodes in heap, skipping the nodes that can not improve the best path.
+            // Request prefetching of other blocks on the search frontier, so that these are likely decoded when settled.
+            for (auto edgeIt = node->firstEdge; edgeIt != node->lastEdge; edgeIt++) {
+                const Graph::Edge edge = *edgeIt;
+                if ((i == 0 && edge.forward) || (i != 0 && edge.backward)) {
+                    if (settledNodes[i].count(edge.targetNodeId) > 0 || stalledNodeIds[i].count(edge.targetNodeId) > 0) {
+                        continue;
+                    }
+                    float edgeWeight = (i == 0 ? getEdgeWeight(customization, searchNode.nodeId, edge.targetNodeId, edge) : getEdgeWeight(customization, edge.targetNodeId, searchNode.nodeId, edge));
+                    float weight = searchNode.weight + edgeWeight;
+                    if (weight + endPoints.minWeights[1 - i] > bestWeight * maxWeightFactor) {
+                        continue;
+                    }
+                    if (!heaps[i].update(SearchNode(edge.targetNodeId, searchNode.nodeId, weight))) {
+                        continue;
+                    }
+                    if (statistics) {
+                        statistics->heapPushes[i]++;
+                    }
+                    if (!(edge.targetNodeId.blockId == searchNode.nodeId.blockId)) {
+                        _graph->prefetchNodeBlock(edge.targetNodeId.blockId);
+                    }
                 }
             }
         }
 
-        // Check that path was found
-        if (bestNodeId.blockId.packageId == -1) {
-            return Result();
+        if (statistics) {
+            statistics->blocksTouched = touchedBlockIds.size();
         }
+    }
 
-        // Unpack path
+    const RouteFinder::SearchNode* RouteFinder::SearchHeap::find(Graph::NodeId nodeId) const {
+        auto it = _searchNodeIndices.find(nodeId);
+        if (it == _searchNodeIndices.end()) {
+            return nullptr;
+        }
+        return &_searchNodes[it->second];
+    }
+
+    bool RouteFinder::SearchHeap::update(const SearchNode& searchNode) {
+        auto it = _searchNodeIndices.find(searchNode.nodeId);
+        if (it == _searchNodeIndices.end()) {
+            _searchNodeIndices[searchNode.nodeId] = _searchNodes.size();
+            _searchNodes.push_back(searchNode);
+            siftUp(_searchNodes.size() - 1);
+            return true;
+        }
+        if (searchNode.weight >= _searchNodes[it->second].weight) {
+            return false;
+        }
+        _searchNodes[it->second] = searchNode;
+        siftUp(it->second);
+        return true;
+    }
+
+    void RouteFinder::SearchHeap::pop() {
+        swapNodes(0, _searchNodes.size() - 1);
+        _searchNodeIndices.erase(_searchNodes.back().nodeId);
+        _searchNodes.pop_back();
+        if (!_searchNodes.empty()) {
+            siftDown(0);
+        }
+    }
+
+    void RouteFinder::SearchHeap::clear() {
+        _searchNodes.clear();
+        _searchNodeIndices.clear();
+    }
+
+    void RouteFinder::SearchHeap::siftUp(std::size_t index) {
+        while (index > 0) {
+            std::size_t parentIndex = (index - 1) / 2;
+            if (!(_searchNodes[index].weight < _searchNodes[parentIndex].weight)) {
+                break;
+            }
+            swapNodes(index, parentIndex);
+            index = parentIndex;
+        }
+    }
+
+    void RouteFinder::SearchHeap::siftDown(std::size_t index) {
+        while (true) {
+            std::size_t minIndex = index;
+            for (std::size_t childIndex = index * 2 + 1; childIndex <= index * 2 + 2 && childIndex < _searchNodes.size(); childIndex++) {
+                if (_searchNodes[childIndex].weight < _searchNodes[minIndex].weight) {
+                    minIndex = childIndex;
+                }
+            }
+            if (minIndex == index) {
+                break;
+            }
+            swapNodes(index, minIndex);
+            index = minIndex;
+        }
+    }
+
+    void RouteFinder::SearchHeap::swapNodes(std::size_t index0, std::size_t index1) {
+        std::swap(_searchNodes[index0], _searchNodes[index1]);
+        _searchNodeIndices[_searchNodes[index0].nodeId] = index0;
+        _searchNodeIndices[_searchNodes[index1].nodeId] = index1;
+    }
+
+    bool RouteFinder::unpackPath(const std::array<SettledNodeMap, 2>& settledNodes, const EndPoints& endPoints, Graph::NodeId viaNodeId, std::vector<PathNode>& path) const {
+        const Customization* customization = endPoints.customization.get();
         std::array<std::vector<PathNode>, 2> paths;
         for (int i = 0; i < 2; i++) {
-            std::stack<std::pair<Graph::NodeId, Graph::NodeId>> stack;
-            Graph::NodeId nodeId = bestNodeId;
+            std::stack<UnpackTask> stack;
+            Graph::NodeId nodeId = viaNodeId;
             while (true) {
                 auto it = settledNodes[i].find(nodeId);
                 assert(it != settledNodes[i].end());
@@ -148,87 +563,208 @@ namespace carto::osrm {
             }
 
             while (!stack.empty()) {
-                std::pair<Graph::NodeId, Graph::NodeId> nodeIds = stack.top();
+                UnpackTask task = stack.top();
                 stack.pop();
 
-                Graph::NodePtr matchedNode;
-                const Graph::Edge* matchedEdge = nullptr;
-
-                // Find the edge between prevNodeId and nodeId. Do matching based on node ids.
-                Graph::NodeId prevNodeId = nodeIds.first;
-                Graph::NodeId nodeId = nodeIds.second;
-                for (int j = 0; j < 2 && !matchedEdge; j++) {
-                    Graph::NodePtr prevNode = _graph->getNode(prevNodeId);
-                    for (auto edge = prevNode->firstEdge; edge != prevNode->lastEdge; edge++) {
-                        if (edge->targetNodeId == nodeId && ((j == i && edge->forward) || (j != i && edge->backward))) {
-                            matchedNode = prevNode;
-                            matchedEdge = edge;
-                            break;
-                        }
+                // Store the unpacked shortcut, once all its subedges are processed. Skip this if the customization was replaced during the query.
+                if (task.shortcutKey) {
+                    std::lock_guard<std::mutex> lock(_cacheMutex);
+                    if (_customization.get() != customization) {
+                        continue;
                     }
-                    std::swap(nodeId, prevNodeId);
-                }
-                
-                // If the edge was not found, then we have a link between packages with different node encodings. Do slow matching, based on geometry, not node ids
-                for (int j = 0; j < 2 && !matchedEdge; j++) {
-                    Graph::NodePtr prevNode = _graph->getNode(prevNodeId);
-                    Graph::NodePtr node = _graph->getNode(nodeId);
-                    std::vector<WGSPos> nodeGeometry = _graph->getNodeGeometry(*node);
-                    for (auto edge = prevNode->firstEdge; edge != prevNode->lastEdge; edge++) {
-                        if (edge->targetNodeId.blockId.packageId == -1) {
-                            continue;
-                        }
-                        Graph::NodePtr targetNode = _graph->getNode(edge->targetNodeId);
-                        std::vector<WGSPos> targetNodeGeometry = _graph->getNodeGeometry(*targetNode);
-                        if (nodeGeometry == targetNodeGeometry && ((j == i && edge->forward) || (j != i && edge->backward))) {
-                            matchedNode = prevNode;
-                            matchedEdge = edge;
-                            break;
-                        }
+                    _shortcutCache.put(*task.shortcutKey, std::make_shared<const std::vector<PathNode>>(paths[i].begin() + task.pathIndex, paths[i].end()));
+                    continue;
+                }
+
+                Graph::Edge matchedEdge;
+                if (!findPathEdge(i, task.nodeIds.first, task.nodeIds.second, matchedEdge)) {
+                    return false; // NOTE: this should not happen, unless the graph is broken
+                }
+
+                // Unpack the matched edge, use the cached sequence if the shortcut has been already unpacked. The customization may select a different contracted node.
+                if (matchedEdge.contracted) {
+                    matchedEdge.contractedNodeId = (i == 0 ? getContractedNodeId(customization, task.nodeIds.first, task.nodeIds.second, matchedEdge) : getContractedNodeId(customization, task.nodeIds.second, task.nodeIds.first, matchedEdge));
+                    if (matchedEdge.contractedNodeId.blockId.packageId == -1) {
+                        return false; // Contracted node is not available, packing failed
                     }
-                    std::swap(nodeId, prevNodeId);
-                }
-                
-                // Unpack the matched edge
-                if (matchedEdge) {
-                    if (matchedEdge->contracted) {
-                        if (matchedEdge->contractedNodeId.blockId.packageId == -1) {
-                            return Result(); // Contracted node is not available, packing failed
-                        }
-                        stack.emplace(matchedEdge->contractedNodeId, nodeIds.second);
-                        stack.emplace(nodeIds.first, matchedEdge->contractedNodeId);
+
+                    ShortcutKey shortcutKey(i, task.nodeIds.first, task.nodeIds.second, matchedEdge.contractedNodeId);
+                    std::shared_ptr<const std::vector<PathNode>> unpackedPath;
+                    {
+                        std::lock_guard<std::mutex> lock(_cacheMutex);
+                        _shortcutCache.read(shortcutKey, unpackedPath);
                     }
-                    else {
-                        paths[i].emplace_back(nodeIds.first, *matchedEdge, nodeIds.second);
+                    if (unpackedPath) {
+                        paths[i].insert(paths[i].end(), unpackedPath->begin(), unpackedPath->end());
+                        continue;
                     }
-                } else {
-                    return Result(); // NOTE: this should not happen, unless the graph is broken
+
+                    stack.emplace(shortcutKey, paths[i].size());
+                    stack.emplace(matchedEdge.contractedNodeId, task.nodeIds.second);
+                    stack.emplace(task.nodeIds.first, matchedEdge.contractedNodeId);
+                }
+                else {
+                    matchedEdge.edgeData.weight = static_cast<unsigned int>(std::lround(i == 0 ? getEdgeWeight(customization, task.nodeIds.first, task.nodeIds.second, matchedEdge) : getEdgeWeight(customization, task.nodeIds.second, task.nodeIds.first, matchedEdge)));
+                    paths[i].emplace_back(task.nodeIds.first, matchedEdge, task.nodeIds.second);
                 }
             }
         }
 
         // Build joined path. Add pseudo-node at the beginning to simplify processing and add final node, if rerouting in case of one-way street
-        std::vector<PathNode> path;
         path = paths[0];
         for (auto it = paths[1].rbegin(); it != paths[1].rend(); it++) {
             path.emplace_back(it->nextNodeId, it->edge, it->prevNodeId);
         }
         if (path.empty()) {
-            path.emplace(path.begin(), bestNodeId, Graph::Edge(), bestNodeId);
+            path.emplace(path.begin(), viaNodeId, Graph::Edge(), viaNodeId);
         }
         else {
             Graph::NodeId firstNodeId = path.front().prevNodeId;
             path.emplace(path.begin(), firstNodeId, Graph::Edge(), firstNodeId);
         }
 
-        auto finalNodeIt = pathSuffixMap.find(path.back().nextNodeId);
-        if (finalNodeIt != pathSuffixMap.end()) {
+        auto finalNodeIt = endPoints.pathSuffixMap.find(path.back().nextNodeId);
+        if (finalNodeIt != endPoints.pathSuffixMap.end()) {
             path.push_back(finalNodeIt->second);
         }
+        return true;
+    }
 
-        // Construct query result
-        std::vector<Instruction> instructions;
+    bool RouteFinder::isLocallyOptimal(const EndPoints& endPoints, const std::vector<PathNode>& path, Graph::NodeId viaNodeId, float localWeight) const {
+        // Node j of the path is path[j].nextNodeId, the edge weight of path[j] is the weight between nodes j - 1 and j
+        std::size_t viaIndex = 0;
+        while (viaIndex < path.size() && !(path[viaIndex].nextNodeId == viaNodeId)) {
+            viaIndex++;
+        }
+        if (viaIndex == path.size()) {
+            return false;
+        }
+
+        // Find the subpath extending by the given weight on both sides of the via node. The final node added for the one-way special case is not reachable by the search, so it is excluded.
+        std::size_t lastIndex = path.size() - (endPoints.pathSuffixMap.empty() || path.size() < 2 ? 1 : 2);
+        std::size_t index0 = viaIndex;
+        float weight0 = 0;
+        for (; index0 > 0 && weight0 < localWeight; index0--) {
+            weight0 += path[index0].edge.edgeData.weight;
+        }
+        std::size_t index1 = viaIndex;
+        float weight1 = 0;
+        for (; index1 < lastIndex && weight1 < localWeight; index1++) {
+            weight1 += path[index1 + 1].edge.edgeData.weight;
+        }
+        if (index0 == index1) {
+            return true;
+        }
+
+        // Compare the subpath weight to the shortest path weight between its endpoints. Path edge weights are rounded, so allow half a unit per edge.
+        EndPoints localEndPoints;
+        localEndPoints.initialNodes[0].emplace_back(path[index0].nextNodeId, Graph::NodeId(), 0.0f);
+        localEndPoints.initialNodes[1].emplace_back(path[index1].nextNodeId, Graph::NodeId(), 0.0f);
+        localEndPoints.customization = endPoints.customization;
+        std::array<SettledNodeMap, 2> settledNodes;
+        Graph::NodeId bestNodeId;
+        float bestWeight = std::numeric_limits<float>::infinity();
+        search(localEndPoints, 1.0f, settledNodes, bestNodeId, bestWeight);
+        return weight0 + weight1 <= bestWeight + 0.5f * (index1 - index0);
+    }
+
+    bool RouteFinder::findPathEdge(int direction, Graph::NodeId nodeId0, Graph::NodeId nodeId1, Graph::Edge& matchedEdge) const {
+        // Find the edge between the nodes. Do matching based on node ids.
+        Graph::NodeId prevNodeId = nodeId0;
+        Graph::NodeId nodeId = nodeId1;
+        for (int j = 0; j < 2; j++) {
+            Graph::NodePtr prevNode = _graph->getNode(prevNodeId);
+            for (auto edgeIt = prevNode->firstEdge; edgeIt != prevNode->lastEdge; edgeIt++) {
+                const Graph::Edge edge = *edgeIt;
+                if (edge.targetNodeId == nodeId && ((j == direction && edge.forward) || (j != direction && edge.backward))) {
+                    matchedEdge = edge;
+                    return true;
+                }
+            }
+            std::swap(nodeId, prevNodeId);
+        }
+
+        // If the edge was not found, then we have a link between packages with different node encodings. Check if the link is already known.
+        ShortcutKey linkKey(direction, nodeId0, nodeId1, Graph::NodeId());
+        {
+            std::lock_guard<std::mutex> lock(_cacheMutex);
+            if (_packageLinkCache.read(linkKey, matchedEdge)) {
+                return true;
+            }
+        }
+
+        // Do slow matching, based on geometry, not node ids
+        for (int j = 0; j < 2; j++) {
+            Graph::NodePtr prevNode = _graph->getNode(prevNodeId);
+            Graph::NodePtr node = _graph->getNode(nodeId);
+            std::vector<WGSPos> nodeGeometry = _graph->getNodeGeometry(*node);
+            for (auto edgeIt = prevNode->firstEdge; edgeIt != prevNode->lastEdge; edgeIt++) {
+                const Graph::Edge edge = *edgeIt;
+                if (edge.targetNodeId.blockId.packageId == -1) {
+                    continue;
+                }
+                Graph::NodePtr targetNode = _graph->getNode(edge.targetNodeId);
+                std::vector<WGSPos> targetNodeGeometry = _graph->getNodeGeometry(*targetNode);
+                if (nodeGeometry == targetNodeGeometry && ((j == direction && edge.forward) || (j != direction && edge.backward))) {
+                    matchedEdge = edge;
+
+                    std::lock_guard<std::mutex> lock(_cacheMutex);
+                    _packageLinkCache.put(linkKey, matchedEdge);
+                    return true;
+                }
+            }
+            std::swap(nodeId, prevNodeId);
+        }
+        return false;
+    }
+
+    Result RouteFinder::buildResult(const EndPoints& endPoints, const std::vector<PathNode>& path, const RouteOptions& options) const {
+        const std::array<std::vector<Graph::NearestNode>, 2>& nearestNodes = endPoints.nearestNodes;
+
+        // The result geometry is simplified incrementally between the kept vertices. With a geometry handler, the detailed vertices are only passed to the handler
+        // and the result keeps the overview geometry, or just the instruction vertices if no tolerance is given.
+        double tolerance = (options.overviewTolerance > 0 ? options.overviewTolerance : options.geometryHandler ? std::numeric_limits<double>::infinity() : 0.0);
         std::vector<WGSPos> routeVertices;
+        std::vector<WGSPos> pendingVertices; // detailed vertices starting from the last kept vertex, if simplifying
+        std::vector<WGSPos> chunkVertices;   // detailed vertices not yet passed to the geometry handler
+        std::size_t vertexCount = 0;
+        WGSPos lastVertex(0, 0);
+        auto keepLastVertex = [&]() {
+            if (tolerance > 0 && !pendingVertices.empty()) {
+                std::vector<std::size_t> vertexIndices = simplifyGeometry(pendingVertices, tolerance, std::vector<bool>(pendingVertices.size(), false));
+                for (std::size_t i = (routeVertices.empty() ? 0 : 1); i < vertexIndices.size(); i++) {
+                    routeVertices.push_back(pendingVertices[vertexIndices[i]]);
+                }
+                pendingVertices.erase(pendingVertices.begin(), pendingVertices.end() - 1);
+            }
+            return routeVertices.empty() ? 0 : routeVertices.size() - 1;
+        };
+        auto addVertices = [&](auto begin, auto end) {
+            for (auto it = begin; it != end; it++) {
+                if (vertexCount > 0 && *it == lastVertex) {
+                    continue; // consecutive node geometries share the end vertices
+                }
+                lastVertex = *it;
+                vertexCount++;
+                if (options.geometryHandler) {
+                    chunkVertices.push_back(*it);
+                }
+                if (tolerance > 0) {
+                    pendingVertices.push_back(*it);
+                    if (pendingVertices.size() >= MAX_PENDING_OVERVIEW_VERTICES) {
+                        keepLastVertex();
+                    }
+                }
+                else {
+                    routeVertices.push_back(*it);
+                }
+            }
+        };
+
+        // Construct query result. Street names are looked up only if instructions are requested.
+        std::vector<Instruction> instructions;
+        double totalDist = 0;
+        double totalTime = 0;
         for (std::size_t j = 0; j < path.size(); j++) {
             Graph::NodeId nodeId = path[j].nextNodeId;
             Graph::NodePtr node = _graph->getNode(nodeId);
@@ -262,37 +798,357 @@ namespace carto::osrm {
             }
 
             double dist = calculateGeometryLength(geometry, geometryRelPos.first, geometryRelPos.second);
-            double time = (j > 0 ? path[j].edge.edgeData.weight : node->nodeData.weight) * (geometryRelPos.second - geometryRelPos.first) / 10.0;
-            std::string streetName = _graph->getNodeName(*node);
+            double time = (j > 0 ? path[j].edge.edgeData.weight : getNodeWeight(endPoints.customization.get(), nodeId, *node)) * (geometryRelPos.second - geometryRelPos.first) / 10.0;
+            std::string streetName = (options.instructions ? _graph->getNodeName(*node) : std::string());
+            totalDist += dist;
+            totalTime += time;
 
             // Initial route instruction/vertex
             if (firstNNIndex != std::numeric_limits<std::size_t>::max()) {
-                instructions.emplace_back(Instruction::Type::HEAD_ON, Instruction::TravelMode::DEFAULT, streetName, dist, time, routeVertices.size());
-                routeVertices.push_back(nearestNodes[0][firstNNIndex].nodePos);
+                addVertices(&nearestNodes[0][firstNNIndex].nodePos, &nearestNodes[0][firstNNIndex].nodePos + 1);
+                instructions.emplace_back(Instruction::Type::HEAD_ON, Instruction::TravelMode::DEFAULT, streetName, dist, time, keepLastVertex());
             }
             
-            // Middle instructions/vertices
-            if (!routeVertices.empty() && geometryIndex.first < geometryIndex.second) {
-                if (routeVertices.back() == geometry[geometryIndex.first]) {
-                    routeVertices.pop_back();
-                }
-            }
-            std::size_t vertexIndex = routeVertices.size();
-            routeVertices.insert(routeVertices.end(), geometry.begin() + geometryIndex.first, geometry.begin() + geometryIndex.second);
-            if (j > 0) {
+            // Middle instructions/vertices. The instruction refers to the first vertex of the node geometry.
+            if (j > 0 && options.instructions) {
+                addVertices(geometry.begin() + std::min(geometryIndex.first, geometryIndex.second), geometry.begin() + std::min(geometryIndex.first + 1, geometryIndex.second));
                 Instruction::Type type = static_cast<Instruction::Type>(path[j].edge.edgeData.turnInstruction);
                 Instruction::TravelMode travelMode = static_cast<Instruction::TravelMode>(node->nodeData.travelMode);
-                instructions.emplace_back(type, travelMode, streetName, dist, time, vertexIndex);
+                instructions.emplace_back(type, travelMode, streetName, dist, time, keepLastVertex());
+            }
+            if (geometryIndex.first < geometryIndex.second) {
+                addVertices(geometry.begin() + geometryIndex.first, geometry.begin() + geometryIndex.second);
             }
 
             // Final instruction/vertex
             if (lastNNIndex != std::numeric_limits<std::size_t>::max()) {
-                instructions.emplace_back(Instruction::Type::REACHED_YOUR_DESTINATION, Instruction::TravelMode::DEFAULT, "", 0, 0, routeVertices.size());
-                routeVertices.push_back(nearestNodes[1][lastNNIndex].nodePos);
+                addVertices(&nearestNodes[1][lastNNIndex].nodePos, &nearestNodes[1][lastNNIndex].nodePos + 1);
+                instructions.emplace_back(Instruction::Type::REACHED_YOUR_DESTINATION, Instruction::TravelMode::DEFAULT, "", 0, 0, keepLastVertex());
+            }
+
+            // Pass the vertices of the node to the handler
+            if (options.geometryHandler && !chunkVertices.empty()) {
+                options.geometryHandler(chunkVertices);
+                chunkVertices.clear();
+            }
+        }
+        if (vertexCount > 0) {
+            keepLastVertex();
+        }
+
+        return Result(std::move(instructions), std::move(routeVertices), totalDist, totalTime);
+    }
+
+    std::vector<std::size_t> RouteFinder::simplifyGeometry(const std::vector<WGSPos>& geometry, double tolerance, std::vector<bool> keepVertices) {
+        static const double degToRad = boost::math::constants::pi<double>() / 180.0;
+
+        // Douglas-Peucker over local equirectangular projection. The explicitly kept vertices split the geometry into independently simplified ranges.
+        double lonScale = std::cos(geometry.front()(0) * degToRad);
+        auto project = [&](const WGSPos& pos) {
+            return cglib::vec2<double>(pos(1) * lonScale, pos(0)) * (EARTH_RADIUS * degToRad);
+        };
+        keepVertices.front() = keepVertices.back() = true;
+
+        std::vector<std::pair<std::size_t, std::size_t>> ranges;
+        for (std::size_t i = 0, j = 1; j < geometry.size(); j++) {
+            if (keepVertices[j]) {
+                ranges.emplace_back(i, j);
+                i = j;
+            }
+        }
+        while (!ranges.empty()) {
+            std::pair<std::size_t, std::size_t> range = ranges.back();
+            ranges.pop_back();
+
+            cglib::vec2<double> p0 = project(geometry[range.first]);
+            cglib::vec2<double> p1 = project(geometry[range.second]);
+            double len2 = cglib::dot_product(p1 - p0, p1 - p0);
+            double maxDist = tolerance;
+            std::size_t maxIndex = range.first;
+            for (std::size_t i = range.first + 1; i < range.second; i++) {
+                cglib::vec2<double> p = project(geometry[i]);
+                double t = (len2 > 0 ? std::max(0.0, std::min(1.0, cglib::dot_product(p - p0, p1 - p0) / len2)) : 0.0);
+                double dist = cglib::length(p - (p0 + (p1 - p0) * t));
+                if (dist > maxDist) {
+                    maxDist = dist;
+                    maxIndex = i;
+                }
+            }
+            if (maxIndex != range.first) {
+                keepVertices[maxIndex] = true;
+                ranges.emplace_back(range.first, maxIndex);
+                ranges.emplace_back(maxIndex, range.second);
             }
         }
 
-        return Result(std::move(instructions), std::move(routeVertices));
+        std::vector<std::size_t> vertexIndices;
+        for (std::size_t i = 0; i < geometry.size(); i++) {
+            if (keepVertices[i]) {
+                vertexIndices.push_back(i);
+            }
+        }
+        return vertexIndices;
+    }
+
+    std::shared_ptr<const RouteFinder::Customization> RouteFinder::customize(const WeightOverlay& weightOverlay, const Customization* prevCustomization) const {
+        auto customization = std::make_shared<Customization>();
+        customization->cacheGeneration = _graph->getCacheGeneration();
+
+        // Resolve the overlay segments to nodes, by matching the first and last vertex of the node geometry
+        std::vector<std::pair<WeightOverlay::Segment, float>> speedFactors = weightOverlay.getSpeedFactors();
+        std::vector<WGSPos> posList;
+        for (const std::pair<WeightOverlay::Segment, float>& speedFactor : speedFactors) {
+            posList.push_back(speedFactor.first[0]);
+        }
+        for (const std::vector<Graph::NearestNode>& nearestNodes : _graph->findNearestNodes(posList)) {
+            for (const Graph::NearestNode& nearestNode : nearestNodes) {
+                std::vector<WGSPos> geometry = _graph->getNodeGeometry(*_graph->getNode(nearestNode.nodeId));
+                float speedFactor = (geometry.empty() ? 1.0f : weightOverlay.getSpeedFactor(WeightOverlay::Segment {{ geometry.front(), geometry.back() }}));
+                if (speedFactor != 1.0f) {
+                    customization->speedFactors[nearestNode.nodeId] = speedFactor;
+                }
+            }
+        }
+
+        // Packages are contracted separately, so the shortcuts of a package depend only on the speed factors of its own nodes.
+        // Only the packages with modified nodes are customized, the shortcuts of the packages with unchanged speed factors are reused.
+        std::unordered_map<int, std::size_t> nodeCounts;
+        for (auto it = customization->speedFactors.begin(); it != customization->speedFactors.end(); it++) {
+            nodeCounts[it->first.blockId.packageId]++;
+        }
+        std::unordered_set<int> reusedPackageIds;
+        if (prevCustomization && prevCustomization->cacheGeneration == customization->cacheGeneration) {
+            std::unordered_map<int, std::size_t> prevNodeCounts;
+            for (auto it = prevCustomization->speedFactors.begin(); it != prevCustomization->speedFactors.end(); it++) {
+                prevNodeCounts[it->first.blockId.packageId]++;
+            }
+            for (auto it = nodeCounts.begin(); it != nodeCounts.end(); it++) {
+                if (prevNodeCounts[it->first] == it->second) {
+                    reusedPackageIds.insert(it->first);
+                }
+            }
+            for (auto it = customization->speedFactors.begin(); it != customization->speedFactors.end(); it++) {
+                auto prevIt = prevCustomization->speedFactors.find(it->first);
+                if (prevIt == prevCustomization->speedFactors.end() || prevIt->second != it->second) {
+                    reusedPackageIds.erase(it->first.blockId.packageId);
+                }
+            }
+            for (auto it = prevCustomization->shortcuts.begin(); it != prevCustomization->shortcuts.end(); it++) {
+                if (reusedPackageIds.count(it->second.packageId) > 0) {
+                    customization->shortcuts.insert(*it);
+                }
+            }
+        }
+        for (auto it = nodeCounts.begin(); it != nodeCounts.end(); it++) {
+            if (reusedPackageIds.count(it->first) == 0) {
+                customizePackage(it->first, *customization);
+            }
+        }
+        return customization;
+    }
+
+    void RouteFinder::customizePackage(int packageId, Customization& customization) const {
+        // Assign dense indices to the nodes of the package and collect the edge records stored at each node. Records leading to other packages are links, these keep their stored weights.
+        struct Record {
+            std::uint32_t sourceIndex;
+            std::uint32_t targetIndex;
+            Graph::Edge edge;
+        };
+        static constexpr std::uint32_t INVALID_INDEX = std::numeric_limits<std::uint32_t>::max();
+        std::vector<std::uint32_t> blockOffsets;
+        std::vector<Graph::NodeId> nodeIds;
+        for (int i = 0; i < _graph->getNodeBlockCount(packageId); i++) {
+            Graph::BlockId blockId(packageId, i);
+            blockOffsets.push_back(static_cast<std::uint32_t>(nodeIds.size()));
+            for (int j = 0; j < _graph->getNodeBlockSize(blockId); j++) {
+                nodeIds.emplace_back(blockId, j);
+            }
+        }
+        auto getNodeIndex = [&blockOffsets, packageId](Graph::NodeId nodeId) {
+            if (nodeId.blockId.packageId != packageId || nodeId.blockId.blockIndex < 0 || static_cast<std::size_t>(nodeId.blockId.blockIndex) >= blockOffsets.size()) {
+                return INVALID_INDEX;
+            }
+            return blockOffsets[nodeId.blockId.blockIndex] + static_cast<std::uint32_t>(nodeId.elementIndex);
+        };
+
+        std::vector<Record> records;
+        std::vector<std::uint32_t> recordOffsets(nodeIds.size() + 1, 0);
+        std::vector<std::uint32_t> lowerOffsets(nodeIds.size() + 1, 0);
+        for (std::uint32_t u = 0; u < nodeIds.size(); u++) {
+            Graph::NodePtr node = _graph->getNode(nodeIds[u]);
+            for (auto edgeIt = node->firstEdge; edgeIt != node->lastEdge; edgeIt++) {
+                const Graph::Edge edge = *edgeIt;
+                std::uint32_t w = getNodeIndex(edge.targetNodeId);
+                if (w != INVALID_INDEX && w != u) {
+                    records.push_back(Record { u, w, edge });
+                    lowerOffsets[w + 1]++;
+                }
+            }
+            recordOffsets[u + 1] = static_cast<std::uint32_t>(records.size());
+        }
+
+        // Edges are stored at the lower ranked end node, so each node also needs the records stored at its lower neighbors, sorted by the neighbor
+        for (std::size_t u = 0; u < nodeIds.size(); u++) {
+            lowerOffsets[u + 1] += lowerOffsets[u];
+        }
+        std::vector<std::uint32_t> lowerRecords(records.size());
+        {
+            std::vector<std::uint32_t> lowerCounts(lowerOffsets.begin(), lowerOffsets.end() - 1);
+            for (std::uint32_t r = 0; r < records.size(); r++) {
+                lowerRecords[lowerCounts[records[r].targetIndex]++] = r;
+            }
+        }
+
+        // Process the nodes in contraction order: a node is processed once all its lower neighbors are processed.
+        // If the order is inconsistent, the nodes on the cycles and above them are not processed and their shortcuts keep the stored weights.
+        std::vector<std::uint32_t> order;
+        order.reserve(nodeIds.size());
+        {
+            std::vector<std::uint32_t> inDegrees(nodeIds.size());
+            for (std::size_t u = 0; u < nodeIds.size(); u++) {
+                inDegrees[u] = lowerOffsets[u + 1] - lowerOffsets[u];
+                if (inDegrees[u] == 0) {
+                    order.push_back(static_cast<std::uint32_t>(u));
+                }
+            }
+            for (std::size_t i = 0; i < order.size(); i++) {
+                for (std::uint32_t r = recordOffsets[order[i]]; r < recordOffsets[order[i] + 1]; r++) {
+                    if (--inDegrees[records[r].targetIndex] == 0) {
+                        order.push_back(records[r].targetIndex);
+                    }
+                }
+            }
+        }
+
+        // Customize the records bottom-up. Original edge weights consist mostly of the source node weight, so the source node speed factor is applied to the whole edge.
+        // A shortcut u-w takes the best path over the lower triangles u-v-w, preferring the stored contracted node in case of ties. Only the upward closure of the modified
+        // nodes is customized: shortcuts whose end nodes have no lower records with changed weights keep the stored weights.
+        auto getSpeedFactor = [&](std::uint32_t u) {
+            auto it = customization.speedFactors.find(nodeIds[u]);
+            return it == customization.speedFactors.end() ? 1.0f : it->second;
+        };
+        static constexpr float INF = std::numeric_limits<float>::infinity();
+        std::vector<std::array<float, 2>> weights(records.size(), {{ INF, INF }}); // forward (source to target) and backward (target to source) weights
+        std::vector<bool> changedNodes(nodeIds.size(), false); // nodes having lower records with changed weights
+        for (std::uint32_t u : order) {
+            for (std::uint32_t r = recordOffsets[u]; r < recordOffsets[u + 1]; r++) {
+                const Record& record = records[r];
+                std::uint32_t w = record.targetIndex;
+                float storedWeight = static_cast<float>(record.edge.edgeData.weight);
+                std::array<bool, 2> flags {{ record.edge.forward, record.edge.backward }};
+                std::array<float, 2> storedWeights {{ flags[0] ? storedWeight : INF, flags[1] ? storedWeight : INF }};
+                if (!record.edge.contracted) {
+                    weights[r] = {{ flags[0] ? storedWeight / getSpeedFactor(u) : INF, flags[1] ? storedWeight / getSpeedFactor(w) : INF }};
+                    if (weights[r] != storedWeights) {
+                        changedNodes[w] = true;
+                    }
+                    continue;
+                }
+                if (!changedNodes[u] && !changedNodes[w]) {
+                    weights[r] = storedWeights;
+                    continue;
+                }
+
+                std::array<std::uint32_t, 2> bestIndices {{ INVALID_INDEX, INVALID_INDEX }};
+                std::uint32_t i0 = lowerOffsets[u], i1 = lowerOffsets[w];
+                while (i0 < lowerOffsets[u + 1] && i1 < lowerOffsets[w + 1]) {
+                    std::uint32_t v0 = records[lowerRecords[i0]].sourceIndex, v1 = records[lowerRecords[i1]].sourceIndex;
+                    if (v0 != v1) {
+                        (v0 < v1 ? i0 : i1)++;
+                        continue;
+                    }
+                    const std::array<float, 2>& weightsVU = weights[lowerRecords[i0]];
+                    const std::array<float, 2>& weightsVW = weights[lowerRecords[i1]];
+                    std::array<float, 2> triangleWeights {{ weightsVU[1] + weightsVW[0], weightsVW[1] + weightsVU[0] }};
+                    bool stored = (nodeIds[v0] == record.edge.contractedNodeId);
+                    for (int d = 0; d < 2; d++) {
+                        if (flags[d] && triangleWeights[d] < INF && (triangleWeights[d] < weights[r][d] || (triangleWeights[d] == weights[r][d] && stored))) {
+                            weights[r][d] = triangleWeights[d];
+                            bestIndices[d] = v0;
+                        }
+                    }
+                    i0++;
+                    i1++;
+                }
+
+                // Store the directed shortcuts that differ from the packed data. Shortcuts without lower triangles (links to missing packages) keep their stored weights.
+                for (int d = 0; d < 2; d++) {
+                    if (!flags[d]) {
+                        continue;
+                    }
+                    if (bestIndices[d] == INVALID_INDEX) {
+                        weights[r][d] = storedWeight;
+                        continue;
+                    }
+                    if (weights[r][d] != storedWeight) {
+                        changedNodes[w] = true;
+                    }
+                    if (weights[r][d] != storedWeight || !(nodeIds[bestIndices[d]] == record.edge.contractedNodeId)) {
+                        ShortcutKey shortcutKey(0, nodeIds[d == 0 ? u : w], nodeIds[d == 0 ? w : u], Graph::NodeId());
+                        auto it = customization.shortcuts.find(shortcutKey);
+                        if (it == customization.shortcuts.end() || weights[r][d] < it->second.weight) {
+                            customization.shortcuts[shortcutKey] = CustomizedShortcut(weights[r][d], nodeIds[bestIndices[d]], packageId);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    float RouteFinder::getNodeWeight(const Customization* customization, Graph::NodeId nodeId, const Graph::Node& node) {
+        if (customization) {
+            auto it = customization->speedFactors.find(nodeId);
+            if (it != customization->speedFactors.end()) {
+                return node.nodeData.weight / it->second;
+            }
+        }
+        return static_cast<float>(node.nodeData.weight);
+    }
+
+    float RouteFinder::getEdgeWeight(const Customization* customization, Graph::NodeId sourceNodeId, Graph::NodeId targetNodeId, const Graph::Edge& edge) {
+        if (customization) {
+            // Original edge weights consist mostly of the source node weight, so the source node speed factor is applied to the whole edge
+            if (!edge.contracted) {
+                auto it = customization->speedFactors.find(sourceNodeId);
+                if (it != customization->speedFactors.end()) {
+                    return edge.edgeData.weight / it->second;
+                }
+            }
+            else {
+                auto it = customization->shortcuts.find(ShortcutKey(0, sourceNodeId, targetNodeId, Graph::NodeId()));
+                if (it != customization->shortcuts.end()) {
+                    return it->second.weight;
+                }
+            }
+        }
+        return static_cast<float>(edge.edgeData.weight);
+    }
+
+    Graph::NodeId RouteFinder::getContractedNodeId(const Customization* customization, Graph::NodeId sourceNodeId, Graph::NodeId targetNodeId, const Graph::Edge& edge) {
+        if (customization) {
+            auto it = customization->shortcuts.find(ShortcutKey(0, sourceNodeId, targetNodeId, Graph::NodeId()));
+            if (it != customization->shortcuts.end()) {
+                return it->second.contractedNodeId;
+            }
+        }
+        return edge.contractedNodeId;
+    }
+
+    std::shared_ptr<const RouteFinder::Customization> RouteFinder::getCustomization() const {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        return _customization;
+    }
+
+    void RouteFinder::validateCaches() const {
+        // Invalidate cached unpacked shortcuts and package links if new packages were imported. The customization remains valid for the old packages,
+        // the new packages are customized by updateWeightOverlay.
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        int cacheGeneration = _graph->getCacheGeneration();
+        if (cacheGeneration != _cacheGeneration) {
+            _shortcutCache.clear();
+            _packageLinkCache.clear();
+            _cacheGeneration = cacheGeneration;
+        }
     }
 
     double RouteFinder::calculateGeometryLength(const std::vector<WGSPos>& geometry, double t0, double t1) {
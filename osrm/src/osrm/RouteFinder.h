@@ -11,21 +11,78 @@
 #include "Instruction.h"
 #include "Result.h"
 #include "Graph.h"
+#include "WeightOverlay.h"
 
 #include <queue>
 #include <map>
+#include <mutex>
+#include <optional>
+#include <array>
 #include <vector>
 #include <stack>
+#include <functional>
+#include <unordered_map>
 
 namespace carto::osrm {
     class RouteFinder final {
     public:
-        explicit RouteFinder(std::shared_ptr<Graph> graph) : _graph(std::move(graph)) { }
+        struct AlternativeOptions {
+            std::size_t maxRoutes = 3;      // maximum number of routes returned, including the best route
+            std::size_t maxCandidates = 32; // maximum number of via node candidates to unpack and test
+            float maxStretch = 0.25f;       // maximum relative weight increase of an alternative compared to the best route
+            float maxSharing = 0.75f;       // maximum fraction of the alternative weight shared with already accepted routes
+            float localOptimality = 0.25f;  // weight on both sides of the via node, relative to the best route weight, that must form a shortest path
+
+            AlternativeOptions() = default;
+        };
+
+        struct RouteOptions {
+            bool instructions = true;           // build turn instructions with street names, otherwise only the initial and final instructions are built
+            double overviewTolerance = 0.0;     // if positive, the result geometry is simplified with the given tolerance (in meters), keeping the instruction vertices
+            std::function<void(const std::vector<WGSPos>&)> geometryHandler; // optional handler receiving the detailed route geometry in consecutive chunks. If set, the result keeps only the overview geometry, or only the instruction vertices if overviewTolerance is not positive.
+
+            RouteOptions() = default;
+        };
+
+        struct Statistics {
+            std::array<std::size_t, 2> initialNodes {{ 0, 0 }};  // per search direction, more than one node per end-point indicates snapping special cases
+            std::array<std::size_t, 2> heapPushes {{ 0, 0 }};
+            std::array<std::size_t, 2> heapPops {{ 0, 0 }};
+            std::array<std::size_t, 2> settledNodes {{ 0, 0 }};
+            std::array<std::size_t, 2> stalledNodes {{ 0, 0 }};
+            std::size_t blocksTouched = 0;                      // number of distinct node blocks settled by the searches
+            Graph::CacheStatistics cacheStatistics;             // graph cache counters during the query, includes concurrent queries on the same graph
+            double snapTime = 0;                                // time spent in snapping and end-point setup, in seconds
+            double searchTime = 0;                              // time spent in bidirectional search, in seconds
+            double unpackTime = 0;                              // time spent in path unpacking and building the result, in seconds
+
+            Statistics() = default;
+        };
+
+        explicit RouteFinder(std::shared_ptr<Graph> graph) : _graph(std::move(graph)), _shortcutCache(SHORTCUT_CACHE_SIZE), _packageLinkCache(PACKAGE_LINK_CACHE_SIZE) { }
+
+        std::shared_ptr<const WeightOverlay> getWeightOverlay() const;
+        void setWeightOverlay(std::shared_ptr<const WeightOverlay> weightOverlay);
+        void updateWeightOverlay(); // applies the current weight overlay to the packages imported after it was set. Queries do not customize the new packages.
 
         Result find(const Query& query) const;
+        Result find(const Query& query, Statistics& statistics) const;
+        Result find(const Query& query, const RouteOptions& options) const;
+        Result find(const Query& query, const RouteOptions& options, Statistics& statistics) const;
+        Result find(const std::vector<Graph::NearestNode>& sourceNodes, const std::vector<Graph::NearestNode>& targetNodes) const;
+
+        std::vector<Result> findAlternatives(const Query& query, const AlternativeOptions& options) const;
+
+        std::vector<std::vector<double>> calculateTimeMatrix(const std::vector<Graph::NearestNode>& sourceNodes, const std::vector<Graph::NearestNode>& targetNodes, double maxTime) const;
+
+        static double calculateGreatCircleDistance(const WGSPos& p0, const WGSPos& p1);
 
     private:
-        static constexpr double EARTH_RADIUS = 6372797.560856;
+        static constexpr std::size_t SHORTCUT_CACHE_SIZE = 4096;
+
+        static constexpr std::size_t PACKAGE_LINK_CACHE_SIZE = 1024;
+
+        static constexpr std::size_t MAX_PENDING_OVERVIEW_VERTICES = 4096; // detailed vertices buffered for overview simplification before a vertex is kept
 
         struct SearchNode {
             Graph::NodeId nodeId;
@@ -40,6 +97,27 @@ namespace carto::osrm {
             }
         };
 
+        class SearchHeap {
+        public:
+            SearchHeap() = default;
+
+            bool empty() const { return _searchNodes.empty(); }
+            const SearchNode& top() const { return _searchNodes.front(); }
+            const SearchNode* find(Graph::NodeId nodeId) const;
+
+            bool update(const SearchNode& searchNode); // inserts the node or decreases its weight, returns false if the weight is not improved
+            void pop();
+            void clear();
+
+        private:
+            void siftUp(std::size_t index);
+            void siftDown(std::size_t index);
+            void swapNodes(std::size_t index0, std::size_t index1);
+
+            std::vector<SearchNode> _searchNodes;
+            std::unordered_map<Graph::NodeId, std::size_t, Graph::NodeId::Hash> _searchNodeIndices;
+        };
+
         struct PathNode {
             Graph::NodeId prevNodeId;
             Graph::Edge edge;
@@ -49,11 +127,103 @@ namespace carto::osrm {
             PathNode(Graph::NodeId prevNodeId, const Graph::Edge& edge, Graph::NodeId nextNodeId) : prevNodeId(prevNodeId), edge(edge), nextNodeId(nextNodeId) { }
         };
 
-        static double calculateGeometryLength(const std::vector<WGSPos>& geometry, double t0, double t1);
+        struct ShortcutKey {
+            int direction = 0;
+            Graph::NodeId nodeId0;
+            Graph::NodeId nodeId1;
+            Graph::NodeId contractedNodeId;
 
-        static double calculateGreatCircleDistance(const WGSPos& p0, const WGSPos& p1);
+            ShortcutKey() = default;
+            explicit ShortcutKey(int direction, Graph::NodeId nodeId0, Graph::NodeId nodeId1, Graph::NodeId contractedNodeId) : direction(direction), nodeId0(nodeId0), nodeId1(nodeId1), contractedNodeId(contractedNodeId) { }
+
+            bool operator == (const ShortcutKey& key) const { return direction == key.direction && nodeId0 == key.nodeId0 && nodeId1 == key.nodeId1 && contractedNodeId == key.contractedNodeId; }
+
+            struct Hash {
+                std::size_t operator() (const ShortcutKey& key) const { return ((Graph::NodeId::Hash()(key.nodeId0) * 31 ^ Graph::NodeId::Hash()(key.nodeId1)) * 31 ^ Graph::NodeId::Hash()(key.contractedNodeId)) * 2 + key.direction; }
+            };
+        };
+
+        struct UnpackTask {
+            std::pair<Graph::NodeId, Graph::NodeId> nodeIds;
+            std::optional<ShortcutKey> shortcutKey; // if set, the task stores the shortcut unpacked from pathIndex onwards
+            std::size_t pathIndex = 0;
+
+            UnpackTask() = default;
+            explicit UnpackTask(Graph::NodeId nodeId0, Graph::NodeId nodeId1) : nodeIds(nodeId0, nodeId1) { }
+            explicit UnpackTask(const ShortcutKey& shortcutKey, std::size_t pathIndex) : shortcutKey(shortcutKey), pathIndex(pathIndex) { }
+        };
+
+        struct CustomizedShortcut {
+            float weight = 0.0f;
+            Graph::NodeId contractedNodeId;
+            int packageId = -1; // package storing the shortcut
+
+            CustomizedShortcut() = default;
+            explicit CustomizedShortcut(float weight, Graph::NodeId contractedNodeId, int packageId) : weight(weight), contractedNodeId(contractedNodeId), packageId(packageId) { }
+        };
+
+        struct Customization {
+            std::unordered_map<Graph::NodeId, float, Graph::NodeId::Hash> speedFactors; // resolved overlay speed factors
+            std::unordered_map<ShortcutKey, CustomizedShortcut, ShortcutKey::Hash> shortcuts; // directed shortcuts whose weight or contracted node differs from the stored one
+            int cacheGeneration = 0;                                                         // graph cache generation the customization was built for
+
+            Customization() = default;
+        };
+
+        using SettledNodeMap = std::unordered_map<Graph::NodeId, SearchNode, Graph::NodeId::Hash>;
+        using PathSuffixMap = std::unordered_map<Graph::NodeId, PathNode, Graph::NodeId::Hash>;
+
+        struct EndPoints {
+            std::array<std::vector<Graph::NearestNode>, 2> nearestNodes;
+            std::array<std::vector<SearchNode>, 2> initialNodes;
+            PathSuffixMap pathSuffixMap;
+            std::array<float, 2> minWeights {{ 0.0f, 0.0f }}; // minimum initial node weight per direction, lower bound for all search weights
+            std::shared_ptr<const Customization> customization;
+
+            EndPoints() = default;
+        };
+
+        Result findRoute(const std::vector<Graph::NearestNode>& sourceNodes, const std::vector<Graph::NearestNode>& targetNodes, const RouteOptions& options, Statistics* statistics) const;
+
+        bool findEndPoints(const std::array<std::vector<Graph::NearestNode>, 2>& nearestNodes, EndPoints& endPoints) const;
+
+        void searchBounded(const SearchNode& initialNode, int direction, float maxWeight, const Customization* customization, SettledNodeMap& settledNodes) const;
+
+        void search(const EndPoints& endPoints, float maxWeightFactor, std::array<SettledNodeMap, 2>& settledNodes, Graph::NodeId& bestNodeId, float& bestWeight, Statistics* statistics = nullptr) const;
+
+        bool findPathEdge(int direction, Graph::NodeId nodeId0, Graph::NodeId nodeId1, Graph::Edge& matchedEdge) const;
+
+        bool unpackPath(const std::array<SettledNodeMap, 2>& settledNodes, const EndPoints& endPoints, Graph::NodeId viaNodeId, std::vector<PathNode>& path) const;
+
+        bool isLocallyOptimal(const EndPoints& endPoints, const std::vector<PathNode>& path, Graph::NodeId viaNodeId, float localWeight) const;
+
+        Result buildResult(const EndPoints& endPoints, const std::vector<PathNode>& path, const RouteOptions& options) const;
+
+        std::shared_ptr<const Customization> customize(const WeightOverlay& weightOverlay, const Customization* prevCustomization) const;
+
+        void customizePackage(int packageId, Customization& customization) const;
+
+        static float getNodeWeight(const Customization* customization, Graph::NodeId nodeId, const Graph::Node& node);
+        static float getEdgeWeight(const Customization* customization, Graph::NodeId sourceNodeId, Graph::NodeId targetNodeId, const Graph::Edge& edge);
+        static Graph::NodeId getContractedNodeId(const Customization* customization, Graph::NodeId sourceNodeId, Graph::NodeId targetNodeId, const Graph::Edge& edge);
+
+        std::shared_ptr<const Customization> getCustomization() const;
+
+        void validateCaches() const;
+
+        static std::vector<std::size_t> simplifyGeometry(const std::vector<WGSPos>& geometry, double tolerance, std::vector<bool> keepVertices);
+
+        static double calculateGeometryLength(const std::vector<WGSPos>& geometry, double t0, double t1);
 
         const std::shared_ptr<Graph> _graph;
+
+        mutable cache::lru_cache<ShortcutKey, std::shared_ptr<const std::vector<PathNode>>, ShortcutKey::Hash> _shortcutCache;
+        mutable cache::lru_cache<ShortcutKey, Graph::Edge, ShortcutKey::Hash> _packageLinkCache;
+        mutable int _cacheGeneration = 0;
+        std::shared_ptr<const WeightOverlay> _weightOverlay;
+        mutable std::shared_ptr<const Customization> _customization;
+        mutable std::mutex _cacheMutex;
+        std::mutex _customizationMutex;
     };
 }
 
@@ -0,0 +1,73 @@
+#include "WeightOverlay.h"
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <utf8.h>
+
+namespace carto::osrm {
+    void WeightOverlay::load(const std::string& fileName) {
+        std::ifstream file;
+#ifdef _WIN32
+        std::wstring wfileName;
+        utf8::utf8to16(fileName.begin(), fileName.end(), std::back_inserter(wfileName));
+        file.open(wfileName);
+#else
+        file.open(fileName);
+#endif
+        if (!file) {
+            throw std::runtime_error("Could not open weight overlay file: " + fileName);
+        }
+
+        // Each line contains the first and last vertex of a node geometry (lat0 lon0 lat1 lon1) and the speed factor of the node. Empty lines and lines starting with '#' are ignored.
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream ss(line);
+            Segment segment;
+            float speedFactor = 1.0f;
+            std::string token;
+            if (!(ss >> token) || token[0] == '#') {
+                continue;
+            }
+            ss.seekg(0);
+            if (!(ss >> segment[0](0) >> segment[0](1) >> segment[1](0) >> segment[1](1) >> speedFactor) || !(ss >> token).fail() || !(speedFactor > 0)) {
+                throw std::runtime_error("Illegal weight overlay line: " + line);
+            }
+            setSpeedFactor(segment, speedFactor);
+        }
+    }
+
+    float WeightOverlay::getSpeedFactor(const Segment& segment) const {
+        auto it = _speedFactors.find(getSegmentKey(segment));
+        if (it == _speedFactors.end()) {
+            return 1.0f;
+        }
+        return it->second;
+    }
+
+    void WeightOverlay::setSpeedFactor(const Segment& segment, float speedFactor) {
+        if (speedFactor == 1.0f) {
+            _speedFactors.erase(getSegmentKey(segment));
+        }
+        else {
+            _speedFactors[getSegmentKey(segment)] = std::max(MIN_SPEED_FACTOR, speedFactor);
+        }
+    }
+
+    std::vector<std::pair<WeightOverlay::Segment, float>> WeightOverlay::getSpeedFactors() const {
+        std::vector<std::pair<Segment, float>> speedFactors;
+        speedFactors.reserve(_speedFactors.size());
+        for (auto it = _speedFactors.begin(); it != _speedFactors.end(); it++) {
+            Segment segment {{ WGSPos(it->first[0], it->first[1]) / COORDINATE_PRECISION, WGSPos(it->first[2], it->first[3]) / COORDINATE_PRECISION }};
+            speedFactors.emplace_back(segment, it->second);
+        }
+        return speedFactors;
+    }
+
+    WeightOverlay::SegmentKey WeightOverlay::getSegmentKey(const Segment& segment) {
+        return SegmentKey {{ std::llround(segment[0](0) * COORDINATE_PRECISION), std::llround(segment[0](1) * COORDINATE_PRECISION), std::llround(segment[1](0) * COORDINATE_PRECISION), std::llround(segment[1](1) * COORDINATE_PRECISION) }};
+    }
+}
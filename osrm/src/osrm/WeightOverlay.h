@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2016 CartoDB. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://cartodb.com/terms/
+ */
+
+#ifndef _CARTO_OSRM_WEIGHTOVERLAY_H_
+#define _CARTO_OSRM_WEIGHTOVERLAY_H_
+
+#include "Base.h"
+
+#include <array>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace carto::osrm {
+    class WeightOverlay final {
+    public:
+        // Directed road segment, given by the first and last vertex of the node geometry. Unlike graph node ids, these stay valid when the packages are rebuilt.
+        using Segment = std::array<WGSPos, 2>;
+
+        WeightOverlay() = default;
+
+        void load(const std::string& fileName);
+
+        bool empty() const { return _speedFactors.empty(); }
+
+        float getSpeedFactor(const Segment& segment) const;
+        void setSpeedFactor(const Segment& segment, float speedFactor);
+
+        std::vector<std::pair<Segment, float>> getSpeedFactors() const;
+
+    private:
+        static constexpr float MIN_SPEED_FACTOR = 0.01f;
+
+        static constexpr double COORDINATE_PRECISION = 1.0e6; // same as the package coordinate precision
+
+        using SegmentKey = std::array<long long, 4>;
+
+        struct SegmentKeyHash {
+            std::size_t operator() (const SegmentKey& key) const { return ((std::hash<long long>()(key[0]) * 31 ^ std::hash<long long>()(key[1])) * 31 ^ std::hash<long long>()(key[2])) * 31 ^ std::hash<long long>()(key[3]); }
+        };
+
+        static SegmentKey getSegmentKey(const Segment& segment);
+
+        std::unordered_map<SegmentKey, float, SegmentKeyHash> _speedFactors;
+    };
+}
+
+#endif
@@ -0,0 +1,380 @@
+// Routing benchmark for sgre using procedurally generated multi-floor venues.
+// Usage: sgre_benchmark [--floors N] [--blocks N] [--queries N] [--seed N] [--threads 1,2,4] [--hierarchy] [--landmarks N] [--geojson venue.geojson] [--output results.csv]
+// Each floor consists of a corridor grid around blocks of 2x2 rooms. Rooms are connected to corridors by doors, floors by stairs and elevators.
+// The venue and the query sets are generated from the given settings and seed, so runs with the same arguments are comparable.
+// With --hierarchy the queries use contraction hierarchy search, the hierarchy is built before each run.
+// With --landmarks N the queries use ALT heuristics with N landmarks, the landmark tables are built before each run.
+
+#include "sgre/Rule.h"
+#include "sgre/Query.h"
+#include "sgre/Result.h"
+#include "sgre/GraphBuilder.h"
+#include "sgre/RouteFinder.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include <picojson/picojson.h>
+
+using namespace carto::sgre;
+
+struct VenueSettings {
+    int floors = 3;
+    int blocks = 8;             // number of room blocks per floor side
+    double blockSize = 20.0;    // in meters, each block contains 2x2 rooms
+    double corridorWidth = 4.0; // in meters
+    double floorHeight = 4.0;   // in meters
+    int connectorStep = 3;      // stairs and elevators are placed at every n-th corridor crossing
+    Point origin = Point(24.7536, 59.4370, 0.0);
+};
+
+struct QuerySet {
+    std::string name;
+    std::vector<Query> queries;
+};
+
+struct RunResult {
+    std::vector<double> latencies;
+    double wallTime = 0;
+};
+
+static const char* RULES = R"R([
+    { "search": "surface", "speed": 1.3 },
+    { "filters": [{ "class": "door" }], "search": "none", "link": "endpoints", "delay": 2.0 },
+    { "filters": [{ "class": "stairs" }], "search": "none", "link": "endpoints", "speed": 0.6, "zspeed": 0.3 },
+    { "filters": [{ "class": "elevator" }], "search": "none", "link": "endpoints", "zspeed": 1.0, "delay": 30.0 }
+])R";
+
+static Point toVenuePoint(const VenueSettings& settings, double x, double y, int floor) {
+    static constexpr double METERS_PER_DEGREE = 6378137.0 * 3.14159265358979323846 / 180.0;
+    double lngScale = std::cos(settings.origin(1) * 3.14159265358979323846 / 180.0);
+    return Point(settings.origin(0) + x / (METERS_PER_DEGREE * lngScale), settings.origin(1) + y / METERS_PER_DEGREE, floor * settings.floorHeight);
+}
+
+static double getFloorExtent(const VenueSettings& settings) {
+    return settings.blocks * settings.blockSize + (settings.blocks + 1) * settings.corridorWidth;
+}
+
+static void writeCoordinates(std::ostream& os, const std::vector<Point>& coords) {
+    os << "[";
+    for (std::size_t i = 0; i < coords.size(); i++) {
+        os << (i > 0 ? "," : "") << "[" << coords[i](0) << "," << coords[i](1) << "," << coords[i](2) << "]";
+    }
+    os << "]";
+}
+
+static std::string generateVenue(const VenueSettings& settings, std::size_t& featureCount) {
+    std::ostringstream os;
+    os.precision(12);
+    os << "{\"type\":\"FeatureCollection\",\"features\":[";
+    featureCount = 0;
+    auto beginFeature = [&](const std::string& properties, const std::string& geometryType) {
+        os << (featureCount++ > 0 ? ",\n" : "") << "{\"type\":\"Feature\",\"properties\":" << properties << ",\"geometry\":{\"type\":\"" << geometryType << "\",\"coordinates\":";
+    };
+    auto endFeature = [&]() {
+        os << "}}";
+    };
+    auto makeRect = [&](double x0, double y0, double x1, double y1, int floor) {
+        return std::vector<Point> { toVenuePoint(settings, x0, y0, floor), toVenuePoint(settings, x1, y0, floor), toVenuePoint(settings, x1, y1, floor), toVenuePoint(settings, x0, y1, floor), toVenuePoint(settings, x0, y0, floor) };
+    };
+
+    double extent = getFloorExtent(settings);
+    double step = settings.blockSize + settings.corridorWidth;
+    double roomSize = settings.blockSize * 0.5;
+    for (int floor = 0; floor < settings.floors; floor++) {
+        // Corridors: the floor outline with the blocks as holes
+        beginFeature("{\"class\":\"corridor\",\"floor\":" + std::to_string(floor) + "}", "Polygon");
+        os << "[";
+        writeCoordinates(os, makeRect(0, 0, extent, extent, floor));
+        for (int i = 0; i < settings.blocks; i++) {
+            for (int j = 0; j < settings.blocks; j++) {
+                double x0 = settings.corridorWidth + i * step, y0 = settings.corridorWidth + j * step;
+                os << ",";
+                writeCoordinates(os, makeRect(x0, y0, x0 + settings.blockSize, y0 + settings.blockSize, floor));
+            }
+        }
+        os << "]";
+        endFeature();
+
+        // Rooms with doors to the corridor on the outer side of the block
+        for (int i = 0; i < settings.blocks; i++) {
+            for (int j = 0; j < settings.blocks; j++) {
+                for (int q = 0; q < 4; q++) {
+                    double x0 = settings.corridorWidth + i * step + (q % 2) * roomSize, y0 = settings.corridorWidth + j * step + (q / 2) * roomSize;
+                    beginFeature("{\"class\":\"room\",\"floor\":" + std::to_string(floor) + "}", "Polygon");
+                    os << "[";
+                    writeCoordinates(os, makeRect(x0, y0, x0 + roomSize, y0 + roomSize, floor));
+                    os << "]";
+                    endFeature();
+
+                    double doorX = x0 + roomSize * 0.5, doorY = (q / 2 == 0 ? y0 : y0 + roomSize);
+                    double doorDir = (q / 2 == 0 ? -1.0 : 1.0);
+                    beginFeature("{\"class\":\"door\"}", "LineString");
+                    writeCoordinates(os, { toVenuePoint(settings, doorX, doorY - doorDir, floor), toVenuePoint(settings, doorX, doorY + doorDir, floor) });
+                    endFeature();
+                }
+            }
+        }
+
+        // Stairs and elevators to the next floor at corridor crossings
+        if (floor + 1 < settings.floors) {
+            for (int i = 0; i <= settings.blocks; i += settings.connectorStep) {
+                for (int j = 0; j <= settings.blocks; j += settings.connectorStep) {
+                    double x = settings.corridorWidth * 0.5 + i * step, y = settings.corridorWidth * 0.5 + j * step;
+                    double offset = settings.corridorWidth * 0.3;
+                    if ((i + j) % 2 == 0) {
+                        beginFeature("{\"class\":\"stairs\"}", "LineString");
+                        writeCoordinates(os, { toVenuePoint(settings, x - offset, y, floor), toVenuePoint(settings, x + offset, y, floor + 1) });
+                    } else {
+                        beginFeature("{\"class\":\"elevator\"}", "LineString");
+                        writeCoordinates(os, { toVenuePoint(settings, x, y, floor), toVenuePoint(settings, x, y, floor + 1) });
+                    }
+                    endFeature();
+                }
+            }
+        }
+    }
+    os << "]}";
+    return os.str();
+}
+
+static std::vector<QuerySet> buildQuerySets(const VenueSettings& settings, std::size_t queryCount, std::mt19937& rng) {
+    std::vector<QuerySet> querySets(2);
+    querySets[0].name = "same floor";
+    querySets[1].name = "cross floor";
+
+    std::uniform_real_distribution<double> posDist(0.0, getFloorExtent(settings));
+    std::uniform_int_distribution<int> floorDist(0, settings.floors - 1);
+    for (std::size_t i = 0; i < queryCount; i++) {
+        int floor0 = floorDist(rng);
+        int floor1 = (settings.floors > 1 ? (floor0 + 1 + std::uniform_int_distribution<int>(0, settings.floors - 2)(rng)) % settings.floors : floor0);
+        double x0 = posDist(rng), y0 = posDist(rng), x1 = posDist(rng), y1 = posDist(rng);
+        querySets[0].queries.emplace_back(toVenuePoint(settings, x0, y0, floor0), toVenuePoint(settings, x1, y1, floor0));
+        querySets[1].queries.emplace_back(toVenuePoint(settings, x0, y0, floor0), toVenuePoint(settings, x1, y1, floor1));
+    }
+    return querySets;
+}
+
+static RunResult runQueries(std::size_t queryCount, std::size_t threadCount, const std::function<void(std::size_t)>& queryFunc) {
+    RunResult runResult;
+    runResult.latencies.resize(queryCount);
+
+    std::atomic<std::size_t> nextIndex(0);
+    auto worker = [&]() {
+        for (std::size_t index = nextIndex++; index < queryCount; index = nextIndex++) {
+            auto startTime = std::chrono::steady_clock::now();
+            queryFunc(index);
+            runResult.latencies[index] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        }
+    };
+
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < threadCount; i++) {
+        threads.emplace_back(worker);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    runResult.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    return runResult;
+}
+
+static double getPercentile(std::vector<double> values, double percentile) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::size_t index = std::min(values.size() - 1, static_cast<std::size_t>(percentile * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static double getPeakMemoryUsage() { // in megabytes
+#if defined(__APPLE__)
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss / (1024.0 * 1024.0) : 0.0; // in bytes
+#elif defined(__unix__)
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss / 1024.0 : 0.0; // in kilobytes
+#else
+    return 0.0;
+#endif
+}
+
+static void printPercentiles(const std::string& name, const std::vector<double>& values) {
+    std::printf("%-28s %-12s p50=%.3fms p90=%.3fms p99=%.3fms max=%.3fms\n", "", name.c_str(),
+        getPercentile(values, 0.50), getPercentile(values, 0.90), getPercentile(values, 0.99), getPercentile(values, 1.0));
+}
+
+static void printReport(const std::string& name, std::size_t threadCount, const RunResult& runResult, const std::vector<RouteFinder::Statistics>& statisticsList, std::size_t failures) {
+    std::printf("%-28s threads=%-2zu queries=%-6zu p50=%.3fms p90=%.3fms p99=%.3fms max=%.3fms throughput=%.1f/s failures=%zu\n",
+        name.c_str(), threadCount, runResult.latencies.size(),
+        getPercentile(runResult.latencies, 0.50), getPercentile(runResult.latencies, 0.90), getPercentile(runResult.latencies, 0.99), getPercentile(runResult.latencies, 1.0),
+        runResult.wallTime > 0 ? runResult.latencies.size() / runResult.wallTime : 0.0, failures);
+
+    std::vector<double> snapTimes, searchTimes, straighteningTimes, resultTimes;
+    double nodeQueuePops = 0;
+    for (const RouteFinder::Statistics& statistics : statisticsList) {
+        snapTimes.push_back(statistics.snapTime * 1000);
+        searchTimes.push_back(statistics.searchTime * 1000);
+        straighteningTimes.push_back(statistics.straighteningTime * 1000);
+        resultTimes.push_back(statistics.resultTime * 1000);
+        nodeQueuePops += statistics.nodeQueuePops;
+    }
+    printPercentiles("snap", snapTimes);
+    printPercentiles("search", searchTimes);
+    printPercentiles("straighten", straighteningTimes);
+    printPercentiles("result", resultTimes);
+    std::printf("%-28s mean per query: pops=%.1f\n", "", statisticsList.empty() ? 0.0 : nodeQueuePops / statisticsList.size());
+}
+
+int main(int argc, char* argv[]) {
+    VenueSettings settings;
+    std::size_t queryCount = 1000;
+    unsigned int seed = 1;
+    std::vector<std::size_t> threadCounts = { 1, 2, 4 };
+    std::string geoJSONFileName;
+    std::string outputFileName;
+    bool hierarchy = false;
+    std::size_t landmarks = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--floors" && i + 1 < argc) {
+            settings.floors = std::max(1, std::stoi(argv[++i]));
+        }
+        else if (arg == "--blocks" && i + 1 < argc) {
+            settings.blocks = std::max(1, std::stoi(argv[++i]));
+        }
+        else if (arg == "--queries" && i + 1 < argc) {
+            queryCount = std::stoul(argv[++i]);
+        }
+        else if (arg == "--seed" && i + 1 < argc) {
+            seed = static_cast<unsigned int>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--threads" && i + 1 < argc) {
+            threadCounts.clear();
+            std::istringstream ss(argv[++i]);
+            for (std::string token; std::getline(ss, token, ','); ) {
+                threadCounts.push_back(std::max<std::size_t>(1, std::stoul(token)));
+            }
+        }
+        else if (arg == "--hierarchy") {
+            hierarchy = true;
+        }
+        else if (arg == "--landmarks" && i + 1 < argc) {
+            landmarks = std::stoul(argv[++i]);
+        }
+        else if (arg == "--geojson" && i + 1 < argc) {
+            geoJSONFileName = argv[++i];
+        }
+        else if (arg == "--output" && i + 1 < argc) {
+            outputFileName = argv[++i];
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--floors N] [--blocks N] [--queries N] [--seed N] [--threads 1,2,4] [--hierarchy] [--landmarks N] [--geojson venue.geojson] [--output results.csv]" << std::endl;
+            return 1;
+        }
+    }
+
+    try {
+        // Generate the venue and build the graph
+        std::size_t featureCount = 0;
+        std::string geoJSON = generateVenue(settings, featureCount);
+        if (!geoJSONFileName.empty()) {
+            std::ofstream(geoJSONFileName) << geoJSON;
+        }
+        std::printf("%-28s floors=%d blocks=%d features=%zu size=%.1fMB\n", "venue", settings.floors, settings.blocks, featureCount, geoJSON.size() / (1024.0 * 1024.0));
+
+        picojson::value rulesDef;
+        std::string err = picojson::parse(rulesDef, RULES);
+        if (!err.empty()) {
+            throw std::runtime_error("Failed to parse rules: " + err);
+        }
+
+        double memoryBefore = getPeakMemoryUsage();
+        auto startTime = std::chrono::steady_clock::now();
+        GraphBuilder graphBuilder(RuleList::parse(rulesDef));
+        std::istringstream geoJSONStream(geoJSON);
+        graphBuilder.importGeoJSON(geoJSONStream);
+        double importTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        startTime = std::chrono::steady_clock::now();
+        std::shared_ptr<const StaticGraph> graph = graphBuilder.build();
+        double buildTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        double memoryAfter = getPeakMemoryUsage();
+
+        std::ostringstream graphStream;
+        graph->save(graphStream);
+        std::printf("%-28s import=%.3fs build=%.3fs nodes=%zu edges=%zu serialized=%.1fMB peakmemory=%.1fMB (+%.1fMB)\n", "graph",
+            importTime, buildTime, static_cast<std::size_t>(graph->getNodeIdRangeEnd()), static_cast<std::size_t>(graph->getEdgeIdRangeEnd()),
+            graphStream.str().size() / (1024.0 * 1024.0), memoryAfter, memoryAfter - memoryBefore);
+
+        std::mt19937 rng(seed);
+        std::vector<QuerySet> querySets = buildQuerySets(settings, queryCount, rng);
+
+        std::ofstream outputFile;
+        if (!outputFileName.empty()) {
+            outputFile.open(outputFileName);
+            outputFile << "set,index,lon0,lat0,z0,lon1,lat1,z1,status,distance,time\n";
+        }
+
+        // Each run uses a fresh route finder, so that cached workspaces and tables are built during the run
+        for (const QuerySet& querySet : querySets) {
+            for (std::size_t threadCount : threadCounts) {
+                RouteFinder routeFinder(graph);
+                if ((hierarchy || landmarks > 0) && !querySet.queries.empty()) {
+                    RouteFinder::RouteOptions routeOptions;
+                    routeOptions.contractionHierarchy = hierarchy;
+                    routeOptions.landmarks = landmarks;
+                    routeFinder.setRouteOptions(routeOptions);
+
+                    // The hierarchy is built explicitly, the landmark tables are built by the first query
+                    auto startTime = std::chrono::steady_clock::now();
+                    if (hierarchy) {
+                        routeFinder.prepareHierarchy();
+                    } else {
+                        routeFinder.find(querySet.queries.front());
+                    }
+                    std::printf("%-28s prepare=%.3fs\n", hierarchy ? "hierarchy" : "landmarks", std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+                }
+                std::vector<Result> results(querySet.queries.size());
+                std::vector<RouteFinder::Statistics> statisticsList(querySet.queries.size());
+                RunResult runResult = runQueries(querySet.queries.size(), threadCount, [&](std::size_t index) {
+                    results[index] = routeFinder.find(querySet.queries[index], statisticsList[index]);
+                });
+
+                std::size_t failures = std::count_if(results.begin(), results.end(), [](const Result& result) { return result.getStatus() != Result::Status::SUCCESS; });
+                printReport("find " + querySet.name, threadCount, runResult, statisticsList, failures);
+
+                if (outputFile.is_open() && threadCount == threadCounts.front()) {
+                    for (std::size_t i = 0; i < results.size(); i++) {
+                        const Query& query = querySet.queries[i];
+                        outputFile << querySet.name << "," << i << "," << query.getPos(0)(0) << "," << query.getPos(0)(1) << "," << query.getPos(0)(2) << "," << query.getPos(1)(0) << "," << query.getPos(1)(1) << "," << query.getPos(1)(2) << ",";
+                        outputFile << (results[i].getStatus() == Result::Status::SUCCESS ? "success" : "failed") << "," << results[i].getTotalDistance() << "," << results[i].getTotalTime() << "\n";
+                    }
+                }
+            }
+        }
+    }
+    catch (const std::exception& ex) {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,327 @@
+#include "ContractionHierarchy.h"
+
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+namespace carto::sgre {
+    ContractionHierarchy::ContractionHierarchy(std::size_t nodeCount, std::vector<Edge> edges) : _edges(std::move(edges)), _nodeRanks(nodeCount, 0) {
+        for (const Edge& edge : _edges) {
+            if (edge.sourceNodeId >= nodeCount || edge.targetNodeId >= nodeCount) {
+                throw std::invalid_argument("Invalid edge node id");
+            }
+            if (!(edge.weight >= 0)) {
+                throw std::invalid_argument("Invalid edge weight");
+            }
+        }
+        contract();
+    }
+
+    bool ContractionHierarchy::findShortestPath(const std::vector<std::pair<NodeId, double>>& initialNodes, const std::vector<std::pair<NodeId, double>>& finalNodes, Path& path, Workspace& workspace, std::size_t* nodeQueuePops) const {
+        std::size_t nodeCount = _nodeRanks.size();
+        std::size_t stamp = ++workspace.stamp;
+        for (int dir = 0; dir < 2; dir++) {
+            if (workspace.stamps[dir].size() < nodeCount) {
+                workspace.weights[dir].resize(nodeCount);
+                workspace.parentEdgeIds[dir].resize(nodeCount);
+                workspace.stamps[dir].resize(nodeCount, 0);
+            }
+            workspace.nodeQueues[dir].clear();
+        }
+        auto getWeight = [&workspace, stamp](int dir, NodeId nodeId) -> double {
+            return (workspace.stamps[dir][nodeId] == stamp ? workspace.weights[dir][nodeId] : std::numeric_limits<double>::infinity());
+        };
+        auto updateWeight = [&workspace, &getWeight, stamp](int dir, NodeId nodeId, double weight, EdgeId parentEdgeId) {
+            if (weight >= getWeight(dir, nodeId)) {
+                return;
+            }
+            workspace.stamps[dir][nodeId] = stamp;
+            workspace.weights[dir][nodeId] = weight;
+            workspace.parentEdgeIds[dir][nodeId] = parentEdgeId;
+            workspace.nodeQueues[dir].push_back({ weight, nodeId });
+            std::push_heap(workspace.nodeQueues[dir].begin(), workspace.nodeQueues[dir].end());
+        };
+
+        // Forward search starts from the initial nodes, backward search from the final nodes
+        for (const std::pair<NodeId, double>& initialNode : initialNodes) {
+            updateWeight(0, initialNode.first, initialNode.second, EdgeId(-1));
+        }
+        for (const std::pair<NodeId, double>& finalNode : finalNodes) {
+            updateWeight(1, finalNode.first, finalNode.second, EdgeId(-1));
+        }
+
+        // Both searches only follow edges to higher ranked nodes. The searches can be stopped once neither can improve the best path.
+        double bestWeight = std::numeric_limits<double>::infinity();
+        NodeId bestNodeId = NodeId(-1);
+        while (true) {
+            int dir = -1;
+            for (int i = 0; i < 2; i++) {
+                const std::vector<SearchRecord>& nodeQueue = workspace.nodeQueues[i];
+                if (!nodeQueue.empty() && nodeQueue.front().weight < bestWeight && (dir == -1 || nodeQueue.front().weight < workspace.nodeQueues[dir].front().weight)) {
+                    dir = i;
+                }
+            }
+            if (dir == -1) {
+                break;
+            }
+
+            std::vector<SearchRecord>& nodeQueue = workspace.nodeQueues[dir];
+            std::pop_heap(nodeQueue.begin(), nodeQueue.end());
+            SearchRecord rec = nodeQueue.back();
+            nodeQueue.pop_back();
+            if (rec.weight > getWeight(dir, rec.nodeId)) {
+                continue;
+            }
+            if (nodeQueuePops) {
+                (*nodeQueuePops)++;
+            }
+
+            double totalWeight = rec.weight + getWeight(1 - dir, rec.nodeId);
+            if (totalWeight < bestWeight) {
+                bestWeight = totalWeight;
+                bestNodeId = rec.nodeId;
+            }
+
+            // Stall-on-demand: the node is not on a shortest path if it can be reached faster through a higher ranked node
+            bool stalled = false;
+            for (std::size_t i = _upwardEdgeOffsets[1 - dir][rec.nodeId]; i < _upwardEdgeOffsets[1 - dir][rec.nodeId + 1]; i++) {
+                const HierarchyEdge& edge = _hierarchyEdges[_upwardEdgeIds[1 - dir][i]];
+                if (getWeight(dir, edge.nodeIds[dir]) + edge.weight < rec.weight) {
+                    stalled = true;
+                    break;
+                }
+            }
+            if (stalled) {
+                continue;
+            }
+
+            for (std::size_t i = _upwardEdgeOffsets[dir][rec.nodeId]; i < _upwardEdgeOffsets[dir][rec.nodeId + 1]; i++) {
+                EdgeId edgeId = _upwardEdgeIds[dir][i];
+                const HierarchyEdge& edge = _hierarchyEdges[edgeId];
+                updateWeight(dir, edge.nodeIds[1 - dir], rec.weight + edge.weight, edgeId);
+            }
+        }
+        if (bestNodeId == NodeId(-1)) {
+            return false;
+        }
+
+        // Collect the hierarchy edges from the initial node to the meeting node and from there to the final node, then unpack the shortcuts
+        std::vector<EdgeId> hierarchyEdgeIds;
+        NodeId nodeId = bestNodeId;
+        for (EdgeId edgeId = workspace.parentEdgeIds[0][nodeId]; edgeId != EdgeId(-1); edgeId = workspace.parentEdgeIds[0][nodeId]) {
+            hierarchyEdgeIds.push_back(edgeId);
+            nodeId = _hierarchyEdges[edgeId].nodeIds[0];
+        }
+        path.initialNodeId = nodeId;
+        std::reverse(hierarchyEdgeIds.begin(), hierarchyEdgeIds.end());
+        nodeId = bestNodeId;
+        for (EdgeId edgeId = workspace.parentEdgeIds[1][nodeId]; edgeId != EdgeId(-1); edgeId = workspace.parentEdgeIds[1][nodeId]) {
+            hierarchyEdgeIds.push_back(edgeId);
+            nodeId = _hierarchyEdges[edgeId].nodeIds[1];
+        }
+        path.finalNodeId = nodeId;
+        path.weight = bestWeight;
+        path.edgeIds.clear();
+        for (EdgeId edgeId : hierarchyEdgeIds) {
+            unpackEdge(edgeId, path.edgeIds, workspace.unpackStack);
+        }
+        return true;
+    }
+
+    void ContractionHierarchy::contract() {
+        std::size_t nodeCount = _nodeRanks.size();
+
+        // Remaining graph of uncontracted nodes. Only the best edge between each pair of nodes is kept.
+        std::vector<std::vector<std::pair<NodeId, EdgeId>>> outEdges(nodeCount), inEdges(nodeCount);
+        auto addRemainingEdge = [&](NodeId sourceNodeId, NodeId targetNodeId, EdgeId edgeId) {
+            auto outIt = std::find_if(outEdges[sourceNodeId].begin(), outEdges[sourceNodeId].end(), [targetNodeId](const std::pair<NodeId, EdgeId>& outEdge) { return outEdge.first == targetNodeId; });
+            if (outIt == outEdges[sourceNodeId].end()) {
+                outEdges[sourceNodeId].emplace_back(targetNodeId, edgeId);
+                inEdges[targetNodeId].emplace_back(sourceNodeId, edgeId);
+            } else if (_hierarchyEdges[edgeId].weight < _hierarchyEdges[outIt->second].weight) {
+                auto inIt = std::find_if(inEdges[targetNodeId].begin(), inEdges[targetNodeId].end(), [sourceNodeId](const std::pair<NodeId, EdgeId>& inEdge) { return inEdge.first == sourceNodeId; });
+                outIt->second = edgeId;
+                inIt->second = edgeId;
+            }
+        };
+        auto removeRemainingEdge = [](std::vector<std::pair<NodeId, EdgeId>>& edges, NodeId nodeId) {
+            edges.erase(std::remove_if(edges.begin(), edges.end(), [nodeId](const std::pair<NodeId, EdgeId>& edge) { return edge.first == nodeId; }), edges.end());
+        };
+
+        _hierarchyEdges.reserve(_edges.size());
+        for (EdgeId edgeId = 0; edgeId < _edges.size(); edgeId++) {
+            const Edge& edge = _edges[edgeId];
+            HierarchyEdge hierarchyEdge;
+            hierarchyEdge.nodeIds = {{ edge.sourceNodeId, edge.targetNodeId }};
+            hierarchyEdge.weight = edge.weight;
+            _hierarchyEdges.push_back(hierarchyEdge);
+
+            // Loops are never part of the shortest paths
+            if (edge.sourceNodeId != edge.targetNodeId) {
+                addRemainingEdge(edge.sourceNodeId, edge.targetNodeId, edgeId);
+            }
+        }
+
+        // Bounded Dijkstra search in the remaining graph, ignoring the node being contracted
+        std::vector<double> witnessWeights(nodeCount, std::numeric_limits<double>::infinity());
+        std::vector<std::size_t> witnessStamps(nodeCount, 0);
+        std::size_t witnessStamp = 0;
+        std::vector<SearchRecord> witnessQueue;
+        auto findWitnesses = [&](NodeId sourceNodeId, NodeId ignoredNodeId, double maxWeight) {
+            witnessStamp++;
+            witnessStamps[sourceNodeId] = witnessStamp;
+            witnessWeights[sourceNodeId] = 0;
+            witnessQueue.assign(1, { 0.0, sourceNodeId });
+            for (std::size_t settledCount = 0; !witnessQueue.empty() && settledCount < MAX_WITNESS_SETTLED_NODES; ) {
+                std::pop_heap(witnessQueue.begin(), witnessQueue.end());
+                SearchRecord rec = witnessQueue.back();
+                witnessQueue.pop_back();
+                if (rec.weight > witnessWeights[rec.nodeId]) {
+                    continue;
+                }
+                if (rec.weight > maxWeight) {
+                    break;
+                }
+                settledCount++;
+
+                for (const std::pair<NodeId, EdgeId>& outEdge : outEdges[rec.nodeId]) {
+                    if (outEdge.first == ignoredNodeId) {
+                        continue;
+                    }
+                    double weight = rec.weight + _hierarchyEdges[outEdge.second].weight;
+                    if (witnessStamps[outEdge.first] != witnessStamp || weight < witnessWeights[outEdge.first]) {
+                        witnessStamps[outEdge.first] = witnessStamp;
+                        witnessWeights[outEdge.first] = weight;
+                        witnessQueue.push_back({ weight, outEdge.first });
+                        std::push_heap(witnessQueue.begin(), witnessQueue.end());
+                    }
+                }
+            }
+        };
+
+        // Count or add the shortcuts needed when the node is contracted
+        auto processNode = [&](NodeId nodeId, bool addShortcuts) -> std::size_t {
+            std::size_t shortcutCount = 0;
+            for (std::size_t i = 0; i < inEdges[nodeId].size(); i++) {
+                NodeId sourceNodeId = inEdges[nodeId][i].first;
+                EdgeId inEdgeId = inEdges[nodeId][i].second;
+                double inWeight = _hierarchyEdges[inEdgeId].weight;
+
+                double maxWeight = 0;
+                for (const std::pair<NodeId, EdgeId>& outEdge : outEdges[nodeId]) {
+                    if (outEdge.first != sourceNodeId) {
+                        maxWeight = std::max(maxWeight, inWeight + _hierarchyEdges[outEdge.second].weight);
+                    }
+                }
+                findWitnesses(sourceNodeId, nodeId, maxWeight);
+
+                for (std::size_t j = 0; j < outEdges[nodeId].size(); j++) {
+                    NodeId targetNodeId = outEdges[nodeId][j].first;
+                    EdgeId outEdgeId = outEdges[nodeId][j].second;
+                    double weight = inWeight + _hierarchyEdges[outEdgeId].weight;
+                    if (targetNodeId == sourceNodeId || (witnessStamps[targetNodeId] == witnessStamp && witnessWeights[targetNodeId] <= weight)) {
+                        continue;
+                    }
+                    shortcutCount++;
+                    if (addShortcuts) {
+                        HierarchyEdge shortcut;
+                        shortcut.nodeIds = {{ sourceNodeId, targetNodeId }};
+                        shortcut.weight = weight;
+                        shortcut.childEdgeIds = {{ inEdgeId, outEdgeId }};
+                        _hierarchyEdges.push_back(shortcut);
+                        addRemainingEdge(sourceNodeId, targetNodeId, _hierarchyEdges.size() - 1);
+                    }
+                }
+            }
+            return shortcutCount;
+        };
+
+        // Contraction priority is based on the edge difference. The number of contracted neighbors and the hierarchy level of the node keep the contraction uniform.
+        std::vector<std::size_t> contractedNeighborCounts(nodeCount, 0);
+        std::vector<std::size_t> nodeLevels(nodeCount, 0);
+        auto calculatePriority = [&](NodeId nodeId) -> double {
+            double edgeDifference = static_cast<double>(processNode(nodeId, false)) - static_cast<double>(inEdges[nodeId].size() + outEdges[nodeId].size());
+            return 2.0 * edgeDifference + static_cast<double>(contractedNeighborCounts[nodeId]) + static_cast<double>(nodeLevels[nodeId]);
+        };
+
+        std::vector<SearchRecord> nodeQueue;
+        nodeQueue.reserve(nodeCount);
+        for (NodeId nodeId = 0; nodeId < nodeCount; nodeId++) {
+            nodeQueue.push_back({ calculatePriority(nodeId), nodeId });
+        }
+        std::make_heap(nodeQueue.begin(), nodeQueue.end());
+
+        // Contract the nodes in the order of their priorities. Priorities are updated lazily, when the node is popped from the queue.
+        std::array<std::vector<std::vector<EdgeId>>, 2> upwardEdgeIds;
+        upwardEdgeIds[0].resize(nodeCount);
+        upwardEdgeIds[1].resize(nodeCount);
+        std::vector<bool> contracted(nodeCount, false);
+        std::size_t rank = 0;
+        while (!nodeQueue.empty()) {
+            std::pop_heap(nodeQueue.begin(), nodeQueue.end());
+            NodeId nodeId = nodeQueue.back().nodeId;
+            nodeQueue.pop_back();
+            if (contracted[nodeId]) {
+                continue;
+            }
+
+            double priority = calculatePriority(nodeId);
+            if (!nodeQueue.empty() && priority > nodeQueue.front().weight) {
+                nodeQueue.push_back({ priority, nodeId });
+                std::push_heap(nodeQueue.begin(), nodeQueue.end());
+                continue;
+            }
+
+            // All remaining neighbors get higher ranks, so the remaining edges of the node are its upward edges
+            _nodeRanks[nodeId] = rank++;
+            contracted[nodeId] = true;
+            for (const std::pair<NodeId, EdgeId>& outEdge : outEdges[nodeId]) {
+                upwardEdgeIds[0][nodeId].push_back(outEdge.second);
+            }
+            for (const std::pair<NodeId, EdgeId>& inEdge : inEdges[nodeId]) {
+                upwardEdgeIds[1][nodeId].push_back(inEdge.second);
+            }
+
+            processNode(nodeId, true);
+
+            for (const std::pair<NodeId, EdgeId>& inEdge : inEdges[nodeId]) {
+                removeRemainingEdge(outEdges[inEdge.first], nodeId);
+                contractedNeighborCounts[inEdge.first]++;
+                nodeLevels[inEdge.first] = std::max(nodeLevels[inEdge.first], nodeLevels[nodeId] + 1);
+            }
+            for (const std::pair<NodeId, EdgeId>& outEdge : outEdges[nodeId]) {
+                removeRemainingEdge(inEdges[outEdge.first], nodeId);
+                contractedNeighborCounts[outEdge.first]++;
+                nodeLevels[outEdge.first] = std::max(nodeLevels[outEdge.first], nodeLevels[nodeId] + 1);
+            }
+            outEdges[nodeId] = std::vector<std::pair<NodeId, EdgeId>>();
+            inEdges[nodeId] = std::vector<std::pair<NodeId, EdgeId>>();
+        }
+
+        // Store the upward edges in compact arrays
+        for (int dir = 0; dir < 2; dir++) {
+            _upwardEdgeOffsets[dir].assign(nodeCount + 1, 0);
+            _upwardEdgeIds[dir].clear();
+            for (NodeId nodeId = 0; nodeId < nodeCount; nodeId++) {
+                _upwardEdgeIds[dir].insert(_upwardEdgeIds[dir].end(), upwardEdgeIds[dir][nodeId].begin(), upwardEdgeIds[dir][nodeId].end());
+                _upwardEdgeOffsets[dir][nodeId + 1] = _upwardEdgeIds[dir].size();
+            }
+        }
+    }
+
+    void ContractionHierarchy::unpackEdge(EdgeId hierarchyEdgeId, std::vector<EdgeId>& edgeIds, std::vector<EdgeId>& unpackStack) const {
+        unpackStack.assign(1, hierarchyEdgeId);
+        while (!unpackStack.empty()) {
+            EdgeId edgeId = unpackStack.back();
+            unpackStack.pop_back();
+
+            const HierarchyEdge& edge = _hierarchyEdges[edgeId];
+            if (edge.childEdgeIds[0] == EdgeId(-1)) {
+                edgeIds.push_back(edgeId);
+                continue;
+            }
+            unpackStack.push_back(edge.childEdgeIds[1]);
+            unpackStack.push_back(edge.childEdgeIds[0]);
+        }
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2016 CartoDB. All rights reserved.
+ * Copying and using this code is allowed only according
+ * to license terms, as given in https://cartodb.com/terms/
+ */
+
+#ifndef _CARTO_SGRE_CONTRACTIONHIERARCHY_H_
+#define _CARTO_SGRE_CONTRACTIONHIERARCHY_H_
+
+#include <cstddef>
+#include <array>
+#include <vector>
+#include <utility>
+
+namespace carto::sgre {
+    class ContractionHierarchy final {
+    public:
+        using NodeId = std::size_t;
+        using EdgeId = std::size_t;
+
+        struct Edge {
+            NodeId sourceNodeId = NodeId(-1);
+            NodeId targetNodeId = NodeId(-1);
+            double weight = 0;
+        };
+
+        struct Path {
+            NodeId initialNodeId = NodeId(-1);
+            NodeId finalNodeId = NodeId(-1);
+            double weight = 0;           // total weight, including the initial and final node weights
+            std::vector<EdgeId> edgeIds; // ids of the original edges along the path, in order
+        };
+
+        struct SearchRecord {
+            double weight;
+            NodeId nodeId;
+
+            bool operator < (const SearchRecord& rec) const { return rec.weight < weight; }
+        };
+
+        struct Workspace {
+            std::array<std::vector<double>, 2> weights;      // best weights per search direction, valid only if the node stamp equals the current stamp
+            std::array<std::vector<EdgeId>, 2> parentEdgeIds; // hierarchy edge used to reach the node, -1 for initial/final nodes
+            std::array<std::vector<std::size_t>, 2> stamps;
+            std::size_t stamp = 0;
+            std::array<std::vector<SearchRecord>, 2> nodeQueues;
+            std::vector<EdgeId> unpackStack;
+        };
+
+        ContractionHierarchy() = delete;
+        explicit ContractionHierarchy(std::size_t nodeCount, std::vector<Edge> edges);
+
+        std::size_t getNodeCount() const { return _nodeRanks.size(); }
+        std::size_t getEdgeCount() const { return _edges.size(); }
+        std::size_t getShortcutCount() const { return _hierarchyEdges.size() - _edges.size(); }
+
+        const Edge& getEdge(EdgeId edgeId) const { return _edges.at(edgeId); }
+
+        // Finds the path with the smallest weight from any initial node to any final node, using bidirectional search over the hierarchy.
+        // Initial and final nodes are given with their initial weights. Returns false if no final node is reachable.
+        bool findShortestPath(const std::vector<std::pair<NodeId, double>>& initialNodes, const std::vector<std::pair<NodeId, double>>& finalNodes, Path& path, Workspace& workspace, std::size_t* nodeQueuePops = nullptr) const;
+
+    private:
+        static constexpr std::size_t MAX_WITNESS_SETTLED_NODES = 256; // witness searches are bounded, failing to find a witness only adds a redundant shortcut
+
+        struct HierarchyEdge {
+            std::array<NodeId, 2> nodeIds {{ NodeId(-1), NodeId(-1) }};
+            double weight = 0;
+            std::array<EdgeId, 2> childEdgeIds {{ EdgeId(-1), EdgeId(-1) }}; // hierarchy edges replaced by the shortcut, -1 for original edges
+        };
+
+        void contract();
+
+        void unpackEdge(EdgeId hierarchyEdgeId, std::vector<EdgeId>& edgeIds, std::vector<EdgeId>& unpackStack) const;
+
+        std::vector<Edge> _edges;
+        std::vector<HierarchyEdge> _hierarchyEdges; // original edges followed by the shortcuts
+        std::vector<std::size_t> _nodeRanks;
+        std::array<std::vector<std::size_t>, 2> _upwardEdgeOffsets; // per search direction, edges to higher ranked nodes of node i are in [offsets[i], offsets[i + 1])
+        std::array<std::vector<EdgeId>, 2> _upwardEdgeIds;
+    };
+}
+
+#endif
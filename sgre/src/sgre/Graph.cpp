@@ -2,6 +2,10 @@
 
 #include <queue>
 #include <algorithm>
+#include <numeric>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
 
 #include <boost/math/constants/constants.hpp>
 
@@ -131,93 +135,228 @@ namespace {
 
         return triangle[0] + edge0 * s + edge1 * t;
     }
+
+    template <typename T>
+    void writeValue(std::ostream& stream, const T& value) {
+        stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    T readValue(std::istream& stream) {
+        T value = T();
+        if (!stream.read(reinterpret_cast<char*>(&value), sizeof(T))) {
+            throw std::runtime_error("Truncated graph file");
+        }
+        return value;
+    }
+
+    std::uint32_t readCount(std::istream& stream, std::size_t minElementSize) {
+        std::uint32_t count = readValue<std::uint32_t>(stream);
+        std::istream::pos_type pos = stream.tellg();
+        if (pos != std::istream::pos_type(-1)) {
+            // Each element takes at least minElementSize bytes, so the count can not exceed the remaining stream size
+            stream.seekg(0, std::ios::end);
+            std::istream::pos_type end = stream.tellg();
+            stream.seekg(pos);
+            if (end != std::istream::pos_type(-1) && static_cast<std::uint64_t>(count) * minElementSize > static_cast<std::uint64_t>(end - pos)) {
+                throw std::runtime_error("Truncated graph file");
+            }
+        }
+        return count;
+    }
+
+    void writeId(std::ostream& stream, std::uint32_t id) {
+        writeValue(stream, id);
+    }
+
+    std::uint32_t readId(std::istream& stream) {
+        return readValue<std::uint32_t>(stream);
+    }
+
+    void writeString(std::ostream& stream, const std::string& str) {
+        writeValue(stream, static_cast<std::uint32_t>(str.size()));
+        stream.write(str.data(), str.size());
+    }
+
+    std::string readString(std::istream& stream) {
+        std::string str(readCount(stream, 1), '\0');
+        if (!stream.read(&str[0], str.size())) {
+            throw std::runtime_error("Truncated graph file");
+        }
+        return str;
+    }
+
+    void writePoint(std::ostream& stream, const cglib::vec3<double>& point) {
+        for (int i = 0; i < 3; i++) {
+            writeValue(stream, point(i));
+        }
+    }
+
+    cglib::vec3<double> readPoint(std::istream& stream) {
+        cglib::vec3<double> point;
+        for (int i = 0; i < 3; i++) {
+            point(i) = readValue<double>(stream);
+        }
+        return point;
+    }
+
+    void writeBounds(std::ostream& stream, const cglib::bbox3<double>& bounds) {
+        writePoint(stream, bounds.min);
+        writePoint(stream, bounds.max);
+    }
+
+    cglib::bbox3<double> readBounds(std::istream& stream) {
+        cglib::bbox3<double> bounds;
+        bounds.min = readPoint(stream);
+        bounds.max = readPoint(stream);
+        return bounds;
+    }
+
+    void writeFloatParameter(std::ostream& stream, const carto::sgre::FloatParameter& param) {
+        writeValue(stream, static_cast<std::uint8_t>(param.index()));
+        if (auto value = std::get_if<float>(&param)) {
+            writeValue(stream, *value);
+        } else if (auto paramName = std::get_if<std::string>(&param)) {
+            writeString(stream, *paramName);
+        }
+    }
+
+    carto::sgre::FloatParameter readFloatParameter(std::istream& stream) {
+        switch (readValue<std::uint8_t>(stream)) {
+        case 0:
+            return carto::sgre::FloatParameter();
+        case 1:
+            return carto::sgre::FloatParameter(readValue<float>(stream));
+        case 2:
+            return carto::sgre::FloatParameter(readString(stream));
+        default:
+            throw std::runtime_error("Illegal attribute parameter in graph file");
+        }
+    }
 }
 
 namespace carto::sgre {
     StaticGraph::StaticGraph(std::vector<Node> nodes, std::vector<Edge> edges, std::vector<FeatureProperties> properties, std::vector<Attributes> attributes) :
         _nodes(std::move(nodes)), _edges(std::move(edges)), _featureProperties(std::move(properties)), _attributes(std::move(attributes))
     {
+        // Ids are 32-bit, -1 is reserved for missing ids
+        if (_nodes.size() >= std::numeric_limits<NodeId>::max() || _edges.size() >= std::numeric_limits<EdgeId>::max()) {
+            throw std::runtime_error("Graph too large");
+        }
+
         // Add edge ids to nodes
-        linkNodeEdgeIds(_nodes, _edges);
+        linkNodeEdgeIds();
 
-        // Build RTree for faster spatial queries
-        cglib::bbox3<double> bounds = cglib::bbox3<double>::smallest();
-        std::vector<EdgeId> edgeIds;
-        edgeIds.reserve(_edges.size());
+        // Precompute edge bounds and build flat BVH for faster spatial queries
+        _edgeBounds.reserve(_edges.size());
+        _bvhEdgeIds.reserve(_edges.size());
         for (std::size_t i = 0; i < _edges.size(); i++) {
             EdgeId edgeId = static_cast<EdgeId>(i);
             const Edge& edge = getEdge(edgeId);
             const Node& node0 = getNode(edge.nodeIds[0]);
             const Node& node1 = getNode(edge.nodeIds[1]);
-            bounds.add(node0.points.begin(), node0.points.end());
-            bounds.add(node1.points.begin(), node1.points.end());
-            edgeIds.push_back(edgeId);
+            cglib::bbox3<double> edgeBounds = cglib::bbox3<double>::smallest();
+            edgeBounds.add(node0.points.begin(), node0.points.end());
+            edgeBounds.add(node1.points.begin(), node1.points.end());
+            _edgeBounds.push_back(edgeBounds);
+            _bvhEdgeIds.push_back(edgeId);
+        }
+        if (!_edges.empty()) {
+            BVHNode rootNode;
+            rootNode.count = static_cast<std::uint32_t>(_bvhEdgeIds.size());
+            for (const cglib::bbox3<double>& edgeBounds : _edgeBounds) {
+                rootNode.bounds.add(edgeBounds);
+            }
+            _bvhNodes.push_back(rootNode);
+            buildBVH(0);
         }
-        _rootNode = buildRTree(bounds, edgeIds);
     }
 
     std::vector<std::pair<Graph::EdgeId, Point>> StaticGraph::findNearestEdgePoint(const Point& pos, const FeatureFilter& filter, const SearchOptions& options) const {
-        struct RTreeNodeRecord {
-            std::shared_ptr<const RTreeNode> node;
-            double dist;
+        SearchWorkspace workspace;
+        std::vector<std::pair<Graph::EdgeId, Point>> results;
+        findNearestEdgePoints(pos, filter, options, workspace, results);
+        return results;
+    }
+
+    std::vector<std::vector<std::pair<Graph::EdgeId, Point>>> StaticGraph::findNearestEdgePoints(const std::vector<Point>& posList, const FeatureFilter& filter, const SearchOptions& options) const {
+        // Share the node queue and feature filter results between the queries
+        SearchWorkspace workspace;
+        if (!filter.empty()) {
+            workspace.featureMatches.assign(_featureProperties.size(), -1);
+        }
+
+        std::vector<std::vector<std::pair<Graph::EdgeId, Point>>> resultsList(posList.size());
+        for (std::size_t i = 0; i < posList.size(); i++) {
+            findNearestEdgePoints(posList[i], filter, options, workspace, resultsList[i]);
+        }
+        return resultsList;
+    }
 
-            bool operator < (const RTreeNodeRecord& rec) const { return rec.dist < dist; }
-        };
-        
+    void StaticGraph::findNearestEdgePoints(const Point& pos, const FeatureFilter& filter, const SearchOptions& options, SearchWorkspace& workspace, std::vector<std::pair<EdgeId, Point>>& results) const {
         static constexpr double DIST_EPSILON = 1.0e-6;
         static constexpr double EARTH_RADIUS = 6378137.0;
 
+        results.clear();
+        if (_bvhNodes.empty()) {
+            return;
+        }
+
         double latScale = EARTH_RADIUS * boost::math::constants::pi<double>() / 180.0;
         double lngScale = latScale * std::max(std::cos(pos(1) * boost::math::constants::pi<double>() / 180.0), 0.01);
         cglib::vec3<double> scale(lngScale, latScale, options.zSensitivity);
 
         double bestDist = std::numeric_limits<double>::infinity();
-        std::vector<std::pair<Graph::EdgeId, Point>> bestResults;
 
-        // Do the matching starting from root RTree node. Use priority queue for sorting and rejecting subnodes.
-        std::priority_queue<RTreeNodeRecord> nodeQueue;
-        Point nearestRootPos = _rootNode->bounds.nearest_point(pos);
-        double rootDist = calculateDistance(nearestRootPos, pos, scale);
-        nodeQueue.push({ _rootNode, rootDist });
+        // Do the matching starting from the root BVH node. Use heap for sorting and rejecting subnodes.
+        std::vector<BVHNodeRecord>& nodeQueue = workspace.nodeQueue;
+        nodeQueue.clear();
+        nodeQueue.push_back({ 0, calculateDistance(_bvhNodes[0].bounds.nearest_point(pos), pos, scale) });
         while (!nodeQueue.empty()) {
-            std::shared_ptr<const RTreeNode> node = nodeQueue.top().node;
-            double dist = nodeQueue.top().dist;
-            nodeQueue.pop();
+            std::pop_heap(nodeQueue.begin(), nodeQueue.end());
+            BVHNodeRecord rec = nodeQueue.back();
+            nodeQueue.pop_back();
 
-            if (dist > bestDist + DIST_EPSILON) {
+            if (rec.dist > bestDist + DIST_EPSILON) {
                 break;
             }
 
-            // Store subnodes in the priority queue
-            for (const std::shared_ptr<const RTreeNode>& subNode : node->subNodes) {
-                if (subNode) {
-                    Point nearestPos = subNode->bounds.nearest_point(pos);
-                    double dist = calculateDistance(nearestPos, pos, scale);
-                    nodeQueue.push({ subNode, dist });
+            // Store subnodes in the heap
+            const BVHNode& node = _bvhNodes[rec.nodeIndex];
+            if (node.count == 0) {
+                for (std::uint32_t childIndex = node.index; childIndex < node.index + 2; childIndex++) {
+                    double dist = calculateDistance(_bvhNodes[childIndex].bounds.nearest_point(pos), pos, scale);
+                    if (dist <= bestDist + DIST_EPSILON) {
+                        nodeQueue.push_back({ childIndex, dist });
+                        std::push_heap(nodeQueue.begin(), nodeQueue.end());
+                    }
                 }
+                continue;
             }
 
-            // Do slow matching for edges store in this RTree node
-            for (EdgeId edgeId : node->edgeIds) {
-                const Edge& edge = getEdge(edgeId);
+            // Do slow matching for edges stored in this leaf node, skipping edges whose bounds are already too far
+            for (std::uint32_t i = node.index; i < node.index + node.count; i++) {
+                EdgeId edgeId = _bvhEdgeIds[i];
+                if (calculateDistance(_edgeBounds[edgeId].nearest_point(pos), pos, scale) > bestDist + DIST_EPSILON) {
+                    continue;
+                }
+
+                const Edge& edge = _edges[edgeId];
 
                 // Apply filter?
                 if (!filter.empty()) {
                     if (edge.featureId == FeatureId(-1)) {
                         continue;
                     }
-                    const FeatureProperties& properties = getFeatureProperties(edge.featureId);
-                    if (!properties.is<picojson::object>()) {
-                        continue;
-                    }
-
-                    auto it = filter.begin();
-                    for (; it != filter.end(); it++) {
-                        if (!properties.contains(it->first) || properties.get(it->first) != it->second) {
-                            break;
+                    if (!workspace.featureMatches.empty()) {
+                        signed char& match = workspace.featureMatches[edge.featureId];
+                        if (match < 0) {
+                            match = matchFeatureFilter(edge.featureId, filter) ? 1 : 0;
                         }
-                    }
-                    if (it != filter.end()) {
+                        if (!match) {
+                            continue;
+                        }
+                    } else if (!matchFeatureFilter(edge.featureId, filter)) {
                         continue;
                     }
                 }
@@ -227,15 +366,188 @@ namespace carto::sgre {
                     if (dist <= bestDist + DIST_EPSILON) {
                         if (dist + DIST_EPSILON < bestDist) {
                             bestDist = dist;
-                            bestResults.clear();
+                            results.clear();
                         }
-                        bestResults.emplace_back(edgeId, *closestPos);
+                        results.emplace_back(edgeId, *closestPos);
                     }
                 }
             }
         }
+    }
 
-        return bestResults;
+    void StaticGraph::save(std::ostream& stream) const {
+        stream.write("SGRE", 4);
+        writeValue(stream, FILE_VERSION);
+
+        // Node edge ids are not stored, they are relinked when loading
+        writeValue(stream, static_cast<std::uint32_t>(_nodes.size()));
+        for (const Node& node : _nodes) {
+            writeValue(stream, static_cast<std::uint32_t>(node.nodeFlags));
+            writePoint(stream, node.points[0]);
+            writePoint(stream, node.points[1]);
+        }
+
+        writeValue(stream, static_cast<std::uint32_t>(_edges.size()));
+        for (const Edge& edge : _edges) {
+            writeValue(stream, static_cast<std::uint32_t>(edge.edgeFlags));
+            writeId(stream, edge.featureId);
+            writeId(stream, edge.triangleId);
+            writeId(stream, edge.attributesId);
+            writeId(stream, edge.nodeIds[0]);
+            writeId(stream, edge.nodeIds[1]);
+            writeValue(stream, static_cast<std::uint8_t>(edge.searchCriteria));
+        }
+
+        // Feature properties are interned, as many features usually share the same properties
+        std::vector<std::string> uniqueProperties;
+        std::unordered_map<std::string, std::size_t> uniquePropertiesMap;
+        std::vector<std::size_t> propertiesIndices;
+        propertiesIndices.reserve(_featureProperties.size());
+        for (const FeatureProperties& properties : _featureProperties) {
+            std::string json = properties.serialize();
+            auto it = uniquePropertiesMap.emplace(json, uniqueProperties.size()).first;
+            if (it->second == uniqueProperties.size()) {
+                uniqueProperties.push_back(std::move(json));
+            }
+            propertiesIndices.push_back(it->second);
+        }
+        writeValue(stream, static_cast<std::uint32_t>(uniqueProperties.size()));
+        for (const std::string& json : uniqueProperties) {
+            writeString(stream, json);
+        }
+        writeValue(stream, static_cast<std::uint32_t>(propertiesIndices.size()));
+        for (std::size_t index : propertiesIndices) {
+            writeId(stream, static_cast<std::uint32_t>(index));
+        }
+
+        writeValue(stream, static_cast<std::uint32_t>(_attributes.size()));
+        for (const Attributes& attribs : _attributes) {
+            writeFloatParameter(stream, attribs.speed);
+            writeFloatParameter(stream, attribs.zSpeed);
+            writeFloatParameter(stream, attribs.turnSpeed);
+            writeFloatParameter(stream, attribs.delay);
+        }
+
+        // Store the prebuilt spatial index
+        for (const cglib::bbox3<double>& edgeBounds : _edgeBounds) {
+            writeBounds(stream, edgeBounds);
+        }
+        for (EdgeId edgeId : _bvhEdgeIds) {
+            writeId(stream, edgeId);
+        }
+        writeValue(stream, static_cast<std::uint32_t>(_bvhNodes.size()));
+        for (const BVHNode& bvhNode : _bvhNodes) {
+            writeBounds(stream, bvhNode.bounds);
+            writeValue(stream, bvhNode.index);
+            writeValue(stream, bvhNode.count);
+        }
+
+        if (!stream) {
+            throw std::runtime_error("Failed to write graph");
+        }
+    }
+
+    std::shared_ptr<StaticGraph> StaticGraph::load(std::istream& stream) {
+        char tag[4] = { 0, 0, 0, 0 };
+        if (!stream.read(tag, 4) || std::string(tag, 4) != "SGRE") {
+            throw std::runtime_error("Illegal graph file");
+        }
+        if (readValue<std::uint32_t>(stream) != FILE_VERSION) {
+            throw std::runtime_error("Unsupported graph version");
+        }
+
+        auto graph = std::make_shared<StaticGraph>();
+
+        graph->_nodes.resize(readCount(stream, sizeof(std::uint32_t) + 6 * sizeof(double)));
+        for (Node& node : graph->_nodes) {
+            node.nodeFlags = NodeFlags(readValue<std::uint32_t>(stream));
+            node.points[0] = readPoint(stream);
+            node.points[1] = readPoint(stream);
+        }
+
+        graph->_edges.resize(readCount(stream, 6 * sizeof(std::uint32_t) + sizeof(std::uint8_t)));
+        for (Edge& edge : graph->_edges) {
+            edge.edgeFlags = EdgeFlags(readValue<std::uint32_t>(stream));
+            edge.featureId = readId(stream);
+            edge.triangleId = readId(stream);
+            edge.attributesId = readId(stream);
+            edge.nodeIds[0] = readId(stream);
+            edge.nodeIds[1] = readId(stream);
+            edge.searchCriteria = SearchCriteria(readValue<std::uint8_t>(stream));
+            if (edge.nodeIds[0] >= graph->_nodes.size() || edge.nodeIds[1] >= graph->_nodes.size()) {
+                throw std::runtime_error("Illegal edge in graph file");
+            }
+            // Every triangle has its own nodes, so triangle ids are always less than the node count
+            if (edge.triangleId != TriangleId(-1) && edge.triangleId >= graph->_nodes.size()) {
+                throw std::runtime_error("Illegal edge in graph file");
+            }
+        }
+
+        std::vector<FeatureProperties> uniqueProperties(readCount(stream, sizeof(std::uint32_t)));
+        for (FeatureProperties& properties : uniqueProperties) {
+            std::string err = picojson::parse(properties, readString(stream));
+            if (!err.empty()) {
+                throw std::runtime_error("Illegal feature properties in graph file: " + err);
+            }
+        }
+        graph->_featureProperties.resize(readCount(stream, sizeof(std::uint32_t)));
+        for (FeatureProperties& properties : graph->_featureProperties) {
+            std::uint32_t index = readId(stream);
+            if (index >= uniqueProperties.size()) {
+                throw std::runtime_error("Illegal feature properties in graph file");
+            }
+            properties = uniqueProperties[index];
+        }
+
+        graph->_attributes.resize(readCount(stream, 4 * sizeof(std::uint8_t)));
+        for (Attributes& attribs : graph->_attributes) {
+            attribs.speed = readFloatParameter(stream);
+            attribs.zSpeed = readFloatParameter(stream);
+            attribs.turnSpeed = readFloatParameter(stream);
+            attribs.delay = readFloatParameter(stream);
+        }
+
+        // Feature and attribute ids can be checked only once the tables are loaded
+        for (const Edge& edge : graph->_edges) {
+            if (edge.featureId != FeatureId(-1) && edge.featureId >= graph->_featureProperties.size()) {
+                throw std::runtime_error("Illegal edge in graph file");
+            }
+            if (edge.attributesId != AttributesId(-1) && edge.attributesId >= graph->_attributes.size()) {
+                throw std::runtime_error("Illegal edge in graph file");
+            }
+        }
+
+        graph->_edgeBounds.resize(graph->_edges.size());
+        for (cglib::bbox3<double>& edgeBounds : graph->_edgeBounds) {
+            edgeBounds = readBounds(stream);
+        }
+        graph->_bvhEdgeIds.resize(graph->_edges.size());
+        for (EdgeId& edgeId : graph->_bvhEdgeIds) {
+            edgeId = readId(stream);
+            if (edgeId >= graph->_edges.size()) {
+                throw std::runtime_error("Illegal spatial index in graph file");
+            }
+        }
+        graph->_bvhNodes.resize(readCount(stream, 6 * sizeof(double) + 2 * sizeof(std::uint32_t)));
+        for (std::size_t i = 0; i < graph->_bvhNodes.size(); i++) {
+            BVHNode& bvhNode = graph->_bvhNodes[i];
+            bvhNode.bounds = readBounds(stream);
+            bvhNode.index = readValue<std::uint32_t>(stream);
+            bvhNode.count = readValue<std::uint32_t>(stream);
+            if (bvhNode.count > 0) {
+                if (static_cast<std::size_t>(bvhNode.index) + bvhNode.count > graph->_bvhEdgeIds.size()) {
+                    throw std::runtime_error("Illegal spatial index in graph file");
+                }
+            } else {
+                // Children must follow the parent, this also rules out cycles
+                if (bvhNode.index <= i || static_cast<std::size_t>(bvhNode.index) + 2 > graph->_bvhNodes.size()) {
+                    throw std::runtime_error("Illegal spatial index in graph file");
+                }
+            }
+        }
+
+        graph->linkNodeEdgeIds();
+        return graph;
     }
 
     std::optional<Point> StaticGraph::findNearestEdgePoint(const Edge& edge, const Point& pos, const cglib::vec3<double>& scale) const {
@@ -313,66 +625,97 @@ namespace carto::sgre {
         return std::optional<Point>();
     }
 
-    std::shared_ptr<StaticGraph::RTreeNode> StaticGraph::buildRTree(const cglib::bbox3<double>& bounds, std::vector<EdgeId> edgeIds) const {
+    bool StaticGraph::matchFeatureFilter(FeatureId featureId, const FeatureFilter& filter) const {
+        const FeatureProperties& properties = getFeatureProperties(featureId);
+        if (!properties.is<picojson::object>()) {
+            return false;
+        }
+
+        for (auto it = filter.begin(); it != filter.end(); it++) {
+            if (!properties.contains(it->first) || properties.get(it->first) != it->second) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void StaticGraph::buildBVH(std::uint32_t nodeIndex) {
         static const std::size_t SPLIT_THRESHOLD = 4;
 
-        // Create non-leaf nodes?
-        if (edgeIds.size() > SPLIT_THRESHOLD) {
-            cglib::bbox3<double> splitBounds[3][2];
-            std::vector<EdgeId> splitEdgeIds[3][2];
+        std::uint32_t first = _bvhNodes[nodeIndex].index;
+        std::uint32_t count = _bvhNodes[nodeIndex].count;
+        if (count <= SPLIT_THRESHOLD) {
+            return;
+        }
+
+        // Do simple splitting by comparing the center of each edge to the center of the parent
+        cglib::vec3<double> center = _bvhNodes[nodeIndex].bounds.center();
+        std::size_t splitCounts[3] = { 0, 0, 0 };
+        for (std::uint32_t i = first; i < first + count; i++) {
+            cglib::vec3<double> edgeCenter = _edgeBounds[_bvhEdgeIds[i]].center();
             for (int dim = 0; dim < 3; dim++) {
-                splitBounds[dim][0] = splitBounds[dim][1] = cglib::bbox3<double>::smallest();
+                splitCounts[dim] += edgeCenter(dim) < center(dim) ? 1 : 0;
             }
+        }
 
-            // Do simple splitting by comparing the center of each edge to the center of the parent
-            cglib::vec3<double> center = bounds.center();
-            for (EdgeId edgeId : edgeIds) {
-                const Edge& edge = getEdge(edgeId);
-                const Node& node0 = getNode(edge.nodeIds[0]);
-                const Node& node1 = getNode(edge.nodeIds[1]);
-                cglib::bbox3<double> edgeBounds = cglib::bbox3<double>::smallest();
-                edgeBounds.add(node0.points.begin(), node0.points.end());
-                edgeBounds.add(node1.points.begin(), node1.points.end());
-                for (int dim = 0; dim < 3; dim++) {
-                    int idx = edgeBounds.center()(dim) < center(dim) ? 0 : 1;
-                    splitBounds[dim][idx].add(edgeBounds);
-                    splitEdgeIds[dim][idx].push_back(edgeId);
-                }
+        // Find best splitting dimension (best means 'most balanced' by the number of edges here)
+        int bestDim = 0;
+        for (int dim = 1; dim < 3; dim++) {
+            if (std::min(splitCounts[dim], count - splitCounts[dim]) > std::min(splitCounts[bestDim], count - splitCounts[bestDim])) {
+                bestDim = dim;
             }
+        }
 
-            // Find best splitting dimension (best means 'most balanced' by the number of edges here)
-            int bestDim = 0;
-            for (int dim = 1; dim < 3; dim++) {
-                if (std::min(splitEdgeIds[dim][0].size(), splitEdgeIds[dim][1].size()) > std::min(splitEdgeIds[bestDim][0].size(), splitEdgeIds[bestDim][1].size())) {
-                    bestDim = dim;
-                }
-            }
+        // If splitting fails (resulting subtrees do not contain enough elements), keep the leaf node
+        std::uint32_t splitCount = static_cast<std::uint32_t>(splitCounts[bestDim]);
+        if (splitCount <= SPLIT_THRESHOLD / 4 || count - splitCount <= SPLIT_THRESHOLD / 4) {
+            return;
+        }
 
-            // If splitting succeeded (resulting subtrees contain enough elements), recurse
-            if (splitEdgeIds[bestDim][0].size() > SPLIT_THRESHOLD / 4 && splitEdgeIds[bestDim][1].size() > SPLIT_THRESHOLD / 4) {
-                auto node = std::make_shared<RTreeNode>();
-                node->bounds = bounds;
-                node->subNodes[0] = buildRTree(splitBounds[bestDim][0], std::move(splitEdgeIds[bestDim][0]));
-                node->subNodes[1] = buildRTree(splitBounds[bestDim][1], std::move(splitEdgeIds[bestDim][1]));
-                return node;
+        // Partition edge ids in place, keeping the original order within both halves
+        std::stable_partition(_bvhEdgeIds.begin() + first, _bvhEdgeIds.begin() + first + count, [&](EdgeId edgeId) {
+            return _edgeBounds[edgeId].center()(bestDim) < center(bestDim);
+        });
+
+        BVHNode childNodes[2];
+        childNodes[0].index = first;
+        childNodes[0].count = splitCount;
+        childNodes[1].index = first + splitCount;
+        childNodes[1].count = count - splitCount;
+        for (BVHNode& childNode : childNodes) {
+            for (std::uint32_t i = childNode.index; i < childNode.index + childNode.count; i++) {
+                childNode.bounds.add(_edgeBounds[_bvhEdgeIds[i]]);
             }
         }
 
-        // Create final leaf node
-        auto node = std::make_shared<RTreeNode>();
-        node->bounds = bounds;
-        node->edgeIds = std::move(edgeIds);
-        return node;
+        std::uint32_t childIndex = static_cast<std::uint32_t>(_bvhNodes.size());
+        _bvhNodes.push_back(childNodes[0]);
+        _bvhNodes.push_back(childNodes[1]);
+        _bvhNodes[nodeIndex].index = childIndex;
+        _bvhNodes[nodeIndex].count = 0;
+        buildBVH(childIndex);
+        buildBVH(childIndex + 1);
     }
 
-    void StaticGraph::linkNodeEdgeIds(std::vector<Node>& nodes, const std::vector<Edge>& edges) {
-        for (std::size_t i = 0; i < nodes.size(); i++) {
-            nodes[i].edgeIds.reserve(3); // 3 should be optimal in most cases
+    void StaticGraph::linkNodeEdgeIds() {
+        // Store the edge ids of all nodes in a single array, grouped by the source node. Edge ids of each node are in increasing order.
+        std::vector<std::size_t> offsets(_nodes.size() + 1, 0);
+        for (const Edge& edge : _edges) {
+            if (edge.nodeIds[0] >= _nodes.size()) {
+                throw std::out_of_range("Illegal edge source node");
+            }
+            offsets[edge.nodeIds[0] + 1]++;
         }
-        for (std::size_t i = 0; i < edges.size(); i++) {
-            const Edge& edge = edges[i];
-            Node& node0 = nodes.at(edge.nodeIds[0]);
-            node0.edgeIds.push_back(static_cast<EdgeId>(i));
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+        _nodeEdgeIds.assign(_edges.size(), 0);
+        std::vector<std::size_t> edgeCounts(_nodes.size(), 0);
+        for (std::size_t i = 0; i < _edges.size(); i++) {
+            NodeId nodeId0 = _edges[i].nodeIds[0];
+            _nodeEdgeIds[offsets[nodeId0] + edgeCounts[nodeId0]++] = static_cast<EdgeId>(i);
+        }
+        for (std::size_t i = 0; i < _nodes.size(); i++) {
+            _nodes[i].edgeIds = EdgeIdRange(_nodeEdgeIds.data() + offsets[i], _nodeEdgeIds.data() + offsets[i + 1]);
         }
     }
 
@@ -395,7 +738,7 @@ namespace carto::sgre {
     const Graph::Node& DynamicGraph::getNode(NodeId nodeId) const {
         auto it = _nodes.find(nodeId);
         if (it != _nodes.end()) {
-            return it->second;
+            return it->second.node;
         }
         return _staticGraph->getNode(nodeId);
     }
@@ -430,15 +773,24 @@ namespace carto::sgre {
 
     Graph::NodeId DynamicGraph::addNode(Node node) {
         NodeId nodeId = getNodeIdRangeEnd();
-        _nodes[nodeId] = std::move(node);
+        OverlayNode& overlayNode = _nodes[nodeId];
+        overlayNode.edgeIds.assign(node.edgeIds.begin(), node.edgeIds.end());
+        overlayNode.node = std::move(node);
+        overlayNode.node.edgeIds = EdgeIdRange(overlayNode.edgeIds.data(), overlayNode.edgeIds.data() + overlayNode.edgeIds.size());
         return nodeId;
     }
     
     Graph::EdgeId DynamicGraph::addEdge(Edge edge) {
         EdgeId edgeId = getEdgeIdRangeEnd();
-        Node node0 = getNode(edge.nodeIds[0]);
-        node0.edgeIds.push_back(edgeId);
-        _nodes[edge.nodeIds[0]] = std::move(node0);
+        auto it = _nodes.find(edge.nodeIds[0]);
+        if (it == _nodes.end()) {
+            // Copy the node of the static graph, the overlay node keeps its own edge ids
+            const Node& node0 = _staticGraph->getNode(edge.nodeIds[0]);
+            it = _nodes.emplace(edge.nodeIds[0], OverlayNode { node0, std::vector<EdgeId>(node0.edgeIds.begin(), node0.edgeIds.end()) }).first;
+        }
+        OverlayNode& overlayNode = it->second;
+        overlayNode.edgeIds.push_back(edgeId);
+        overlayNode.node.edgeIds = EdgeIdRange(overlayNode.edgeIds.data(), overlayNode.edgeIds.data() + overlayNode.edgeIds.size());
         _edges.push_back(std::move(edge));
         return edgeId;
     }
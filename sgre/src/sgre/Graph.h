@@ -9,7 +9,11 @@
 
 #include "Base.h"
 
+#include <cstdint>
 #include <memory>
+#include <iosfwd>
+#include <iterator>
+#include <algorithm>
 #include <optional>
 #include <array>
 #include <vector>
@@ -22,11 +26,11 @@
 namespace carto::sgre {
     class Graph {
     public:
-        using NodeId = std::size_t;
-        using EdgeId = std::size_t;
-        using FeatureId = std::size_t;
-        using TriangleId = std::size_t;
-        using AttributesId = std::size_t;
+        using NodeId = std::uint32_t;
+        using EdgeId = std::uint32_t;
+        using FeatureId = std::uint32_t;
+        using TriangleId = std::uint32_t;
+        using AttributesId = std::uint32_t;
 
         enum NodeFlags : unsigned int {
             GEOMETRY_VERTEX = 1, // node is part of the original geometry (always the case with linestrings; in case of triangles, the edge formed by node endpoints must be an edge of original polygon)
@@ -51,9 +55,30 @@ namespace carto::sgre {
             SURFACE              // whole surface of the geometry is used when matching routing endpoints
         };
 
+        class EdgeIdRange final {
+        public:
+            EdgeIdRange() = default;
+            explicit EdgeIdRange(const EdgeId* begin, const EdgeId* end) : _begin(begin), _end(end) { }
+
+            const EdgeId* begin() const { return _begin; }
+            const EdgeId* end() const { return _end; }
+            std::reverse_iterator<const EdgeId*> rbegin() const { return std::reverse_iterator<const EdgeId*>(_end); }
+            std::reverse_iterator<const EdgeId*> rend() const { return std::reverse_iterator<const EdgeId*>(_begin); }
+
+            std::size_t size() const { return static_cast<std::size_t>(_end - _begin); }
+            bool empty() const { return _begin == _end; }
+
+            bool operator == (const EdgeIdRange& other) const { return std::equal(_begin, _end, other._begin, other._end); }
+            bool operator != (const EdgeIdRange& other) const { return !(*this == other); }
+
+        private:
+            const EdgeId* _begin = nullptr;
+            const EdgeId* _end = nullptr;
+        };
+
         struct Node {
             NodeFlags nodeFlags = NodeFlags(0);     // bitflags for this node
-            std::vector<EdgeId> edgeIds;            // outward edge ids. Filled automatically when the graph is constructed.
+            EdgeIdRange edgeIds;                    // outward edge ids, filled automatically when the graph is constructed. Points into graph storage, valid only while the graph is alive.
             std::array<Point, 2> points = {{ Point(0, 0, 0), Point(0, 0, 0) }}; // edge points or identical points, in case of point node
         };
 
@@ -99,6 +124,9 @@ namespace carto::sgre {
         
         StaticGraph() = default;
         explicit StaticGraph(std::vector<Node> nodes, std::vector<Edge> edges, std::vector<FeatureProperties> properties, std::vector<Attributes> attributes);
+        StaticGraph(const StaticGraph&) = delete; // nodes refer to the edge id array of the graph
+
+        StaticGraph& operator = (const StaticGraph&) = delete;
 
         virtual NodeId getNodeIdRangeEnd() const override { return static_cast<NodeId>(_nodes.size()); }
         virtual EdgeId getEdgeIdRangeEnd() const override { return static_cast<EdgeId>(_edges.size()); }
@@ -111,33 +139,63 @@ namespace carto::sgre {
         virtual const Attributes& getAttributes(AttributesId attribsId) const override { return _attributes.at(attribsId); }
 
         std::vector<std::pair<EdgeId, Point>> findNearestEdgePoint(const Point& pos, const FeatureFilter& filter, const SearchOptions& options) const;
+        std::vector<std::vector<std::pair<EdgeId, Point>>> findNearestEdgePoints(const std::vector<Point>& posList, const FeatureFilter& filter, const SearchOptions& options) const;
+
+        void save(std::ostream& stream) const;
+
+        static std::shared_ptr<StaticGraph> load(std::istream& stream);
 
     private:
-        struct RTreeNode {
+        static constexpr std::uint32_t FILE_VERSION = 1;
+
+        struct BVHNode {
             cglib::bbox3<double> bounds = cglib::bbox3<double>::smallest();
-            std::vector<EdgeId> edgeIds;
-            std::array<std::shared_ptr<const RTreeNode>, 2> subNodes;
+            std::uint32_t index = 0; // index of the first child node for inner nodes (children are stored consecutively), index of the first edge in _bvhEdgeIds for leaf nodes
+            std::uint32_t count = 0; // number of edges for leaf nodes, 0 for inner nodes
         };
-        
+
+        struct BVHNodeRecord {
+            std::uint32_t nodeIndex;
+            double dist;
+
+            bool operator < (const BVHNodeRecord& rec) const { return rec.dist < dist; }
+        };
+
+        struct SearchWorkspace {
+            std::vector<BVHNodeRecord> nodeQueue;
+            std::vector<signed char> featureMatches; // cached filter results per feature (-1 if not evaluated), not used if empty
+        };
+
+        void findNearestEdgePoints(const Point& pos, const FeatureFilter& filter, const SearchOptions& options, SearchWorkspace& workspace, std::vector<std::pair<EdgeId, Point>>& results) const;
         std::optional<Point> findNearestEdgePoint(const Edge& edge, const Point& pos, const cglib::vec3<double>& scale) const;
 
-        std::shared_ptr<RTreeNode> buildRTree(const cglib::bbox3<double>& bounds, std::vector<EdgeId> edgeIds) const;
+        bool matchFeatureFilter(FeatureId featureId, const FeatureFilter& filter) const;
 
-        static void linkNodeEdgeIds(std::vector<Node>& nodes, const std::vector<Edge>& edges);
+        void buildBVH(std::uint32_t nodeIndex);
+
+        void linkNodeEdgeIds();
 
         static double calculateDistance(const Point& pos0, const Point& pos1, const cglib::vec3<double>& scale);
 
         std::vector<Node> _nodes;
         std::vector<Edge> _edges;
+        std::vector<EdgeId> _nodeEdgeIds; // outward edge ids of all nodes, grouped by node
         std::vector<FeatureProperties> _featureProperties;
         std::vector<Attributes> _attributes;
-        std::shared_ptr<const RTreeNode> _rootNode;
+        std::vector<cglib::bbox3<double>> _edgeBounds;
+        std::vector<BVHNode> _bvhNodes;
+        std::vector<EdgeId> _bvhEdgeIds;
     };
 
     class DynamicGraph final : public Graph {
     public:
         DynamicGraph() = delete;
         explicit DynamicGraph(std::shared_ptr<const StaticGraph> staticGraph) : _staticGraph(std::move(staticGraph)) { }
+        DynamicGraph(const DynamicGraph&) = delete; // overlay nodes refer to their own edge id storage
+
+        DynamicGraph& operator = (const DynamicGraph&) = delete;
+
+        const std::shared_ptr<const StaticGraph>& getStaticGraph() const { return _staticGraph; }
 
         virtual NodeId getNodeIdRangeEnd() const override;
         virtual EdgeId getEdgeIdRangeEnd() const override { return _staticGraph->getEdgeIdRangeEnd() + static_cast<EdgeId>(_edges.size()); }
@@ -157,7 +215,12 @@ namespace carto::sgre {
         AttributesId addAttributes(Attributes attribs);
 
     private:
-        std::unordered_map<NodeId, Node> _nodes;
+        struct OverlayNode {
+            Node node;
+            std::vector<EdgeId> edgeIds; // storage for the edge ids of the node
+        };
+
+        std::unordered_map<NodeId, OverlayNode> _nodes;
         std::vector<Edge> _edges;
         std::vector<FeatureProperties> _featureProperties;
         std::vector<Attributes> _attributes;
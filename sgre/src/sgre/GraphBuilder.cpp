@@ -4,6 +4,9 @@
 
 #include <tesselator.h>
 
+#include <common/Parallel.h>
+#include <common/GeoJSONReader.h>
+
 namespace {
     bool pointInsideTriangle(const std::array<cglib::vec3<double>, 3>& triangle, const cglib::vec3<double>& pos, double epsilon = 0.0) {
         cglib::vec3<double> v0 = triangle[2] - triangle[0];
@@ -28,18 +31,18 @@ namespace {
 namespace carto::sgre {
     void GraphBuilder::addLineString(const std::vector<Point>& coordsList, const Graph::FeatureProperties& properties) {
         Graph::FeatureId featureId = addFeature(properties);
-        addLineString(featureId, coordsList, properties);
+        addLineString(featureId, prepareLineString(coordsList, properties));
     }
 
     void GraphBuilder::addPolygon(const std::vector<std::vector<Point>>& rings, const Graph::FeatureProperties& properties) {
         Graph::FeatureId featureId = addFeature(properties);
-        addPolygon(featureId, rings, properties);
+        addPolygon(featureId, preparePolygon(rings, properties));
     }
 
-    void GraphBuilder::importGeoJSON(const picojson::value& geoJSON) {
+    void GraphBuilder::importGeoJSON(const picojson::value& geoJSON, std::size_t threadCount) {
         std::string type = geoJSON.get("type").get<std::string>();
         if (type == "FeatureCollection") {
-            importGeoJSONFeatureCollection(geoJSON);
+            importGeoJSONFeatureCollection(geoJSON, threadCount);
         } else if (type == "Feature") {
             importGeoJSONFeature(geoJSON);
         } else {
@@ -47,7 +50,9 @@ namespace carto::sgre {
         }
     }
 
-    void GraphBuilder::importGeoJSONFeatureCollection(const picojson::value& featureCollectionDef) {
+    void GraphBuilder::importGeoJSONFeatureCollection(const picojson::value& featureCollectionDef, std::size_t threadCount) {
+        static constexpr std::size_t BATCH_SIZE = 4096;
+
         const picojson::array& featuresDef = featureCollectionDef.get("features").get<picojson::array>();
 
         for (const picojson::value& featureDef : featuresDef) {
@@ -55,8 +60,29 @@ namespace carto::sgre {
             if (type != "Feature") {
                 throw std::runtime_error("Unexpected element type");
             }
-            
-            importGeoJSONFeature(featureDef);
+        }
+
+        if (threadCount <= 1) {
+            for (const picojson::value& featureDef : featuresDef) {
+                importGeoJSONFeature(featureDef);
+            }
+            return;
+        }
+
+        // Parse, match rules and tesselate the features in parallel in batches. The results are added to the graph in the original order, so the ids are identical to the serial import.
+        std::vector<FeatureData> featureDataList;
+        for (std::size_t batchStart = 0; batchStart < featuresDef.size(); batchStart += BATCH_SIZE) {
+            std::size_t batchSize = std::min(BATCH_SIZE, featuresDef.size() - batchStart);
+            featureDataList.assign(batchSize, FeatureData());
+
+            common::runParallel(batchSize, threadCount, [&](std::size_t i) {
+                const picojson::value& featureDef = featuresDef[batchStart + i];
+                featureDataList[i] = prepareGeoJSONGeometry(featureDef.get("geometry"), featureDef.get("properties"));
+            });
+
+            for (std::size_t i = 0; i < batchSize; i++) {
+                addFeatureData(featureDataList[i], featuresDef[batchStart + i].get("properties"));
+            }
         }
     }
 
@@ -67,30 +93,66 @@ namespace carto::sgre {
         importGeoJSONGeometry(geometryDef, properties);
     }
 
+    void GraphBuilder::importGeoJSON(std::istream& stream) {
+        using GeoJSONReader = common::GeoJSONReader<3>;
+        GeoJSONReader reader(stream);
+        reader.read([this](GeoJSONReader::Geometry geometry, picojson::value properties) {
+            FeatureData featureData;
+            if (auto coordsList = std::get_if<GeoJSONReader::MultiLineString>(&geometry)) {
+                for (const std::vector<Point>& coords : *coordsList) {
+                    featureData.lineStrings.push_back(prepareLineString(coords, properties));
+                }
+            } else if (auto ringsList = std::get_if<GeoJSONReader::MultiPolygon>(&geometry)) {
+                for (const std::vector<std::vector<Point>>& rings : *ringsList) {
+                    featureData.polygons.push_back(preparePolygon(rings, properties));
+                }
+            }
+            addFeatureData(featureData, properties);
+        });
+    }
+
     void GraphBuilder::importGeoJSONGeometry(const picojson::value& geometryDef, const Graph::FeatureProperties& properties) {
+        addFeatureData(prepareGeoJSONGeometry(geometryDef, properties), properties);
+    }
+
+    GraphBuilder::FeatureData GraphBuilder::prepareGeoJSONGeometry(const picojson::value& geometryDef, const Graph::FeatureProperties& properties) const {
+        if (geometryDef.is<picojson::null>()) {
+            return FeatureData(); // features without geometry are kept, like points, so that feature ids do not depend on the geometry
+        }
         std::string type = geometryDef.get("type").get<std::string>();
         const picojson::value& coordsDef = geometryDef.get("coordinates");
         
-        Graph::FeatureId featureId = addFeature(properties);
+        FeatureData featureData;
         if (type == "Point") {
             // Can ignore
         } else if (type == "LineString") {
-            addLineString(featureId, parseCoordinatesList(coordsDef), properties);
+            featureData.lineStrings.push_back(prepareLineString(parseCoordinatesList(coordsDef), properties));
         } else if (type == "Polygon") {
-            addPolygon(featureId, parseCoordinatesRings(coordsDef), properties);
+            featureData.polygons.push_back(preparePolygon(parseCoordinatesRings(coordsDef), properties));
         } else if (type == "MultiPoint") {
             // Can ignore
         } else if (type == "MultiLineString") {
             for (const picojson::value& subCoordsDef : coordsDef.get<picojson::array>()) {
-                addLineString(featureId, parseCoordinatesList(subCoordsDef), properties);
+                featureData.lineStrings.push_back(prepareLineString(parseCoordinatesList(subCoordsDef), properties));
             }
         } else if (type == "MultiPolygon") {
             for (const picojson::value& subCoordsDef : coordsDef.get<picojson::array>()) {
-                addPolygon(featureId, parseCoordinatesRings(subCoordsDef), properties);
+                featureData.polygons.push_back(preparePolygon(parseCoordinatesRings(subCoordsDef), properties));
             }
         } else {
             throw std::runtime_error("Invalid geometry type");
         }
+        return featureData;
+    }
+
+    void GraphBuilder::addFeatureData(const FeatureData& featureData, const Graph::FeatureProperties& properties) {
+        Graph::FeatureId featureId = addFeature(properties);
+        for (const LineStringData& lineString : featureData.lineStrings) {
+            addLineString(featureId, lineString);
+        }
+        for (const PolygonData& polygon : featureData.polygons) {
+            addPolygon(featureId, polygon);
+        }
     }
 
     std::shared_ptr<StaticGraph> GraphBuilder::build() const {
@@ -135,74 +197,23 @@ namespace carto::sgre {
         return std::make_shared<StaticGraph>(std::move(nodes), std::move(edges), _featureProperties, _attributes);
     }
 
-    void GraphBuilder::addLineString(Graph::FeatureId featureId, const std::vector<Point>& coordsList, const Graph::FeatureProperties& properties) {
-        Graph::LinkMode linkMode = Graph::LinkMode::ALL;
-        Graph::SearchCriteria searchCriteria = Graph::SearchCriteria::EDGE;
-        Graph::Attributes attribs;
-        matchRules(properties, linkMode, searchCriteria, attribs, true);
-        Graph::AttributesId attribsId = addAttributes(attribs);
-
-        Graph::LinkMode linkModeBackwards = linkMode;
-        Graph::SearchCriteria searchCriteriaBackwards = searchCriteria;
-        Graph::Attributes attribsBackwards = attribs;
-        matchRules(properties, linkModeBackwards, searchCriteriaBackwards, attribsBackwards, false);
-        Graph::AttributesId attribsIdBackwards = addAttributes(attribsBackwards);
-
-        // Create node for each vertex
-        std::vector<Graph::NodeId> nodeIds;
-        for (std::size_t i = 0; i < coordsList.size(); i++) {
-            const Point& point = coordsList[i];
-
-            Graph::Node node;
-            node.nodeFlags = Graph::NodeFlags(i == 0 || i + 1 == coordsList.size() ? Graph::NodeFlags::ENDPOINT_VERTEX | Graph::NodeFlags::GEOMETRY_VERTEX : Graph::NodeFlags::GEOMETRY_VERTEX);
-            node.points = std::array<Point, 2> {{ point, point }};
-            Graph::NodeId nodeId = addNode(node);
-            nodeIds.push_back(nodeId);
-
-            // Store vertex information needed for linking it with underlying triangle
-            LineVertex lineVertex;
-            lineVertex.nodeId = nodeId;
-            lineVertex.linkMode = linkMode;
-            lineVertex.point = point;
-            _lineVertices.push_back(lineVertex);
-        }
-
-        // Create edges (both forward and backward)
-        for (std::size_t i = 1; i < nodeIds.size(); i++) {
-            const Graph::Node& node0 = getNode(nodeIds[i - 1]);
-            const Graph::Node& node1 = getNode(nodeIds[i]);
+    GraphBuilder::LineStringData GraphBuilder::prepareLineString(const std::vector<Point>& coordsList, const Graph::FeatureProperties& properties) const {
+        LineStringData lineString;
+        lineString.coordsList = coordsList;
+        matchRules(properties, lineString.linkMode, lineString.searchCriteria[0], lineString.attribs[0], true);
 
-            std::pair<double, double> dist2D = calculateDistance2D(node0.points[0], node1.points[0]);
-
-            if (!(dist2D.first != 0 && attribs.speed == FloatParameter(0.0f)) && !(dist2D.second != 0 && attribs.zSpeed == FloatParameter(0.0f))) {
-                Graph::Edge edge;
-                edge.edgeFlags = Graph::EdgeFlags(Graph::EdgeFlags::GEOMETRY_EDGE);
-                edge.featureId = featureId;
-                edge.attributesId = attribsId;
-                edge.nodeIds = std::array<Graph::NodeId, 2> {{ nodeIds[i - 1], nodeIds[i] }};
-                edge.searchCriteria = searchCriteria;
-                addEdge(edge);
-            }
-
-            if (!(dist2D.first != 0 && attribsBackwards.speed == FloatParameter(0.0f)) && !(dist2D.second != 0 && attribsBackwards.zSpeed == FloatParameter(0.0f))) {
-                Graph::Edge edge;
-                edge.edgeFlags = Graph::EdgeFlags(Graph::EdgeFlags::GEOMETRY_EDGE);
-                edge.featureId = featureId;
-                edge.attributesId = attribsIdBackwards;
-                edge.nodeIds = std::array<Graph::NodeId, 2> {{ nodeIds[i], nodeIds[i - 1] }};
-                edge.searchCriteria = searchCriteriaBackwards; // Note: always equal to searchCriteria
-                addEdge(edge);
-            }
-        }
+        Graph::LinkMode linkModeBackwards = lineString.linkMode;
+        lineString.searchCriteria[1] = lineString.searchCriteria[0];
+        lineString.attribs[1] = lineString.attribs[0];
+        matchRules(properties, linkModeBackwards, lineString.searchCriteria[1], lineString.attribs[1], false);
+        return lineString;
     }
 
-    void GraphBuilder::addPolygon(Graph::FeatureId featureId, const std::vector<std::vector<Point>>& rings, const Graph::FeatureProperties& properties) {
+    GraphBuilder::PolygonData GraphBuilder::preparePolygon(const std::vector<std::vector<Point>>& rings, const Graph::FeatureProperties& properties) const {
+        PolygonData polygon;
         Graph::LinkMode linkMode = Graph::LinkMode::ALL;
-        Graph::SearchCriteria searchCriteria = Graph::SearchCriteria::SURFACE;
-        Graph::Attributes attribs;
-        matchRules(properties, linkMode, searchCriteria, attribs);
-        attribs.delay = FloatParameter(0.0f); // reset the delay manually
-        Graph::AttributesId attribsId = addAttributes(attribs);
+        matchRules(properties, linkMode, polygon.searchCriteria, polygon.attribs);
+        polygon.attribs.delay = FloatParameter(0.0f); // reset the delay manually
 
         TESSalloc ma;
         memset(&ma, 0, sizeof(ma));
@@ -248,11 +259,9 @@ namespace carto::sgre {
         const int* elements = tessGetElements(tess.get());
         int elementCount = tessGetElementCount(tess.get());
 
-        // Build nodes and edges for triangles
+        // Store the triangle edges. Each edge corresponds to a graph node.
+        polygon.triangles.resize(elementCount);
         for (int i = 0; i < elementCount; i++) {
-            // Create the nodes. Each node corresponds to a triangle edge.
-            std::vector<Point> points;
-            std::vector<Graph::NodeId> nodeIds;
             for (int j = 0; j < 3; j++) {
                 int i0 = elements[i * 3 + j];
                 int i1 = elements[i * 3 + (j + 1) % 3];
@@ -261,11 +270,84 @@ namespace carto::sgre {
                 }
                 Point point0(coords[i0 * 3 + 0], coords[i0 * 3 + 1], coords[i0 * 3 + 2]);
                 Point point1(coords[i1 * 3 + 0], coords[i1 * 3 + 1], coords[i1 * 3 + 2]);
-                points.push_back(point0);
+
+                TriangleEdge triangleEdge;
+                triangleEdge.points = std::array<Point, 2> {{ point0, point1 }};
+                triangleEdge.geometryEdge = geometryEdges.count({{ point0(0), point0(1), point0(2), point1(0), point1(1), point1(2) }}) + geometryEdges.count({{ point1(0), point1(1), point1(2), point0(0), point0(1), point0(2) }}) > 0;
+                polygon.triangles[i].push_back(triangleEdge);
+            }
+        }
+        return polygon;
+    }
+
+    void GraphBuilder::addLineString(Graph::FeatureId featureId, const LineStringData& lineString) {
+        const std::vector<Point>& coordsList = lineString.coordsList;
+        Graph::AttributesId attribsId = addAttributes(lineString.attribs[0]);
+        Graph::AttributesId attribsIdBackwards = addAttributes(lineString.attribs[1]);
+
+        // Create node for each vertex
+        std::vector<Graph::NodeId> nodeIds;
+        for (std::size_t i = 0; i < coordsList.size(); i++) {
+            const Point& point = coordsList[i];
+
+            Graph::Node node;
+            node.nodeFlags = Graph::NodeFlags(i == 0 || i + 1 == coordsList.size() ? Graph::NodeFlags::ENDPOINT_VERTEX | Graph::NodeFlags::GEOMETRY_VERTEX : Graph::NodeFlags::GEOMETRY_VERTEX);
+            node.points = std::array<Point, 2> {{ point, point }};
+            Graph::NodeId nodeId = addNode(node);
+            nodeIds.push_back(nodeId);
+
+            // Store vertex information needed for linking it with underlying triangle
+            LineVertex lineVertex;
+            lineVertex.nodeId = nodeId;
+            lineVertex.linkMode = lineString.linkMode;
+            lineVertex.point = point;
+            _lineVertices.push_back(lineVertex);
+        }
+
+        // Create edges (both forward and backward)
+        for (std::size_t i = 1; i < nodeIds.size(); i++) {
+            const Graph::Node& node0 = getNode(nodeIds[i - 1]);
+            const Graph::Node& node1 = getNode(nodeIds[i]);
+
+            std::pair<double, double> dist2D = calculateDistance2D(node0.points[0], node1.points[0]);
+
+            if (!(dist2D.first != 0 && lineString.attribs[0].speed == FloatParameter(0.0f)) && !(dist2D.second != 0 && lineString.attribs[0].zSpeed == FloatParameter(0.0f))) {
+                Graph::Edge edge;
+                edge.edgeFlags = Graph::EdgeFlags(Graph::EdgeFlags::GEOMETRY_EDGE);
+                edge.featureId = featureId;
+                edge.attributesId = attribsId;
+                edge.nodeIds = std::array<Graph::NodeId, 2> {{ nodeIds[i - 1], nodeIds[i] }};
+                edge.searchCriteria = lineString.searchCriteria[0];
+                addEdge(edge);
+            }
+
+            if (!(dist2D.first != 0 && lineString.attribs[1].speed == FloatParameter(0.0f)) && !(dist2D.second != 0 && lineString.attribs[1].zSpeed == FloatParameter(0.0f))) {
+                Graph::Edge edge;
+                edge.edgeFlags = Graph::EdgeFlags(Graph::EdgeFlags::GEOMETRY_EDGE);
+                edge.featureId = featureId;
+                edge.attributesId = attribsIdBackwards;
+                edge.nodeIds = std::array<Graph::NodeId, 2> {{ nodeIds[i], nodeIds[i - 1] }};
+                edge.searchCriteria = lineString.searchCriteria[1]; // Note: always equal to forward search criteria
+                addEdge(edge);
+            }
+        }
+    }
+
+    void GraphBuilder::addPolygon(Graph::FeatureId featureId, const PolygonData& polygon) {
+        const Graph::Attributes& attribs = polygon.attribs;
+        Graph::AttributesId attribsId = addAttributes(attribs);
+
+        // Build nodes and edges for triangles
+        for (const std::vector<TriangleEdge>& triangleEdges : polygon.triangles) {
+            // Create the nodes. Each node corresponds to a triangle edge.
+            std::vector<Point> points;
+            std::vector<Graph::NodeId> nodeIds;
+            for (const TriangleEdge& triangleEdge : triangleEdges) {
+                points.push_back(triangleEdge.points[0]);
 
                 Graph::Node node;
-                node.nodeFlags = geometryEdges.count({{ point0(0), point0(1), point0(2), point1(0), point1(1), point1(2) }}) + geometryEdges.count({{ point1(0), point1(1), point1(2), point0(0), point0(1), point0(2) }}) > 0 ? Graph::NodeFlags::GEOMETRY_VERTEX : Graph::NodeFlags();
-                node.points = std::array<Point, 2> {{ point0, point1 }};
+                node.nodeFlags = triangleEdge.geometryEdge ? Graph::NodeFlags::GEOMETRY_VERTEX : Graph::NodeFlags();
+                node.points = triangleEdge.points;
                 Graph::NodeId nodeId = addNode(node);
                 nodeIds.push_back(nodeId);
             }
@@ -277,7 +359,7 @@ namespace carto::sgre {
                 Triangle triangle;
                 triangle.featureId = featureId;
                 triangle.attributesId = attribsId;
-                triangle.searchCriteria = searchCriteria;
+                triangle.searchCriteria = polygon.searchCriteria;
                 triangle.points = std::array<Point, 3> {{ points[0], points[1], points[2] }};
                 triangle.nodeIds = nodeIds;
                 _triangles.push_back(triangle);
@@ -298,7 +380,7 @@ namespace carto::sgre {
                         edge.triangleId = triangleId;
                         edge.attributesId = attribsId;
                         edge.nodeIds = std::array<Graph::NodeId, 2> {{ nodeIds[i0], nodeIds[i1] }};
-                        edge.searchCriteria = searchCriteria;
+                        edge.searchCriteria = polygon.searchCriteria;
                         addEdge(edge);
 
                         std::swap(edge.nodeIds[0], edge.nodeIds[1]);
@@ -363,26 +445,9 @@ namespace carto::sgre {
     }
 
     void GraphBuilder::matchRules(const Graph::FeatureProperties& properties, Graph::LinkMode& linkMode, Graph::SearchCriteria& searchCriteria, Graph::Attributes& attribs, bool forward) const {
-        for (const Rule& rule : _ruleList.getRules()) {
-            if (auto filters = rule.getFilters()) {
-                bool match = false;
-                for (const FeatureFilter& filter : *filters) {
-                    auto it = filter.begin();
-                    for (; it != filter.end(); it++) {
-                        if (!properties.contains(it->first) || properties.get(it->first) != it->second) {
-                            break;
-                        }
-                    }
-                    if (it == filter.end()) {
-                        match = true;
-                        break;
-                    }
-                }
-                if (!match) {
-                    continue;
-                }
-            }
-
+        const std::vector<Rule>& rules = _ruleList.getRules();
+        for (std::size_t ruleIndex : *_ruleMatcher.match(properties)) {
+            const Rule& rule = rules[ruleIndex];
             rule.apply(attribs, forward);
 
             if (auto ruleLinkMode = rule.getLinkMode()) {
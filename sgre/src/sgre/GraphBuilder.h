@@ -14,6 +14,7 @@
 #include <memory>
 #include <vector>
 #include <unordered_map>
+#include <istream>
 
 #include <boost/functional/hash.hpp>
 
@@ -23,14 +24,15 @@ namespace carto::sgre {
     class GraphBuilder final {
     public:
         GraphBuilder() = delete;
-        explicit GraphBuilder(RuleList ruleList) : _ruleList(std::move(ruleList)) { }
+        explicit GraphBuilder(RuleList ruleList) : _ruleList(std::move(ruleList)), _ruleMatcher(_ruleList) { }
 
         void addLineString(const std::vector<Point>& coordsList, const Graph::FeatureProperties& properties);
         void addPolygon(const std::vector<std::vector<Point>>& rings, const Graph::FeatureProperties& properties);
 
-        void importGeoJSON(const picojson::value& geoJSON);
-        void importGeoJSONFeatureCollection(const picojson::value& featureCollectionDef);
+        void importGeoJSON(const picojson::value& geoJSON, std::size_t threadCount = 1);
+        void importGeoJSONFeatureCollection(const picojson::value& featureCollectionDef, std::size_t threadCount = 1);
         void importGeoJSONFeature(const picojson::value& featureDef);
+        void importGeoJSON(std::istream& stream); // streams the features, without building the whole JSON document in memory
 
         std::shared_ptr<StaticGraph> build() const;
 
@@ -48,11 +50,39 @@ namespace carto::sgre {
             std::array<Point, 3> points;
             std::vector<Graph::NodeId> nodeIds;
         };
+
+        struct TriangleEdge {
+            std::array<Point, 2> points;
+            bool geometryEdge = false; // edge is part of the original polygon
+        };
+
+        struct LineStringData {
+            std::vector<Point> coordsList;
+            Graph::LinkMode linkMode = Graph::LinkMode::ALL;
+            std::array<Graph::SearchCriteria, 2> searchCriteria = {{ Graph::SearchCriteria::EDGE, Graph::SearchCriteria::EDGE }}; // forward and backward criteria
+            std::array<Graph::Attributes, 2> attribs;                                                                              // forward and backward attributes
+        };
+
+        struct PolygonData {
+            std::vector<std::vector<TriangleEdge>> triangles; // edges of the tesselated triangles, less than 3 edges only for invalid geometry
+            Graph::SearchCriteria searchCriteria = Graph::SearchCriteria::SURFACE;
+            Graph::Attributes attribs;
+        };
+
+        struct FeatureData {
+            std::vector<LineStringData> lineStrings;
+            std::vector<PolygonData> polygons;
+        };
         
         void importGeoJSONGeometry(const picojson::value& geometryDef, const Graph::FeatureProperties& properties);
+        FeatureData prepareGeoJSONGeometry(const picojson::value& geometryDef, const Graph::FeatureProperties& properties) const;
+        void addFeatureData(const FeatureData& featureData, const Graph::FeatureProperties& properties);
+
+        LineStringData prepareLineString(const std::vector<Point>& coordsList, const Graph::FeatureProperties& properties) const;
+        PolygonData preparePolygon(const std::vector<std::vector<Point>>& rings, const Graph::FeatureProperties& properties) const;
 
-        void addLineString(Graph::FeatureId featureId, const std::vector<Point>& coordsList, const Graph::FeatureProperties& properties);
-        void addPolygon(Graph::FeatureId featureId, const std::vector<std::vector<Point>>& rings, const Graph::FeatureProperties& properties);
+        void addLineString(Graph::FeatureId featureId, const LineStringData& lineString);
+        void addPolygon(Graph::FeatureId featureId, const PolygonData& polygon);
         
         const Graph::Node& getNode(Graph::NodeId nodeId) const;
         const Graph::Edge& getEdge(Graph::EdgeId edgeId) const;
@@ -71,6 +101,7 @@ namespace carto::sgre {
         static std::pair<double, double> calculateDistance2D(const Point& pos0, const Point& pos1);
 
         const RuleList _ruleList;
+        const RuleMatcher _ruleMatcher;
 
         std::vector<Graph::Node> _nodes;
         std::vector<Graph::Edge> _edges;
@@ -6,103 +6,249 @@
 #include <queue>
 #include <set>
 #include <map>
+#include <numeric>
+#include <functional>
+#include <chrono>
 
 #include <boost/math/constants/constants.hpp>
 
+#include <common/Parallel.h>
+
 namespace carto::sgre {
+    std::map<std::string, float> RouteFinder::getParameters() const {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        return _paramValues;
+    }
+
+    void RouteFinder::setParameters(const std::map<std::string, float>& paramValues) {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        _paramValues = paramValues;
+        _attributesTable.reset();
+    }
+
+    float RouteFinder::getParameter(const std::string& paramName) const {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        auto it = _paramValues.find(paramName);
+        return (it != _paramValues.end() ? it->second : std::numeric_limits<float>::quiet_NaN());
+    }
+
+    void RouteFinder::setParameter(const std::string& paramName, float value) {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        _paramValues[paramName] = value;
+        _attributesTable.reset();
+    }
+
     Result RouteFinder::find(const Query& query) const {
-        struct EndPoint {
-            Point point = Point();
-            Graph::TriangleId triangleId = Graph::TriangleId(-1);
-            std::set<Graph::EdgeId> edgeIds;
-        };
+        std::unique_ptr<Workspace> workspace = acquireWorkspace();
+        Result result = findRoute(query, *workspace, nullptr);
+        releaseWorkspace(std::move(workspace));
+        return result;
+    }
+
+    Result RouteFinder::find(const Query& query, Statistics& statistics) const {
+        statistics = Statistics();
+        std::unique_ptr<Workspace> workspace = acquireWorkspace();
+        Result result = findRoute(query, *workspace, &statistics);
+        releaseWorkspace(std::move(workspace));
+        return result;
+    }
+
+    void RouteFinder::prepareHierarchy() const {
+        getHierarchy(getAttributesTable());
+    }
+
+    std::vector<Result> RouteFinder::findOneToMany(const Point& sourcePos, const std::vector<Point>& targetPositions, const FeatureFilter& sourceFilter, const FeatureFilter& targetFilter) const {
+        std::vector<std::vector<EndPoint>> sourceEndPoints = findEndPoints({ sourcePos }, sourceFilter);
+        std::vector<std::vector<EndPoint>> targetEndPoints = findEndPoints(targetPositions, targetFilter);
+
+        std::unique_ptr<Workspace> workspace = acquireWorkspace();
+        std::vector<Result> results = findRoutes(sourceEndPoints.front(), targetEndPoints, *workspace);
+        releaseWorkspace(std::move(workspace));
+        return results;
+    }
+
+    std::vector<std::vector<double>> RouteFinder::calculateTimeMatrix(const std::vector<Point>& sourcePositions, const std::vector<Point>& targetPositions, const FeatureFilter& sourceFilter, const FeatureFilter& targetFilter, std::size_t threadCount) const {
+        // Snap all endpoints only once, the same target endpoints are used for each source
+        std::vector<std::vector<EndPoint>> sourceEndPoints = findEndPoints(sourcePositions, sourceFilter);
+        std::vector<std::vector<EndPoint>> targetEndPoints = findEndPoints(targetPositions, targetFilter);
+
+        // Run one-to-many searches for the sources in parallel. Workspaces are taken from the pool, so each thread keeps reusing them.
+        std::vector<std::vector<double>> timeMatrix(sourcePositions.size(), std::vector<double>(targetPositions.size(), std::numeric_limits<double>::infinity()));
+        common::runParallel(sourceEndPoints.size(), threadCount, [&](std::size_t i) {
+            // Only the route times are needed, so the results (geometry, instructions) are not built
+            std::unique_ptr<Workspace> workspace = acquireWorkspace();
+            double lngScale = 1.0;
+            std::shared_ptr<const EvaluatedAttributesTable> attributesTable;
+            std::vector<std::optional<Route>> routes = searchRoutes(sourceEndPoints[i], targetEndPoints, *workspace, nullptr, lngScale, attributesTable);
+            for (std::size_t j = 0; j < routes.size(); j++) {
+                if (routes[j]) {
+                    timeMatrix[i][j] = calculateRouteTime(*workspace->graph, *attributesTable, *routes[j], lngScale, _routeOptions.minTurnAngle, _routeOptions.minUpDownAngle);
+                }
+            }
+            releaseWorkspace(std::move(workspace));
+        });
+        return timeMatrix;
+    }
+
+    Result RouteFinder::findRoute(const Query& query, Workspace& workspace, Statistics* statistics) const {
+        auto startTime = std::chrono::steady_clock::now();
 
-        auto calculateAvgLngScale = [](const Point& point1, const Point& point2) -> double {
-            return std::max(std::cos((point1(1) + point2(1)) * 0.5 * boost::math::constants::pi<double>() / 180.0), 0.01);
-        };
-        
         // Find nearest edges to the endpoints. Note that there could be multiple nearest edges for both endpoints (two-way edges)
-        std::vector<EndPoint> endPoints[2];
+        std::vector<std::vector<EndPoint>> endPoints[2];
         for (int i = 0; i < 2; i++) {
-            StaticGraph::SearchOptions searchOptions;
-            searchOptions.zSensitivity = _routeOptions.zSensitivity;
-            std::vector<std::pair<Graph::EdgeId, Point>> edgePoints = _graph->findNearestEdgePoint(query.getPos(i), query.getFilter(i), searchOptions);
-            if (edgePoints.empty()) {
-                return Result();
+            endPoints[i] = findEndPoints({ query.getPos(i) }, query.getFilter(i));
+        }
+        if (statistics) {
+            statistics->snapTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        }
+        return findRoutes(endPoints[0].front(), endPoints[1], workspace, statistics).front();
+    }
+
+    std::vector<Result> RouteFinder::findRoutes(const std::vector<EndPoint>& sourceEndPoints, const std::vector<std::vector<EndPoint>>& targetEndPointsList, Workspace& workspace, Statistics* statistics) const {
+        double lngScale = 1.0;
+        std::shared_ptr<const EvaluatedAttributesTable> attributesTable;
+        std::vector<std::optional<Route>> routes = searchRoutes(sourceEndPoints, targetEndPointsList, workspace, statistics, lngScale, attributesTable);
+
+        // Build final results (remove duplicate nodes, create instructions)
+        auto startTime = std::chrono::steady_clock::now();
+        std::vector<Result> results(routes.size());
+        for (std::size_t j = 0; j < routes.size(); j++) {
+            if (routes[j]) {
+                results[j] = buildResult(*workspace.graph, *attributesTable, *routes[j], lngScale, _routeOptions.minTurnAngle, _routeOptions.minUpDownAngle);
             }
+        }
+        if (statistics) {
+            statistics->resultTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        }
+        return results;
+    }
 
-            for (const std::pair<Graph::EdgeId, Point>& edgePoint : edgePoints) {
-                const Graph::Edge& edge = _graph->getEdge(edgePoint.first);
+    std::vector<std::optional<RouteFinder::Route>> RouteFinder::searchRoutes(const std::vector<EndPoint>& sourceEndPoints, const std::vector<std::vector<EndPoint>>& targetEndPointsList, Workspace& workspace, Statistics* statistics, double& lngScale, std::shared_ptr<const EvaluatedAttributesTable>& attributesTable) const {
+        // Returns the time since the previous call, in seconds
+        auto lapTime = [lastTime = std::chrono::steady_clock::now()]() mutable {
+            auto currentTime = std::chrono::steady_clock::now();
+            double time = std::chrono::duration<double>(currentTime - lastTime).count();
+            lastTime = currentTime;
+            return time;
+        };
 
-                EndPoint endPoint;
-                endPoint.point = edgePoint.second;
-                endPoint.triangleId = edge.triangleId;
-                endPoint.edgeIds = std::set<Graph::EdgeId> { edgePoint.first };
+        std::vector<std::optional<Route>> routes(targetEndPointsList.size());
+        if (sourceEndPoints.empty()) {
+            return routes;
+        }
 
-                bool found = false;
-                for (std::size_t j = 0; j < endPoints[i].size(); j++) {
-                    double lngScale = calculateAvgLngScale(endPoints[i][j].point, endPoint.point);
-                    double dist = calculateDistance(endPoints[i][j].point, endPoint.point, lngScale);
-                    if (dist < DIST_EPSILON && endPoints[i][j].triangleId == endPoint.triangleId) {
-                        endPoints[i][j].edgeIds.insert(edgePoint.first);
-                        found = true;
-                        break;
-                    }
-                }
-                if (!found) {
-                    endPoints[i].push_back(endPoint);
-                }
-            }
+        // Link all endpoint combinations. Reuse the overlay graph of the workspace.
+        if (!workspace.graph) {
+            workspace.graph = std::make_shared<DynamicGraph>(_graph);
         }
-        
-        // Link all endpoint combinations.
-        auto graph = std::make_shared<DynamicGraph>(_graph);
-        double lngScale = calculateAvgLngScale(endPoints[0][0].point, endPoints[1][0].point);
-        
+        std::shared_ptr<DynamicGraph> graph = workspace.graph;
+        graph->reset();
+
         std::vector<Graph::NodeId> initialNodeIds;
-        std::vector<Graph::NodeId> finalNodeIds;
-        for (std::size_t i0 = 0; i0 < endPoints[0].size(); i0++) {
-            Graph::NodeId initialNodeId = createNode(*graph, endPoints[0][i0].point);
-            linkNodeToEdges(*graph, endPoints[0][i0].edgeIds, initialNodeId, 0);
+        for (std::size_t i0 = 0; i0 < sourceEndPoints.size(); i0++) {
+            Graph::NodeId initialNodeId = createNode(*graph, sourceEndPoints[i0].point);
+            linkNodeToEdges(*graph, sourceEndPoints[i0].edgeIds, initialNodeId, 0);
             initialNodeIds.push_back(initialNodeId);
         }
-        for (std::size_t i1 = 0; i1 < endPoints[1].size(); i1++) {
-            Graph::NodeId finalNodeId = createNode(*graph, endPoints[1][i1].point);
-            linkNodeToEdges(*graph, endPoints[1][i1].edgeIds, finalNodeId, 1);
-            finalNodeIds.push_back(finalNodeId);
-        }
-        for (std::size_t i0 = 0; i0 < endPoints[0].size(); i0++) {
-            for (std::size_t i1 = 0; i1 < endPoints[1].size(); i1++) {
-                linkNodesToCommonEdges(*graph, endPoints[0][i0].edgeIds, endPoints[1][i1].edgeIds, initialNodeIds[i0], finalNodeIds[i1]);
+
+        std::vector<std::vector<Graph::NodeId>> finalNodeIdsList(targetEndPointsList.size());
+        double targetLatSum = 0;
+        std::size_t targetCount = 0;
+        for (std::size_t j = 0; j < targetEndPointsList.size(); j++) {
+            const std::vector<EndPoint>& targetEndPoints = targetEndPointsList[j];
+            for (std::size_t i1 = 0; i1 < targetEndPoints.size(); i1++) {
+                Graph::NodeId finalNodeId = createNode(*graph, targetEndPoints[i1].point);
+                linkNodeToEdges(*graph, targetEndPoints[i1].edgeIds, finalNodeId, 1);
+                finalNodeIdsList[j].push_back(finalNodeId);
+            }
+            for (std::size_t i0 = 0; i0 < sourceEndPoints.size(); i0++) {
+                for (std::size_t i1 = 0; i1 < targetEndPoints.size(); i1++) {
+                    linkNodesToCommonEdges(*graph, sourceEndPoints[i0].edgeIds, targetEndPoints[i1].edgeIds, initialNodeIds[i0], finalNodeIdsList[j][i1]);
+                }
+            }
+            if (!targetEndPoints.empty()) {
+                targetLatSum += targetEndPoints.front().point(1);
+                targetCount++;
             }
         }
-
-        // Create evaluated attributes table
-        std::vector<EvaluatedAttributes> attributesTable(graph->getAttributesIdRangeEnd());
-        for (Graph::AttributesId attribsId = 0; attribsId < graph->getAttributesIdRangeEnd(); attribsId++) {
-            const Graph::Attributes& baseAttribs = graph->getAttributes(attribsId);
-
-            EvaluatedAttributes attribs;
-            attribs.speed = std::visit(FloatParameterEvaluator(_paramValues, DEFAULT_SPEED), baseAttribs.speed);
-            attribs.zSpeed = std::visit(FloatParameterEvaluator(_paramValues, DEFAULT_ZSPEED), baseAttribs.zSpeed);
-            attribs.turnSpeed = std::visit(FloatParameterEvaluator(_paramValues, DEFAULT_TURNSPEED), baseAttribs.turnSpeed);
-            attribs.delay = std::visit(FloatParameterEvaluator(_paramValues, DEFAULT_DELAY), baseAttribs.delay);
-            attributesTable[attribsId] = attribs;
+        if (targetCount == 0) {
+            return routes;
         }
 
-        // Try to find the fastest route
-        std::optional<Route> route = findFastestRoute(*graph, attributesTable, initialNodeIds, finalNodeIds, lngScale, _routeOptions.tesselationDistance);
-        if (!route) {
-            return Result();
+        // Use a common longitude scale for the search, based on the average latitude of the targets
+        lngScale = calculateAvgLngScale(sourceEndPoints.front().point, Point(0, targetLatSum / targetCount, 0));
+
+        // Get evaluated attributes table. The graph overlay does not add new attributes, so the table of the static graph can be used.
+        attributesTable = getAttributesTable();
+
+        // Try to find the fastest routes. Use the contraction hierarchy for single target queries, if enabled.
+        if (_routeOptions.contractionHierarchy && targetEndPointsList.size() == 1) {
+            std::shared_ptr<const Hierarchy> hierarchy = getHierarchy(attributesTable);
+            routes.front() = findHierarchyRoute(*graph, *hierarchy, initialNodeIds, finalNodeIdsList.front(), workspace, statistics);
+        } else {
+            // Use landmarks for better A* estimates, if enabled
+            std::shared_ptr<const Landmarks> landmarks;
+            if (_routeOptions.landmarks > 0 && targetEndPointsList.size() == 1) {
+                landmarks = getLandmarks(attributesTable);
+            }
+            routes = findFastestRoutes(*graph, *attributesTable, landmarks.get(), initialNodeIds, finalNodeIdsList, lngScale, _routeOptions.tesselationDistance, workspace, statistics);
+        }
+        if (statistics) {
+            statistics->searchTime += lapTime();
         }
 
         // Do optional path straightening. This is very important for polygon/hybrid graphs.
         if (_routeOptions.pathStraightening) {
-            route = straightenRoute(*graph, *route, lngScale);
+            for (std::size_t j = 0; j < routes.size(); j++) {
+                if (routes[j]) {
+                    routes[j] = straightenRoute(*graph, *routes[j], lngScale, _routeOptions.fastStraightening, workspace.visibilityWorkspace);
+                }
+            }
+            if (statistics) {
+                statistics->straighteningTime += lapTime();
+            }
+        }
+        return routes;
+    }
+
+    std::vector<std::vector<RouteFinder::EndPoint>> RouteFinder::findEndPoints(const std::vector<Point>& posList, const FeatureFilter& filter) const {
+        StaticGraph::SearchOptions searchOptions;
+        searchOptions.zSensitivity = _routeOptions.zSensitivity;
+        std::vector<std::vector<std::pair<Graph::EdgeId, Point>>> edgePointsList;
+        if (posList.size() == 1) {
+            edgePointsList.push_back(_graph->findNearestEdgePoint(posList.front(), filter, searchOptions));
+        } else {
+            edgePointsList = _graph->findNearestEdgePoints(posList, filter, searchOptions);
         }
 
-        // Build final result (remove duplicate nodes, create instructions)
-        return buildResult(*graph, attributesTable, *route, lngScale, _routeOptions.minTurnAngle, _routeOptions.minUpDownAngle);
+        // Merge the edges with same nearest points (two-way edges, shared triangle edges)
+        std::vector<std::vector<EndPoint>> endPointsList(posList.size());
+        for (std::size_t i = 0; i < posList.size(); i++) {
+            std::vector<EndPoint>& endPoints = endPointsList[i];
+            for (const std::pair<Graph::EdgeId, Point>& edgePoint : edgePointsList[i]) {
+                const Graph::Edge& edge = _graph->getEdge(edgePoint.first);
+
+                EndPoint endPoint;
+                endPoint.point = edgePoint.second;
+                endPoint.triangleId = edge.triangleId;
+                endPoint.edgeIds = std::set<Graph::EdgeId> { edgePoint.first };
+
+                bool found = false;
+                for (std::size_t j = 0; j < endPoints.size(); j++) {
+                    double lngScale = calculateAvgLngScale(endPoints[j].point, endPoint.point);
+                    double dist = calculateDistance(endPoints[j].point, endPoint.point, lngScale);
+                    if (dist < DIST_EPSILON && endPoints[j].triangleId == endPoint.triangleId) {
+                        endPoints[j].edgeIds.insert(edgePoint.first);
+                        found = true;
+                        break;
+                    }
+                }
+                if (!found) {
+                    endPoints.push_back(endPoint);
+                }
+            }
+        }
+        return endPointsList;
     }
 
     std::unique_ptr<RouteFinder> RouteFinder::create(std::shared_ptr<const StaticGraph> graph, const picojson::value& configDef) {
@@ -122,12 +268,276 @@ namespace carto::sgre {
         if (configDef.contains("min_updownangle")) {
             routeOptions.minUpDownAngle = configDef.get("min_updownangle").get<double>();
         }
+        if (configDef.contains("landmarks")) {
+            routeOptions.landmarks = static_cast<std::size_t>(configDef.get("landmarks").get<double>());
+        }
+        if (configDef.contains("contractionhierarchy")) {
+            routeOptions.contractionHierarchy = configDef.get("contractionhierarchy").get<bool>();
+        }
 
         auto routeFinder = std::make_unique<RouteFinder>(std::move(graph));
         routeFinder->setRouteOptions(routeOptions);
         return routeFinder;
     }
 
+    std::shared_ptr<const RouteFinder::EvaluatedAttributesTable> RouteFinder::getAttributesTable() const {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+
+        // The table is invalidated when the parameters change
+        if (!_attributesTable) {
+            auto attributesTable = std::make_shared<EvaluatedAttributesTable>(_graph->getAttributesIdRangeEnd());
+            for (Graph::AttributesId attribsId = 0; attribsId < _graph->getAttributesIdRangeEnd(); attribsId++) {
+                const Graph::Attributes& baseAttribs = _graph->getAttributes(attribsId);
+
+                EvaluatedAttributes attribs;
+                attribs.speed = std::visit(FloatParameterEvaluator(_paramValues, DEFAULT_SPEED), baseAttribs.speed);
+                attribs.zSpeed = std::visit(FloatParameterEvaluator(_paramValues, DEFAULT_ZSPEED), baseAttribs.zSpeed);
+                attribs.turnSpeed = std::visit(FloatParameterEvaluator(_paramValues, DEFAULT_TURNSPEED), baseAttribs.turnSpeed);
+                attribs.delay = std::visit(FloatParameterEvaluator(_paramValues, DEFAULT_DELAY), baseAttribs.delay);
+                (*attributesTable)[attribsId] = attribs;
+            }
+            _attributesTable = std::move(attributesTable);
+        }
+        return _attributesTable;
+    }
+
+    std::shared_ptr<const RouteFinder::Landmarks> RouteFinder::getLandmarks(const std::shared_ptr<const EvaluatedAttributesTable>& attributesTable) const {
+        // Rebuild the landmarks if the options or parameters affecting the times have changed. The landmarks are built outside of the lock, as in getHierarchy.
+        double tesselationDistance = _routeOptions.tesselationDistance;
+        std::size_t count = std::min(_routeOptions.landmarks, static_cast<std::size_t>(_graph->getNodeIdRangeEnd()));
+        std::promise<std::shared_ptr<const Landmarks>> promise;
+        std::shared_future<std::shared_ptr<const Landmarks>> future;
+        bool build = false;
+        {
+            std::lock_guard<std::mutex> lock(_cacheMutex);
+            if (!_landmarksFuture.valid() || _landmarksCount != count || _landmarksTesselationDistance != tesselationDistance || *_landmarksAttributesTable != *attributesTable) {
+                _landmarksFuture = promise.get_future().share();
+                _landmarksAttributesTable = attributesTable;
+                _landmarksTesselationDistance = tesselationDistance;
+                _landmarksCount = count;
+                build = true;
+            }
+            future = _landmarksFuture;
+        }
+
+        if (build) {
+            try {
+                promise.set_value(buildLandmarks(*_graph, *attributesTable, tesselationDistance, count));
+            }
+            catch (...) {
+                promise.set_exception(std::current_exception());
+
+                // Do not keep the failed build, the next query will retry
+                std::lock_guard<std::mutex> lock(_cacheMutex);
+                if (_landmarksAttributesTable == attributesTable && _landmarksTesselationDistance == tesselationDistance && _landmarksCount == count) {
+                    _landmarksFuture = std::shared_future<std::shared_ptr<const Landmarks>>();
+                }
+            }
+        }
+        return future.get();
+    }
+
+    std::shared_ptr<const RouteFinder::Landmarks> RouteFinder::buildLandmarks(const StaticGraph& graph, const EvaluatedAttributesTable& attributesTable, double tesselationDistance, std::size_t count) {
+        auto landmarks = std::make_shared<Landmarks>();
+        landmarks->attributesTable = attributesTable;
+        landmarks->tesselationDistance = tesselationDistance;
+        landmarks->edgeIdRangeEnd = graph.getEdgeIdRangeEnd();
+
+        std::size_t nodeCount = graph.getNodeIdRangeEnd();
+        std::size_t edgeCount = graph.getEdgeIdRangeEnd();
+        if (nodeCount == 0) {
+            return landmarks;
+        }
+
+        // Use the smallest longitude scale within the graph, so that the times are lower bounds for all queries
+        double lngScale = 1.0;
+        for (Graph::NodeId nodeId = 0; nodeId < nodeCount; nodeId++) {
+            for (const Point& point : graph.getNode(nodeId).points) {
+                lngScale = std::min(lngScale, std::max(std::cos(point(1) * boost::math::constants::pi<double>() / 180.0), 0.01));
+            }
+        }
+
+        // Find the possible search positions of each node. Nodes that are not tesselated are always entered at their first point.
+        std::vector<std::array<Point, 2>> nodeSegments(nodeCount);
+        for (Graph::NodeId nodeId = 0; nodeId < nodeCount; nodeId++) {
+            const Graph::Node& node = graph.getNode(nodeId);
+            std::size_t tesselationLevel = static_cast<std::size_t>(std::ceil(calculateDistance(node.points[0], node.points[1], lngScale) / tesselationDistance));
+            nodeSegments[nodeId] = (tesselationLevel > 0 ? node.points : std::array<Point, 2> {{ node.points[0], node.points[0] }});
+        }
+
+        // Calculate lower bounds for edge times and build incoming edge lists for backward searches
+        std::vector<double> edgeTimes(edgeCount);
+        std::vector<std::size_t> incomingEdgeOffsets(nodeCount + 1, 0);
+        for (Graph::EdgeId edgeId = 0; edgeId < edgeCount; edgeId++) {
+            const Graph::Edge& edge = graph.getEdge(edgeId);
+            edgeTimes[edgeId] = calculateMinTime(attributesTable[edge.attributesId], nodeSegments[edge.nodeIds[0]], nodeSegments[edge.nodeIds[1]], lngScale);
+            incomingEdgeOffsets[edge.nodeIds[1] + 1]++;
+        }
+        std::partial_sum(incomingEdgeOffsets.begin(), incomingEdgeOffsets.end(), incomingEdgeOffsets.begin());
+        std::vector<Graph::EdgeId> incomingEdgeIds(edgeCount);
+        std::vector<std::size_t> incomingEdgeCounts(nodeCount, 0);
+        for (Graph::EdgeId edgeId = 0; edgeId < edgeCount; edgeId++) {
+            Graph::NodeId targetNodeId = graph.getEdge(edgeId).nodeIds[1];
+            incomingEdgeIds[incomingEdgeOffsets[targetNodeId] + incomingEdgeCounts[targetNodeId]++] = edgeId;
+        }
+
+        // Plain Dijkstra search from or to the landmark
+        auto calculateTimes = [&](Graph::NodeId landmarkId, bool backward) -> std::vector<double> {
+            using QueueRecord = std::pair<double, Graph::NodeId>;
+
+            std::vector<double> times(nodeCount, std::numeric_limits<double>::infinity());
+            std::priority_queue<QueueRecord, std::vector<QueueRecord>, std::greater<QueueRecord>> nodeQueue;
+            times[landmarkId] = 0;
+            nodeQueue.emplace(0.0, landmarkId);
+            while (!nodeQueue.empty()) {
+                QueueRecord rec = nodeQueue.top();
+                nodeQueue.pop();
+                if (rec.first > times[rec.second]) {
+                    continue;
+                }
+
+                auto relaxEdge = [&](Graph::EdgeId edgeId, Graph::NodeId targetNodeId) {
+                    double targetTime = rec.first + edgeTimes[edgeId];
+                    if (targetTime < times[targetNodeId]) {
+                        times[targetNodeId] = targetTime;
+                        nodeQueue.emplace(targetTime, targetNodeId);
+                    }
+                };
+                if (!backward) {
+                    for (Graph::EdgeId edgeId : graph.getNode(rec.second).edgeIds) {
+                        relaxEdge(edgeId, graph.getEdge(edgeId).nodeIds[1]);
+                    }
+                } else {
+                    for (std::size_t i = incomingEdgeOffsets[rec.second]; i < incomingEdgeOffsets[rec.second + 1]; i++) {
+                        relaxEdge(incomingEdgeIds[i], graph.getEdge(incomingEdgeIds[i]).nodeIds[0]);
+                    }
+                }
+            }
+            return times;
+        };
+
+        // Select the landmarks using farthest point heuristics, starting from the node farthest from the first node
+        std::vector<double> minDists(nodeCount, std::numeric_limits<double>::infinity());
+        auto selectFarthestNode = [&](Graph::NodeId nodeId) -> Graph::NodeId {
+            const Point& pos = graph.getNode(nodeId).points[0];
+            Graph::NodeId farthestNodeId = nodeId;
+            for (Graph::NodeId i = 0; i < nodeCount; i++) {
+                minDists[i] = std::min(minDists[i], calculateDistance(graph.getNode(i).points[0], pos, lngScale));
+                if (minDists[i] > minDists[farthestNodeId]) {
+                    farthestNodeId = i;
+                }
+            }
+            return farthestNodeId;
+        };
+        Graph::NodeId landmarkId = selectFarthestNode(0);
+        std::fill(minDists.begin(), minDists.end(), std::numeric_limits<double>::infinity());
+        while (landmarks->nodeIds.size() < count) {
+            landmarks->nodeIds.push_back(landmarkId);
+            landmarks->fromTimes.push_back(calculateTimes(landmarkId, false));
+            landmarks->toTimes.push_back(calculateTimes(landmarkId, true));
+            landmarkId = selectFarthestNode(landmarkId);
+        }
+        return landmarks;
+    }
+
+    std::shared_ptr<const RouteFinder::Hierarchy> RouteFinder::getHierarchy(const std::shared_ptr<const EvaluatedAttributesTable>& attributesTable) const {
+        // Rebuild the hierarchy if the options or parameters affecting the times have changed. The hierarchy is built outside of the lock,
+        // concurrent queries with the same parameters wait for the same build.
+        double tesselationDistance = _routeOptions.tesselationDistance;
+        std::promise<std::shared_ptr<const Hierarchy>> promise;
+        std::shared_future<std::shared_ptr<const Hierarchy>> future;
+        bool build = false;
+        {
+            std::lock_guard<std::mutex> lock(_cacheMutex);
+            if (!_hierarchyFuture.valid() || _hierarchyTesselationDistance != tesselationDistance || *_hierarchyAttributesTable != *attributesTable) {
+                _hierarchyFuture = promise.get_future().share();
+                _hierarchyAttributesTable = attributesTable;
+                _hierarchyTesselationDistance = tesselationDistance;
+                build = true;
+            }
+            future = _hierarchyFuture;
+        }
+
+        if (build) {
+            try {
+                promise.set_value(buildHierarchy(*_graph, *attributesTable, tesselationDistance));
+            }
+            catch (...) {
+                promise.set_exception(std::current_exception());
+
+                // Do not keep the failed build, the next query will retry
+                std::lock_guard<std::mutex> lock(_cacheMutex);
+                if (_hierarchyAttributesTable == attributesTable && _hierarchyTesselationDistance == tesselationDistance) {
+                    _hierarchyFuture = std::shared_future<std::shared_ptr<const Hierarchy>>();
+                }
+            }
+        }
+        return future.get();
+    }
+
+    std::shared_ptr<const RouteFinder::Hierarchy> RouteFinder::buildHierarchy(const StaticGraph& graph, const EvaluatedAttributesTable& attributesTable, double tesselationDistance) {
+        auto hierarchy = std::make_shared<Hierarchy>();
+        hierarchy->attributesTable = attributesTable;
+        hierarchy->tesselationDistance = tesselationDistance;
+
+        // Use a fixed longitude scale based on the average latitude of the graph. Within a venue the difference from the query scale is negligible.
+        std::size_t nodeCount = graph.getNodeIdRangeEnd();
+        double latSum = 0;
+        for (Graph::NodeId nodeId = 0; nodeId < nodeCount; nodeId++) {
+            latSum += graph.getNode(nodeId).points[0](1);
+        }
+        Point avgPos(0, nodeCount > 0 ? latSum / nodeCount : 0, 0);
+        hierarchy->lngScale = calculateAvgLngScale(avgPos, avgPos);
+
+        // Each tesselated position of a node is a separate search state, as in the plain search
+        hierarchy->nodeStateOffsets.assign(nodeCount + 1, 0);
+        for (Graph::NodeId nodeId = 0; nodeId < nodeCount; nodeId++) {
+            const Graph::Node& node = graph.getNode(nodeId);
+            std::size_t tesselationLevel = static_cast<std::size_t>(std::ceil(calculateDistance(node.points[0], node.points[1], hierarchy->lngScale) / tesselationDistance));
+            hierarchy->nodeStateOffsets[nodeId + 1] = hierarchy->nodeStateOffsets[nodeId] + tesselationLevel + 1;
+        }
+        auto getStatePoint = [&](Graph::NodeId nodeId, std::size_t state) -> Point {
+            const Graph::Node& node = graph.getNode(nodeId);
+            std::size_t stateCount = hierarchy->nodeStateOffsets[nodeId + 1] - hierarchy->nodeStateOffsets[nodeId];
+            double t = static_cast<double>(state - hierarchy->nodeStateOffsets[nodeId]) / std::max(stateCount - 1, std::size_t(1));
+            return node.points[0] + (node.points[1] - node.points[0]) * t;
+        };
+
+        // Connect all states of the edge nodes, ignoring impassable edges
+        std::vector<ContractionHierarchy::Edge> stateEdges;
+        for (Graph::EdgeId edgeId = 0; edgeId < graph.getEdgeIdRangeEnd(); edgeId++) {
+            const Graph::Edge& edge = graph.getEdge(edgeId);
+            const EvaluatedAttributes& attribs = attributesTable[edge.attributesId];
+            for (std::size_t state0 = hierarchy->nodeStateOffsets[edge.nodeIds[0]]; state0 < hierarchy->nodeStateOffsets[edge.nodeIds[0] + 1]; state0++) {
+                Point pos0 = getStatePoint(edge.nodeIds[0], state0);
+                for (std::size_t state1 = hierarchy->nodeStateOffsets[edge.nodeIds[1]]; state1 < hierarchy->nodeStateOffsets[edge.nodeIds[1] + 1]; state1++) {
+                    double time = calculateTime(attribs, true, 0.0, pos0, getStatePoint(edge.nodeIds[1], state1), hierarchy->lngScale);
+                    if (std::isfinite(time)) {
+                        stateEdges.push_back({ state0, state1, time });
+                        hierarchy->stateEdgeIds.push_back(edgeId);
+                    }
+                }
+            }
+        }
+        hierarchy->contractionHierarchy = std::make_unique<const ContractionHierarchy>(hierarchy->nodeStateOffsets.back(), std::move(stateEdges));
+        return hierarchy;
+    }
+
+    std::unique_ptr<RouteFinder::Workspace> RouteFinder::acquireWorkspace() const {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        if (_workspacePool.empty()) {
+            return std::make_unique<Workspace>();
+        }
+        std::unique_ptr<Workspace> workspace = std::move(_workspacePool.back());
+        _workspacePool.pop_back();
+        return workspace;
+    }
+
+    void RouteFinder::releaseWorkspace(std::unique_ptr<Workspace> workspace) const {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        _workspacePool.push_back(std::move(workspace));
+    }
+
     Graph::NodeId RouteFinder::createNode(DynamicGraph& graph, const Point& point) {
         Graph::Node node;
         node.nodeFlags = Graph::NodeFlags(0);
@@ -137,6 +547,8 @@ namespace carto::sgre {
 
     void RouteFinder::linkNodeToEdges(DynamicGraph& graph, const std::set<Graph::EdgeId>& edgeIds, Graph::NodeId nodeId, int nodeIdx) {
         // Find all 'linked edge' ids. For triangles this means finding all edges of the triangle.
+        // Edges added for previously linked endpoints are skipped, they would only create duplicate edges.
+        Graph::EdgeId staticEdgeIdRangeEnd = graph.getStaticGraph()->getEdgeIdRangeEnd();
         std::set<Graph::EdgeId> linkedEdgeIds;
         for (Graph::EdgeId edgeId : edgeIds) {
             const Graph::Edge& edge = graph.getEdge(edgeId);
@@ -145,7 +557,7 @@ namespace carto::sgre {
                 const Graph::Node& node = graph.getNode(edge.nodeIds[1 - nodeIdx]);
                 for (Graph::EdgeId linkedEdgeId : node.edgeIds) {
                     const Graph::Edge& linkedEdge = graph.getEdge(linkedEdgeId);
-                    if (linkedEdge.triangleId == edge.triangleId) {
+                    if (linkedEdgeId < staticEdgeIdRangeEnd && linkedEdge.triangleId == edge.triangleId) {
                         linkedEdgeIds.insert(linkedEdgeId);
 
                         // For final node, we need to do another hop as we do not store incoming edge ids for nodes
@@ -153,7 +565,7 @@ namespace carto::sgre {
                             const Graph::Node& nextNode = graph.getNode(linkedEdge.nodeIds[1]);
                             for (Graph::EdgeId nextLinkedEdgeId : nextNode.edgeIds) {
                                 const Graph::Edge& nextLinkedEdge = graph.getEdge(nextLinkedEdgeId);
-                                if (nextLinkedEdge.triangleId == edge.triangleId) {
+                                if (nextLinkedEdgeId < staticEdgeIdRangeEnd && nextLinkedEdge.triangleId == edge.triangleId) {
                                     linkedEdgeIds.insert(nextLinkedEdgeId);
                                 }
                             }
@@ -199,58 +611,201 @@ namespace carto::sgre {
         }
     }
 
-    bool RouteFinder::isNodeVisible(const Graph& graph, Graph::NodeId nodeId0, double t0, Graph::NodeId nodeId1, double t1, double lngScale, std::set<Graph::NodeId> visitedNodeIds) {
-        if (nodeId0 == nodeId1) {
-            return true;
-        }
-        if (visitedNodeIds.count(nodeId0) > 0) {
-            return false;
+    bool RouteFinder::isNodeVisible(const Graph& graph, Graph::NodeId nodeId0, double t0, Graph::NodeId nodeId1, double t1, double lngScale, VisibilityWorkspace& workspace) {
+        // Start a new test by advancing the stamp instead of clearing the visited nodes
+        if (workspace.visitedStamps.size() < graph.getNodeIdRangeEnd()) {
+            workspace.visitedStamps.resize(graph.getNodeIdRangeEnd(), 0);
         }
-        visitedNodeIds.insert(nodeId0);
+        std::size_t stamp = ++workspace.stamp;
 
-        const Graph::Node& node0 = graph.getNode(nodeId0);
         const Graph::Node& node1 = graph.getNode(nodeId1);
-        Point pos0 = node0.points[0] + (node0.points[1] - node0.points[0]) * t0;
         Point pos1 = node1.points[0] + (node1.points[1] - node1.points[0]) * t1;
-        cglib::vec3<double> posDelta = pos1 - pos0;
 
-        for (Graph::EdgeId edgeId : node0.edgeIds) {
-            Graph::NodeId targetNodeId = graph.getEdge(edgeId).nodeIds[1];
-            const Graph::Node& targetNode = graph.getNode(targetNodeId);
-            cglib::vec3<double> pointsDelta = targetNode.points[1] - targetNode.points[0];
-
-            // Calculate distances along 2 axes for intersection point
-            double s = 0;
-            if (cglib::norm(posDelta) != 0) {
-                cglib::vec3<double> normal = cglib::vector_product(cglib::vector_product(pointsDelta, posDelta), pointsDelta);
-                double dot = cglib::dot_product(posDelta, normal);
-                if (dot != 0) {
-                    s = std::min(1.0, std::max(0.0, cglib::dot_product(targetNode.points[0] - pos0, normal) / dot));
-                } else {
-                    s = std::min(1.0, std::max(0.0, cglib::dot_product(targetNode.points[0] - pos0, posDelta) / cglib::norm(posDelta)));
+        // Walk along the line from the starting position, using explicit stack
+        std::vector<std::pair<Graph::NodeId, double>>& nodeStack = workspace.nodeStack;
+        nodeStack.clear();
+        nodeStack.emplace_back(nodeId0, t0);
+        while (!nodeStack.empty()) {
+            Graph::NodeId nodeId = nodeStack.back().first;
+            double t = nodeStack.back().second;
+            nodeStack.pop_back();
+
+            if (nodeId == nodeId1) {
+                return true;
+            }
+            if (workspace.visitedStamps[nodeId] == stamp) {
+                continue;
+            }
+            workspace.visitedStamps[nodeId] = stamp;
+
+            const Graph::Node& node0 = graph.getNode(nodeId);
+            Point pos0 = node0.points[0] + (node0.points[1] - node0.points[0]) * t;
+            cglib::vec3<double> posDelta = pos1 - pos0;
+
+            // Process the edges in reverse order, so that the nodes are visited in the order of the edges
+            for (auto it = node0.edgeIds.rbegin(); it != node0.edgeIds.rend(); it++) {
+                Graph::NodeId targetNodeId = graph.getEdge(*it).nodeIds[1];
+                const Graph::Node& targetNode = graph.getNode(targetNodeId);
+                cglib::vec3<double> pointsDelta = targetNode.points[1] - targetNode.points[0];
+
+                // Calculate distances along 2 axes for intersection point
+                double s = 0;
+                if (cglib::norm(posDelta) != 0) {
+                    cglib::vec3<double> normal = cglib::vector_product(cglib::vector_product(pointsDelta, posDelta), pointsDelta);
+                    double dot = cglib::dot_product(posDelta, normal);
+                    if (dot != 0) {
+                        s = std::min(1.0, std::max(0.0, cglib::dot_product(targetNode.points[0] - pos0, normal) / dot));
+                    } else {
+                        s = std::min(1.0, std::max(0.0, cglib::dot_product(targetNode.points[0] - pos0, posDelta) / cglib::norm(posDelta)));
+                    }
+                }
+
+                double targetT = 0;
+                if (cglib::norm(pointsDelta) != 0) {
+                    targetT = std::min(1.0, std::max(0.0, cglib::dot_product(pos0 + posDelta * s - targetNode.points[0], pointsDelta) / cglib::norm(pointsDelta)));
+                }
+
+                // If the resulting points are close, try moving along the edge
+                double dist = calculateDistance(pos0 + posDelta * s, targetNode.points[0] + pointsDelta * targetT, lngScale);
+                if (dist < DIST_EPSILON) {
+                    nodeStack.emplace_back(targetNodeId, targetT);
+                }
+            }
+        }
+        return false;
+    }
+
+    bool RouteFinder::isRouteSegmentVisible(const Graph& graph, const Route& route, std::size_t index1, double lngScale, VisibilityCone& cone) {
+        auto getRoutePoint = [&](std::size_t index) -> Point {
+            const Graph::Node& node = graph.getNode(route[index].targetNodeId);
+            return node.points[0] + (node.points[1] - node.points[0]) * route[index].targetNodeT;
+        };
+        auto projectPoint = [lngScale](const Point& pos) {
+            return cglib::vec2<double>(pos(0) * lngScale, pos(1));
+        };
+        auto crossProduct = [](const cglib::vec2<double>& v0, const cglib::vec2<double>& v1) {
+            return v0(0) * v1(1) - v0(1) * v1(0);
+        };
+        auto isInside = [&](const cglib::vec2<double>& dir, const cglib::vec2<double>& right, const cglib::vec2<double>& left) {
+            return crossProduct(right, dir) >= 0 && crossProduct(dir, left) >= 0 && (crossProduct(right, left) > 0 || crossProduct(right, dir) > 0 || cglib::dot_product(right, dir) > 0);
+        };
+        auto intersectCone = [&](const cglib::vec2<double>& right, const cglib::vec2<double>& left) {
+            if (!cone.bounded) {
+                cone.right = right;
+                cone.left = left;
+                cone.bounded = true;
+                return true;
+            }
+            if (!isInside(cone.right, right, left)) {
+                if (!isInside(right, cone.right, cone.left)) {
+                    return false;
+                }
+                cone.right = right;
+            }
+            if (!isInside(cone.left, right, left)) {
+                if (!isInside(left, cone.right, cone.left)) {
+                    return false;
                 }
+                cone.left = left;
             }
+            return true;
+        };
+        auto getNodeSegment = [&](std::size_t index) {
+            const Graph::Node& node = graph.getNode(route[index].targetNodeId);
+            return std::make_pair(projectPoint(node.points[0]) - cone.apex, projectPoint(node.points[1]) - cone.apex);
+        };
+        auto getRayParam = [&](const cglib::vec2<double>& dir, const std::pair<cglib::vec2<double>, cglib::vec2<double>>& segment) {
+            return crossProduct(segment.first, segment.second - segment.first) / crossProduct(dir, segment.second - segment.first);
+        };
 
-            double t = 0;
-            if (cglib::norm(pointsDelta) != 0) {
-                t = std::min(1.0, std::max(0.0, cglib::dot_product(pos0 + posDelta * s - targetNode.points[0], pointsDelta) / cglib::norm(pointsDelta)));
+        // Only flat segments are handled, as the intersections are calculated in 2D
+        Point pos0 = getRoutePoint(cone.index0);
+        if (cone.index1 == cone.index0 + 1 && !cone.bounded) {
+            cone.apex = projectPoint(pos0);
+        }
+
+        // Add the intermediate route nodes, narrowing the cone to the directions that cross the nodes in order. Nodes are added only once for the apex.
+        for (; cone.valid && cone.index1 < index1; cone.index1++) {
+            const Graph::Node& node = graph.getNode(route[cone.index1].targetNodeId);
+            if (node.points[0](2) != pos0(2) || node.points[1](2) != pos0(2)) {
+                cone.valid = false;
+                break;
+            }
+            std::pair<cglib::vec2<double>, cglib::vec2<double>> segment = getNodeSegment(cone.index1);
+            double side = crossProduct(segment.first, segment.second);
+            if (side == 0 || !intersectCone(side > 0 ? segment.first : segment.second, side > 0 ? segment.second : segment.first)) {
+                cone.valid = false;
+                break;
+            }
+            if (cone.index1 == cone.index0 + 1) {
+                continue;
             }
 
-            // If the resulting points are close, try moving along the edge recursively
-            double dist = calculateDistance(pos0 + posDelta * s, targetNode.points[0] + pointsDelta * t, lngScale);
-            if (dist < DIST_EPSILON) {
-                if (isNodeVisible(graph, targetNodeId, t, nodeId1, t1, lngScale, visitedNodeIds)) {
-                    return true;
+            // The previous node must be crossed first. If the nodes intersect, this holds only on one side of the intersection point.
+            std::pair<cglib::vec2<double>, cglib::vec2<double>> prevSegment = getNodeSegment(cone.index1 - 1);
+            cglib::vec2<double> testDir = cglib::unit(cone.right) + cglib::unit(cone.left);
+            cglib::vec2<double> delta = segment.second - segment.first, prevDelta = prevSegment.second - prevSegment.first;
+            double denom = crossProduct(delta, prevDelta);
+            if (denom != 0) {
+                double t = crossProduct(prevSegment.first - segment.first, prevDelta) / denom;
+                double prevT = crossProduct(prevSegment.first - segment.first, delta) / denom;
+                if (t >= 0 && t <= 1 && prevT >= 0 && prevT <= 1) {
+                    cglib::vec2<double> crossDir = segment.first + delta * t;
+                    if (crossDir == cglib::vec2<double>(0, 0)) {
+                        cone.valid = false;
+                        break;
+                    }
+                    if (crossProduct(crossDir, testDir) == 0) {
+                        testDir = (crossProduct(crossDir, cone.right) != 0 ? cone.right : cone.left);
+                    }
+                    bool ordered = getRayParam(testDir, prevSegment) <= getRayParam(testDir, segment);
+                    bool rightSide = crossProduct(crossDir, testDir) > 0;
+                    if (!(rightSide == ordered ? intersectCone(crossDir, -crossDir) : intersectCone(-crossDir, crossDir))) {
+                        cone.valid = false;
+                    }
+                    continue;
                 }
             }
+            if (getRayParam(testDir, prevSegment) > getRayParam(testDir, segment)) {
+                cone.valid = false;
+            }
         }
-        return false;
+        if (!cone.valid) {
+            return false;
+        }
+
+        // The target must be inside the cone and beyond the last intermediate node. The earlier nodes are then crossed before the target.
+        Point pos1 = getRoutePoint(index1);
+        cglib::vec2<double> dir = projectPoint(pos1) - cone.apex;
+        if (pos1(2) != pos0(2) || dir == cglib::vec2<double>(0, 0)) {
+            return false;
+        }
+        if (cone.bounded) {
+            if (!isInside(dir, cone.right, cone.left) || getRayParam(dir, getNodeSegment(index1 - 1)) > 1) {
+                return false;
+            }
+        }
+        return true;
     }
 
     Result RouteFinder::buildResult(const Graph& graph, const EvaluatedAttributesTable& attributesTable, const Route& route, double lngScale, double minTurnAngle, double minUpDownAngle) {
-        // Build both route geometry and instructions in one pass
         std::vector<Point> points;
         std::vector<Instruction> instructions;
+        if (!std::isfinite(traceRoute(graph, attributesTable, route, lngScale, minTurnAngle, minUpDownAngle, points, &instructions))) {
+            return Result();
+        }
+        return Result(std::move(instructions), std::move(points));
+    }
+
+    double RouteFinder::calculateRouteTime(const Graph& graph, const EvaluatedAttributesTable& attributesTable, const Route& route, double lngScale, double minTurnAngle, double minUpDownAngle) {
+        std::vector<Point> points;
+        return traceRoute(graph, attributesTable, route, lngScale, minTurnAngle, minUpDownAngle, points, nullptr);
+    }
+
+    double RouteFinder::traceRoute(const Graph& graph, const EvaluatedAttributesTable& attributesTable, const Route& route, double lngScale, double minTurnAngle, double minUpDownAngle, std::vector<Point>& points, std::vector<Instruction>* instructions) {
+        // Build both route geometry and instructions in one pass. Without instructions only the geometry needed for the turn angles is built.
+        double totalTime = 0;
+        bool hasInstructions = false;
         Graph::FeatureId lastFeatureId = Graph::FeatureId(-1);
         for (std::size_t i = 0; i < route.size(); i++) {
             const RouteNode& routeNode = route[i];
@@ -263,13 +818,16 @@ namespace carto::sgre {
             }
 
             // Read node feature and attributes
-            const Graph::FeatureProperties& properties = graph.getFeatureProperties(routeNode.featureId);
             const EvaluatedAttributes& attribs = attributesTable[routeNode.attributesId];
 
             // Add optional waiting instruction.
             if (attribs.delay > 0) {
-                Instruction waitInstruction(Instruction::Type::WAIT, properties, 0, attribs.delay, points.size() - 2);
-                instructions.push_back(std::move(waitInstruction));
+                if (instructions) {
+                    Instruction waitInstruction(Instruction::Type::WAIT, graph.getFeatureProperties(routeNode.featureId), 0, attribs.delay, points.size() - 2);
+                    instructions->push_back(std::move(waitInstruction));
+                }
+                totalTime += attribs.delay;
+                hasInstructions = true;
             }
 
             // Calculate the turning angle/mode starting from the second point
@@ -333,17 +891,20 @@ namespace carto::sgre {
             double dist = calculateDistance(pos0, pos1, lngScale);
             double time = calculateTime(attribs, false, turnAngle, pos0, pos1, lngScale);
             if (!std::isfinite(time)) {
-                return Result();
+                return std::numeric_limits<double>::infinity();
             }
+            totalTime += time;
 
             // Store the instruction. But first check if we can merge this instruction with the last one based on type
             std::size_t geometryIndex = points.size() - 2;
-            if (instructions.size() > 0 && routeNode.featureId == lastFeatureId && type == Instruction::Type::GO_STRAIGHT) {
-                type = instructions.back().getType();
-                dist += instructions.back().getDistance();
-                time += instructions.back().getTime();
-                geometryIndex = instructions.back().getGeometryIndex();
-                instructions.pop_back();
+            if (hasInstructions && routeNode.featureId == lastFeatureId && type == Instruction::Type::GO_STRAIGHT) {
+                if (instructions) {
+                    type = instructions->back().getType();
+                    dist += instructions->back().getDistance();
+                    time += instructions->back().getTime();
+                    geometryIndex = instructions->back().getGeometryIndex();
+                    instructions->pop_back();
+                }
 
                 // Remove redundant points from straight lines
                 if (points.size() > 2) {
@@ -355,22 +916,25 @@ namespace carto::sgre {
                     }
                 }
             }
-            Instruction instruction(type, properties, dist, time, geometryIndex);
-            instructions.push_back(std::move(instruction));
-
-            // Add the final instruction if we are at the end
-            if (i + 1 == route.size()) {
-                Instruction finalInstruction(Instruction::Type::REACHED_YOUR_DESTINATION, properties, 0, 0, points.size() - 1);
-                instructions.push_back(std::move(finalInstruction));
+            if (instructions) {
+                const Graph::FeatureProperties& properties = graph.getFeatureProperties(routeNode.featureId);
+                Instruction instruction(type, properties, dist, time, geometryIndex);
+                instructions->push_back(std::move(instruction));
+
+                // Add the final instruction if we are at the end
+                if (i + 1 == route.size()) {
+                    Instruction finalInstruction(Instruction::Type::REACHED_YOUR_DESTINATION, properties, 0, 0, points.size() - 1);
+                    instructions->push_back(std::move(finalInstruction));
+                }
             }
+            hasInstructions = true;
 
             lastFeatureId = routeNode.featureId;
         }
-
-        return Result(std::move(instructions), std::move(points));
+        return totalTime;
     }
 
-    RouteFinder::Route RouteFinder::straightenRoute(const Graph& graph, const Route& route, double lngScale) {
+    RouteFinder::Route RouteFinder::straightenRoute(const Graph& graph, const Route& route, double lngScale, bool fastStraightening, VisibilityWorkspace& workspace) {
         Route optimizedRoute;
         if (!route.empty()) {
             optimizedRoute.push_back(route.front());
@@ -378,7 +942,9 @@ namespace carto::sgre {
         for (std::size_t i = 1; i < route.size(); ) {
             const RouteNode& routeNode0 = optimizedRoute.back();
 
-            // Find first node that is not 'visible' from current node
+            // Find first node that is not 'visible' from current node. Use fast check along the route nodes first, before walking the graph.
+            // The fast check narrows the cone of directions from the current node incrementally, so each route node is added only once.
+            VisibilityCone cone(i - 1);
             std::size_t j = i + 1;
             for (; j < route.size(); j++) {
                 // Stop if feature id has changed
@@ -388,8 +954,10 @@ namespace carto::sgre {
                 
                 const RouteNode& routeNode1 = route[j];
 
-                std::set<Graph::NodeId> visitedNodeIds;
-                if (!isNodeVisible(graph, routeNode0.targetNodeId, routeNode0.targetNodeT, routeNode1.targetNodeId, routeNode1.targetNodeT, lngScale, visitedNodeIds)) {
+                if (fastStraightening && isRouteSegmentVisible(graph, route, j, lngScale, cone)) {
+                    continue;
+                }
+                if (!isNodeVisible(graph, routeNode0.targetNodeId, routeNode0.targetNodeT, routeNode1.targetNodeId, routeNode1.targetNodeT, lngScale, workspace)) {
                     break;
                 }
             }
@@ -402,21 +970,16 @@ namespace carto::sgre {
         return optimizedRoute;
     }
 
-    std::optional<RouteFinder::Route> RouteFinder::findFastestRoute(const Graph& graph, const EvaluatedAttributesTable& attributesTable, const std::vector<Graph::NodeId>& initialNodeIds, const std::vector<Graph::NodeId>& finalNodeIds, double lngScale, double tesselationDistance) {
-        struct NodeRecord {
-            double time; // best estimated time to final some from some initial node. Estimated time must not exceed actual time.
-            Graph::NodeId nodeId;
-            std::size_t routeEdgeIndex; // outgoing route edge index
-
-            bool operator < (const NodeRecord& rec) const { return rec.time < time; }
-        };
-
-        struct RouteEdge {
-            double time; // time spent up to this point
-            Graph::EdgeId edgeId;
-            std::size_t routeEdgeIndex; // incoming route edge index
-            double nodeT; // outgoing edge node T value
-        };
+    std::vector<std::optional<RouteFinder::Route>> RouteFinder::findFastestRoutes(const Graph& graph, const EvaluatedAttributesTable& attributesTable, const Landmarks* landmarks, const std::vector<Graph::NodeId>& initialNodeIds, const std::vector<std::vector<Graph::NodeId>>& finalNodeIdsList, double lngScale, double tesselationDistance, Workspace& workspace, Statistics* statistics) {
+        // Map final nodes to their targets. With multiple targets A* estimates are not used and the search settles the targets in the order of their times.
+        std::vector<std::pair<Graph::NodeId, std::size_t>> finalNodeTargets;
+        for (std::size_t j = 0; j < finalNodeIdsList.size(); j++) {
+            for (Graph::NodeId finalNodeId : finalNodeIdsList[j]) {
+                finalNodeTargets.emplace_back(finalNodeId, j);
+            }
+        }
+        std::sort(finalNodeTargets.begin(), finalNodeTargets.end());
+        const std::vector<Graph::NodeId> finalNodeIds = (finalNodeIdsList.size() == 1 ? finalNodeIdsList.front() : std::vector<Graph::NodeId>());
 
         // Find fastest attributes for A*
         EvaluatedAttributes fastestAttributes;
@@ -430,41 +993,107 @@ namespace carto::sgre {
             fastestAttributes.turnSpeed = std::max(fastestAttributes.turnSpeed, attribs.turnSpeed);
         }
 
-        // Initialize route map and node queue
-        std::unordered_map<Graph::NodeId, std::vector<RouteEdge>> bestRouteMap;
-        std::priority_queue<NodeRecord> nodeQueue;
+        // Prepare landmark times for final nodes. Final nodes are not part of the static graph, so use the bounds of their predecessor nodes instead:
+        // minimum time from the landmark to the predecessors and maximum time from the predecessors to the landmark.
+        std::size_t landmarkNodeCount = 0;
+        std::vector<std::pair<double, double>> landmarkFinalTimes;
+        if (landmarks && !landmarks->nodeIds.empty()) {
+            landmarkNodeCount = landmarks->fromTimes.front().size();
+            landmarkFinalTimes.assign(landmarks->nodeIds.size(), { std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity() });
+            for (Graph::EdgeId edgeId = landmarks->edgeIdRangeEnd; edgeId < graph.getEdgeIdRangeEnd(); edgeId++) {
+                const Graph::Edge& edge = graph.getEdge(edgeId);
+                if (edge.nodeIds[0] >= landmarkNodeCount || std::find(finalNodeIds.begin(), finalNodeIds.end(), edge.nodeIds[1]) == finalNodeIds.end()) {
+                    continue;
+                }
+                for (std::size_t i = 0; i < landmarkFinalTimes.size(); i++) {
+                    landmarkFinalTimes[i].first = std::min(landmarkFinalTimes[i].first, landmarks->fromTimes[i][edge.nodeIds[0]]);
+                    landmarkFinalTimes[i].second = std::max(landmarkFinalTimes[i].second, landmarks->toTimes[i][edge.nodeIds[0]]);
+                }
+            }
+        }
+
+        // Calculate best possible time from the node position to the closest final node. Use landmark bounds based on triangle inequality, if available.
+        auto estimateTime = [&](Graph::NodeId nodeId, const Point& nodePos) -> double {
+            if (finalNodeIds.empty()) {
+                return 0.0;
+            }
+            double bestEstTime = std::numeric_limits<double>::infinity();
+            for (Graph::NodeId finalNodeId : finalNodeIds) {
+                const Graph::Node& finalNode = graph.getNode(finalNodeId);
+                double estTime = calculateTime(fastestAttributes, false, 0.0, nodePos, finalNode.points[0], lngScale);
+                bestEstTime = std::min(bestEstTime, estTime);
+            }
+            if (nodeId < landmarkNodeCount) {
+                for (std::size_t i = 0; i < landmarkFinalTimes.size(); i++) {
+                    double fromTime = landmarks->fromTimes[i][nodeId];
+                    double toTime = landmarks->toTimes[i][nodeId];
+                    if (std::isfinite(landmarkFinalTimes[i].first) && std::isfinite(fromTime)) {
+                        bestEstTime = std::max(bestEstTime, landmarkFinalTimes[i].first - fromTime);
+                    }
+                    if (std::isfinite(landmarkFinalTimes[i].second)) {
+                        bestEstTime = std::max(bestEstTime, toTime - landmarkFinalTimes[i].second);
+                    }
+                }
+            }
+            return bestEstTime;
+        };
+
+        // Initialize route edges and node queue of the workspace. Route edges of the previous queries are invalidated by advancing the stamp.
+        if (workspace.routeEdges.size() < graph.getNodeIdRangeEnd()) {
+            workspace.routeEdges.resize(graph.getNodeIdRangeEnd());
+            workspace.routeEdgeStamps.resize(graph.getNodeIdRangeEnd(), 0);
+        }
+        std::size_t stamp = ++workspace.stamp;
+        auto getRouteEdges = [&workspace, stamp](Graph::NodeId nodeId) -> std::vector<RouteEdge>& {
+            std::vector<RouteEdge>& routeEdges = workspace.routeEdges[nodeId];
+            if (workspace.routeEdgeStamps[nodeId] != stamp) {
+                workspace.routeEdgeStamps[nodeId] = stamp;
+                routeEdges.clear();
+            }
+            return routeEdges;
+        };
+
+        std::vector<NodeRecord>& nodeQueue = workspace.nodeQueue;
+        nodeQueue.clear();
         for (Graph::NodeId initialNodeId : initialNodeIds) {
             const Graph::Node& initialNode = graph.getNode(initialNodeId);
 
             // Store initial node of the path
-            bestRouteMap[initialNodeId] = std::vector<RouteEdge> {{ 0.0, Graph::EdgeId(-1), 0, 0.0 }};
+            getRouteEdges(initialNodeId).assign(1, { 0.0, Graph::EdgeId(-1), 0, 0.0 });
 
-            // Calculate best possible time from the node to the closest final node
-            double bestTotalEstTime = std::numeric_limits<double>::infinity();
-            for (Graph::NodeId finalNodeId : finalNodeIds) {
-                const Graph::Node& finalNode = graph.getNode(finalNodeId);
-                double totalEstTime = calculateTime(fastestAttributes, false, 0.0, initialNode.points[0], finalNode.points[0], lngScale);
-                bestTotalEstTime = std::min(bestTotalEstTime, totalEstTime);
+            // Calculate best possible time from the node to the closest final node. Skip the node if no final node is reachable.
+            double bestTotalEstTime = estimateTime(initialNodeId, initialNode.points[0]);
+            if (std::isinf(bestTotalEstTime)) {
+                continue;
             }
-            nodeQueue.push({ bestTotalEstTime, initialNodeId, 0 });
+            nodeQueue.push_back({ bestTotalEstTime, initialNodeId, 0 });
+            std::push_heap(nodeQueue.begin(), nodeQueue.end());
         }
 
-        // Process the node queue
-        Graph::NodeId finalNodeId = Graph::NodeId(-1);
-        while (!nodeQueue.empty()) {
-            NodeRecord rec = nodeQueue.top();
-            nodeQueue.pop();
+        // Process the node queue until all targets are reached
+        std::vector<Graph::NodeId> bestFinalNodeIds(finalNodeIdsList.size(), Graph::NodeId(-1));
+        std::size_t remainingTargetCount = std::count_if(finalNodeIdsList.begin(), finalNodeIdsList.end(), [](const std::vector<Graph::NodeId>& targetNodeIds) { return !targetNodeIds.empty(); });
+        while (!nodeQueue.empty() && remainingTargetCount > 0) {
+            std::pop_heap(nodeQueue.begin(), nodeQueue.end());
+            NodeRecord rec = nodeQueue.back();
+            nodeQueue.pop_back();
+            if (statistics) {
+                statistics->nodeQueuePops++;
+            }
 
-            // Check if we have reached a final node
-            auto nodeIt = std::find(finalNodeIds.begin(), finalNodeIds.end(), rec.nodeId);
-            if (nodeIt != finalNodeIds.end()) {
-                finalNodeId = *nodeIt;
-                break;
+            // Check if we have reached a final node. Final nodes have no outgoing edges.
+            auto nodeIt = std::lower_bound(finalNodeTargets.begin(), finalNodeTargets.end(), std::make_pair(rec.nodeId, std::size_t(0)));
+            if (nodeIt != finalNodeTargets.end() && nodeIt->first == rec.nodeId) {
+                if (bestFinalNodeIds[nodeIt->second] == Graph::NodeId(-1)) {
+                    bestFinalNodeIds[nodeIt->second] = rec.nodeId;
+                    remainingTargetCount--;
+                }
+                continue;
             }
 
             Graph::NodeId nodeId = rec.nodeId;
             const Graph::Node& node = graph.getNode(nodeId);
-            const RouteEdge& routeEdge = bestRouteMap[nodeId][rec.routeEdgeIndex];
+            const RouteEdge& routeEdge = getRouteEdges(nodeId)[rec.routeEdgeIndex];
             Point nodePos = node.points[0] + (node.points[1] - node.points[0]) * routeEdge.nodeT;
             double time = routeEdge.time;
 
@@ -476,7 +1105,7 @@ namespace carto::sgre {
                 const Graph::Node& targetNode = graph.getNode(targetNodeId);
 
                 // Read/initialize edges to target node
-                std::vector<RouteEdge>& targetRouteEdges = bestRouteMap[targetNodeId];
+                std::vector<RouteEdge>& targetRouteEdges = getRouteEdges(targetNodeId);
                 if (targetRouteEdges.empty()) {
                     std::size_t tesselationLevel = static_cast<std::size_t>(std::ceil(calculateDistance(targetNode.points[0], targetNode.points[1], lngScale) / tesselationDistance));
                     targetRouteEdges.resize(tesselationLevel + 1, { std::numeric_limits<double>::infinity(), Graph::EdgeId(-1), 0, 0.0 });
@@ -501,50 +1130,152 @@ namespace carto::sgre {
                     targetRouteEdges[i] = { targetTime, edgeId, rec.routeEdgeIndex, targetNodeT };
 
                     // Calculate the fastest possible estimation from target node to the closest final node and push it to queue
-                    double bestTotalEstTime = std::numeric_limits<double>::infinity();
-                    for (Graph::NodeId finalNodeId : finalNodeIds) {
-                        const Graph::Node& finalNode = graph.getNode(finalNodeId);
-                        double totalEstTime = targetTime + calculateTime(fastestAttributes, false, 0.0, targetNodePos, finalNode.points[0], lngScale);
-                        bestTotalEstTime = std::min(bestTotalEstTime, totalEstTime);
+                    double bestTotalEstTime = targetTime + estimateTime(targetNodeId, targetNodePos);
+                    if (std::isinf(bestTotalEstTime)) {
+                        continue;
                     }
-                    nodeQueue.push({ bestTotalEstTime, targetNodeId, i });
+                    nodeQueue.push_back({ bestTotalEstTime, targetNodeId, i });
+                    std::push_heap(nodeQueue.begin(), nodeQueue.end());
                 }
             }
         }
 
-        // Success?
-        if (finalNodeId == Graph::NodeId(-1)) {
-            return std::optional<Route>();
-        }
+        // Reconstruct the fastest routes backwards
+        std::vector<std::optional<Route>> bestRoutes(finalNodeIdsList.size());
+        for (std::size_t j = 0; j < bestFinalNodeIds.size(); j++) {
+            if (bestFinalNodeIds[j] == Graph::NodeId(-1)) {
+                continue;
+            }
 
-        // Reconstruct the fastest route backwards.
-        Route bestRoute;
-        Graph::NodeId lastNodeId = finalNodeId;
-        std::size_t lastRouteEdgeIndex = 0;
-        while (true) {
-            const RouteEdge& routeEdge = bestRouteMap[lastNodeId].at(lastRouteEdgeIndex);
-            if (routeEdge.edgeId == Graph::EdgeId(-1)) {
-                break;
+            Route bestRoute;
+            Graph::NodeId lastNodeId = bestFinalNodeIds[j];
+            std::size_t lastRouteEdgeIndex = 0;
+            while (true) {
+                const RouteEdge& routeEdge = getRouteEdges(lastNodeId).at(lastRouteEdgeIndex);
+                if (routeEdge.edgeId == Graph::EdgeId(-1)) {
+                    break;
+                }
+                
+                const Graph::Edge& edge = graph.getEdge(routeEdge.edgeId);
+                RouteNode routeNode;
+                routeNode.featureId = edge.featureId;
+                routeNode.attributesId = edge.attributesId;
+                routeNode.targetNodeId = edge.nodeIds[1];
+                routeNode.targetNodeT = routeEdge.nodeT;
+                bestRoute.emplace_back(routeNode);
+
+                lastNodeId = edge.nodeIds[0];
+                lastRouteEdgeIndex = routeEdge.routeEdgeIndex;
             }
+            RouteNode initialRouteNode;
+            initialRouteNode.targetNodeId = lastNodeId;
+            bestRoute.emplace_back(initialRouteNode);
             
-            const Graph::Edge& edge = graph.getEdge(routeEdge.edgeId);
+            // Done, reverse the generated route
+            std::reverse(bestRoute.begin(), bestRoute.end());
+            bestRoutes[j] = std::move(bestRoute);
+        }
+        return bestRoutes;
+    }
+
+    std::optional<RouteFinder::Route> RouteFinder::findHierarchyRoute(const DynamicGraph& graph, const Hierarchy& hierarchy, const std::vector<Graph::NodeId>& initialNodeIds, const std::vector<Graph::NodeId>& finalNodeIds, Workspace& workspace, Statistics* statistics) {
+        const EvaluatedAttributesTable& attributesTable = hierarchy.attributesTable;
+        const std::vector<std::size_t>& nodeStateOffsets = hierarchy.nodeStateOffsets;
+        Graph::NodeId staticNodeCount = static_cast<Graph::NodeId>(nodeStateOffsets.size() - 1);
+        auto getStateNodeId = [&](std::size_t state) -> Graph::NodeId {
+            return static_cast<Graph::NodeId>(std::upper_bound(nodeStateOffsets.begin(), nodeStateOffsets.end(), state) - nodeStateOffsets.begin() - 1);
+        };
+        auto getStateT = [&](Graph::NodeId nodeId, std::size_t state) -> double {
+            std::size_t stateCount = nodeStateOffsets[nodeId + 1] - nodeStateOffsets[nodeId];
+            return static_cast<double>(state - nodeStateOffsets[nodeId]) / std::max(stateCount - 1, std::size_t(1));
+        };
+        auto getNodePoint = [&](Graph::NodeId nodeId, double t) -> Point {
+            const Graph::Node& node = graph.getNode(nodeId);
+            return node.points[0] + (node.points[1] - node.points[0]) * t;
+        };
+
+        // Endpoint nodes are only linked to the static graph by the overlay edges. Find the best overlay edge for each initial and final state,
+        // and the best edge directly linking initial and final nodes.
+        std::map<std::size_t, std::pair<double, Graph::EdgeId>> initialStates, finalStates;
+        double bestDirectTime = std::numeric_limits<double>::infinity();
+        Graph::EdgeId bestDirectEdgeId = Graph::EdgeId(-1);
+        for (Graph::EdgeId edgeId = graph.getStaticGraph()->getEdgeIdRangeEnd(); edgeId < graph.getEdgeIdRangeEnd(); edgeId++) {
+            const Graph::Edge& edge = graph.getEdge(edgeId);
+            const EvaluatedAttributes& attribs = attributesTable[edge.attributesId];
+            bool initial = std::find(initialNodeIds.begin(), initialNodeIds.end(), edge.nodeIds[0]) != initialNodeIds.end();
+            bool final = std::find(finalNodeIds.begin(), finalNodeIds.end(), edge.nodeIds[1]) != finalNodeIds.end();
+            if (initial && final) {
+                double time = calculateTime(attribs, true, 0.0, getNodePoint(edge.nodeIds[0], 0), getNodePoint(edge.nodeIds[1], 0), hierarchy.lngScale);
+                if (time < bestDirectTime) {
+                    bestDirectTime = time;
+                    bestDirectEdgeId = edgeId;
+                }
+            } else if (initial && edge.nodeIds[1] < staticNodeCount) {
+                for (std::size_t state = nodeStateOffsets[edge.nodeIds[1]]; state < nodeStateOffsets[edge.nodeIds[1] + 1]; state++) {
+                    double time = calculateTime(attribs, true, 0.0, getNodePoint(edge.nodeIds[0], 0), getNodePoint(edge.nodeIds[1], getStateT(edge.nodeIds[1], state)), hierarchy.lngScale);
+                    auto it = initialStates.emplace(state, std::make_pair(time, edgeId)).first;
+                    if (time < it->second.first) {
+                        it->second = std::make_pair(time, edgeId);
+                    }
+                }
+            } else if (final && edge.nodeIds[0] < staticNodeCount) {
+                for (std::size_t state = nodeStateOffsets[edge.nodeIds[0]]; state < nodeStateOffsets[edge.nodeIds[0] + 1]; state++) {
+                    double time = calculateTime(attribs, true, 0.0, getNodePoint(edge.nodeIds[0], getStateT(edge.nodeIds[0], state)), getNodePoint(edge.nodeIds[1], 0), hierarchy.lngScale);
+                    auto it = finalStates.emplace(state, std::make_pair(time, edgeId)).first;
+                    if (time < it->second.first) {
+                        it->second = std::make_pair(time, edgeId);
+                    }
+                }
+            }
+        }
+
+        std::vector<std::pair<std::size_t, double>> initialStateTimes, finalStateTimes;
+        for (const auto& initialState : initialStates) {
+            if (std::isfinite(initialState.second.first)) {
+                initialStateTimes.emplace_back(initialState.first, initialState.second.first);
+            }
+        }
+        for (const auto& finalState : finalStates) {
+            if (std::isfinite(finalState.second.first)) {
+                finalStateTimes.emplace_back(finalState.first, finalState.second.first);
+            }
+        }
+
+        // Find the fastest path between the states and compare it to the direct route
+        ContractionHierarchy::Path path;
+        bool found = hierarchy.contractionHierarchy->findShortestPath(initialStateTimes, finalStateTimes, path, workspace.hierarchyWorkspace, statistics ? &statistics->nodeQueuePops : nullptr);
+        if (!found && bestDirectEdgeId == Graph::EdgeId(-1)) {
+            return std::optional<Route>();
+        }
+
+        auto createRouteNode = [&](Graph::EdgeId edgeId, double targetNodeT) {
+            const Graph::Edge& edge = graph.getEdge(edgeId);
             RouteNode routeNode;
             routeNode.featureId = edge.featureId;
             routeNode.attributesId = edge.attributesId;
             routeNode.targetNodeId = edge.nodeIds[1];
-            routeNode.targetNodeT = routeEdge.nodeT;
-            bestRoute.emplace_back(routeNode);
+            routeNode.targetNodeT = targetNodeT;
+            return routeNode;
+        };
 
-            lastNodeId = edge.nodeIds[0];
-            lastRouteEdgeIndex = routeEdge.routeEdgeIndex;
+        Route route;
+        if (!found || bestDirectTime <= path.weight) {
+            route.emplace_back();
+            route.back().targetNodeId = graph.getEdge(bestDirectEdgeId).nodeIds[0];
+            route.push_back(createRouteNode(bestDirectEdgeId, 0.0));
+            return route;
         }
-        RouteNode initialRouteNode;
-        initialRouteNode.targetNodeId = lastNodeId;
-        bestRoute.emplace_back(initialRouteNode);
-        
-        // Done, reverse the generated route
-        std::reverse(bestRoute.begin(), bestRoute.end());
-        return bestRoute;
+
+        Graph::EdgeId initialEdgeId = initialStates.at(path.initialNodeId).second;
+        route.emplace_back();
+        route.back().targetNodeId = graph.getEdge(initialEdgeId).nodeIds[0];
+        route.push_back(createRouteNode(initialEdgeId, getStateT(getStateNodeId(path.initialNodeId), path.initialNodeId)));
+        for (ContractionHierarchy::EdgeId stateEdgeId : path.edgeIds) {
+            std::size_t state = hierarchy.contractionHierarchy->getEdge(stateEdgeId).targetNodeId;
+            route.push_back(createRouteNode(hierarchy.stateEdgeIds[stateEdgeId], getStateT(getStateNodeId(state), state)));
+        }
+        route.push_back(createRouteNode(finalStates.at(path.finalNodeId).second, 0.0));
+        return route;
     }
 
     double RouteFinder::calculateTime(const EvaluatedAttributes& attribs, bool applyDelay, double turnAngle, const Point& pos0, const Point& pos1, double lngScale) {
@@ -560,6 +1291,44 @@ namespace carto::sgre {
         return time;
     }
     
+    double RouteFinder::calculateMinTime(const EvaluatedAttributes& attribs, const std::array<Point, 2>& segment0, const std::array<Point, 2>& segment1, double lngScale) {
+        static constexpr double EARTH_RADIUS = 6378137.0;
+
+        // Find the minimum horizontal distance between the segments, in meters
+        auto projectPoint = [lngScale](const Point& pos) {
+            return cglib::vec2<double>(pos(0) * lngScale, pos(1)) * (EARTH_RADIUS * boost::math::constants::pi<double>() / 180.0);
+        };
+        auto pointSegmentDistance = [](const cglib::vec2<double>& pos, const cglib::vec2<double>& pos0, const cglib::vec2<double>& pos1) {
+            cglib::vec2<double> delta = pos1 - pos0;
+            double d = cglib::dot_product(delta, delta);
+            double s = (d > 0 ? std::max(0.0, std::min(1.0, cglib::dot_product(pos - pos0, delta) / d)) : 0.0);
+            return cglib::length(pos - (pos0 + delta * s));
+        };
+        auto orientation = [](const cglib::vec2<double>& pos0, const cglib::vec2<double>& pos1, const cglib::vec2<double>& pos2) {
+            double det = (pos1(0) - pos0(0)) * (pos2(1) - pos0(1)) - (pos1(1) - pos0(1)) * (pos2(0) - pos0(0));
+            return (det > 0 ? 1 : (det < 0 ? -1 : 0));
+        };
+
+        std::array<cglib::vec2<double>, 2> s0 {{ projectPoint(segment0[0]), projectPoint(segment0[1]) }};
+        std::array<cglib::vec2<double>, 2> s1 {{ projectPoint(segment1[0]), projectPoint(segment1[1]) }};
+        double distXY = 0;
+        if (orientation(s0[0], s0[1], s1[0]) * orientation(s0[0], s0[1], s1[1]) >= 0 || orientation(s1[0], s1[1], s0[0]) * orientation(s1[0], s1[1], s0[1]) >= 0) {
+            distXY = std::min(std::min(pointSegmentDistance(s0[0], s1[0], s1[1]), pointSegmentDistance(s0[1], s1[0], s1[1])), std::min(pointSegmentDistance(s1[0], s0[0], s0[1]), pointSegmentDistance(s1[1], s0[0], s0[1])));
+        }
+
+        // Find the minimum vertical distance between the segments
+        double distZ = std::max(0.0, std::max(std::min(segment1[0](2), segment1[1](2)) - std::max(segment0[0](2), segment0[1](2)), std::min(segment0[0](2), segment0[1](2)) - std::max(segment1[0](2), segment1[1](2))));
+
+        double time = std::max(0.0f, attribs.delay);
+        time += (distXY > 0 ? distXY / attribs.speed : 0);
+        time += (distZ > 0 ? distZ / attribs.zSpeed : 0);
+        return time;
+    }
+
+    double RouteFinder::calculateAvgLngScale(const Point& pos0, const Point& pos1) {
+        return std::max(std::cos((pos0(1) + pos1(1)) * 0.5 * boost::math::constants::pi<double>() / 180.0), 0.01);
+    }
+
     double RouteFinder::calculateDistance(const Point& pos0, const Point& pos1, double lngScale) {
         std::pair<double, double> dist2D = calculateDistance2D(pos0, pos1, lngScale);
         return std::sqrt(dist2D.first * dist2D.first + dist2D.second * dist2D.second);
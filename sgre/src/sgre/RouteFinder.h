@@ -11,12 +11,15 @@
 #include "Graph.h"
 #include "Query.h"
 #include "Result.h"
+#include "ContractionHierarchy.h"
 
 #include <memory>
 #include <optional>
 #include <string>
 #include <vector>
 #include <set>
+#include <mutex>
+#include <future>
 #include <limits>
 
 #include <picojson/picojson.h>
@@ -26,10 +29,21 @@ namespace carto::sgre {
     public:
         struct RouteOptions {
             bool pathStraightening = true;
+            bool fastStraightening = true; // accept straightened segments crossing the route nodes in order without walking the graph, the result is the same
             double tesselationDistance = std::numeric_limits<double>::infinity();
             double zSensitivity = 1.0;
             double minTurnAngle = 5.0;
             double minUpDownAngle = 45.0;
+            std::size_t landmarks = 0; // number of landmark nodes for ALT heuristics, 0 disables landmarks
+            bool contractionHierarchy = false; // use a contraction hierarchy built for the current parameters in single target queries
+        };
+
+        struct Statistics {
+            std::size_t nodeQueuePops = 0; // number of node records processed by the search
+            double snapTime = 0;           // time spent in snapping the endpoints, in seconds
+            double searchTime = 0;         // time spent in linking the endpoints and in the fastest route search, in seconds
+            double straighteningTime = 0;  // time spent in path straightening, in seconds
+            double resultTime = 0;         // time spent in building the result, in seconds
         };
 
         RouteFinder() = delete;
@@ -38,13 +52,23 @@ namespace carto::sgre {
         const RouteOptions& getRouteOptions() const { return _routeOptions; }
         void setRouteOptions(const RouteOptions& routeOptions) { _routeOptions = routeOptions; }
 
-        std::map<std::string, float> getParameters() const { return _paramValues; }
-        void setParameters(const std::map<std::string, float>& paramValues) { _paramValues = paramValues; }
+        std::map<std::string, float> getParameters() const;
+        void setParameters(const std::map<std::string, float>& paramValues);
 
-        float getParameter(const std::string& paramName) const { auto it = _paramValues.find(paramName); return (it != _paramValues.end() ? it->second : std::numeric_limits<float>::quiet_NaN()); }
-        void setParameter(const std::string& paramName, float value) { _paramValues[paramName] = value; }
+        float getParameter(const std::string& paramName) const;
+        void setParameter(const std::string& paramName, float value);
 
         Result find(const Query& query) const;
+        Result find(const Query& query, Statistics& statistics) const;
+
+        // Builds the contraction hierarchy for the current parameters and route options, so that the next query does not have to wait for it
+        void prepareHierarchy() const;
+
+        // Finds routes from the source to each target with a single search. Results are in the order of the targets.
+        std::vector<Result> findOneToMany(const Point& sourcePos, const std::vector<Point>& targetPositions, const FeatureFilter& sourceFilter = FeatureFilter(), const FeatureFilter& targetFilter = FeatureFilter()) const;
+
+        // Calculates route times from each source to each target, infinity if the target is not reachable. Sources are processed in parallel using the given number of threads.
+        std::vector<std::vector<double>> calculateTimeMatrix(const std::vector<Point>& sourcePositions, const std::vector<Point>& targetPositions, const FeatureFilter& sourceFilter = FeatureFilter(), const FeatureFilter& targetFilter = FeatureFilter(), std::size_t threadCount = 1) const;
 
         static std::unique_ptr<RouteFinder> create(std::shared_ptr<const StaticGraph> graph, const picojson::value& configDef);
 
@@ -61,6 +85,15 @@ namespace carto::sgre {
             float zSpeed = 0;
             float turnSpeed = 0;
             float delay = 0;
+
+            bool operator == (const EvaluatedAttributes& other) const { return speed == other.speed && zSpeed == other.zSpeed && turnSpeed == other.turnSpeed && delay == other.delay; }
+            bool operator != (const EvaluatedAttributes& other) const { return !(*this == other); }
+        };
+
+        struct EndPoint {
+            Point point = Point();
+            Graph::TriangleId triangleId = Graph::TriangleId(-1);
+            std::set<Graph::EdgeId> edgeIds;
         };
 
         struct RouteNode {
@@ -74,22 +107,115 @@ namespace carto::sgre {
         
         using Route = std::vector<RouteNode>;
 
+        struct NodeRecord {
+            double time; // best estimated time to final some from some initial node. Estimated time must not exceed actual time.
+            Graph::NodeId nodeId;
+            std::size_t routeEdgeIndex; // outgoing route edge index
+
+            bool operator < (const NodeRecord& rec) const { return rec.time < time; }
+        };
+
+        struct RouteEdge {
+            double time; // time spent up to this point
+            Graph::EdgeId edgeId;
+            std::size_t routeEdgeIndex; // incoming route edge index
+            double nodeT; // outgoing edge node T value
+        };
+
+        struct VisibilityCone {
+            std::size_t index0 = 0;                 // route index of the apex
+            std::size_t index1 = 0;                 // route nodes after the apex and before this index are crossed by all directions in the cone
+            bool valid = true;                      // false if no straight segment from the apex crosses the added route nodes in order
+            bool bounded = false;                   // false if no route nodes are added yet
+            cglib::vec2<double> apex;               // apex position in projected coordinates
+            cglib::vec2<double> right, left;        // cone boundary directions, counterclockwise from right to left
+
+            explicit VisibilityCone(std::size_t index0) : index0(index0), index1(index0 + 1) { }
+        };
+
+        struct VisibilityWorkspace {
+            std::vector<std::size_t> visitedStamps; // node is visited during the current test if its stamp equals the current stamp
+            std::size_t stamp = 0;
+            std::vector<std::pair<Graph::NodeId, double>> nodeStack;
+        };
+
+        struct Workspace {
+            std::shared_ptr<DynamicGraph> graph;            // overlay graph for the query endpoints, reset between queries
+            std::vector<std::vector<RouteEdge>> routeEdges; // best route edges per node, valid only if the node stamp equals the current stamp
+            std::vector<std::size_t> routeEdgeStamps;
+            std::size_t stamp = 0;
+            std::vector<NodeRecord> nodeQueue;
+            VisibilityWorkspace visibilityWorkspace;
+            ContractionHierarchy::Workspace hierarchyWorkspace;
+        };
+
+        struct Landmarks {
+            EvaluatedAttributesTable attributesTable; // attributes used for calculating the times
+            double tesselationDistance = 0;
+            Graph::EdgeId edgeIdRangeEnd = 0;         // edges created for the query endpoints start from this id
+            std::vector<Graph::NodeId> nodeIds;
+            std::vector<std::vector<double>> fromTimes; // lower bounds for times from each landmark to graph nodes, infinity if not reachable
+            std::vector<std::vector<double>> toTimes;   // lower bounds for times from graph nodes to each landmark, infinity if not reachable
+        };
+
+        struct Hierarchy {
+            EvaluatedAttributesTable attributesTable;  // attributes used for calculating the times
+            double tesselationDistance = 0;
+            double lngScale = 1.0;                     // longitude scale used for the times, based on the average latitude of the graph
+            std::vector<std::size_t> nodeStateOffsets; // search states (tesselated positions) of node i are in [offsets[i], offsets[i + 1])
+            std::vector<Graph::EdgeId> stateEdgeIds;   // graph edge of each hierarchy edge
+            std::unique_ptr<const ContractionHierarchy> contractionHierarchy;
+        };
+
+        Result findRoute(const Query& query, Workspace& workspace, Statistics* statistics) const;
+
+        std::vector<Result> findRoutes(const std::vector<EndPoint>& sourceEndPoints, const std::vector<std::vector<EndPoint>>& targetEndPointsList, Workspace& workspace, Statistics* statistics = nullptr) const;
+
+        std::vector<std::optional<Route>> searchRoutes(const std::vector<EndPoint>& sourceEndPoints, const std::vector<std::vector<EndPoint>>& targetEndPointsList, Workspace& workspace, Statistics* statistics, double& lngScale, std::shared_ptr<const EvaluatedAttributesTable>& attributesTable) const;
+
+        std::vector<std::vector<EndPoint>> findEndPoints(const std::vector<Point>& posList, const FeatureFilter& filter) const;
+
+        std::shared_ptr<const EvaluatedAttributesTable> getAttributesTable() const;
+
+        std::shared_ptr<const Landmarks> getLandmarks(const std::shared_ptr<const EvaluatedAttributesTable>& attributesTable) const;
+
+        std::shared_ptr<const Hierarchy> getHierarchy(const std::shared_ptr<const EvaluatedAttributesTable>& attributesTable) const;
+
+        std::unique_ptr<Workspace> acquireWorkspace() const;
+        void releaseWorkspace(std::unique_ptr<Workspace> workspace) const;
+
+        static std::shared_ptr<const Landmarks> buildLandmarks(const StaticGraph& graph, const EvaluatedAttributesTable& attributesTable, double tesselationDistance, std::size_t count);
+
+        static std::shared_ptr<const Hierarchy> buildHierarchy(const StaticGraph& graph, const EvaluatedAttributesTable& attributesTable, double tesselationDistance);
+
         static Graph::NodeId createNode(DynamicGraph& graph, const Point& point);
         
         static void linkNodeToEdges(DynamicGraph& graph, const std::set<Graph::EdgeId>& edgeIds, Graph::NodeId nodeId, int nodeIdx);
 
         static void linkNodesToCommonEdges(DynamicGraph& graph, const std::set<Graph::EdgeId>& edgeIds0, const std::set<Graph::EdgeId>& edgeIds1, Graph::NodeId nodeId0, Graph::NodeId nodeId1);
 
-        static bool isNodeVisible(const Graph& graph, Graph::NodeId nodeId0, double t0, Graph::NodeId nodeId1, double t1, double lngScale, std::set<Graph::NodeId> visitedNodeIds);
+        static bool isNodeVisible(const Graph& graph, Graph::NodeId nodeId0, double t0, Graph::NodeId nodeId1, double t1, double lngScale, VisibilityWorkspace& workspace);
+
+        static bool isRouteSegmentVisible(const Graph& graph, const Route& route, std::size_t index1, double lngScale, VisibilityCone& cone);
 
         static Result buildResult(const Graph& graph, const EvaluatedAttributesTable& attributesTable, const Route& route, double lngScale, double minTurnAngle, double minUpDownAngle);
+
+        static double calculateRouteTime(const Graph& graph, const EvaluatedAttributesTable& attributesTable, const Route& route, double lngScale, double minTurnAngle, double minUpDownAngle);
+
+        static double traceRoute(const Graph& graph, const EvaluatedAttributesTable& attributesTable, const Route& route, double lngScale, double minTurnAngle, double minUpDownAngle, std::vector<Point>& points, std::vector<Instruction>* instructions);
         
-        static Route straightenRoute(const Graph& graph, const Route& route, double lngScale);
+        static Route straightenRoute(const Graph& graph, const Route& route, double lngScale, bool fastStraightening, VisibilityWorkspace& workspace);
         
-        static std::optional<Route> findFastestRoute(const Graph& graph, const EvaluatedAttributesTable& attributesTable, const std::vector<Graph::NodeId>& initialNodeIds, const std::vector<Graph::NodeId>& finalNodeIds, double lngScale, double tesselationDistance);
+        static std::vector<std::optional<Route>> findFastestRoutes(const Graph& graph, const EvaluatedAttributesTable& attributesTable, const Landmarks* landmarks, const std::vector<Graph::NodeId>& initialNodeIds, const std::vector<std::vector<Graph::NodeId>>& finalNodeIdsList, double lngScale, double tesselationDistance, Workspace& workspace, Statistics* statistics = nullptr);
         
+        static std::optional<Route> findHierarchyRoute(const DynamicGraph& graph, const Hierarchy& hierarchy, const std::vector<Graph::NodeId>& initialNodeIds, const std::vector<Graph::NodeId>& finalNodeIds, Workspace& workspace, Statistics* statistics = nullptr);
+
         static double calculateTime(const EvaluatedAttributes& attribs, bool applyDelay, double turnAngle, const Point& pos0, const Point& pos1, double lngScale);
 
+        static double calculateMinTime(const EvaluatedAttributes& attribs, const std::array<Point, 2>& segment0, const std::array<Point, 2>& segment1, double lngScale);
+
+        static double calculateAvgLngScale(const Point& pos0, const Point& pos1);
+
         static double calculateDistance(const Point& pos0, const Point& pos1, double lngScale);
         
         static std::pair<double, double> calculateDistance2D(const Point& pos0, const Point& pos1, double lngScale);
@@ -99,6 +225,17 @@ namespace carto::sgre {
         std::map<std::string, float> _paramValues;
 
         const std::shared_ptr<const StaticGraph> _graph;
+
+        mutable std::shared_ptr<const EvaluatedAttributesTable> _attributesTable;
+        mutable std::shared_future<std::shared_ptr<const Landmarks>> _landmarksFuture; // built or being built for the attributes, tesselation distance and count below
+        mutable std::shared_ptr<const EvaluatedAttributesTable> _landmarksAttributesTable;
+        mutable double _landmarksTesselationDistance = 0;
+        mutable std::size_t _landmarksCount = 0;
+        mutable std::shared_future<std::shared_ptr<const Hierarchy>> _hierarchyFuture; // built or being built for the attributes and tesselation distance below
+        mutable std::shared_ptr<const EvaluatedAttributesTable> _hierarchyAttributesTable;
+        mutable double _hierarchyTesselationDistance = 0;
+        mutable std::vector<std::unique_ptr<Workspace>> _workspacePool;
+        mutable std::mutex _cacheMutex;
     };
 }
 
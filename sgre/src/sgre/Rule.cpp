@@ -1,5 +1,7 @@
 #include "Rule.h"
 
+#include <algorithm>
+
 namespace carto::sgre {
     void Rule::apply(Graph::Attributes& attribs, bool forward) const {
         int ruleIndex = forward ? 0 : 1;
@@ -130,4 +132,84 @@ namespace carto::sgre {
         }
         return RuleList(std::move(rules));
     }
+
+    RuleMatcher::RuleMatcher(const RuleList& ruleList) {
+        std::unordered_map<std::string, std::size_t> keyIndices;
+        for (const Rule& rule : ruleList.getRules()) {
+            if (auto filters = rule.getFilters()) {
+                std::vector<ConditionList> conditionLists;
+                for (const FeatureFilter& filter : *filters) {
+                    ConditionList conditions;
+                    for (auto it = filter.begin(); it != filter.end(); it++) {
+                        auto keyIt = keyIndices.emplace(it->first, _keys.size()).first;
+                        if (keyIt->second == _keys.size()) {
+                            _keys.push_back(it->first);
+                            _keyValueIndices.emplace_back();
+                        }
+                        auto& valueIndices = _keyValueIndices[keyIt->second];
+                        int valueIndex = valueIndices.emplace(it->second, static_cast<int>(valueIndices.size())).first->second;
+                        conditions.emplace_back(keyIt->second, valueIndex);
+                    }
+                    conditionLists.push_back(std::move(conditions));
+                }
+                _ruleFilters.emplace_back(std::move(conditionLists));
+            } else {
+                _ruleFilters.emplace_back();
+            }
+        }
+    }
+
+    std::shared_ptr<const std::vector<std::size_t>> RuleMatcher::match(const Graph::FeatureProperties& properties) const {
+        // Map the referenced property values to value indices, missing keys and values not used by any filter are both mapped to -1
+        std::vector<int> valueIndices(_keys.size(), -1);
+        if (properties.is<picojson::object>()) {
+            const picojson::object& propertiesObject = properties.get<picojson::object>();
+            for (std::size_t i = 0; i < _keys.size(); i++) {
+                auto propertyIt = propertiesObject.find(_keys[i]);
+                if (propertyIt != propertiesObject.end()) {
+                    auto valueIt = _keyValueIndices[i].find(propertyIt->second);
+                    if (valueIt != _keyValueIndices[i].end()) {
+                        valueIndices[i] = valueIt->second;
+                    }
+                }
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _matchCache.find(valueIndices);
+            if (it != _matchCache.end()) {
+                return it->second;
+            }
+        }
+
+        auto ruleIndices = std::make_shared<std::vector<std::size_t>>();
+        for (std::size_t i = 0; i < _ruleFilters.size(); i++) {
+            if (auto conditionLists = _ruleFilters[i]) {
+                bool match = std::any_of(conditionLists->begin(), conditionLists->end(), [&valueIndices](const ConditionList& conditions) {
+                    return std::all_of(conditions.begin(), conditions.end(), [&valueIndices](const Condition& condition) {
+                        return valueIndices[condition.keyIndex] == condition.valueIndex;
+                    });
+                });
+                if (!match) {
+                    continue;
+                }
+            }
+            ruleIndices->push_back(i);
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_matchCache.size() < MAX_CACHE_SIZE) {
+            _matchCache.emplace(std::move(valueIndices), ruleIndices);
+        }
+        return ruleIndices;
+    }
+
+    std::size_t RuleMatcher::ValueHash::operator() (const picojson::value& val) const {
+        // Numbers are hashed by their double value, as integer and floating point values compare equal
+        if (val.is<double>()) {
+            return std::hash<double>()(val.get<double>());
+        }
+        return std::hash<picojson::value>()(val);
+    }
 }
@@ -15,6 +15,11 @@
 #include <array>
 #include <vector>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include <boost/functional/hash.hpp>
 
 #include <picojson/picojson.h>
 
@@ -63,6 +68,40 @@ namespace carto::sgre {
     private:
         std::vector<Rule> _rules;
     };
+
+    class RuleMatcher final {
+    public:
+        RuleMatcher() = delete;
+        explicit RuleMatcher(const RuleList& ruleList);
+
+        // Returns the indices of the rules matching the feature properties, in rule order.
+        // Only the properties referenced by the rule filters are used, results are cached per distinct combination of their values.
+        std::shared_ptr<const std::vector<std::size_t>> match(const Graph::FeatureProperties& properties) const;
+
+    private:
+        static constexpr std::size_t MAX_CACHE_SIZE = 65536;
+
+        struct ValueHash {
+            std::size_t operator() (const picojson::value& val) const;
+        };
+
+        struct Condition {
+            std::size_t keyIndex;
+            int valueIndex;
+
+            Condition() = default;
+            explicit Condition(std::size_t keyIndex, int valueIndex) : keyIndex(keyIndex), valueIndex(valueIndex) { }
+        };
+
+        using ConditionList = std::vector<Condition>;
+
+        std::vector<std::string> _keys;
+        std::vector<std::unordered_map<picojson::value, int, ValueHash>> _keyValueIndices;
+        std::vector<std::optional<std::vector<ConditionList>>> _ruleFilters;
+
+        mutable std::unordered_map<std::vector<int>, std::shared_ptr<const std::vector<std::size_t>>, boost::hash<std::vector<int>>> _matchCache;
+        mutable std::mutex _mutex;
+    };
 }
 
 #endif
@@ -6,6 +6,8 @@
 #include "GraphBuilder.h"
 #include "RouteFinder.h"
 
+#include <sstream>
+
 #include <picojson/picojson.h>
 
 #include <boost/math/constants/constants.hpp>
@@ -96,6 +98,33 @@ static std::vector<Point> createSquare(double radius) {
     return points;
 }
 
+// 8x8 grid of lines with alternating types (0, 1, 2) and two surfaces (type 3), starting from the origin. The grid step is 0.001 degrees.
+static std::shared_ptr<const StaticGraph> createGridGraph(const RuleList& ruleList, const Point& origin) {
+    static constexpr int N = 8;
+    static constexpr double STEP = 0.001;
+    GraphBuilder graphBuilder = GraphBuilder(ruleList);
+    for (int i = 0; i < N; i++) {
+        graphBuilder.addLineString(shiftPoints(createChain(STEP, N), origin + Point(0, i * STEP, 0)), parseJSON("{ \"type\": " + std::to_string(i % 3) + " }"));
+        std::vector<Point> column;
+        for (int j = 0; j < N; j++) {
+            column.push_back(origin + Point(i * STEP, j * STEP, 0.0));
+        }
+        graphBuilder.addLineString(column, parseJSON("{ \"type\": " + std::to_string((i + 1) % 3) + " }"));
+    }
+    graphBuilder.addPolygon({ shiftPoints(createSquare(STEP * 0.5), origin + Point(STEP * 2.5, STEP * 2.5, 0)) }, parseJSON("{ \"type\": 3 }"));
+    graphBuilder.addPolygon({ shiftPoints(createSquare(STEP * 0.5), origin + Point(STEP * 5.5, STEP * 4.5, 0)) }, parseJSON("{ \"type\": 3 }"));
+    return graphBuilder.build();
+}
+
+// Pseudo-random source and target positions within the grid of createGridGraph
+static Point createGridSourcePos(int i, const Point& origin) {
+    return origin + Point(std::fmod(i * 0.00137, 0.007), std::fmod(i * 0.00071, 0.007), 0.0);
+}
+
+static Point createGridTargetPos(int i, const Point& origin) {
+    return origin + Point(std::fmod(i * 0.00053 + 0.003, 0.007), std::fmod(i * 0.00113 + 0.005, 0.007), 0.0);
+}
+
 // Build convex polygon regions and check that resulting routing path always contains a straight line
 BOOST_AUTO_TEST_CASE(convexRouting) {
     for (int n = 3; n <= 100; n++) {
@@ -130,6 +159,43 @@ BOOST_AUTO_TEST_CASE(chainRouting) {
     }
 }
 
+// Test cases for path straightening, the fast visibility check must not change the results
+BOOST_AUTO_TEST_CASE(pathStraightening) {
+    // Round room with notches, so that long straight segments cross many triangles and some routes must bend around the notches
+    std::vector<Point> ring = createRing(1.0, 80);
+    for (std::size_t i = 3; i < ring.size(); i += 7) {
+        ring[i] = ring[i] * 0.6;
+    }
+    GraphBuilder graphBuilder = GraphBuilder(RuleList::parse(parseJSON("[{\"search\": \"surface\"}]")));
+    graphBuilder.addPolygon({ ring }, picojson::value());
+    std::shared_ptr<const StaticGraph> graph = graphBuilder.build();
+
+    RouteFinder routeFinder1(graph);
+    RouteFinder routeFinder2(graph);
+    RouteFinder::RouteOptions routeOptions;
+    routeOptions.fastStraightening = false;
+    routeFinder2.setRouteOptions(routeOptions);
+
+    std::size_t bentCount = 0;
+    for (int i = 0; i < 40; i++) {
+        for (int j = 0; j < 10; j++) {
+            double angle0 = i * 0.157, angle1 = angle0 + 2.0 + j * 0.23;
+            Query query(Point(0.55 * std::cos(angle0), 0.55 * std::sin(angle0), 0), Point(0.58 * std::cos(angle1), 0.58 * std::sin(angle1), 0));
+            Result result1 = routeFinder1.find(query);
+            Result result2 = routeFinder2.find(query);
+            BOOST_CHECK(result1.getStatus() == Result::Status::SUCCESS);
+            BOOST_CHECK(result1.getGeometry().size() == result2.getGeometry().size());
+            if (result1.getGeometry().size() == result2.getGeometry().size()) {
+                for (std::size_t k = 0; k < result1.getGeometry().size(); k++) {
+                    BOOST_CHECK(equal(result1.getGeometry()[k], result2.getGeometry()[k]));
+                }
+            }
+            bentCount += (result1.getGeometry().size() > 2 ? 1 : 0);
+        }
+    }
+    BOOST_CHECK(bentCount > 0);
+}
+
 // Test cases for search modes for linestring-based graphs
 BOOST_AUTO_TEST_CASE(lineEdgeSearch) {
     auto buildGraph = [](const std::string& mode) -> std::shared_ptr<const StaticGraph> {
@@ -466,6 +532,33 @@ BOOST_AUTO_TEST_CASE(ruleParsing) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(ruleMatching) {
+    RuleList ruleList = RuleList::parse(parseJSON(R"R([
+        { "speed": 1 },
+        { "filters": [{ "class": "door" }, { "class": "gate", "open": true }], "speed": 2 },
+        { "filters": [{ "level": 1 }], "speed": 3 },
+        { "filters": [{ "class": "door", "level": null }], "speed": 4 },
+        { "filters": [], "speed": 5 },
+        { "filters": [{}], "speed": 6 }
+    ])R"));
+    RuleMatcher ruleMatcher(ruleList);
+    auto match = [&](const std::string& json) {
+        return *ruleMatcher.match(parseJSON(json));
+    };
+
+    BOOST_CHECK(match(R"R({})R") == std::vector<std::size_t>({ 0, 5 }));
+    BOOST_CHECK(match(R"R(null)R") == std::vector<std::size_t>({ 0, 5 }));
+    BOOST_CHECK(match(R"R({"class": "door", "name": "a"})R") == std::vector<std::size_t>({ 0, 1, 5 }));
+    BOOST_CHECK(match(R"R({"class": "door", "name": "b"})R") == std::vector<std::size_t>({ 0, 1, 5 }));
+    BOOST_CHECK(match(R"R({"class": "gate"})R") == std::vector<std::size_t>({ 0, 5 }));
+    BOOST_CHECK(match(R"R({"class": "gate", "open": true})R") == std::vector<std::size_t>({ 0, 1, 5 }));
+    BOOST_CHECK(match(R"R({"class": "gate", "open": false})R") == std::vector<std::size_t>({ 0, 5 }));
+    BOOST_CHECK(match(R"R({"level": 1})R") == std::vector<std::size_t>({ 0, 2, 5 }));
+    BOOST_CHECK(match(R"R({"level": 1.0})R") == std::vector<std::size_t>({ 0, 2, 5 }));
+    BOOST_CHECK(match(R"R({"level": "1"})R") == std::vector<std::size_t>({ 0, 5 }));
+    BOOST_CHECK(match(R"R({"class": "door", "level": null})R") == std::vector<std::size_t>({ 0, 1, 3, 5 }));
+}
+
 // Test cases for zsensitivity parameter
 BOOST_AUTO_TEST_CASE(zSensitivity) {
     auto buildZGraph = [](const std::string& rules) -> std::shared_ptr<const StaticGraph> {
@@ -654,3 +747,319 @@ BOOST_AUTO_TEST_CASE(parametrizedRules) {
         BOOST_CHECK(equal(result4.serialize(), parseJSON(R"R({"status":0})R")));
     }
 }
+
+// Test cases for batch nearest edge search
+BOOST_AUTO_TEST_CASE(batchEdgeSearch) {
+    auto buildGraph = []() -> std::shared_ptr<const StaticGraph> {
+        auto chain = createChain(0.1, 20);
+        auto ruleList = RuleList::parse(parseJSON(R"R([{ "search": "edge" }])R"));
+        GraphBuilder graphBuilder = GraphBuilder(ruleList);
+        for (int i = 0; i < 10; i++) {
+            graphBuilder.addLineString(shiftPoints(chain, { 0, i * 0.1, 0 }), parseJSON("{ \"type\": " + std::to_string(i % 2) + " }"));
+        }
+        return graphBuilder.build();
+    };
+
+    auto graph = buildGraph();
+    std::vector<Point> posList;
+    for (int i = 0; i < 50; i++) {
+        posList.emplace_back(std::fmod(i * 0.37, 2.0), std::fmod(i * 0.11, 1.0), 0.0);
+    }
+
+    // Batch results must match the results of single queries, with and without filters
+    for (const std::string& filter : { std::string("{}"), std::string("{ \"type\": 1 }") }) {
+        FeatureFilter featureFilter = parseJSON(filter).get<picojson::object>();
+        auto resultsList = graph->findNearestEdgePoints(posList, featureFilter, StaticGraph::SearchOptions());
+        BOOST_CHECK(resultsList.size() == posList.size());
+        for (std::size_t i = 0; i < posList.size(); i++) {
+            auto results = graph->findNearestEdgePoint(posList[i], featureFilter, StaticGraph::SearchOptions());
+            BOOST_CHECK(!results.empty());
+            BOOST_CHECK(results.size() == resultsList[i].size());
+            for (std::size_t j = 0; j < std::min(results.size(), resultsList[i].size()); j++) {
+                BOOST_CHECK(results[j].first == resultsList[i][j].first);
+                BOOST_CHECK(equal(results[j].second, resultsList[i][j].second));
+                if (!featureFilter.empty()) {
+                    BOOST_CHECK(std::abs(std::fmod(results[j].second(1) + 1.0e-9, 0.2) - 0.1) < 1.0e-6);
+                }
+            }
+        }
+    }
+}
+
+// Test cases for landmark heuristics, results must match plain search
+BOOST_AUTO_TEST_CASE(landmarkRouting) {
+    // Turn times are not part of the search, so make turns free to avoid ties with different results
+    auto ruleList = RuleList::parse(parseJSON(R"R([{ "search": "edge", "turnspeed": 1.0e9 }, { "filters":[{"type":1}], "backward_speed":0.0 }, { "filters":[{"type":2}], "speed":3.0 }, { "filters":[{"type":3}], "search":"surface", "speed":0.5 }])R"));
+    auto graph = createGridGraph(ruleList, Point(0, 0, 0));
+    for (double tesselationDistance : { std::numeric_limits<double>::infinity(), 20.0 }) {
+        RouteFinder::RouteOptions routeOptions;
+        routeOptions.pathStraightening = false;
+        routeOptions.tesselationDistance = tesselationDistance;
+        RouteFinder finder1(graph);
+        finder1.setRouteOptions(routeOptions);
+        routeOptions.landmarks = 4;
+        RouteFinder finder2(graph);
+        finder2.setRouteOptions(routeOptions);
+
+        for (int i = 0; i < 100; i++) {
+            Query query(createGridSourcePos(i, Point(0, 0, 0)), createGridTargetPos(i, Point(0, 0, 0)));
+            Result result1 = finder1.find(query);
+            Result result2 = finder2.find(query);
+            BOOST_CHECK(result1.getStatus() == result2.getStatus());
+            BOOST_CHECK(std::abs(result1.getTotalTime() - result2.getTotalTime()) <= 1.0e-6 * result1.getTotalTime());
+        }
+    }
+
+    // Statistics are reset for each query
+    RouteFinder finder(graph);
+    RouteFinder::Statistics statistics;
+    Query query(createGridSourcePos(1, Point(0, 0, 0)), createGridTargetPos(1, Point(0, 0, 0)));
+    finder.find(query, statistics);
+    std::size_t nodeQueuePops = statistics.nodeQueuePops;
+    finder.find(query, statistics);
+    BOOST_CHECK(nodeQueuePops > 0 && statistics.nodeQueuePops == nodeQueuePops);
+}
+
+// Test cases for contraction hierarchy search, results must match plain search
+BOOST_AUTO_TEST_CASE(contractionHierarchyRouting) {
+    // Use a high latitude, where the longitude scale of the hierarchy (average latitude of the graph) differs most from the query scale (average latitude of the endpoints)
+    const Point origin(0, 60, 0);
+    auto ruleList = RuleList::parse(parseJSON(R"R([{ "search": "edge", "turnspeed": 1.0e9 }, { "filters":[{"type":1}], "backward_speed":0.0 }, { "filters":[{"type":2}], "speed":"$speed", "delay":2.0 }, { "filters":[{"type":3}], "search":"surface", "speed":0.5 }])R"));
+    auto graph = createGridGraph(ruleList, origin);
+
+    // The grid spans 0.007 degrees, so the scales differ by at most tan(60deg) * 0.007 * pi / 180 = 2.2e-4 (relative).
+    // Route times under the two scales differ by the same factor, so a route optimal for one scale is within 2 * 2.2e-4 of the optimum of the other.
+    static constexpr double TOLERANCE = 5.0e-4;
+
+    // The same finder must rebuild the hierarchy when the parameters or the tesselation distance change
+    RouteFinder finder2(graph);
+    finder2.setParameter("$speed", 1.0f);
+    RouteFinder::RouteOptions hierarchyRouteOptions;
+    hierarchyRouteOptions.pathStraightening = false;
+    hierarchyRouteOptions.contractionHierarchy = true;
+    finder2.setRouteOptions(hierarchyRouteOptions);
+    finder2.prepareHierarchy();
+    for (float speed : { 3.0f, 0.2f }) {
+        for (double tesselationDistance : { std::numeric_limits<double>::infinity(), 20.0 }) {
+            RouteFinder::RouteOptions routeOptions;
+            routeOptions.pathStraightening = false;
+            routeOptions.tesselationDistance = tesselationDistance;
+            RouteFinder finder1(graph);
+            finder1.setRouteOptions(routeOptions);
+            finder1.setParameter("$speed", speed);
+            routeOptions.contractionHierarchy = true;
+            finder2.setRouteOptions(routeOptions);
+            finder2.setParameter("$speed", speed);
+
+            for (int i = 0; i < 100; i++) {
+                Query query(createGridSourcePos(i, origin), createGridTargetPos(i, origin));
+                Result result1 = finder1.find(query);
+                Result result2 = finder2.find(query);
+                BOOST_CHECK(result1.getStatus() == result2.getStatus());
+                BOOST_CHECK(std::abs(result1.getTotalTime() - result2.getTotalTime()) <= TOLERANCE * result1.getTotalTime());
+            }
+        }
+    }
+}
+
+// Test cases for graph serialization
+BOOST_AUTO_TEST_CASE(graphSerialization) {
+    auto buildGraph = []() -> std::shared_ptr<const StaticGraph> {
+        auto square = createSquare(0.25);
+        auto chain = createChain(1.0, 2);
+        auto ruleList = RuleList::parse(parseJSON(R"R([{ "filters":[{"type":1}], "speed":"$speed", "backward_speed":0.0 }, { "filters":[{"type":2}], "delay":2.0 }])R"));
+        GraphBuilder graphBuilder = GraphBuilder(ruleList);
+        graphBuilder.addPolygon({ shiftPoints(square, { 0, 0, 0 }) }, parseJSON("{ \"type\": 0 }"));
+        graphBuilder.addLineString({ chain }, parseJSON("{ \"type\": 1 }"));
+        graphBuilder.addPolygon({ shiftPoints(square, { 1, 0, 0 }) }, parseJSON("{ \"type\": 2 }"));
+        return graphBuilder.build();
+    };
+
+    auto graph = buildGraph();
+    std::stringstream stream;
+    graph->save(stream);
+    auto loadedGraph = StaticGraph::load(stream);
+
+    BOOST_CHECK(loadedGraph->getNodeIdRangeEnd() == graph->getNodeIdRangeEnd());
+    BOOST_CHECK(loadedGraph->getEdgeIdRangeEnd() == graph->getEdgeIdRangeEnd());
+    BOOST_CHECK(loadedGraph->getFeatureIdRangeEnd() == graph->getFeatureIdRangeEnd());
+    BOOST_CHECK(loadedGraph->getAttributesIdRangeEnd() == graph->getAttributesIdRangeEnd());
+    for (Graph::NodeId nodeId = 0; nodeId < graph->getNodeIdRangeEnd(); nodeId++) {
+        BOOST_CHECK(loadedGraph->getNode(nodeId).points == graph->getNode(nodeId).points);
+        BOOST_CHECK(loadedGraph->getNode(nodeId).edgeIds == graph->getNode(nodeId).edgeIds);
+    }
+    for (Graph::FeatureId featureId = 0; featureId < graph->getFeatureIdRangeEnd(); featureId++) {
+        BOOST_CHECK(loadedGraph->getFeatureProperties(featureId) == graph->getFeatureProperties(featureId));
+    }
+    for (Graph::AttributesId attribsId = 0; attribsId < graph->getAttributesIdRangeEnd(); attribsId++) {
+        BOOST_CHECK(loadedGraph->getAttributes(attribsId) == graph->getAttributes(attribsId));
+    }
+
+    // Routing results must match
+    for (const Query& query : { Query(Point(0.0, 0.1, 0.0), Point(1.0, 0.1, 0.0)), Query(Point(1.0, 0.1, 0.0), Point(0.0, 0.1, 0.0)), Query(Point(0.1, -0.1, 0.0), Point(1.1, 0.2, 0.0)) }) {
+        RouteFinder finder1(graph);
+        RouteFinder finder2(loadedGraph);
+        finder1.setParameter("$speed", 2.0f);
+        finder2.setParameter("$speed", 2.0f);
+        BOOST_CHECK(equal(finder1.find(query).serialize(), finder2.find(query).serialize()));
+    }
+
+    // Illegal data must be rejected
+    std::stringstream badStream(stream.str().substr(0, stream.str().size() / 2));
+    BOOST_CHECK_THROW(StaticGraph::load(badStream), std::runtime_error);
+
+    auto patchValue = [&](std::size_t offset, std::uint32_t value) {
+        std::string data = stream.str();
+        data.replace(offset, sizeof(value), reinterpret_cast<const char*>(&value), sizeof(value));
+        return std::stringstream(data);
+    };
+    std::stringstream badCountStream = patchValue(8, 0x7fffffff);
+    BOOST_CHECK_THROW(StaticGraph::load(badCountStream), std::runtime_error);
+    std::stringstream badFeatureStream = patchValue(12 + graph->getNodeIdRangeEnd() * 52 + 8, graph->getFeatureIdRangeEnd());
+    BOOST_CHECK_THROW(StaticGraph::load(badFeatureStream), std::runtime_error);
+}
+
+// Test cases for parallel GeoJSON import, the graph must match the serial import
+BOOST_AUTO_TEST_CASE(parallelImport) {
+    auto createFeatureCollection = []() {
+        picojson::array featuresDef;
+        for (int i = 0; i < 20; i++) {
+            picojson::array ringDef;
+            for (const Point& point : shiftPoints(createSquare(0.5), { i * 0.5, 0, 0 })) {
+                ringDef.push_back(picojson::value(picojson::array { picojson::value(point(0)), picojson::value(point(1)), picojson::value(point(2)) }));
+            }
+            picojson::object geometryDef;
+            geometryDef["type"] = picojson::value("Polygon");
+            geometryDef["coordinates"] = picojson::value(picojson::array { picojson::value(ringDef) });
+            picojson::object featureDef;
+            featureDef["type"] = picojson::value("Feature");
+            featureDef["geometry"] = picojson::value(geometryDef);
+            featureDef["properties"] = parseJSON("{ \"type\": " + std::to_string(i % 3) + " }");
+            featuresDef.push_back(picojson::value(featureDef));
+        }
+        picojson::object featureCollectionDef;
+        featureCollectionDef["type"] = picojson::value("FeatureCollection");
+        featureCollectionDef["features"] = picojson::value(featuresDef);
+        return picojson::value(featureCollectionDef);
+    };
+
+    auto featureCollectionDef = createFeatureCollection();
+    auto ruleList = RuleList::parse(parseJSON(R"R([{ "filters":[{"type":1}], "speed":2.0 }, { "filters":[{"type":2}], "delay":1.0 }])R"));
+    GraphBuilder serialBuilder = GraphBuilder(ruleList);
+    serialBuilder.importGeoJSON(featureCollectionDef);
+    auto serialGraph = serialBuilder.build();
+    GraphBuilder parallelBuilder = GraphBuilder(ruleList);
+    parallelBuilder.importGeoJSON(featureCollectionDef, 4);
+    auto parallelGraph = parallelBuilder.build();
+
+    // Graphs must be identical, including the ids
+    BOOST_CHECK(parallelGraph->getNodeIdRangeEnd() == serialGraph->getNodeIdRangeEnd());
+    BOOST_CHECK(parallelGraph->getEdgeIdRangeEnd() == serialGraph->getEdgeIdRangeEnd());
+    BOOST_CHECK(parallelGraph->getFeatureIdRangeEnd() == serialGraph->getFeatureIdRangeEnd());
+    BOOST_CHECK(parallelGraph->getAttributesIdRangeEnd() == serialGraph->getAttributesIdRangeEnd());
+    for (Graph::NodeId nodeId = 0; nodeId < serialGraph->getNodeIdRangeEnd(); nodeId++) {
+        BOOST_CHECK(parallelGraph->getNode(nodeId).points == serialGraph->getNode(nodeId).points);
+        BOOST_CHECK(parallelGraph->getNode(nodeId).edgeIds == serialGraph->getNode(nodeId).edgeIds);
+    }
+
+    Query query(Point(0.1, 0.1, 0.0), Point(9.8, 0.4, 0.0));
+    BOOST_CHECK(equal(RouteFinder(serialGraph).find(query).serialize(), RouteFinder(parallelGraph).find(query).serialize()));
+}
+
+// Test cases for streaming GeoJSON import, the graph must match the picojson-based import
+BOOST_AUTO_TEST_CASE(streamingImport) {
+    std::string geoJSON = R"R({
+        "type": "FeatureCollection",
+        "crs": { "type": "name", "properties": { "name": "urn:ogc:def:crs:OGC:1.3:CRS84" } },
+        "features": [
+            { "type": "Feature", "properties": { "type": 0, "name": "A \"quoted\" ä name", "tags": [1, 2.5e0, null, true] }, "geometry": { "type": "Polygon", "coordinates": [[[0, 0], [1, 0], [1, 1], [0, 1], [0, 0]]] } },
+            { "type": "Feature", "geometry": { "coordinates": [[0.5, 0.5, 0.0], [1.5, 0.5, 0.0]], "type": "LineString" }, "properties": { "type": 1 } },
+            { "type": "Feature", "properties": { "type": 2 }, "geometry": { "type": "MultiPolygon", "coordinates": [[[[1, 0], [2, 0], [2, 1], [1, 1], [1, 0]]], [[[2, 0], [3, 0], [3, 1], [2, 0]]]] } },
+            { "type": "Feature", "properties": { "type": 3 }, "geometry": { "type": "Point", "coordinates": [0.1, 0.1] } },
+            { "type": "Feature", "properties": { "type": 4 }, "geometry": null },
+            { "type": "Feature", "properties": { "type": 5 }, "geometry": { "type": "LineString", "coordinates": [[2.5, 0.5, 0.0], [3.5, 0.5, 0.0]] } }
+        ]
+    })R";
+
+    auto ruleList = RuleList::parse(parseJSON(R"R([{ "filters":[{"type":1}], "speed":2.0 }, { "filters":[{"type":2}], "delay":1.0 }])R"));
+    GraphBuilder treeBuilder = GraphBuilder(ruleList);
+    treeBuilder.importGeoJSON(parseJSON(geoJSON));
+    auto treeGraph = treeBuilder.build();
+    GraphBuilder streamBuilder = GraphBuilder(ruleList);
+    std::istringstream stream(geoJSON);
+    streamBuilder.importGeoJSON(stream);
+    auto streamGraph = streamBuilder.build();
+
+    BOOST_CHECK(streamGraph->getNodeIdRangeEnd() == treeGraph->getNodeIdRangeEnd());
+    BOOST_CHECK(streamGraph->getEdgeIdRangeEnd() == treeGraph->getEdgeIdRangeEnd());
+    BOOST_CHECK(streamGraph->getFeatureIdRangeEnd() == treeGraph->getFeatureIdRangeEnd());
+    for (Graph::NodeId nodeId = 0; nodeId < treeGraph->getNodeIdRangeEnd(); nodeId++) {
+        BOOST_CHECK(streamGraph->getNode(nodeId).points == treeGraph->getNode(nodeId).points);
+    }
+    for (Graph::FeatureId featureId = 0; featureId < treeGraph->getFeatureIdRangeEnd(); featureId++) {
+        BOOST_CHECK(equal(streamGraph->getFeatureProperties(featureId), treeGraph->getFeatureProperties(featureId)));
+    }
+
+    Query query(Point(0.1, 0.1, 0.0), Point(2.5, 0.2, 0.0));
+    BOOST_CHECK(equal(RouteFinder(treeGraph).find(query).serialize(), RouteFinder(streamGraph).find(query).serialize()));
+
+    // Features with null geometry are kept without geometry, malformed documents are rejected
+    {
+        GraphBuilder graphBuilder = GraphBuilder(ruleList);
+        std::istringstream nullStream(R"R({ "type": "Feature", "geometry": null, "properties": {} })R");
+        graphBuilder.importGeoJSON(nullStream);
+        auto graph = graphBuilder.build();
+        BOOST_CHECK(graph->getFeatureIdRangeEnd() == 1);
+        BOOST_CHECK(graph->getNodeIdRangeEnd() == 0);
+    }
+    for (std::string badGeoJSON : { geoJSON.substr(0, geoJSON.size() / 2), std::string(R"R({ "type": "Feature", "geometry": { "type": "Point", "coordinates": [0, "x"] } })R"), std::string(R"R({ "type": "Topology" })R") }) {
+        GraphBuilder graphBuilder = GraphBuilder(ruleList);
+        std::istringstream badStream(badGeoJSON);
+        BOOST_CHECK_THROW(graphBuilder.importGeoJSON(badStream), std::runtime_error);
+    }
+}
+
+// Test cases for one-to-many routing and time matrices, results must match separate queries
+BOOST_AUTO_TEST_CASE(oneToManyRouting) {
+    auto ruleList = RuleList::parse(parseJSON(R"R([{ "search": "edge", "turnspeed": 1.0e9 }, { "filters":[{"type":1}], "backward_speed":0.0 }, { "filters":[{"type":2}], "speed":3.0 }, { "filters":[{"type":3}], "search":"surface", "speed":0.5 }])R"));
+    auto graph = createGridGraph(ruleList, Point(0, 0, 0));
+
+    std::vector<Point> sourcePositions, targetPositions;
+    for (int i = 0; i < 20; i++) {
+        sourcePositions.push_back(createGridSourcePos(i, Point(0, 0, 0)));
+        targetPositions.push_back(createGridTargetPos(i, Point(0, 0, 0)));
+    }
+
+    // One-to-many results must match the separate queries
+    RouteFinder finder(graph);
+    std::vector<Result> results = finder.findOneToMany(sourcePositions[0], targetPositions);
+    BOOST_CHECK(results.size() == targetPositions.size());
+    for (std::size_t j = 0; j < targetPositions.size(); j++) {
+        Result result = finder.find(Query(sourcePositions[0], targetPositions[j]));
+        BOOST_CHECK(results[j].getStatus() == result.getStatus());
+        BOOST_CHECK(std::abs(results[j].getTotalTime() - result.getTotalTime()) <= 1.0e-6 * result.getTotalTime());
+    }
+
+    // Matrix must not depend on the number of threads
+    std::vector<std::vector<double>> timeMatrix = finder.calculateTimeMatrix(sourcePositions, targetPositions);
+    BOOST_CHECK(timeMatrix == finder.calculateTimeMatrix(sourcePositions, targetPositions, FeatureFilter(), FeatureFilter(), 4));
+    for (std::size_t j = 0; j < targetPositions.size(); j++) {
+        if (results[j].getStatus() == Result::Status::SUCCESS) {
+            BOOST_CHECK(std::abs(timeMatrix[0][j] - results[j].getTotalTime()) <= 1.0e-6 * results[j].getTotalTime());
+        } else {
+            BOOST_CHECK(std::isinf(timeMatrix[0][j]));
+        }
+    }
+    for (std::size_t i = 0; i < sourcePositions.size(); i++) {
+        Result result = finder.find(Query(sourcePositions[i], targetPositions[i]));
+        if (result.getStatus() == Result::Status::SUCCESS) {
+            BOOST_CHECK(std::abs(timeMatrix[i][i] - result.getTotalTime()) <= 1.0e-6 * result.getTotalTime());
+        } else {
+            BOOST_CHECK(std::isinf(timeMatrix[i][i]));
+        }
+    }
+
+    // Unmatched targets are unreachable
+    std::vector<std::vector<double>> emptyMatrix = finder.calculateTimeMatrix(sourcePositions, targetPositions, FeatureFilter(), parseJSON("{ \"type\": 9 }").get<picojson::object>());
+    BOOST_CHECK(std::isinf(emptyMatrix[0][0]) && std::isinf(emptyMatrix[19][19]));
+}